@@ -11,10 +11,13 @@ void main()
     gl_Position = vec4(position, 1.0);
 }
 
-#shader fragment
+#shader fragment compute
 #version 460 core
 
+// This section is also compiled as a compute shader, with WAVEFRONT_TRACE, for the wavefront tracer below.
+#ifndef WAVEFRONT_TRACE
 in vec2 TexCoords;
+#endif
 
 uniform sampler2D diskTexture;
 uniform sampler2D sphereTexture;
@@ -40,11 +43,18 @@ uniform float u_Tmax;
 uniform float u_diskRotationAngle;
 
 uniform int u_msaa;
+// Sub-pixel offset of the ray, in pixels, for temporal anti-aliasing.
+uniform vec2 u_jitter;
 
 uniform int u_maxSteps;
 uniform float u_drawDistance;
 uniform int u_ODESolver;
 uniform float u_tolerance;
+// ODE_SOLVER 8 uses Dormand-Prince beyond this many masses from the black hole.
+uniform float u_hybridRadius;
+// With PI_CONTROLLER, the adaptive solvers' error is measured against these instead of u_tolerance.
+uniform float u_absoluteTolerance;
+uniform float u_relativeTolerance;
 uniform float u_diskIntersectionThreshold;
 uniform float u_sphereIntersectionThreshold;
 
@@ -60,6 +70,8 @@ uniform vec3 u_diskDebugColourTop1;
 uniform vec3 u_diskDebugColourTop2;
 uniform vec3 u_diskDebugColourBottom1;
 uniform vec3 u_diskDebugColourBottom2;
+uniform bool u_showCaptureCulling;
+uniform vec3 u_captureCullingColour;
 
 uniform bool u_bloom;
 uniform float u_bloomThreshold;
@@ -71,8 +83,102 @@ uniform float u_gamma;
 uniform float u_brightnessFromDiskVel;
 uniform float u_blueshiftPower;
 
+// GEODESIC_TRACE and GEODESIC_SHADE split the work of main() between two passes through a geodesic G-buffer, so that
+// a static camera doesn't re-integrate every geodesic each frame just because the disk rotates.  The trace pass
+// writes the first MAX_DISK_HITS crossings of the disk's plane as (r, phi, g, sign of previous y), with 0 in the last
+// component for no crossing, and how the ray ended as (direction or point, ESCAPE_*).  The shade pass reads these
+// back and only does the disk, sphere and skybox shading.  With GEODESIC_ENVIRONMENT, the trace pass covers every
+// direction around the camera instead of just the screen.  ESCAPE_CULLED rays fell in without being integrated, and
+// shade like ESCAPE_NONE unless u_showCaptureCulling is set.
+#define ESCAPE_NONE 0.0
+#define ESCAPE_INFINITY 1.0
+#define ESCAPE_UNFINISHED 2.0
+#define ESCAPE_SPHERE 3.0
+#define ESCAPE_CULLED 4.0
+
+#if defined(WAVEFRONT_TRACE)
+// The wavefront tracer writes the trace pass's records with image stores, into consecutive image units.
+layout(rgba32f, binding = 0) uniform writeonly image2D u_diskHitImages[MAX_DISK_HITS];
+layout(rgba32f, binding = MAX_DISK_HITS) uniform writeonly image2D u_escapeImage;
+#elif defined(GEODESIC_TRACE)
+layout(location = 0) out vec4 diskHits[MAX_DISK_HITS];
+layout(location = MAX_DISK_HITS) out vec4 escapeRecord;
+
+struct GeodesicRecord
+{
+    vec4 diskHits[MAX_DISK_HITS];
+    vec4 escape;
+};
+// Filled in by rayMarch().
+GeodesicRecord geodesicRecord;
+#else
 layout(location = 0) out vec4 fragColour;
 layout(location = 1) out vec4 brightColour;
+#endif
+
+#ifdef GEODESIC_SHADE
+uniform sampler2D u_diskHits[MAX_DISK_HITS];
+uniform sampler2D u_escapeRecord;
+#ifdef GEODESIC_ENVIRONMENT
+// How far round the spin axis the camera is from where the records were traced.  0 for the environment cache, which
+// is traced at the camera.  A TransferAtlas is traced at azimuth 0 for every camera on the same circle about the axis.
+uniform float u_environmentAzimuth;
+// How far apart the four map texels around a direction may be for it to be interpolated, as in GEODESIC_REFINE.
+uniform float u_refineTolerance;
+#endif
+#endif
+
+// The block prepass is a trace pass with GEODESIC_PREPASS, which traces the corners of GEODESIC_BLOCK_SIZE pixel
+// square blocks into a G-buffer with one texel per corner.  The full resolution trace pass then has GEODESIC_REFINE
+// and only traces the pixels in blocks whose corners disagree.
+#ifdef GEODESIC_REFINE
+uniform sampler2D u_coarseDiskHits[MAX_DISK_HITS];
+uniform sampler2D u_coarseEscapeRecord;
+uniform float u_refineTolerance;
+#endif
+
+// ADAPTIVE_SUPERSAMPLE is a shade pass that traces up to u_adaptiveSamples^2 more rays, spread over the pixel,
+// wherever the pixel's records disagree with a neighbour's by more than u_adaptiveTolerance.  A pass with
+// ADAPTIVE_COUNT as well runs first and only counts these pixels in markedPixels, so that the shade pass can split
+// u_adaptiveRayBudget evenly between them.  The frame's extra cost is then bounded however much of the screen is
+// edges, and doesn't depend on the order the pixels are shaded in.  adaptiveRays counts the rays actually traced.
+#ifdef ADAPTIVE_SUPERSAMPLE
+layout(std430, binding = 5) buffer AdaptiveRayCount
+{
+    uint markedPixels;
+    uint adaptiveRays;
+};
+uniform int u_adaptiveSamples;
+uniform float u_adaptiveTolerance;
+uniform int u_adaptiveRayBudget;
+#endif
+
+// SOLVER_STATISTICS totals the adaptive solvers' accepted and rejected steps, to compare step size controllers, and
+// the steps FP64_REFINEMENT took in double precision.  Each ray counts its own and adds them to the totals once, with
+// addSolverStatistics().  Rays that CAPTURE_CULLING skips, MINKOWSKI's straight rays and rays read from the
+// SCHWARZSCHILD_TABLES return before taking a step and add nothing, though they still count as pixels in BlackHole's
+// per-pixel averages.
+#ifdef SOLVER_STATISTICS
+layout(std430, binding = 3) buffer SolverStatistics
+{
+    uint acceptedSteps;
+    uint rejectedSteps;
+    uint fp64Steps;
+};
+uint rayAcceptedSteps = 0u;
+uint rayRejectedSteps = 0u;
+uint rayFP64Steps = 0u;
+
+void addSolverStatistics()
+{
+    atomicAdd(acceptedSteps, rayAcceptedSteps);
+    atomicAdd(rejectedSteps, rayRejectedSteps);
+    atomicAdd(fp64Steps, rayFP64Steps);
+    rayAcceptedSteps = 0u;
+    rayRejectedSteps = 0u;
+    rayFP64Steps = 0u;
+}
+#endif
 
 
 /////////////////////////////////////////////////////
@@ -310,29 +416,65 @@ float implicitr(vec4 x)
     float a2 = u_a * u_a;
     float b = a2 - dot(p, p);
     float c = -a2 * p.y * p.y;
-    float r2 = 0.5 * (-b + sqrt(b * b - 4.0 * c));
+    // -b + sqrt(b^2 - 4c) cancels catastrophically in float when b > 0, which is near the ring singularity and, for
+    // large a, inside the horizon.  There the other form of the root, 2|c| / (b + sqrt(b^2 - 4c)), is used instead.
+    float sq = sqrt(b * b - 4.0 * c);
+    float r2 = (b > 0.0) ? -2.0 * c / (b + sq) : 0.5 * (sq - b);
     return sqrt(r2);
 }
 
-mat4 metric(vec4 x)
+struct KerrSchildState
 {
-    // Calculate the Kerr metric in Kerr-Schild coordinates at the position x.  G = c = 1.  Signature (-+++).
-    // This differs slightly from the definition in https://arxiv.org/abs/0706.0622
-    // because that paper has Cartesian z as the up direction, while this program has Cartesian y
-    // as the up direction.
+    // Everything about the metric at one position that Hamilton's equations need: r, and f and the null vector l of the
+    // inverse metric g^{ab} = \eta^{ab} - f * l^a l^b, with the intermediates KerrdHdxExact() reuses.  Evaluating one
+    // of these per RK stage, instead of calling invmetric() and KerrdHdxExact() separately, solves for r once.
+    float r;
+    float r2plusa2;
+    // r^4 + a^2 y^2, the denominator of f.
+    float Q;
+    float f;
+    vec4 l;
+};
+
+KerrSchildState kerrSchildState(vec4 x)
+{
+    // r is solved for as in implicitr(), keeping r^2.
+    KerrSchildState s;
     vec3 p = x.yzw;
-    float r = implicitr(x);
-    float r2 = r*r;
-    float a2 = u_a*u_a;
-    float f = 2.0 * u_BHMass * r2*r / (r2*r2 + a2*p.y*p.y);
+    float a2 = u_a * u_a;
+    float y2 = p.y * p.y;
+    float b = a2 - dot(p, p);
+    float sq = sqrt(b * b + 4.0 * a2 * y2);
+    float r2 = (b > 0.0) ? 2.0 * a2 * y2 / (b + sq) : 0.5 * (sq - b);
+    s.r = sqrt(r2);
+    s.r2plusa2 = r2 + a2;
+    s.Q = r2 * r2 + a2 * y2;
+    s.f = 2.0 * u_BHMass * r2 * s.r / s.Q;
 #ifdef INSIDE_HORIZON
     // Outgoing Kerr-Schild coordinates.
-    vec4 l = vec4(-1.0, (r * p.x - u_a * p.z) / (r2 + a2), p.y / r, (r * p.z + u_a * p.x) / (r2 + a2));
+    s.l = vec4(1.0, (s.r * p.x - u_a * p.z) / s.r2plusa2, p.y / s.r, (s.r * p.z + u_a * p.x) / s.r2plusa2);
 #else
     // Ingoing Kerr-Schild coordinates.
-    vec4 l = vec4(1.0, (r * p.x - u_a * p.z) / (r2 + a2), p.y / r, (r * p.z + u_a * p.x) / (r2 + a2));
+    s.l = vec4(-1.0, (s.r * p.x - u_a * p.z) / s.r2plusa2, p.y / s.r, (s.r * p.z + u_a * p.x) / s.r2plusa2);
 #endif
-    return diag(vec4(-1.0, 1.0, 1.0, 1.0)) + f * outerProduct(l, l);
+    return s;
+}
+
+vec4 kerrRaiseIndex(const in KerrSchildState s, const in vec4 p)
+{
+    // g^{ab} p_b = \eta p - f (l.p) l, without building the inverse metric.
+    return vec4(-p.x, p.yzw) - s.f * dot(s.l, p) * s.l;
+}
+
+mat4 metric(vec4 x)
+{
+    // Calculate the Kerr metric in Kerr-Schild coordinates at the position x.  G = c = 1.  Signature (-+++).
+    // This differs slightly from the definition in https://arxiv.org/abs/0706.0622
+    // because that paper has Cartesian z as the up direction, while this program has Cartesian y
+    // as the up direction.  The metric's l is the inverse metric's with the time component negated.
+    KerrSchildState s = kerrSchildState(x);
+    vec4 l = vec4(-s.l.x, s.l.yzw);
+    return diag(vec4(-1.0, 1.0, 1.0, 1.0)) + s.f * outerProduct(l, l);
 }
 
 mat4 invmetric(vec4 x)
@@ -347,21 +489,9 @@ mat4 invmetric(vec4 x)
 
     // Calculate the inverse Kerr metric in Kerr-Schild coordinates at the position x.  G = c = 1. Signature (-+++).
     // As with the metric, this is also from https://arxiv.org/abs/0706.0622 with adjusted coordinates.
-    // Due to the convenient decomposition of these coordinates, this has pretty much identical computational cost as
-    // the metric.
-    vec3 p = x.yzw;
-    float r = implicitr(x);
-    float r2 = r*r;
-    float a2 = u_a*u_a;
-    float f = 2.0 * u_BHMass * r2*r / (r2*r2 + a2*p.y*p.y);
-#ifdef INSIDE_HORIZON
-    // Outgoing Kerr-Schild coordinates.
-    vec4 l = vec4(1.0, (r * p.x - u_a * p.z) / (r2 + a2), p.y / r, (r * p.z + u_a * p.x) / (r2 + a2));
-#else
-    // Ingoing Kerr-Schild coordinates.
-    vec4 l = vec4(-1.0, (r * p.x - u_a * p.z) / (r2 + a2), p.y / r, (r * p.z + u_a * p.x) / (r2 + a2));
-#endif
-    return diag(vec4(-1.0, 1.0, 1.0, 1.0)) - f * outerProduct(l, l);
+    // Where only g^{ab} p_b is needed, kerrRaiseIndex() skips building the matrix.
+    KerrSchildState s = kerrSchildState(x);
+    return diag(vec4(-1.0, 1.0, 1.0, 1.0)) - s.f * outerProduct(s.l, s.l);
 }
 #endif
 
@@ -413,21 +543,197 @@ float gravRedshift(vec4 emitterx, vec4 receiverx)
     // Under these assumptions, dlambda = sqrt(-g_00(x))dt, and we are just comparing the ratio between the dlambdas of
     // the emitter and receiver.
     // See: "Einstein Gravity in a Nutshell" by Zee.
+#ifdef KERR
+    // g_00 = f - 1, since l_0 = +-1.
+    return sqrt((1.0 - kerrSchildState(emitterx).f) / (1.0 - kerrSchildState(receiverx).f));
+#else
     return sqrt(metric(emitterx)[0][0] / metric(receiverx)[0][0]);
+#endif
 }
 
 vec3 pToDir(mat2x4 xp)
 {
     // dx^i/dl = g^ij * p_j
+#ifdef KERR
+    vec4 dxdl = kerrRaiseIndex(kerrSchildState(xp[0]), xp[1]);
+#else
     vec4 dxdl = invmetric(xp[0]) * xp[1];
+#endif
     // Discard the time "velocity", dx^0/dl.
     return normalize(dxdl.yzw);
 }
 
+#ifdef FAR_FIELD_ESCAPE
+// Only defined with KERR outside the horizon.  An outgoing ray beyond u_escapeRadius masses and the disk can't hit
+// anything before the draw distance, and what bending it has left is the weak-field deflection, so it stops integrating
+// there and escapeDirection() bends its direction by the rest in closed form.
+uniform float u_escapeRadius;
+#endif
+
+bool hasEscaped(const in mat2x4 xp, const in float dist)
+{
+#ifdef FAR_FIELD_ESCAPE
+    // Outgoing if x.p > 0.  Out here p_i is dx^i/dl up to O(M/r), which only matters close to the ray's closest
+    // approach, where escapeDirection() is continuous in cos(psi) around 0.
+    return dist > u_drawDistance
+        || (dist > max(u_escapeRadius * u_BHMass, u_OuterRadius) && dot(xp[0].yzw, xp[1].yzw) > 0.0);
+#else
+    return dist > u_drawDistance;
+#endif
+}
+
+vec3 escapeDirection(const in mat2x4 xp)
+{
+    // The direction the skybox is sampled in once hasEscaped() is true.
+    vec3 dir = pToDir(xp);
+#ifdef FAR_FIELD_ESCAPE
+    // The rest of the bending up to the draw distance D, to first order in M / r.  Kerr-Schild x, y, z are
+    // Schwarzschild's r, theta, phi in Cartesian form, up to a twist about the spin axis, so the ray follows the
+    // weak-field orbit 1/r = sin(phi) / b + (M / b^2) * (1 + cos^2(phi)).  If the ray makes the angle psi with the
+    // radial direction at r, its direction turns towards the black hole by
+    // (M / b) * ((2 + w^2) * sqrt(1 - w^2) - (2 + sin^2(psi)) * cos(psi)) on the way to D, where b = r sin(psi) and
+    // w = b / D.  The twist, between the Kerr-Schild and Boyer-Lindquist azimuths, changes by a M / r^2 along the ray
+    // and tilts its direction about the spin axis by 2 a M cos(psi) / r^3 times its distance from the axis, which is
+    // taken out at r and put back at D.  What's left is O((M / r)^2), about 3e-4 radians at 30 M for a = 0.99.
+    vec3 x = xp[0].yzw;
+    float r = length(x);
+    float cosPsi = dot(x, dir) / r;
+    // The part of -x / r perpendicular to dir, of length sin(psi).
+    vec3 inwards = cosPsi * dir - x / r;
+    float sinPsi = length(inwards);
+    float D = max(u_drawDistance, r);
+    float b = r * sinPsi;
+    // Distance from the closest approach at D, and where the ray gets to there along the straight line.
+    float sD = sqrt(max(0.0, D * D - b * b));
+    vec3 xD = x + (sD - r * cosPsi) * dir;
+    vec3 spinAxis = vec3(0.0, 1.0, 0.0);
+    vec3 twist = (2.0 * u_a * u_BHMass) * ((sD / (D * D * D * D)) * cross(spinAxis, xD)
+        - (cosPsi / (r * r * r)) * cross(spinAxis, x));
+    if (b > 1.0e-4 * r)
+    {
+        float deflection = (u_BHMass / b) * ((2.0 + b * b / (D * D)) * sD / D - (2.0 + sinPsi * sinPsi) * cosPsi);
+        dir = cos(deflection) * dir + sin(deflection) * inwards / sinPsi;
+    }
+    dir = normalize(dir + twist);
+#endif
+    return dir;
+}
+
+#ifdef CAPTURE_CULLING
+// Only defined with KERR outside the horizon.  An ingoing ray falls in without a radial turning point when its
+// lambda = L / E and eta = Q / E^2 put it inside the critical curve of the photon shell, i.e. when eta is below
+// eta_c(lambda) = min over r+ < r <= rCamera of (r^2 + a^2 - a lambda)^2 / Delta - (lambda - a)^2.  BlackHole tabulates
+// eta_c for the camera's radius with CaptureCulling, evenly spaced in lambda over +-u_captureLambdaRange.  Those rays
+// are culled if they can't cross the equatorial plane before the disk's inner radius, and rayMarch() records them as
+// ESCAPE_CULLED instead of integrating them.
+#define CAPTURE_CURVE_SAMPLES 65
+uniform float u_captureCurve[CAPTURE_CURVE_SAMPLES];
+uniform float u_captureLambdaRange;
+uniform float u_captureMargin;
+
+bool captureCulled(const in mat2x4 xp, const in float horizon)
+{
+    if (u_useDebugSphereTexture)
+    {
+        // The sphere's debug texture needs where the ray crosses the horizon.
+        return false;
+    }
+    vec4 x = xp[0];
+    vec4 p = xp[1];
+    float a = u_a;
+    float a2 = a * a;
+    KerrSchildState s = kerrSchildState(x);
+    float r = s.r;
+    float cosTheta = x.z / r;
+    float sin2Theta = 1.0 - cosTheta * cosTheta;
+    float E = -p.x;
+    if (sin2Theta < 1.0e-6 || E <= 0.0)
+    {
+        return false;
+    }
+
+    // Only ingoing rays.  dr/dl from dx/dl = g^-1 p, by differentiating r^4 - (|x|^2 - a^2) r^2 - a^2 y^2 = 0.
+    vec4 v = kerrRaiseIndex(s, p);
+    if (r * r * (x.y * v.y + x.w * v.w) + (r * r + a2) * x.z * v.z >= 0.0)
+    {
+        return false;
+    }
+
+    // p_phi = z p_x - x p_z, and p_theta from d/dtheta = cot(theta) (x d/dx + z d/dz) - r sin(theta) d/dy.  initRay()'s p
+    // isn't null in Kerr-Schild coordinates, so g^{ab} p_a p_b = h E^2 > 0, which adds a^2 h cos^2(theta) to the Carter
+    // constant and Theta, and Delta h r^2 to R (MTW 33.31).
+    float sinTheta = sqrt(sin2Theta);
+    float lambda = (x.w * p.y - x.y * p.w) / E;
+    float pTheta = (cosTheta / sinTheta * (x.y * p.y + x.w * p.w) - r * sinTheta * p.z) / E;
+    float h = dot(v, p) / (E * E);
+    float a2h = a2 * (1.0 + h);
+    float eta = pTheta * pTheta + cosTheta * cosTheta * (lambda * lambda / sin2Theta - a2h);
+
+    // Captured.  The Delta h r^2 term only raises eta_c, by at least h r+^2.
+    float t = (lambda / u_captureLambdaRange * 0.5 + 0.5) * float(CAPTURE_CURVE_SAMPLES - 1);
+    if (t < 0.0 || t >= float(CAPTURE_CURVE_SAMPLES - 1))
+    {
+        return false;
+    }
+    int i = int(t);
+    float etaCritical = mix(u_captureCurve[i], u_captureCurve[i + 1], t - float(i)) + max(h, 0.0) * horizon * horizon
+        - u_captureMargin;
+    if (eta >= etaCritical)
+    {
+        return false;
+    }
+
+    // r decreases all the way to the horizon, so the ray misses the disk if it doesn't cross the equatorial plane, or
+    // only crosses it inside the inner radius.
+    float rInner = max(u_InnerRadius, horizon);
+    if (r <= rInner || eta <= 0.0)
+    {
+        return true;
+    }
+
+    // With u = cos(theta) = sqrt(u+) sin(psi), the first crossing is at Mino time (F(j pi | m) - F(psi0 | m)) / sqrt(A),
+    // which is at least (j pi - psi0) / sqrt(A + a^2 u+) because m <= 0.
+    float pi = 3.14159265359;
+    float B = eta + lambda * lambda - a2h;
+    float D = sqrt(B * B + 4.0 * a2h * eta);
+    float uplus = 2.0 * eta / (B + D);
+    float A = 0.5 * (B + D);
+    float psi0 = asin(clamp(cosTheta / sqrt(uplus), -1.0, 1.0));
+    if (pTheta > 0.0)
+    {
+        psi0 = pi - psi0;
+    }
+    float tauTheta = (pi * (floor(psi0 / pi) + 1.0) - psi0) / sqrt(A + a2h * uplus);
+
+    // Mino time to the inner radius, the integral of dr / sqrt(R) with s = 1 / r, in which
+    // R / r^4 = (1 + (a^2 - a lambda) s^2)^2 - (1 - 2 M s + a^2 s^2) (C s^2 - h) is smooth.  8 point Gauss-Legendre,
+    // with 10% to spare for its error.
+    const float nodes[4] = float[4](0.1834346425, 0.5255324099, 0.7966664774, 0.9602898565);
+    const float weights[4] = float[4](0.3626837834, 0.3137066459, 0.2223810345, 0.1012285363);
+    float C = eta + (lambda - a) * (lambda - a);
+    float sMid = 0.5 * (1.0 / rInner + 1.0 / r);
+    float sHalf = 0.5 * (1.0 / rInner - 1.0 / r);
+    float tauR = 0.0;
+    for (int k = 0; k < 8; k++)
+    {
+        float sk = sMid + ((k < 4) ? -sHalf : sHalf) * nodes[k % 4];
+        float q = 1.0 + (a2 - a * lambda) * sk * sk;
+        float DeltaS2 = 1.0 - 2.0 * u_BHMass * sk + a2 * sk * sk;
+        tauR += weights[k % 4] / sqrt(max(q * q - DeltaS2 * (C * sk * sk - h), 1.0e-12));
+    }
+    tauR *= sHalf;
+    return tauTheta > 1.1 * tauR;
+}
+#endif
+
 float H(vec4 x, vec4 p)
 {
     // Calculate the Super-Hamiltonian for position x and momentum p.
+#ifdef KERR
+    return 0.5 * dot(kerrRaiseIndex(kerrSchildState(x), p), p);
+#else
     return 0.5 * dot(invmetric(x) * p, p);
+#endif
 }
 
 float L(vec4 x, vec4 dxdl)
@@ -454,10 +760,10 @@ vec4 dHdx(vec4 x, vec4 p)
 }
 
 #ifdef KERR
-vec4 KerrdHdxExact(vec4 x, vec4 p)
+vec4 KerrdHdxExact(const in KerrSchildState s, const in vec4 x, const in vec4 p)
 {
-    // Calculates dH/dx exactly for the Kerr metric in Kerr-Schild Cartesian coordinates.
-    // Not only is this obviously more accurate than the naive approximation of dHdx, but it happens to be
+    // Calculates dH/dx exactly for the Kerr metric in Kerr-Schild Cartesian coordinates, from the KerrSchildState s at
+    // x.  Not only is this obviously more accurate than the naive approximation of dHdx, but it happens to be
     // much faster as well.
     // 
     // dH/dx^\alpha = (1/2) * dg^{\mu \nu}/dx^\alpha * p_\mu * p_\nu
@@ -466,63 +772,34 @@ vec4 KerrdHdxExact(vec4 x, vec4 p)
     // We note that since p^T outerProduct(dl/dx^\alpha, l) p = p^T  outerProduct(l, dl/dx^\alpha) p,
     // we only need to calculate -df/dx^\alpha * outerProduct(l,l) - 2 * f * outerProduct(dl/dx^\alpha, l).
     // So we need to calculate df/dx^\alpha and dl/dx^\alpha.  To calculate those, we'll also need dr/dx^\alpha.
+    // Nothing depends on t, so the time components are all 0.
     vec3 pos = x.yzw;
-    float r = implicitr(x);
+    float r = s.r;
     float r2 = r * r;
-    float r3 = r2 * r;
-    float r4 = r3 * r;
     float a2 = u_a * u_a;
-    float r2plusa2 = r2 + a2;
-    float a4 = a2 * a2;
-    float y2 = pos.y * pos.y;
-    float f = 2.0 * u_BHMass * r3 / (r4 + a2 * y2);
-    float xnumer = (r * pos.x - u_a * pos.z);
-    float znumer = (r * pos.z + u_a * pos.x);
-#ifdef INSIDE_HORIZON
-    // Outgoing Kerr-Schild coordinates.
-    vec4 l = vec4(1.0, xnumer / r2plusa2, pos.y / r, znumer / r2plusa2);
-#else
-    // Ingoing Kerr-Schild coordinates.
-    vec4 l = vec4(-1.0, xnumer / r2plusa2, pos.y / r, znumer / r2plusa2);
-#endif
-
-    // Calculate dr/dx, dr/dy, dr/dz.
-    float dr_common_factor = r3 * r2plusa2 * r2plusa2 / (y2 * r2plusa2 * r2plusa2 + r4 * (pos.x * pos.x + pos.z * pos.z));
-    float drdx = (pos.x / r2plusa2) * dr_common_factor;
-    float drdy = (pos.y / r2) * dr_common_factor;
-    float drdz = (pos.z / r2plusa2) * dr_common_factor;
-
-    // Calculate df/dt, df/dx, df/dy, df/dz using dr/dx, dr/dy, dr/dz.
-    float df_common_numerator = (6.0 * u_BHMass * r2 * (r4 + a2 * y2) - 8.0 * u_BHMass * r4 * r2);
-    float df_common_denominator = (r4 + a2 * y2) * (r4 + a2 * y2);
-    float dfdt = 0.0;
-    float dfdx = df_common_numerator * drdx / df_common_denominator;
-    float dfdy = (df_common_numerator * drdy - 4.0 * u_BHMass * r3 * a2 * pos.y) / df_common_denominator;
-    float dfdz = df_common_numerator * drdz / df_common_denominator;
-    vec4 dfdxhat = vec4(dfdt, dfdx, dfdy, dfdz);
-
-    // Calculate dl/dt, dl/dx, dl/dy, dl/dz.
-    float denom = r2plusa2 * r2plusa2;
-    vec4 dldt = vec4(0.0, 0.0, 0.0, 0.0);
-    vec4 dldx = vec4(0.0, (r2plusa2 * (drdx * pos.x + r) - xnumer * 2.0 * r * drdx) / denom,
-        -pos.y * drdx / r2, (r2plusa2 * (drdx * pos.z + u_a) - znumer * 2.0 * r * drdx) / denom);
-    vec4 dldy = vec4(0.0, (r2plusa2 * drdy * pos.x - xnumer * 2.0 * r * drdy) / denom, (r - pos.y * drdy) / r2,
-        (r2plusa2 * drdy * pos.z - znumer * 2.0 * r * drdy) / denom);
-    vec4 dldz = vec4(0.0, (r2plusa2 * (drdz * pos.x - u_a) - xnumer * 2.0 * r * drdz) / denom,
-        -pos.y * drdz / r2, (r2plusa2 * (drdz * pos.z + r) - znumer * 2.0 * r * drdz) / denom);
-
-    // Calculate dot products
-    // Rather than calculating the outerProducts and then multiplying by p on both sides, we can skip this and just
-    // calculate the dot products directly.
-    float ldotp = dot(l, p);
-    vec4 dldxhatdotp = vec4(dot(dldt, p), dot(dldx, p), dot(dldy, p), dot(dldz, p));
-    vec4 firstterm = vec4(ldotp * ldotp);
-    vec4 secondterm = vec4(2.0 * f * ldotp);
+
+    // Calculate dr/dx, dr/dy, dr/dz.  Differentiating r^4 - (|x|^2 - a^2) r^2 - a^2 y^2 = 0 and simplifying with it
+    // gives dr/dx = r^3 x / Q, dr/dy = r (r^2 + a^2) y / Q and dr/dz = r^3 z / Q, where Q = r^4 + a^2 y^2.
+    float rOverQ = r / s.Q;
+    vec3 drdxhat = rOverQ * vec3(r2 * pos.x, s.r2plusa2 * pos.y, r2 * pos.z);
+
+    // Calculate df/dx, df/dy, df/dz.  f = 2 M r^3 / Q, so at constant y, df/dr = f (3 a^2 y^2 - r^4) / (r Q), and y
+    // also appears explicitly in Q.
+    float fOverQ = s.f / s.Q;
+    vec3 dfdxhat = (fOverQ * (3.0 * a2 * pos.y * pos.y - r2 * r2) / r) * drdxhat;
+    dfdxhat.y -= 2.0 * a2 * pos.y * fOverQ;
+
+    // Calculate the dot products (dl/dx).p, (dl/dy).p, (dl/dz).p directly, rather than the dl/dx^\alpha.  Each is
+    // G * dr/dx^\alpha, the part through r, plus the derivative of l at constant r.
+    float G = (p.y * (pos.x - 2.0 * r * s.l.y) + p.w * (pos.z - 2.0 * r * s.l.w)) / s.r2plusa2 - p.z * s.l.z / r;
+    vec3 explicitTerm = vec3((r * p.y + u_a * p.w) / s.r2plusa2, p.z / r, (r * p.w - u_a * p.y) / s.r2plusa2);
+    vec3 dldxhatdotp = G * drdxhat + explicitTerm;
 
     // Equivalent to the 4-vector whose alpha-th component is:
     // (1/2) * (-df/dx^\alpha * p^T * outerProduct(l,l) * p - 2 * f * p^T * outerProduct(l, dl/dx^\alpha) * p)
     // which is precisely the vector dH/dx.
-    return -0.5 * (dfdxhat * firstterm + secondterm * dldxhatdotp);
+    float ldotp = dot(s.l, p);
+    return vec4(0.0, -0.5 * ldotp * (ldotp * dfdxhat + 2.0 * s.f * dldxhatdotp));
 }
 #endif
 
@@ -592,13 +869,16 @@ mat2x4 fasterxpupdate(in mat2x4 xp, float dl)
     // Saves one invmetric(x) over calling the dHdx function.
     vec4 x = xp[0];
     vec4 p = xp[1];
-    // Calculate the Hamiltonian at x.
-    mat4 ginv = invmetric(x);
 
     mat2x4 dxp;
 #ifdef KERR
-    dxp[1] = -KerrdHdxExact(x, p) * dl;
+    // Both of Hamilton's equations from one KerrSchildState.
+    KerrSchildState s = kerrSchildState(x);
+    dxp[1] = -KerrdHdxExact(s, x, p) * dl;
+    dxp[0] = kerrRaiseIndex(s, p) * dl;
 #else
+    // Calculate the Hamiltonian at x.
+    mat4 ginv = invmetric(x);
     // General approximation of dHdx.
     float Hatx = 0.5 * dot(ginv * p, p);
     float dx = 0.005; // Governs accuracy of dHdx
@@ -606,8 +886,8 @@ mat2x4 fasterxpupdate(in mat2x4 xp, float dl)
         H(x + vec4(0.0, 0.0, dx, 0.0), p), H(x + vec4(0.0, 0.0, 0.0, dx), p));
     vec4 dHdx = (Hdx - Hatx) / dx;
     dxp[1] = -dHdx * dl;
-#endif
     dxp[0] = ginv * p * dl;
+#endif
 
     return dxp;
 }
@@ -632,13 +912,18 @@ mat2x4 fasterxpupdateImplicitEuler(in mat2x4 xp, float dl)
     // Saves one invmetric(x) calculation over calling the dHdx function...
     vec4 x = xp[0];
     vec4 p = xp[1];
-    // Calculate the Hamiltonian at x.
-    mat4 ginv = invmetric(x);
 
     mat2x4 dxp;
 #ifdef KERR
-    dxp[1] = -KerrdHdxExact(x, p) * dl;
+    KerrSchildState s = kerrSchildState(x);
+    dxp[1] = -KerrdHdxExact(s, x, p) * dl;
+    // Correction for Euler-Cromer method as opposed to vanilla Euler method
+    p += dxp[1];
+    dxp[0] = kerrRaiseIndex(s, p) * dl;
 #else
+    // Calculate the Hamiltonian at x.
+    mat4 ginv = invmetric(x);
+
     // General formula.
     float Hatx = 0.5 * dot(ginv * p, p);
     float dx = 0.005; // Governs accuracy of dHdx
@@ -646,10 +931,10 @@ mat2x4 fasterxpupdateImplicitEuler(in mat2x4 xp, float dl)
         H(x + vec4(0.0, 0.0, dx, 0.0), p), H(x + vec4(0.0, 0.0, 0.0, dx), p));
     vec4 dHdx = (Hdx - Hatx) / dx;
     dxp[1] = -dHdx * dl;
-#endif
     // Correction for Euler-Cromer method as opposed to vanilla Euler method
     p += dxp[1];
     dxp[0] = ginv * p * dl;
+#endif
 
     return dxp;
 }
@@ -660,6 +945,13 @@ mat2x4 fasterxpupdateImplicitEuler(in mat2x4 xp, float dl)
 /////////   DIFFERENTIAL EQUATION SOLVING   /////////
 /////////////////////////////////////////////////////
 
+// ODE_SOLVER 0, 1 and 7 take fixed steps.  2 to 5 are embedded Runge-Kutta pairs, which choose their step size
+// from an error estimate, carry the first-same-as-last derivative between steps and have a dense output.  8 switches
+// between the pairs 2 and 3 every step.  6 is the CPU renderer's Bulirsch-Stoer solver, which has no shader version.
+#if ((ODE_SOLVER >= 2 && ODE_SOLVER <= 5) || ODE_SOLVER == 8)
+#define ADAPTIVE_SOLVER
+#endif
+
 #if (ODE_SOLVER == 0)
 mat2x4 integrationStep(mat2x4 xp, float dl)
 {
@@ -679,7 +971,7 @@ mat2x4 integrationStep(mat2x4 xp, float dl)
 }
 #endif
 
-#if (ODE_SOLVER == 1 || ODE_SOLVER == 3)
+#if (ODE_SOLVER == 1 || (ODE_SOLVER >= 3 && ODE_SOLVER <= 5) || ODE_SOLVER == 8)
 mat2x4 RK4integrationStep(mat2x4 xp, float dl)
 {
     // Classic Runge-Kutta 4.
@@ -700,7 +992,47 @@ mat2x4 RK4integrationStep(mat2x4 xp, float dl)
 }
 #endif
 
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#if (ODE_SOLVER == 7)
+mat2x4 GLintegrationStep(mat2x4 xp, float dl)
+{
+    // Two stage Gauss-Legendre Method, the order 4 implicit Runge-Kutta method.
+    // https://en.wikipedia.org/wiki/Gauss%E2%80%93Legendre_method
+    // It is only symplectic at a fixed step size.  It takes RK4's steps, which grow with the distance, so H, which is
+    // 0 along a light ray, still drifts away, but less than with RK4.  The stages are solved by fixed point iteration
+    // from the Euler guess, which converges in a few iterations at these step sizes.
+    float s = sqrt(3.0) / 6.0;
+    mat2x4 k1 = fasterxpupdate(xp, dl);
+    mat2x4 k2 = k1;
+    for (int i = 0; i < 8; i++)
+    {
+        mat2x4 previousk1 = k1;
+        k1 = fasterxpupdate(xp + 0.25 * k1 + (0.25 - s) * k2, dl);
+        k2 = fasterxpupdate(xp + (0.25 + s) * k1 + 0.25 * k2, dl);
+        mat2x4 change = k1 - previousk1;
+        if (dot(change[0], change[0]) + dot(change[1], change[1]) < 1.0e-12 * (dot(k1[0], k1[0]) + dot(k1[1], k1[1])))
+        {
+            break;
+        }
+    }
+    return xp + 0.5 * (k1 + k2);
+}
+#endif
+
+// Continuous extension of an adaptive step, so that events inside it can be located without integrating again:
+// y(theta) = y0 + theta * (c[0] + theta * (c[1] + theta * (c[2] + theta * c[3]))) for theta from 0 to 1 across the
+// step.  The coefficients are the solvers' own interpolants, as in Hairer, Norsett and Wanner and in scipy.
+struct DenseOutput
+{
+    mat2x4 y0;
+    mat2x4 c[4];
+};
+
+mat2x4 denseOutput(const in DenseOutput dense, const in float theta)
+{
+    return dense.y0 + theta * (dense.c[0] + theta * (dense.c[1] + theta * (dense.c[2] + theta * dense.c[3])));
+}
+
+#if (ODE_SOLVER == 2 || ODE_SOLVER == 3 || ODE_SOLVER == 8)
 void RK23integrationStep(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize)
 {
     // Bogacki-Shampine Method.
@@ -722,7 +1054,8 @@ void RK23integrationStep(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2,
     nextxp2 = xp + (7.0 / 24.0) * k1 + (1.0 / 4.0) * k2 + (1.0 / 3.0) * k3 + (1.0 / 8.0) * k4;
 }
 
-void RK23integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL)
+void RK23integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL,
+    out DenseOutput dense)
 {
     // Bogacki-Shampine Method.
     // https://en.wikipedia.org/wiki/Bogacki%E2%80%93Shampine_method
@@ -744,10 +1077,17 @@ void RK23integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextx
     k4 = fasterxpupdate(nextxp1, stepsize);
     nextxp2 = xp + (7.0 / 24.0) * k1 + (1.0 / 4.0) * k2 + (1.0 / 3.0) * k3 + (1.0 / 8.0) * k4;
     FSAL = k4 / stepsize;
+
+    // Bogacki and Shampine's cubic interpolant.
+    dense.y0 = xp;
+    dense.c[0] = k1;
+    dense.c[1] = (-4.0 / 3.0) * k1 + k2 + (4.0 / 3.0) * k3 - k4;
+    dense.c[2] = (5.0 / 9.0) * k1 + (-2.0 / 3.0) * k2 + (-8.0 / 9.0) * k3 + k4;
+    dense.c[3] = mat2x4(0.0);
 }
 #endif
 
-#if (ODE_SOLVER == 3)
+#if ((ODE_SOLVER >= 3 && ODE_SOLVER <= 5) || ODE_SOLVER == 8)
 void RK45integrationStep(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize)
 {
     // Dormand-Prince Method.
@@ -775,7 +1115,8 @@ void RK45integrationStep(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2,
     nextxp2 = xp + (5179.0/57600.0)*k1 + (0.0)*k2 + (7571.0/16695.0)*k3 + (393.0/640.0)*k4 + (-92097.0/339200.0)*k5 + (187.0/2100.0)*k6 + (1.0/40.0)*k7;
 }
 
-void RK45integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL)
+void RK45integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL,
+    out DenseOutput dense)
 {
     // Dormand-Prince Method.
     // https://en.wikipedia.org/wiki/Dormand%E2%80%93Prince_method
@@ -803,14 +1144,146 @@ void RK45integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextx
     k7 = fasterxpupdate(nextxp1, stepsize);
     nextxp2 = xp + (5179.0 / 57600.0) * k1 + (0.0) * k2 + (7571.0 / 16695.0) * k3 + (393.0 / 640.0) * k4 + (-92097.0 / 339200.0) * k5 + (187.0 / 2100.0) * k6 + (1.0 / 40.0) * k7;
     FSAL = k7 / stepsize;
+
+    // Shampine's fourth order interpolant for Dormand-Prince.  k2 doesn't appear in it.
+    dense.y0 = xp;
+    dense.c[0] = k1;
+    dense.c[1] = (-8048581381.0 / 2820520608.0) * k1 + (131558114200.0 / 32700410799.0) * k3 + (-1754552775.0 / 470086768.0) * k4
+        + (127303824393.0 / 49829197408.0) * k5 + (-282668133.0 / 205662961.0) * k6 + (40617522.0 / 29380423.0) * k7;
+    dense.c[2] = (8663915743.0 / 2820520608.0) * k1 + (-68118460800.0 / 10900136933.0) * k3 + (14199869525.0 / 1410260304.0) * k4
+        + (-318862633887.0 / 49829197408.0) * k5 + (2019193451.0 / 616988883.0) * k6 + (-110615467.0 / 29380423.0) * k7;
+    dense.c[3] = (-12715105075.0 / 11282082432.0) * k1 + (87487479700.0 / 32700410799.0) * k3 + (-10690763975.0 / 1880347072.0) * k4
+        + (701980252875.0 / 199316789632.0) * k5 + (-1453857185.0 / 822651844.0) * k6 + (69997945.0 / 29380423.0) * k7;
+}
+#endif
+
+#if (ODE_SOLVER == 4)
+void Tsit5integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL,
+    out DenseOutput dense)
+{
+    // Tsitouras 5(4) Method.
+    // https://doi.org/10.1016/j.camwa.2011.06.002
+    // The same seven stages and FSAL as Dormand-Prince, but the coefficients minimize the fifth order solution's
+    // error instead of satisfying extra simplifying assumptions, so it takes longer steps for the same tolerance.
+    // Note that the differential equations here don't explicitly depend on the 
+    // affine parameter.  i.e. instead of dy/dt = f(t, y), we just have dy/dt = f(y).
+    // So the vector field f is stationary in time.  This simplifies the xpupdate function.
+    // Here y is the vector of (x, p) and f is the vector of (dH/dp, -dH/dx).
+
+    // This version of the function uses the first-same-as-last (FSAL) optimization.
+    mat2x4 k1;
+    mat2x4 k2;
+    mat2x4 k3;
+    mat2x4 k4;
+    mat2x4 k5;
+    mat2x4 k6;
+    mat2x4 k7;
+
+    k1 = FSAL * stepsize;
+    k2 = fasterxpupdate(xp + 0.161 * k1, stepsize);
+    k3 = fasterxpupdate(xp + -0.008480655492356989 * k1 + 0.335480655492357 * k2, stepsize);
+    k4 = fasterxpupdate(xp + 2.897153057105493 * k1 + -6.359448489975075 * k2 + 4.3622954328695815 * k3, stepsize);
+    k5 = fasterxpupdate(xp + 5.325864828439257 * k1 + -11.748883564062828 * k2 + 7.4955393428898365 * k3
+        + -0.09249506636175525 * k4, stepsize);
+    k6 = fasterxpupdate(xp + 5.86145544294642 * k1 + -12.92096931784711 * k2 + 8.159367898576159 * k3
+        + -0.071584973281401 * k4 + -0.028269050394068383 * k5, stepsize);
+    nextxp1 = xp + 0.09646076681806523 * k1 + 0.01 * k2 + 0.4798896504144996 * k3 + 1.379008574103742 * k4
+        + -3.290069515436081 * k5 + 2.324710524099774 * k6;
+    k7 = fasterxpupdate(nextxp1, stepsize);
+    nextxp2 = xp + 0.09824077787029101 * k1 + 0.010816434459656746 * k2 + 0.4720087724042376 * k3
+        + 1.5237195812770048 * k4 + -3.872426680888636 * k5 + 2.7827926300289607 * k6 + (-1.0 / 66.0) * k7;
+    FSAL = k7 / stepsize;
+
+    // Tsitouras' fourth order interpolant.
+    dense.y0 = xp;
+    dense.c[0] = k1;
+    dense.c[1] = -2.763706197274826 * k1 + 0.1317 * k2 + 3.9302962368947516 * k3 + -12.411077166933676 * k4
+        + 37.50931341651104 * k5 + -27.896526289197286 * k6 + 1.5 * k7;
+    dense.c[2] = 2.9132554618219126 * k1 + -0.2234 * k2 + -5.941033872131505 * k3 + 30.33818863028232 * k4
+        + -88.1789048947664 * k5 + 65.09189467479366 * k6 + -4.0 * k7;
+    dense.c[3] = -1.0530884977290216 * k1 + 0.1017 * k2 + 2.490627285651253 * k3 + -16.548102889244902 * k4
+        + 47.37952196281928 * k5 + -34.87065786149661 * k6 + 2.5 * k7;
+}
+#endif
+
+#if (ODE_SOLVER == 5)
+void Vern6integrationStepFSAL(mat2x4 xp, inout mat2x4 nextxp1, inout mat2x4 nextxp2, float stepsize, inout mat2x4 FSAL,
+    out DenseOutput dense)
+{
+    // Verner's "most efficient" 6(5) Method.
+    // https://www.sfu.ca/~jverner/
+    // Nine stages, the last of which is the FSAL derivative at nextxp1, so eight evaluations per step.  The embedded
+    // fifth order weights are one member of the family that Verner's stages allow, chosen to use the FSAL stage.
+    // Note that the differential equations here don't explicitly depend on the 
+    // affine parameter.  i.e. instead of dy/dt = f(t, y), we just have dy/dt = f(y).
+    // So the vector field f is stationary in time.  This simplifies the xpupdate function.
+    // Here y is the vector of (x, p) and f is the vector of (dH/dp, -dH/dx).
+
+    // This version of the function uses the first-same-as-last (FSAL) optimization.
+    mat2x4 k1;
+    mat2x4 k2;
+    mat2x4 k3;
+    mat2x4 k4;
+    mat2x4 k5;
+    mat2x4 k6;
+    mat2x4 k7;
+    mat2x4 k8;
+    mat2x4 k9;
+
+    k1 = FSAL * stepsize;
+    k2 = fasterxpupdate(xp + 0.06 * k1, stepsize);
+    k3 = fasterxpupdate(xp + 0.019239962962962962 * k1 + 0.07669337037037037 * k2, stepsize);
+    k4 = fasterxpupdate(xp + 0.035975 * k1 + 0.107925 * k3, stepsize);
+    k5 = fasterxpupdate(xp + 1.3186834152331484 * k1 + -5.042058063628562 * k3 + 4.220674648395414 * k4, stepsize);
+    k6 = fasterxpupdate(xp + -41.872591664327516 * k1 + 159.4325621631375 * k3 + -122.11921356501003 * k4
+        + 5.531743066200054 * k5, stepsize);
+    k7 = fasterxpupdate(xp + -54.430156935316504 * k1 + 207.06725136501848 * k3 + -158.61081378459 * k4
+        + 6.991816585950242 * k5 + -0.018597231062309694 * k6, stepsize);
+    k8 = fasterxpupdate(xp + -54.66374178728198 * k1 + 207.95280625538936 * k3 + -159.2889574744995 * k4
+        + 7.018743740796944 * k5 + -0.018338785905045722 * k6 + -0.0005119484997882099 * k7, stepsize);
+    nextxp1 = xp + 0.03438957868357036 * k1 + 0.2582624555633503 * k4 + 0.4209371189673537 * k5
+        + 4.40539646966931 * k6 + -176.48311902429865 * k7 + 172.36413340141507 * k8;
+    k9 = fasterxpupdate(nextxp1, stepsize);
+    nextxp2 = xp + 0.0430129829743893 * k1 + 0.23882842559078052 * k4 + 0.44938719158355656 * k5
+        + 2.2956854065344765 * k6 + -73.02457601267984 * k7 + 70.96432867266324 * k8 + (1.0 / 30.0) * k9;
+    FSAL = k9 / stepsize;
+
+    // Verner's own interpolants need extra stages.  This quartic uses the stages above and satisfies the fourth order
+    // conditions, with the slope matching k1 and k9 at the ends of the step.
+    dense.y0 = xp;
+    dense.c[0] = k1;
+    dense.c[1] = -4.948956295899341 * k1 + 5.660042140098469 * k4 + -0.8070158105376372 * k5 + 6.201805421709491 * k6
+        + -322.9371626136628 * k7 + 316.6660991971082 * k8 + 0.1651879611838094 * k9;
+    dense.c[2] = 7.0354709066810255 * k1 + -10.287034457943447 * k4 + 3.297780096944718 * k5 + 5.21797503525826 * k6
+        + -60.05815087001707 * k7 + 56.12433521144375 * k8 + -1.330375922367619 * k9;
+    dense.c[3] = -3.052125032061035 * k1 + 4.885254773408416 * k4 + -2.0698271674397324 * k5 + -7.014383987298429 * k6
+        + 206.5121944593442 * k7 + -200.42630100713708 * k8 + 1.165187961183782 * k9;
+}
+#endif
+
+#if (ODE_SOLVER == 8)
+bool useHighOrderPair(const in mat2x4 xp, const in float previousError)
+{
+    // The automatic solver takes Dormand-Prince steps in the weak field, where long steps are accurate, and wherever
+    // the last step came in well under the tolerance.  Otherwise it takes Bogacki-Shampine steps, which are cheaper
+    // where the error changes too quickly for long steps, e.g. near the photon sphere.  previousError is the last
+    // accepted step's error as a fraction of the tolerance, or 1 after a rejection.  Both pairs end on the derivative
+    // at the end of the step, so FSAL carries over when the pair changes.  u_hybridRadius is in units of the mass;
+    // every photon orbit is within 4M.
+    float r = metricDistance(xp[0]);
+    bool weakField = r > u_hybridRadius * u_BHMass;
+    return weakField || previousError < 0.5;
 }
 #endif
 
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
-mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize, inout mat2x4 FSAL)
+#ifdef ADAPTIVE_SOLVER
+mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize, inout mat2x4 FSAL, inout float previousError,
+    out DenseOutput dense)
 {
     // oldStepSize is the size of the step that is actually used in the integration step.  stepsize is then updated
-    // for the next step based on the error.
+    // for the next step based on the error.  previousError is the last accepted step's error relative to the
+    // tolerance, which the PI controller and the automatic solver use.  dense is the continuous extension of the
+    // step that was taken.
     mat2x4 nextxp1;
     mat2x4 nextxp2;
     mat2x4 errormat;
@@ -830,9 +1303,25 @@ mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize,
     float power;
 #if (ODE_SOLVER == 2)
     power = 1.0 / 3.0;
-#elif (ODE_SOLVER == 3)
+#elif (ODE_SOLVER == 3 || ODE_SOLVER == 4)
     power = 1.0 / 5.0;
+#elif (ODE_SOLVER == 5)
+    power = 1.0 / 6.0;
+#elif (ODE_SOLVER == 8)
+    // The pair is chosen before the attempts, so that a rejected step retries with the same pair.
+    bool highOrder = useHighOrderPair(xp, previousError);
+    power = highOrder ? 1.0 / 5.0 : 1.0 / 3.0;
 #endif
+
+#ifdef PI_CONTROLLER
+    // Gustafsson's PI controller also looks at the previous step's error, which damps the accept/reject cycles the
+    // plain controller falls into where the error changes quickly along the geodesic, e.g. near the horizon.  The
+    // gains are the usual 0.7/k and 0.4/k for an error estimate of order k.
+    float alpha = 0.7 * power;
+    float beta = 0.4 * power;
+    bool rejected = false;
+#endif
+    int rejections = 0;
     
     mat2x4 localFSAL = FSAL;
 
@@ -842,21 +1331,37 @@ mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize,
     for (int i = 0; i < max_attempts; i++)
     {
         localFSAL = FSAL;
+#ifdef PI_CONTROLLER
+        // Flat and nearly flat spacetimes have almost no error, so the step would grow until it jumps over the disk
+        // or the sphere.  Cap it relative to the distance instead.
+        stepsize = min(0.01 + metricDistance(xp[0]) / 5.0, stepsize);
+#else
         // HACK.  The adaptive driver steps too far for flat or close to flat spacetimes.  This causes it to miss
-        // crossing the disk or the sphere.
+        // crossing the disk or the sphere.  Minkowski rays are never integrated, see straightRayMarch().
 #ifdef CLASSICAL
         stepsize = min(0.01 + (metricDistance(xp[0]) - 2.0 * u_BHMass) * 1.0 / 5.0, stepsize);
 #endif
-#ifdef MINKOWSKI
-        stepsize = 0.01 + metricDistance(xp[0]) / 5.0;
 #endif
 
 #if (ODE_SOLVER == 2)
-        RK23integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+        RK23integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
         //RK23integrationStep(xp, nextxp1, nextxp2, stepsize);
 #elif (ODE_SOLVER == 3)
-        RK45integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+        RK45integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
         //RK45integrationStep(xp, nextxp1, nextxp2, stepsize);
+#elif (ODE_SOLVER == 4)
+        Tsit5integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
+#elif (ODE_SOLVER == 5)
+        Vern6integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
+#elif (ODE_SOLVER == 8)
+        if (highOrder)
+        {
+            RK45integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
+        }
+        else
+        {
+            RK23integrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, dense);
+        }
 #endif
 
         // Now adapt stepsize:
@@ -864,6 +1369,34 @@ mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize,
         // https://jonshiach.github.io/ODEs-book/pages/2.5_Adaptive_step_size_control.html
         // Calculate the error
         errormat = nextxp1 - nextxp2;
+#ifdef PI_CONTROLLER
+        // RMS of each component's error relative to atol + rtol * |component|, so that positions in the tens and
+        // momenta of order one are held to the same relative accuracy.  The step is accepted when this is at most 1.
+        vec4 xScale = u_absoluteTolerance + u_relativeTolerance * max(abs(xp[0]), abs(nextxp1[0]));
+        vec4 pScale = u_absoluteTolerance + u_relativeTolerance * max(abs(xp[1]), abs(nextxp1[1]));
+        vec4 xError = errormat[0] / xScale;
+        vec4 pError = errormat[1] / pScale;
+        error = max(sqrt((dot(xError, xError) + dot(pError, pError)) / 8.0), 1.0e-10);
+
+        if (error <= 1.0)
+        {
+            stepSizeRatio = clamp(safety * pow(error, -alpha) * pow(previousError, beta), minstep, maxstep);
+            if (rejected)
+            {
+                // Don't grow the step straight after a rejection.
+                stepSizeRatio = min(stepSizeRatio, 1.0);
+            }
+            oldStepSize = stepsize;
+            stepsize *= stepSizeRatio;
+            previousError = max(error, 1.0e-4);
+            break;
+        }
+
+        // Retry with the plain controller.  The history doesn't say anything about a step that failed.
+        stepsize *= clamp(safety * pow(error, -power), minstep, 1.0);
+        rejected = true;
+        rejections++;
+#else
         // L2-norm error
         error = sqrt(dot(errormat[0], errormat[0]) + dot(errormat[1], errormat[1]));
         // L1-norm error
@@ -880,13 +1413,20 @@ mat2x4 adaptiveRKDriver(mat2x4 xp, inout float stepsize, out float oldStepSize,
             {
                 oldStepSize = stepsize;
                 stepsize *= stepSizeRatio;
+                previousError = (rejections > 0) ? 1.0 : error / u_tolerance;
                 break;
             }
         }
 
         stepsize *= stepSizeRatio;
+        rejections++;
+#endif
     }
 
+#ifdef SOLVER_STATISTICS
+    rayAcceptedSteps++;
+    rayRejectedSteps += uint(rejections);
+#endif
     FSAL = localFSAL;
     return nextxp1;
 }
@@ -906,10 +1446,11 @@ void BSDiskIntersectionPoint(mat2x4 previousxp, mat2x4 xp, out mat2x4 diskInters
     float rightEndpoint = stepsize;
     float midpoint;
     mat2x4 xptest;
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#ifdef ADAPTIVE_SOLVER
     mat2x4 xptest2;
     mat2x4 FSAL = fasterxpupdate(previousxp, stepsize) / stepsize;
     mat2x4 localFSAL = FSAL;
+    DenseOutput unusedDense;
 #endif
     if (abs(previousxp[0][2]) < u_diskIntersectionThreshold)
     {
@@ -923,7 +1464,7 @@ void BSDiskIntersectionPoint(mat2x4 previousxp, mat2x4 xp, out mat2x4 diskInters
     {
         for (int j = 0; j < BS_attempts; j++)
         {
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#ifdef ADAPTIVE_SOLVER
             localFSAL = FSAL;
 #endif
             midpoint = (leftEndpoint + rightEndpoint) / 2.0;
@@ -933,8 +1474,10 @@ void BSDiskIntersectionPoint(mat2x4 previousxp, mat2x4 xp, out mat2x4 diskInters
             xptest = RK4integrationStep(previousxp, midpoint);
 #elif (ODE_SOLVER == 2)
             //RK23integrationStep(previousxp, xptest, xptest2, midpoint);
-            RK23integrationStepFSAL(previousxp, xptest, xptest2, midpoint, localFSAL);
-#elif (ODE_SOLVER == 3)
+            RK23integrationStepFSAL(previousxp, xptest, xptest2, midpoint, localFSAL, unusedDense);
+#elif (ODE_SOLVER == 7)
+            xptest = GLintegrationStep(previousxp, midpoint);
+#elif (ODE_SOLVER >= 3)
             //RK23integrationStepFSAL(previousxp, xptest, xptest2, midpoint, localFSAL);
             //RK45integrationStep(previousxp, xptest, xptest2, midpoint);
             //RK45integrationStepFSAL(previousxp, xptest, xptest2, midpoint, localFSAL);
@@ -973,14 +1516,15 @@ void BSSphereIntersectionPoint(mat2x4 xp, out mat2x4 sphereIntersectionPoint, fl
     float midpoint;
     float dist;
     mat2x4 xptest;
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#ifdef ADAPTIVE_SOLVER
     mat2x4 xptest2;
     mat2x4 FSAL = fasterxpupdate(xp, stepsize) / stepsize;
     mat2x4 localFSAL = FSAL;
+    DenseOutput unusedDense;
 #endif
     for (int j = 0; j < BS_attempts; j++)
     {
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#ifdef ADAPTIVE_SOLVER
         localFSAL = FSAL;
 #endif
         midpoint = (leftEndpoint + rightEndpoint) / 2.0;
@@ -990,8 +1534,11 @@ void BSSphereIntersectionPoint(mat2x4 xp, out mat2x4 sphereIntersectionPoint, fl
         xptest = RK4integrationStep(xp, midpoint);
 #elif (ODE_SOLVER == 2)
         //RK23integrationStep(xp, xptest, xptest2, midpoint);
-        RK23integrationStepFSAL(xp, xptest, xptest2, midpoint, localFSAL);
-#elif (ODE_SOLVER == 3)
+        RK23integrationStepFSAL(xp, xptest, xptest2, midpoint, localFSAL, unusedDense);
+#elif (ODE_SOLVER == 7)
+        xptest = GLintegrationStep(xp, midpoint);
+#elif (ODE_SOLVER >= 3)
+        // The higher order pairs also bisect with Dormand-Prince, which rarely happens with their dense output.
         RK45integrationStep(xp, xptest, xptest2, midpoint);
         //RK23integrationStep(xp, xptest, xptest2, midpoint);
         //RK23integrationStepFSAL(xp, xptest, xptest2, midpoint, localFSAL);
@@ -1020,6 +1567,87 @@ void BSSphereIntersectionPoint(mat2x4 xp, out mat2x4 sphereIntersectionPoint, fl
     sphereIntersectionPoint = xptest;
 }
 
+#ifdef ADAPTIVE_SOLVER
+float sphereEvent(const in mat2x4 xp, const in float horizon)
+{
+    return metricDistance(xp[0]) - horizon;
+}
+
+bool denseIntersectionPoint(const in DenseOutput dense, const in float g0, const in float g1, const in bool sphere,
+    const in float horizon, const in float threshold, out mat2x4 intersectionPoint)
+{
+    // Illinois root finding on the step's continuous extension, for where y = 0 (sphere == false) or r = horizon.
+    // g0 and g1 are the event function at the ends of the step, which must have different signs.  Every iteration
+    // only evaluates a polynomial, where bisection has to integrate again.  Returns false if it didn't converge.
+    float a = 0.0;
+    float b = 1.0;
+    float ga = g0;
+    float gb = g1;
+    int side = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        float theta = clamp((a * gb - b * ga) / (gb - ga), a, b);
+        intersectionPoint = denseOutput(dense, theta);
+        float g = sphere ? sphereEvent(intersectionPoint, horizon) : intersectionPoint[0][2];
+        if (abs(g) < threshold)
+        {
+            return true;
+        }
+        // Halve the endpoint that has stayed put twice in a row, so that convex g doesn't converge from one side.
+        if (g * gb > 0.0)
+        {
+            b = theta;
+            gb = g;
+            if (side == -1)
+            {
+                ga *= 0.5;
+            }
+            side = -1;
+        }
+        else
+        {
+            a = theta;
+            ga = g;
+            if (side == 1)
+            {
+                gb *= 0.5;
+            }
+            side = 1;
+        }
+    }
+    return false;
+}
+#endif
+
+void findDiskIntersectionPoint(mat2x4 previousxp, mat2x4 xp, const in DenseOutput dense, out mat2x4 diskIntersectionPoint,
+    float stepsize)
+{
+    // The adaptive solvers locate the crossing on the step they just took, and only integrate again with the binary
+    // search if that fails.
+#ifdef ADAPTIVE_SOLVER
+    if (abs(previousxp[0][2]) >= u_diskIntersectionThreshold && abs(xp[0][2]) >= u_diskIntersectionThreshold
+        && denseIntersectionPoint(dense, previousxp[0][2], xp[0][2], false, 0.0, u_diskIntersectionThreshold,
+        diskIntersectionPoint))
+    {
+        return;
+    }
+#endif
+    BSDiskIntersectionPoint(previousxp, xp, diskIntersectionPoint, stepsize);
+}
+
+void findSphereIntersectionPoint(mat2x4 previousxp, mat2x4 xp, const in DenseOutput dense, out mat2x4 sphereIntersectionPoint,
+    float horizon, float stepsize)
+{
+#ifdef ADAPTIVE_SOLVER
+    if (denseIntersectionPoint(dense, sphereEvent(previousxp, horizon), sphereEvent(xp, horizon), true, horizon,
+        u_sphereIntersectionThreshold, sphereIntersectionPoint))
+    {
+        return;
+    }
+#endif
+    BSSphereIntersectionPoint(previousxp, sphereIntersectionPoint, horizon, stepsize);
+}
+
 
 /////////////////////////////////////////////////////
 ////////////////   SPHERE SHADING   /////////////////
@@ -1189,7 +1817,41 @@ float observedTemperature(const float r, const float blueshift)
     return blueshift * u_Tmax * pow(f(r) * r_max / (r * f(r_max)), 1.0 / 4.0);
 }
 
-vec3 getDiskColour(const in mat2x4 diskIntersectionPoint, const in float previousy, const in float r, inout float T)
+float diskRedshift(const in mat2x4 diskIntersectionPoint, const in float r)
+{
+    // The redshift g only depends on the geodesic, not on the disk's rotation angle or lighting, so the trace pass of
+    // the geodesic G-buffer stores it for the shade pass.
+    vec4 planeIntersectionPoint = diskIntersectionPoint[0];
+    vec4 diskVel;
+
+    // Velocity (in Kerr-Schild cartesian coordinates) of a massive particle in circular orbit in the equatorial plane
+    // at a distance r from a black hole with mass u_BHMass and spin a.
+    // The minus sign in front of the time term is just to make the later dot product work out.  The ray of light
+    // is moving toward the disk because we're tracing backwards, so we need to swap the sign on either
+    // the light momentum or the disk velocity, so we just do it here for simplicity.  We flip observerVel's time term
+    // for the same reason.
+#ifdef INSIDE_HORIZON
+    diskVel = vec4((r + u_a * sqrt(u_BHMass / r)), vec3(-planeIntersectionPoint.w, 0.0, planeIntersectionPoint.y) * sqrt(u_BHMass / r)) / sqrt(r * r - 3.0 * r * u_BHMass + 2.0 * u_a * sqrt(u_BHMass * r));
+#else
+    diskVel = vec4(-(r + u_a * sqrt(u_BHMass / r)), vec3(-planeIntersectionPoint.w, 0.0, planeIntersectionPoint.y) * sqrt(u_BHMass / r)) / sqrt(r * r - 3.0 * r * u_BHMass + 2.0 * u_a * sqrt(u_BHMass * r));
+#endif
+    // Ensure diskVel is normalized, otherwise the dot product produces incorrect results for g.
+    diskVel /= sqrt(-dot(metric(vec4(diskIntersectionPoint[0])) * diskVel, diskVel));
+
+    // g is the energy/frequency shift aka the Doppler effect.
+    // Note that we actually want to compute the sum dx_i/dt * dy^i/dt, where x is the light ray's position and y is the
+    // disk particle's position.  We are using momentum coordinates for the light, so we'd need to multiply by the
+    // inverse metric to get dx^i/dt = g^ij * p_j.  But then in the metric dot product, we'd multiply by g_ij again:
+    // metricdot(dx^i/dt, dy^i/dt) = regulardot(g_ij dx^j/dt, dy^i/dt) = regulardot(g_ik * g^kj * p_j, dy^i/dt) = regulardot(p_i, dy^i/dt)
+    // See, e.g. Gravitation by Misner, Thorne, and Wheeler, page 64.
+    // NOTE: because the camera is stationary, including in places where the gravitational field is very strong,
+    // the camera would have to be moving faster than the speed of light to not fall into the black hole.
+    // This would cause g to diverage at points if we included the numerator of g.
+    return 1.0 / dot(diskIntersectionPoint[1], diskVel);
+}
+
+vec3 getDiskColour(const in vec3 planeIntersectionPoint, const in float previousy, const in float r, const in float g,
+    inout float T)
 {
     vec3 rayCol;
     vec3 diskSample;
@@ -1197,19 +1859,17 @@ vec3 getDiskColour(const in mat2x4 diskIntersectionPoint, const in float previou
     float brightnessFromRadius;
     float brightnessFromVel;
     float temperature;
-    vec4 diskVel;
 
-    vec4 planeIntersectionPoint = diskIntersectionPoint[0];
     if (u_useDebugDiskTexture)
     {
         // Need to pass in the sign of previousx's Cartesian y-value to colour the top and bottom of the disk
         // differently in debug mode.
-        diskSample = drawDebugDiskTexture(vec3(planeIntersectionPoint.y, previousy, planeIntersectionPoint.w));
+        diskSample = drawDebugDiskTexture(vec3(planeIntersectionPoint.x, previousy, planeIntersectionPoint.z));
     }
     else
     {
         // Can do multiple noise texture samples here and combine them.
-        diskSample = vec3(1.0) * sampleNoiseTexture(planeIntersectionPoint.yzw);
+        diskSample = vec3(1.0) * sampleNoiseTexture(planeIntersectionPoint);
     }
 
     // This r-mapping is a hack to make the disc look nice when the disk's inner radius doesn't match the ISCO.
@@ -1218,31 +1878,6 @@ vec3 getDiskColour(const in mat2x4 diskIntersectionPoint, const in float previou
 
     if (!u_drawBasicDisk)
     {
-        // Velocity (in Kerr-Schild cartesian coordinates) of a massive particle in circular orbit in the equatorial plane
-        // at a distance r from a black hole with mass u_BHMass and spin a.
-        // The minus sign in front of the time term is just to make the later dot product work out.  The ray of light
-        // is moving toward the disk because we're tracing backwards, so we need to swap the sign on either
-        // the light momentum or the disk velocity, so we just do it here for simplicity.  We flip observerVel's time term
-        // for the same reason.
-#ifdef INSIDE_HORIZON
-        diskVel = vec4((r + u_a * sqrt(u_BHMass / r)), vec3(-planeIntersectionPoint.w, 0.0, planeIntersectionPoint.y) * sqrt(u_BHMass / r)) / sqrt(r * r - 3.0 * r * u_BHMass + 2.0 * u_a * sqrt(u_BHMass * r));
-#else
-        diskVel = vec4(-(r + u_a * sqrt(u_BHMass / r)), vec3(-planeIntersectionPoint.w, 0.0, planeIntersectionPoint.y) * sqrt(u_BHMass / r)) / sqrt(r * r - 3.0 * r * u_BHMass + 2.0 * u_a * sqrt(u_BHMass * r));
-#endif
-        // Ensure diskVel is normalized, otherwise the dot product produces incorrect results for g.
-        diskVel /= sqrt(-dot(metric(vec4(diskIntersectionPoint[0])) * diskVel, diskVel));
-
-        // g is the energy/frequency shift aka the Doppler effect.
-        // Note that we actually want to compute the sum dx_i/dt * dy^i/dt, where x is the light ray's position and y is the
-        // disk particle's position.  We are using momentum coordinates for the light, so we'd need to multiply by the
-        // inverse metric to get dx^i/dt = g^ij * p_j.  But then in the metric dot product, we'd multiply by g_ij again:
-        // metricdot(dx^i/dt, dy^i/dt) = regulardot(g_ij dx^j/dt, dy^i/dt) = regulardot(g_ik * g^kj * p_j, dy^i/dt) = regulardot(p_i, dy^i/dt)
-        // See, e.g. Gravitation by Misner, Thorne, and Wheeler, page 64.
-        // NOTE: because the camera is stationary, including in places where the gravitational field is very strong,
-        // the camera would have to be moving faster than the speed of light to not fall into the black hole.
-        // This would cause g to diverage at points if we included the numerator of g.
-        float g = 1.0 / dot(diskIntersectionPoint[1], diskVel);
-
         // u_blueshiftPower = 1.0 is physically correct.
         float blueshift = pow(g, u_blueshiftPower);
         temperature = observedTemperature(mappedr, blueshift);
@@ -1282,7 +1917,7 @@ vec3 getDiskColour(const in mat2x4 diskIntersectionPoint, const in float previou
         // Beer's law (https://en.wikipedia.org/wiki/Beer%E2%80%93Lambert_law)
         //brightnessFromRadius = clamp(10000.0 * ((f(r) / r) - (f(u_OuterRadius) / u_OuterRadius)), 0.0, 1.0);
         float absorptionDropOff = clamp(700.0 * (pow(mappedr, -2.5) - pow(u_OuterRadius, -2.5)), 0.0, 1.0);
-        float absorptionNoise = sampleNoiseTexture(-planeIntersectionPoint.yzw);
+        float absorptionNoise = sampleNoiseTexture(-planeIntersectionPoint);
         float absorption = u_diskAbsorption * absorptionNoise * absorptionDropOff;
         T *= exp(-absorption);
     }
@@ -1299,25 +1934,14 @@ vec3 getDiskColour(const in mat2x4 diskIntersectionPoint, const in float previou
 /////////////////   RAY MARCHING   //////////////////
 /////////////////////////////////////////////////////
 
-void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk)
+void initRay(const in vec3 cameraPos, const in vec3 rayDir, const in float horizon, out mat2x4 xp, out float stepSize,
+    out mat2x4 FSAL, out float previousError)
 {
-    vec3 dir;
-    float dist;
-    float diskDist;
-    float T = 1.0;  // Transmittance
-    float horizon = u_BHMass + sqrt(u_BHMass * u_BHMass - u_a * u_a); // G = c = 1
-    mat2x4 diskIntersectionPoint;
-    mat2x4 sphereIntersectionPoint;
-    bool hitSphere = false;
-    bool hitInfinity = false;
-
     // x and p are the spacetime position and momentum coordinates.
     // p_i = g_ij * dx^j/dlambda
     // Set x_t = 0.  Set dx^0/dlambda = 1 for ingoing coordinates and -1 for outgoing coordinates.
-    mat2x4 xp;
-    mat2x4 previousxp;
     xp[0] = vec4(0.0, cameraPos);
-    dist = metricDistance(xp[0]);
+    float dist = metricDistance(xp[0]);
 #ifdef INSIDE_HORIZON
     // Inside the event horizon, we change the metric to outgoing coordinates.  We adjust p accordingly.
     xp[1] = metric(xp[0]) * vec4(-1.0, rayDir);
@@ -1325,8 +1949,6 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
     xp[1] = metric(xp[0]) * vec4(1.0, rayDir);
 #endif
 
-    float stepSize;
-    float oldStepSize;
     // Cheap, dumb initial stepsize heuristic
 #ifdef INSIDE_HORIZON
     stepSize = dist / (100.0 * horizon);
@@ -1334,39 +1956,531 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
     stepSize = 0.01 + (dist - horizon) / 10.0;
 #endif
 
-#if (ODE_SOLVER == 2 || ODE_SOLVER == 3)
+#ifdef ADAPTIVE_SOLVER
     // Prepare adaptive ODE solvers for first-same-as-last (FSAL).
-    mat2x4 FSAL = fasterxpupdate(xp, stepSize) / stepSize;
+    FSAL = fasterxpupdate(xp, stepSize) / stepSize;
+#else
+    FSAL = mat2x4(0.0);
 #endif
+    // The PI controller's history before the first step.  Small, so that it doesn't hold the step size back.
+    previousError = 1.0e-4;
+}
 
-    // MAIN RAYMARCH LOOP
-    for (int i = 0; i < u_maxSteps; i++)
-    {
-        previousxp = xp;
+#ifdef FP64_REFINEMENT
+// Only defined with KERR.  The float solvers lose their accuracy where the metric is ill-conditioned: close to the
+// horizon, where r is the small difference of large numbers and f changes quickly, more so for near-extremal spins,
+// and where |p| is much larger than the energy -p_t, which happens on rays that circle the photon orbits many times.
+// Steps there are taken in double precision instead, by advanceRayFP64().  Doubles are core in GLSL 4.00, but most
+// consumer GPUs run them at 1/32 or 1/64 of the float rate, so the band should be as narrow as the image allows.
+uniform float u_fp64Band;
+
+struct KerrSchildStateD
+{
+    double r;
+    double r2plusa2;
+    double Q;
+    double f;
+    dvec4 l;
+};
+
+KerrSchildStateD kerrSchildStateD(const in dvec4 x)
+{
+    // kerrSchildState() in double precision.
+    KerrSchildStateD s;
+    dvec3 p = x.yzw;
+    double a = double(u_a);
+    double a2 = a * a;
+    double y2 = p.y * p.y;
+    double b = a2 - dot(p, p);
+    double sq = sqrt(b * b + 4.0 * a2 * y2);
+    double r2 = (b > 0.0) ? 2.0 * a2 * y2 / (b + sq) : 0.5 * (sq - b);
+    s.r = sqrt(r2);
+    s.r2plusa2 = r2 + a2;
+    s.Q = r2 * r2 + a2 * y2;
+    s.f = 2.0 * double(u_BHMass) * r2 * s.r / s.Q;
+#ifdef INSIDE_HORIZON
+    s.l = dvec4(1.0, (s.r * p.x - a * p.z) / s.r2plusa2, p.y / s.r, (s.r * p.z + a * p.x) / s.r2plusa2);
+#else
+    s.l = dvec4(-1.0, (s.r * p.x - a * p.z) / s.r2plusa2, p.y / s.r, (s.r * p.z + a * p.x) / s.r2plusa2);
+#endif
+    return s;
+}
+
+dmat2x4 fasterxpupdateD(const in dmat2x4 xp, const in double dl)
+{
+    // fasterxpupdate() in double precision, with kerrRaiseIndex() and KerrdHdxExact() written out.
+    dvec4 x = xp[0];
+    dvec4 p = xp[1];
+    KerrSchildStateD s = kerrSchildStateD(x);
+    dvec3 pos = x.yzw;
+    double a = double(u_a);
+    double a2 = a * a;
+    double r = s.r;
+    double r2 = r * r;
+
+    dvec3 drdxhat = (r / s.Q) * dvec3(r2 * pos.x, s.r2plusa2 * pos.y, r2 * pos.z);
+    double fOverQ = s.f / s.Q;
+    dvec3 dfdxhat = (fOverQ * (3.0 * a2 * pos.y * pos.y - r2 * r2) / r) * drdxhat;
+    dfdxhat.y -= 2.0 * a2 * pos.y * fOverQ;
+    double G = (p.y * (pos.x - 2.0 * r * s.l.y) + p.w * (pos.z - 2.0 * r * s.l.w)) / s.r2plusa2 - p.z * s.l.z / r;
+    dvec3 explicitTerm = dvec3((r * p.y + a * p.w) / s.r2plusa2, p.z / r, (r * p.w - a * p.y) / s.r2plusa2);
+    dvec3 dldxhatdotp = G * drdxhat + explicitTerm;
+    double ldotp = dot(s.l, p);
+
+    dmat2x4 dxp;
+    dxp[1] = dvec4(0.0, 0.5 * ldotp * (ldotp * dfdxhat + 2.0 * s.f * dldxhatdotp)) * dl;
+    dxp[0] = (dvec4(-p.x, p.yzw) - s.f * ldotp * s.l) * dl;
+    return dxp;
+}
+
+// The ray's state at the end of its last double precision step.  While a ray stays in the band, each step continues
+// from this rather than from xp rounded to float.
+dmat2x4 rayxpD = dmat2x4(0.0);
+
+bool needsFP64(const in mat2x4 xp, const in float dist, const in float horizon)
+{
+    // The band is twice as wide for near-extremal spins, where the photon orbits crowd against the horizon.
+    float band = u_fp64Band * u_BHMass * ((abs(u_a) > 0.95 * u_BHMass) ? 2.0 : 1.0);
+    return dist < horizon + band || dot(xp[1].yzw, xp[1].yzw) > 400.0 * xp[1].x * xp[1].x;
+}
+
+float advanceRayFP64(inout mat2x4 xp, inout float stepSize, inout float oldStepSize, inout mat2x4 FSAL,
+    out DenseOutput dense, const in float horizon, const in float dist)
+{
+    // One classical RK4 step in double precision, no longer than the fixed solvers would take here.  The derivative
+    // at the end of the step gives a cubic Hermite dense output and, for the adaptive solvers, the next FSAL.
+#ifdef INSIDE_HORIZON
+    float h = min(stepSize, dist / (10.0 * horizon));
+#else
+    float h = min(stepSize, 0.01 + (dist - horizon) / 5.0);
+#endif
+    double dh = double(h);
+    dmat2x4 y0 = (mat2x4(rayxpD) == xp) ? rayxpD : dmat2x4(xp);
+    dmat2x4 k1 = fasterxpupdateD(y0, dh);
+    dmat2x4 k2 = fasterxpupdateD(y0 + 0.5 * k1, dh);
+    dmat2x4 k3 = fasterxpupdateD(y0 + 0.5 * k2, dh);
+    dmat2x4 k4 = fasterxpupdateD(y0 + k3, dh);
+    rayxpD = y0 + (k1 + 2.0 * k2 + 2.0 * k3 + k4) / 6.0;
+#ifdef ADAPTIVE_SOLVER
+    dmat2x4 k5 = fasterxpupdateD(rayxpD, dh);
+    dmat2x4 delta = rayxpD - y0;
+    dense.y0 = xp;
+    dense.c[0] = mat2x4(k1);
+    dense.c[1] = mat2x4(3.0 * delta - 2.0 * k1 - k5);
+    dense.c[2] = mat2x4(-2.0 * delta + k1 + k5);
+    dense.c[3] = mat2x4(0.0);
+    FSAL = mat2x4(k5 / dh);
+#endif
+    xp = mat2x4(rayxpD);
 
-        // The actual integration step, depending on which ODE solver is used.
+    float newDist = float(kerrSchildStateD(rayxpD[0]).r);
+    oldStepSize = h;
+#ifdef INSIDE_HORIZON
+    stepSize = newDist / (10.0 * horizon);
+#else
+    stepSize = 0.01 + (newDist - horizon) / 5.0;
+#endif
+#ifdef SOLVER_STATISTICS
+    rayFP64Steps++;
+#endif
+    return newDist;
+}
+#endif
+
+float advanceRay(inout mat2x4 xp, inout float stepSize, inout float oldStepSize, inout mat2x4 FSAL,
+    inout float previousError, out DenseOutput dense, const in float horizon)
+{
+    // The actual integration step, depending on which ODE solver is used.  Returns the new distance from the black
+    // hole.  FSAL, previousError and dense are only used by the adaptive solvers.
+    float dist;
+#ifdef FP64_REFINEMENT
+    dist = metricDistance(xp[0]);
+    if (needsFP64(xp, dist, horizon))
+    {
+        return advanceRayFP64(xp, stepSize, oldStepSize, FSAL, dense, horizon, dist);
+    }
+#endif
 #if (ODE_SOLVER == 0)
-        xp = integrationStep(xp, stepSize);
-        dist = metricDistance(xp[0]);
-        oldStepSize = stepSize;
+    xp = integrationStep(xp, stepSize);
+    dist = metricDistance(xp[0]);
+    oldStepSize = stepSize;
 #ifdef INSIDE_HORIZON
-        stepSize = dist / (10.0 * horizon);
+    stepSize = dist / (10.0 * horizon);
 #else
-        stepSize = 0.01 + (dist - horizon) / 10.0;
+    stepSize = 0.01 + (dist - horizon) / 10.0;
 #endif
-#elif (ODE_SOLVER == 1)
-        xp = RK4integrationStep(xp, stepSize);
-        dist = metricDistance(xp[0]);
-        oldStepSize = stepSize;
+#elif (ODE_SOLVER == 1 || ODE_SOLVER == 7)
+#if (ODE_SOLVER == 1)
+    xp = RK4integrationStep(xp, stepSize);
+#else
+    xp = GLintegrationStep(xp, stepSize);
+#endif
+    dist = metricDistance(xp[0]);
+    oldStepSize = stepSize;
 #ifdef INSIDE_HORIZON
-        stepSize = dist / (10.0 * horizon);
+    stepSize = dist / (10.0 * horizon);
 #else
-        stepSize = 0.01 + (dist - horizon) / 5.0;
+    stepSize = 0.01 + (dist - horizon) / 5.0;
 #endif
-#elif (ODE_SOLVER == 2 || ODE_SOLVER == 3)
-        xp = adaptiveRKDriver(xp, stepSize, oldStepSize, FSAL);
-        dist = metricDistance(xp[0]);
+#elif defined(ADAPTIVE_SOLVER)
+    xp = adaptiveRKDriver(xp, stepSize, oldStepSize, FSAL, previousError, dense);
+    dist = metricDistance(xp[0]);
 #endif
+    return dist;
+}
+
+vec4 diskHitRecord(const in mat2x4 previousxp, const in mat2x4 diskIntersectionPoint, const in float diskDist)
+{
+    // A disk plane crossing as the trace pass records it: (r, phi, g, side the ray came from).
+    vec4 planeIntersectionPoint = diskIntersectionPoint[0];
+    return vec4(diskDist, atan(planeIntersectionPoint.w, planeIntersectionPoint.y), diskRedshift(diskIntersectionPoint, diskDist),
+        (previousxp[0][2] < 0.0) ? -1.0 : 1.0);
+}
+
+#ifdef MINKOWSKI
+bool straightRay(const in mat2x4 xp, const in float horizon, out mat2x4 diskIntersectionPoint, out vec4 escape)
+{
+    // In flat space p is constant and the ray is the straight line x + l * dx/dl, so it crosses the disk's plane at
+    // most once and where it does, and where it hits the sphere, have closed forms.  Returns whether the ray crosses
+    // the plane outside the sphere, and sets escape to how the ray ends as the trace pass records it.
+    vec4 dxdl = invmetric(xp[0]) * xp[1];
+    vec3 x = xp[0].yzw;
+    vec3 dir = dxdl.yzw;
+    float lSphere = -1.0;
+#ifndef INSIDE_HORIZON
+    // The nearer root of |x + l dir|^2 = horizon^2, in the form that doesn't cancel.  dir is a unit vector.
+    float b = dot(x, dir);
+    float discriminant = b * b - (dot(x, x) - horizon * horizon);
+    if (b < 0.0 && discriminant > 0.0)
+    {
+        lSphere = (dot(x, x) - horizon * horizon) / (sqrt(discriminant) - b);
+    }
+#endif
+
+    if (lSphere >= 0.0)
+    {
+        escape = u_useDebugSphereTexture ? vec4(x + lSphere * dir, ESCAPE_SPHERE) : vec4(0.0, 0.0, 0.0, ESCAPE_NONE);
+    }
+    else
+    {
+        escape = vec4(normalize(dir), ESCAPE_INFINITY);
+    }
+
+    if (x.y * dir.y >= 0.0)
+    {
+        return false;
+    }
+    float lDisk = -x.y / dir.y;
+    diskIntersectionPoint[0] = xp[0] + lDisk * dxdl;
+    diskIntersectionPoint[0].z = 0.0;
+    diskIntersectionPoint[1] = xp[1];
+    // As in rayMarch()'s loop, crossings inside the sphere don't count.
+    return (lSphere < 0.0 || lDisk < lSphere) && metricDistance(diskIntersectionPoint[0]) > horizon;
+}
+
+void straightRayMarch(const in mat2x4 xp, const in float horizon, inout vec3 rayCol, inout bool hitDisk)
+{
+    // rayMarch() for the Minkowski metric, with zero integration steps.
+    mat2x4 diskIntersectionPoint;
+    vec4 escape;
+    bool crossesPlane = straightRay(xp, horizon, diskIntersectionPoint, escape);
+#ifdef GEODESIC_TRACE
+    if (crossesPlane)
+    {
+        geodesicRecord.diskHits[0] = diskHitRecord(xp, diskIntersectionPoint, metricDistance(diskIntersectionPoint[0]));
+    }
+    geodesicRecord.escape = escape;
+#else
+    // The same shading as the shade pass gives the records above.
+    float T = 1.0;  // Transmittance
+    if (crossesPlane)
+    {
+        float diskDist = metricDistance(diskIntersectionPoint[0]);
+        if (diskDist <= u_OuterRadius && diskDist >= u_InnerRadius)
+        {
+            hitDisk = true;
+            rayCol += getDiskColour(diskIntersectionPoint[0].yzw, sign(xp[0][2]), diskDist,
+                diskRedshift(diskIntersectionPoint, diskDist), T);
+        }
+    }
+    bool stopped = T < 0.05;
+    if (escape.w == ESCAPE_INFINITY && (!stopped || (u_transparentDisk && !u_useDebugDiskTexture)))
+    {
+        vec3 dir = escape.xyz;
+        rayCol += T * texture(skybox, vec3(-dir.x, dir.y, dir.z)).xyz * u_bloomBackgroundMultiplier;
+    }
+    else if (escape.w == ESCAPE_SPHERE && !stopped)
+    {
+        rayCol += T * getSphereColour(escape.xyz);
+    }
+#endif
+}
+#endif
+
+#ifdef SCHWARZSCHILD_TABLES
+// Only defined with KERR outside the horizon, and only used while u_a is 0.  Then every ray stays in the plane through
+// the black hole that contains its starting point and direction, and how far round that plane it has gone at each
+// radius only depends on its impact parameter.  SchwarzschildTables integrates that once, in units of the mass, and
+// BlackHole uploads it to the buffer below.  schwarzschildRay() reads the ray's plane crossings and how it ends from
+// it without taking a step.  The rays it doesn't cover, closest to the photon sphere's impact parameter and in or
+// parallel to the equatorial plane, are integrated as before.  These must match SchwarzschildTables.
+#define SCHWARZSCHILD_ROWS 256
+#define SCHWARZSCHILD_COLUMNS 256
+#define SCHWARZSCHILD_MAX_CROSSINGS 3
+#define SCHWARZSCHILD_CRITICAL_B 5.19615242
+#define SCHWARZSCHILD_LAST_ROW_DISTANCE 1.0e-3
+
+layout(std430, binding = 4) readonly buffer SchwarzschildTableData
+{
+    // Per row, psi at the turning point for b > b_c and at the horizon for b < b_c.  Then per row and column,
+    // (psi, u / u_t) for b > b_c and (psi, u / u_h) for b < b_c.
+    vec2 schwarzschildEnds[SCHWARZSCHILD_ROWS];
+    vec4 schwarzschildEntries[];
+};
+uniform bool u_useSchwarzschildTables;
+
+vec4 schwarzschildLookup(const in float row, const in float column)
+{
+    // Bilinear interpolation in table coordinates, as in SchwarzschildTables::Lookup().
+    float y = row * float(SCHWARZSCHILD_ROWS - 1);
+    float x = clamp(column, 0.0, 1.0) * float(SCHWARZSCHILD_COLUMNS - 1);
+    int i = min(int(y), SCHWARZSCHILD_ROWS - 2);
+    int j = min(int(x), SCHWARZSCHILD_COLUMNS - 2);
+    int k = i * SCHWARZSCHILD_COLUMNS + j;
+    vec4 bottom = mix(schwarzschildEntries[k], schwarzschildEntries[k + 1], x - float(j));
+    vec4 top = mix(schwarzschildEntries[k + SCHWARZSCHILD_COLUMNS], schwarzschildEntries[k + SCHWARZSCHILD_COLUMNS + 1],
+        x - float(j));
+    return mix(bottom, top, y - float(i));
+}
+
+bool schwarzschildRay(const in mat2x4 xp, out vec4 crossings[SCHWARZSCHILD_MAX_CROSSINGS], out int numCrossings,
+    out vec4 escape)
+{
+    // SchwarzschildTables::Trace(), with the crossings in diskHitRecord()'s form.  Returns false for the rays that
+    // must be integrated instead.
+    float pi = 3.14159265359;
+    numCrossings = 0;
+    escape = vec4(0.0, 0.0, 0.0, ESCAPE_NONE);
+    vec3 x = xp[0].yzw;
+    float r0 = length(x);
+    if (!u_useSchwarzschildTables || r0 <= 2.0 * u_BHMass || r0 >= u_drawDistance)
+    {
+        return false;
+    }
+
+    // Make p null by solving for p_t.
+    mat4 g = invmetric(xp[0]);
+    vec4 p = xp[1];
+    float quadraticA = g[0][0];
+    float quadraticB = 2.0 * dot(g[0].yzw, p.yzw);
+    float quadraticC = dot(p.yzw, mat3(g[1].yzw, g[2].yzw, g[3].yzw) * p.yzw);
+    float discriminant = quadraticB * quadraticB - 4.0 * quadraticA * quadraticC;
+    if (discriminant < 0.0)
+    {
+        return false;
+    }
+    float root1 = (-quadraticB + sqrt(discriminant)) / (2.0 * quadraticA);
+    float root2 = (-quadraticB - sqrt(discriminant)) / (2.0 * quadraticA);
+    p.x = (abs(root1 - p.x) < abs(root2 - p.x)) ? root1 : root2;
+
+    // The orbital plane's unit vectors, e1 towards the camera and e2 the way the ray goes round.
+    float E = -p.x;
+    vec3 angularMomentum = cross(x, p.yzw);
+    float L = length(angularMomentum);
+    if (E <= 0.0 || L < 1e-6 * r0 * E)
+    {
+        return false;
+    }
+    vec3 e1 = x / r0;
+    vec3 e2 = normalize(cross(angularMomentum, e1));
+    if (length(vec2(e1.y, e2.y)) < 1e-6)
+    {
+        return false;
+    }
+    bool outgoing = dot(x, (g * p).yzw) > 0.0;
+
+    float b = L / (E * u_BHMass);
+    float u0 = u_BHMass / r0;
+    float uDraw = u_BHMass / u_drawDistance;
+    bool captured = b < SCHWARZSCHILD_CRITICAL_B;
+    float distance = captured ? 1.0 - b / SCHWARZSCHILD_CRITICAL_B : 1.0 - SCHWARZSCHILD_CRITICAL_B / b;
+    if (distance < SCHWARZSCHILD_LAST_ROW_DISTANCE || (!captured && u0 > 1.0 / 3.0))
+    {
+        return false;
+    }
+    float row = log(distance) / log(SCHWARZSCHILD_LAST_ROW_DISTANCE);
+    float theta = acos(clamp(1.0 - 54.0 / (b * b), -1.0, 1.0));
+    float uEnd = captured ? 0.5 : 1.0 / 6.0 + cos(theta / 3.0 - 2.0 * pi / 3.0) / 3.0;
+    float y = row * float(SCHWARZSCHILD_ROWS - 1);
+    int i = min(int(y), SCHWARZSCHILD_ROWS - 2);
+    vec2 ends = mix(schwarzschildEnds[i], schwarzschildEnds[i + 1], y - float(i));
+    float psiEnd = captured ? ends.y : ends.x;
+
+    // psi at the camera and where the ray ends, and which way the ray moves through psi.
+    vec4 entry = schwarzschildLookup(row, sqrt(max(0.0, 1.0 - u0 / uEnd)));
+    float psi0 = captured ? entry.z : entry.x;
+    entry = schwarzschildLookup(row, sqrt(max(0.0, 1.0 - uDraw / uEnd)));
+    float psiDraw = captured ? entry.z : entry.x;
+    float direction = 1.0;
+    float psiFinal = psiEnd;
+    if (!captured)
+    {
+        psi0 = outgoing ? 2.0 * psiEnd - psi0 : psi0;
+        psiFinal = 2.0 * psiEnd - psiDraw;
+    }
+    else if (outgoing)
+    {
+        direction = -1.0;
+        psiFinal = psiDraw;
+    }
+    float phiFinal = max(0.0, direction * (psiFinal - psi0));
+
+    float phi = mod(atan(e2.y, e1.y) + 0.5 * pi, pi);
+    phi = (phi < 1e-6) ? phi + pi : phi;
+    float previousy = (x.y < 0.0) ? -1.0 : 1.0;
+    for (; phi < phiFinal && numCrossings < SCHWARZSCHILD_MAX_CROSSINGS; phi += pi)
+    {
+        // Past the turning point, the orbit is the mirror image of the way in.
+        float psi = psi0 + direction * phi;
+        psi = (psi > psiEnd) ? 2.0 * psiEnd - psi : psi;
+        entry = schwarzschildLookup(row, (psiEnd > 0.0) ? psi / psiEnd : 0.0);
+        float r = u_BHMass / (uEnd * (captured ? entry.w : entry.y));
+        vec3 crossing = r * (cos(phi) * e1 + sin(phi) * e2);
+        // Only p_t and p_phi matter to diskRedshift().
+        float rho2 = crossing.x * crossing.x + crossing.z * crossing.z;
+        mat2x4 diskIntersectionPoint = mat2x4(vec4(0.0, crossing.x, 0.0, crossing.z),
+            vec4(-E, angularMomentum.y * vec3(crossing.z, 0.0, -crossing.x) / rho2));
+        crossings[numCrossings] = vec4(r, atan(crossing.z, crossing.x), diskRedshift(diskIntersectionPoint, r),
+            previousy);
+        numCrossings++;
+        previousy = -previousy;
+    }
+
+    // Escaping rays leave along sqrt(G) r^ + u phi^ at the draw distance, where the integrated rays stop, and captured
+    // ones cross the horizon at phiFinal.
+    vec3 radial = cos(phiFinal) * e1 + sin(phiFinal) * e2;
+    vec3 tangent = -sin(phiFinal) * e1 + cos(phiFinal) * e2;
+    if (!captured || outgoing)
+    {
+        float G = 1.0 / (b * b) - uDraw * uDraw + 2.0 * uDraw * uDraw * uDraw;
+        escape = vec4(normalize(sqrt(max(0.0, G)) * radial + uDraw * tangent), ESCAPE_INFINITY);
+    }
+    else if (u_useDebugSphereTexture)
+    {
+        escape = vec4(2.0 * u_BHMass * radial, ESCAPE_SPHERE);
+    }
+    return true;
+}
+
+bool schwarzschildRayMarch(const in mat2x4 xp, inout vec3 rayCol, inout bool hitDisk)
+{
+    // rayMarch() from the tables, for the rays they cover.  Returns false for the rest.
+    vec4 crossings[SCHWARZSCHILD_MAX_CROSSINGS];
+    int numCrossings;
+    vec4 escape;
+    if (!schwarzschildRay(xp, crossings, numCrossings, escape))
+    {
+        return false;
+    }
+#ifdef GEODESIC_TRACE
+    for (int i = 0; i < min(numCrossings, MAX_DISK_HITS); i++)
+    {
+        geodesicRecord.diskHits[i] = crossings[i];
+    }
+    geodesicRecord.escape = escape;
+#else
+    // The same shading as the shade pass gives the records above.
+    float T = 1.0;  // Transmittance
+    bool stopped = false;
+    for (int i = 0; i < numCrossings && !stopped; i++)
+    {
+        float diskDist = crossings[i].x;
+        if (diskDist <= u_OuterRadius && diskDist >= u_InnerRadius)
+        {
+            hitDisk = true;
+            vec3 planeIntersectionPoint = diskDist * vec3(cos(crossings[i].y), 0.0, sin(crossings[i].y));
+            rayCol += getDiskColour(planeIntersectionPoint, crossings[i].w, diskDist, crossings[i].z, T);
+        }
+        stopped = T < 0.05;
+    }
+    if (escape.w == ESCAPE_INFINITY && (!stopped || (u_transparentDisk && !u_useDebugDiskTexture)))
+    {
+        vec3 dir = escape.xyz;
+        rayCol += T * texture(skybox, vec3(-dir.x, dir.y, dir.z)).xyz * u_bloomBackgroundMultiplier;
+    }
+    else if (escape.w == ESCAPE_SPHERE && !stopped)
+    {
+        rayCol += T * getSphereColour(escape.xyz);
+    }
+#endif
+    return true;
+}
+#endif
+
+void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk)
+{
+    vec3 dir;
+    float dist;
+    float diskDist;
+    float T = 1.0;  // Transmittance
+    float horizon = u_BHMass + sqrt(u_BHMass * u_BHMass - u_a * u_a); // G = c = 1
+    mat2x4 diskIntersectionPoint;
+    mat2x4 sphereIntersectionPoint;
+    bool hitSphere = false;
+    bool hitInfinity = false;
+#ifdef GEODESIC_TRACE
+    int numDiskHits = 0;
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        geodesicRecord.diskHits[i] = vec4(0.0);
+    }
+    geodesicRecord.escape = vec4(0.0, 0.0, 0.0, ESCAPE_NONE);
+#endif
+
+    mat2x4 xp;
+    mat2x4 previousxp;
+    float stepSize;
+    float oldStepSize;
+    mat2x4 FSAL;
+    float previousError;
+    DenseOutput dense;
+    initRay(cameraPos, rayDir, horizon, xp, stepSize, FSAL, previousError);
+
+#ifdef CAPTURE_CULLING
+    if (captureCulled(xp, horizon))
+    {
+#ifdef GEODESIC_TRACE
+        geodesicRecord.escape = vec4(0.0, 0.0, 0.0, ESCAPE_CULLED);
+#else
+        if (u_showCaptureCulling)
+        {
+            rayCol += u_captureCullingColour;
+        }
+#endif
+        return;
+    }
+#endif
+
+#ifdef SCHWARZSCHILD_TABLES
+    // Nothing to integrate for the rays the tables cover either.
+    if (schwarzschildRayMarch(xp, rayCol, hitDisk))
+    {
+        return;
+    }
+#endif
+
+#ifdef MINKOWSKI
+    // Nothing to integrate, so no steps for SOLVER_STATISTICS either.
+    straightRayMarch(xp, horizon, rayCol, hitDisk);
+    return;
+#endif
+
+    // MAIN RAYMARCH LOOP
+    for (int i = 0; i < u_maxSteps; i++)
+    {
+        previousxp = xp;
+
+        dist = advanceRay(xp, stepSize, oldStepSize, FSAL, previousError, dense, horizon);
 
         // Check if the ray hit the disk
         // Check to see whether the Cartesian y-coordinate changed signs, i.e. if the ray crossed the disk's plane.
@@ -1378,17 +2492,29 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
             if (dist > horizon)
             {
                 // Do a binary search on stepsize to find the point where the geodesic crosses the xz-plane.
-                BSDiskIntersectionPoint(previousxp, xp, diskIntersectionPoint, oldStepSize);
+                findDiskIntersectionPoint(previousxp, xp, dense, diskIntersectionPoint, oldStepSize);
                 diskDist = metricDistance(diskIntersectionPoint[0]);
+#ifdef GEODESIC_TRACE
+                // Record every crossing of the plane, so that the disk's radii can change without re-tracing.  The
+                // transmittance depends on the disk's rotation, so the shade pass decides where the ray stops.
+                geodesicRecord.diskHits[numDiskHits] = diskHitRecord(previousxp, diskIntersectionPoint, diskDist);
+                numDiskHits++;
+                if (numDiskHits == MAX_DISK_HITS)
+                {
+                    break;
+                }
+#else
                 if (diskDist <= u_OuterRadius && diskDist >= u_InnerRadius)
                 {
                     hitDisk = true;
-                    rayCol += getDiskColour(diskIntersectionPoint, sign(previousxp[0][2]), diskDist, T);
+                    rayCol += getDiskColour(diskIntersectionPoint[0].yzw, sign(previousxp[0][2]), diskDist,
+                        diskRedshift(diskIntersectionPoint, diskDist), T);
                 }
                 if (T < 0.05)
                 {
                     break;
                 }
+#endif
             }
         }
 
@@ -1399,23 +2525,38 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
             hitSphere = true;
             if (u_useDebugSphereTexture)
             {
-                BSSphereIntersectionPoint(previousxp, sphereIntersectionPoint, horizon, oldStepSize);
+                findSphereIntersectionPoint(previousxp, xp, dense, sphereIntersectionPoint, horizon, oldStepSize);
+#ifdef GEODESIC_TRACE
+                geodesicRecord.escape = vec4(sphereIntersectionPoint[0].yzw, ESCAPE_SPHERE);
+#else
                 rayCol += T * getSphereColour(sphereIntersectionPoint[0].yzw);
+#endif
             }
             break;
         }
 #endif
 
         // Check if the ray escaped the black hole and hit the skybox.
-        else if (dist > u_drawDistance)
+        else if (hasEscaped(xp, dist))
         {
             hitInfinity = true;
-            dir = pToDir(xp);
+            dir = escapeDirection(xp);
+#ifdef GEODESIC_TRACE
+            geodesicRecord.escape = vec4(dir, ESCAPE_INFINITY);
+#else
             rayCol += T * texture(skybox, vec3(-dir.x, dir.y, dir.z)).xyz * u_bloomBackgroundMultiplier;
+#endif
             break;
         }        
     }
 
+#ifdef GEODESIC_TRACE
+    // The shade pass applies the same test as below once it knows whether the ray hit the disk.
+    if (!hitSphere && !hitInfinity && metricDistance(xp[0]) > horizon)
+    {
+        geodesicRecord.escape = vec4(pToDir(xp), ESCAPE_UNFINISHED);
+    }
+#else
     // If the ray went max steps without hitting anything, just cast the ray to the skybox.
     if (!hitDisk && !hitSphere && !hitInfinity || !hitSphere && !hitInfinity && u_transparentDisk && !u_useDebugDiskTexture)
     {
@@ -1426,6 +2567,11 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
             rayCol += T * texture(skybox, vec3(-dir.x, dir.y, dir.z)).xyz * u_bloomBackgroundMultiplier;
         }
     }
+#endif
+
+#ifdef SOLVER_STATISTICS
+    addSolverStatistics();
+#endif
 }
 
 
@@ -1433,6 +2579,642 @@ void rayMarch(vec3 cameraPos, vec3 rayDir, inout vec3 rayCol, inout bool hitDisk
 /////////////////////   MAIN   //////////////////////
 /////////////////////////////////////////////////////
 
+vec3 cameraRayDirAt(const in vec2 texCoords)
+{
+    // texCoords go from 0 to 1 for both x and y.  uv will go from -1 to 1.
+    vec2 uv = (texCoords - 0.5) * 2.0;
+
+    // https://sibaku.github.io/computer-graphics/2017/01/10/Camera-Ray-Generation.html
+    // The image "screen" we're casting through in view space.
+    // the z=0.0 value here gives us a point in the view frustrum, but we could've chosen
+    // any value <=1.0.  The w=1.0 value makes the point homogeneous without scaling the vector.
+    // Then we undo the projection matrix to get to view space.
+    vec4 screen = u_ProjInv * vec4(uv, 0.0, 1.0);
+    // We're now in view space, where the camera is at the origin by definition.
+    // Convert screen from a point to a direction in projective space.
+    screen.xyz /= screen.w;
+    screen.w = 0.0;
+    // ViewInv * screen takes the direction to world space.  Then normalize for our final unit length ray direction.
+    return normalize((u_ViewInv * screen).xyz);
+}
+
+#ifndef WAVEFRONT_TRACE
+vec3 cameraRayDir(int i, int j)
+{
+    //vec2 uv = ((gl_FragCoord.xy / u_ScreenSize.zw) - 0.5) * 2.0;
+
+    // TexCoords go from 0 to 1 for both x and y.
+    // TexCoordOffset is how to offset the original uv when we're using MSAA.
+    vec2 TexCoordOffset = (vec2(float(i) / float(u_msaa + 1), float(j) / float(u_msaa + 1)) + u_jitter) / u_ScreenSize.zw;
+    return cameraRayDirAt(TexCoords + TexCoordOffset);
+}
+#endif
+
+// Octahedral map of the unit sphere onto [-1, 1]^2, folded along z.
+vec2 octahedralEncode(vec3 dir)
+{
+    vec2 e = dir.xy / (abs(dir.x) + abs(dir.y) + abs(dir.z));
+    if (dir.z < 0.0)
+    {
+        e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return e;
+}
+
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 dir = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (dir.z < 0.0)
+    {
+        dir.xy = (1.0 - abs(dir.yx)) * vec2(dir.x >= 0.0 ? 1.0 : -1.0, dir.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(dir);
+}
+
+float wrapAngle(const in float angle)
+{
+    float pi = 3.14159265359;
+    return angle - 2.0 * pi * round(angle / (2.0 * pi));
+}
+
+#if defined(GEODESIC_REFINE) || defined(GEODESIC_SHADE) && defined(GEODESIC_ENVIRONMENT)
+// The records interpolateRecords() reads: the block prepass's corners when refining, otherwise the octahedral map.
+#ifdef GEODESIC_REFINE
+#define INTERPOLATED_DISK_HITS u_coarseDiskHits
+#define INTERPOLATED_ESCAPE_RECORD u_coarseEscapeRecord
+#else
+#define INTERPOLATED_DISK_HITS u_diskHits
+#define INTERPOLATED_ESCAPE_RECORD u_escapeRecord
+#endif
+
+bool interpolateRecords(const in ivec2 texels[4], const in float weights[4], out vec4 hits[MAX_DISK_HITS],
+    out vec4 escape)
+{
+    // Interpolate the records at four texels, if they agree: the same outcome, the same disk plane crossings on the
+    // same side, and radius, angle, redshift and escape direction within u_refineTolerance of each other.  The
+    // shadow's edge, the photon ring and lensing caustics all break at least one of these.  Like any sampling, this
+    // misses features that fit between the texels.  hits and escape are only meaningful if it returns true.
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        hits[i] = vec4(0.0);
+    }
+
+    vec4 escape0 = texelFetch(INTERPOLATED_ESCAPE_RECORD, texels[0], 0);
+    bool escapeIsDirection = escape0.w == ESCAPE_INFINITY || escape0.w == ESCAPE_UNFINISHED;
+    escape = vec4(0.0, 0.0, 0.0, escape0.w);
+    for (int c = 0; c < 4; c++)
+    {
+        vec4 texelEscape = texelFetch(INTERPOLATED_ESCAPE_RECORD, texels[c], 0);
+        if (texelEscape.w != escape0.w
+            || escapeIsDirection && dot(texelEscape.xyz, escape0.xyz) < cos(u_refineTolerance))
+        {
+            return false;
+        }
+        escape.xyz += weights[c] * texelEscape.xyz;
+    }
+    if (escapeIsDirection)
+    {
+        escape.xyz = normalize(escape.xyz);
+    }
+
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        vec4 hit0 = texelFetch(INTERPOLATED_DISK_HITS[i], texels[0], 0);
+        // The angle is interpolated as an offset from texel 0's, so that it doesn't jump at +-pi.
+        vec4 hit = vec4(0.0, hit0.y, 0.0, hit0.w);
+        for (int c = 0; c < 4; c++)
+        {
+            vec4 texelHit = texelFetch(INTERPOLATED_DISK_HITS[i], texels[c], 0);
+            float dphi = wrapAngle(texelHit.y - hit0.y);
+            if (texelHit.w != hit0.w || abs(texelHit.x - hit0.x) > u_refineTolerance * hit0.x
+                || abs(dphi) > u_refineTolerance || abs(texelHit.z - hit0.z) > u_refineTolerance * hit0.z)
+            {
+                return false;
+            }
+            hit.xyz += weights[c] * vec3(texelHit.x, dphi, texelHit.z);
+        }
+        if (hit0.w == 0.0)
+        {
+            // All four texels have run out of crossings.
+            break;
+        }
+        hits[i] = hit;
+    }
+    return true;
+}
+#endif
+
+#ifdef GEODESIC_REFINE
+bool interpolateBlock()
+{
+    // Fill in geodesicRecord from the geodesics traced at the corners of this pixel's block, if they agree.  It is
+    // left as it was otherwise, for rayMarch() to fill in.
+    ivec2 block = ivec2(gl_FragCoord.xy) / GEODESIC_BLOCK_SIZE;
+    // The corners and this pixel's own ray are both offset by u_jitter, so it cancels here.
+    vec2 f = (gl_FragCoord.xy - vec2(block * GEODESIC_BLOCK_SIZE)) / float(GEODESIC_BLOCK_SIZE);
+    float weights[4] = float[4]((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+    ivec2 corners[4] = ivec2[4](block, block + ivec2(1, 0), block + ivec2(0, 1), block + ivec2(1, 1));
+
+    vec4 hits[MAX_DISK_HITS];
+    vec4 escape;
+    if (!interpolateRecords(corners, weights, hits, escape))
+    {
+        return false;
+    }
+    geodesicRecord.diskHits = hits;
+    geodesicRecord.escape = escape;
+    return true;
+}
+#endif
+
+#ifdef ADAPTIVE_SUPERSAMPLE
+bool recordsDisagree(const in ivec2 texel, const in ivec2 neighbour)
+{
+    // Whether a pixel and its neighbour see something different enough that the pixel needs more rays: a different
+    // outcome, or a crossing that lands on the disk in one and not the other, which are the shadow's edge, the photon
+    // rings and the disk's edges, or a crossing whose radius, angle or redshift changes by more than
+    // u_adaptiveTolerance across the pixel, which is where the disk's texture and noise alias.
+    vec4 escape = texelFetch(u_escapeRecord, texel, 0);
+    vec4 neighbourEscape = texelFetch(u_escapeRecord, neighbour, 0);
+    if (escape.w != neighbourEscape.w
+        || escape.w == ESCAPE_INFINITY && dot(escape.xyz, neighbourEscape.xyz) < cos(u_adaptiveTolerance))
+    {
+        return true;
+    }
+
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        vec4 hit = texelFetch(u_diskHits[i], texel, 0);
+        vec4 neighbourHit = texelFetch(u_diskHits[i], neighbour, 0);
+        if (hit.w != neighbourHit.w)
+        {
+            return true;
+        }
+        if (hit.w == 0.0)
+        {
+            break;
+        }
+        bool onDisk = hit.x <= u_OuterRadius && hit.x >= u_InnerRadius;
+        bool neighbourOnDisk = neighbourHit.x <= u_OuterRadius && neighbourHit.x >= u_InnerRadius;
+        if (onDisk != neighbourOnDisk)
+        {
+            return true;
+        }
+        if (onDisk && (abs(neighbourHit.x - hit.x) > u_adaptiveTolerance * hit.x
+            || abs(wrapAngle(neighbourHit.y - hit.y)) > u_adaptiveTolerance
+            || abs(neighbourHit.z - hit.z) > u_adaptiveTolerance * hit.z))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool needsSupersampling(const in ivec2 texel)
+{
+    ivec2 size = textureSize(u_escapeRecord, 0);
+    ivec2 offsets[4] = ivec2[4](ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1));
+    for (int k = 0; k < 4; k++)
+    {
+        ivec2 neighbour = texel + offsets[k];
+        if (all(greaterThanEqual(neighbour, ivec2(0))) && all(lessThan(neighbour, size))
+            && recordsDisagree(texel, neighbour))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+vec3 supersamplePixel(const in vec3 centreCol)
+{
+    // centreCol is the pixel's own ray, from the G-buffer.  Every marked pixel gets the same share of the budget, up
+    // to u_adaptiveSamples^2 rays.  They are spread over the pixel with the R2 sequence, which covers it evenly for any
+    // number of rays, and are traced like the single pass's, without the records, so they cost a full ray each every
+    // frame.
+    int numRays = min(u_adaptiveSamples * u_adaptiveSamples, u_adaptiveRayBudget / int(max(markedPixels, 1u)));
+    if (numRays == 0)
+    {
+        return centreCol;
+    }
+    atomicAdd(adaptiveRays, uint(numRays));
+    vec3 pixelCol = centreCol;
+    for (int k = 0; k < numRays; k++)
+    {
+        bool rayHitDisk = false;
+        vec3 rayCol = vec3(0.0);
+        vec2 offset = fract(0.5 + float(k + 1) * vec2(0.7548776662, 0.5698402910)) - 0.5;
+        rayMarch(u_cameraPos, cameraRayDirAt(TexCoords + offset / u_ScreenSize.zw), rayCol, rayHitDisk);
+        pixelCol += rayCol;
+    }
+    return pixelCol / float(numRays + 1);
+}
+#endif
+
+#if defined(WAVEFRONT_TRACE)
+// The wavefront tracer does the trace pass's work in compute dispatches over queues of rays instead of one fragment
+// per pixel.  WAVEFRONT_GENERATE starts every pixel's ray in the input queue.  WAVEFRONT_STEP advances the live rays
+// by up to u_stepsPerDispatch steps each, writes the records of the ones that finish, and compacts the rest into the
+// output queue, so that no later dispatch spends threads on finished rays.  WAVEFRONT_DISPATCH turns the output
+// queue's length into the next step dispatch's size.  BlackHole swaps the queues between dispatches.
+struct WavefrontRay
+{
+    mat2x4 xp;
+    mat2x4 FSAL;
+    vec4 diskHits[MAX_DISK_HITS];
+    // (stepSize, oldStepSize, previousError, unused)
+    vec4 stepSizes;
+    // (pixel index, steps taken, number of disk hits, 1 if WAVEFRONT_GENERATE already finished it)
+    ivec4 counters;
+};
+
+layout(std430, binding = 0) buffer WavefrontInputQueue
+{
+    WavefrontRay inputRays[];
+};
+
+layout(std430, binding = 1) buffer WavefrontOutputQueue
+{
+    WavefrontRay outputRays[];
+};
+
+layout(std430, binding = 2) buffer WavefrontCounters
+{
+    // The next step dispatch's size, for glDispatchComputeIndirect, then the number of rays in each queue.
+    uint numGroupsX;
+    uint numGroupsY;
+    uint numGroupsZ;
+    uint rayCount[2];
+};
+
+// Which of rayCount is the input queue's.
+uniform int u_parity;
+uniform int u_stepsPerDispatch;
+
+#ifdef WAVEFRONT_DISPATCH
+layout(local_size_x = 1) in;
+#else
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+#endif
+
+void finishWavefrontRay(const in WavefrontRay ray, const in vec4 escape)
+{
+    int width = int(u_ScreenSize.z);
+    ivec2 pixel = ivec2(ray.counters.x % width, ray.counters.x / width);
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        imageStore(u_diskHitImages[i], pixel, ray.diskHits[i]);
+    }
+    imageStore(u_escapeImage, pixel, escape);
+}
+
+bool stepWavefrontRay(inout WavefrontRay ray)
+{
+    // The loop body of rayMarch() with GEODESIC_TRACE, resumed where the last dispatch left off.  Returns whether
+    // the ray is still going.
+    if (ray.counters.w != 0)
+    {
+        return false;
+    }
+    float horizon = u_BHMass + sqrt(u_BHMass * u_BHMass - u_a * u_a); // G = c = 1
+    mat2x4 xp = ray.xp;
+    mat2x4 previousxp;
+    mat2x4 FSAL = ray.FSAL;
+    float stepSize = ray.stepSizes.x;
+    float oldStepSize = ray.stepSizes.y;
+    float previousError = ray.stepSizes.z;
+    int steps = ray.counters.y;
+    int numDiskHits = ray.counters.z;
+    mat2x4 diskIntersectionPoint;
+    mat2x4 sphereIntersectionPoint;
+    DenseOutput dense;
+    float dist;
+
+    for (int k = 0; k < u_stepsPerDispatch; k++)
+    {
+        previousxp = xp;
+        dist = advanceRay(xp, stepSize, oldStepSize, FSAL, previousError, dense, horizon);
+        steps++;
+
+        if (xp[0][2] * previousxp[0][2] < 0.0)
+        {
+            if (dist > horizon)
+            {
+                findDiskIntersectionPoint(previousxp, xp, dense, diskIntersectionPoint, oldStepSize);
+                float diskDist = metricDistance(diskIntersectionPoint[0]);
+                ray.diskHits[numDiskHits] = diskHitRecord(previousxp, diskIntersectionPoint, diskDist);
+                numDiskHits++;
+                if (numDiskHits == MAX_DISK_HITS)
+                {
+                    break;
+                }
+            }
+        }
+
+#ifndef INSIDE_HORIZON
+        if (dist < horizon)
+        {
+            vec4 escape = vec4(0.0, 0.0, 0.0, ESCAPE_NONE);
+            if (u_useDebugSphereTexture)
+            {
+                findSphereIntersectionPoint(previousxp, xp, dense, sphereIntersectionPoint, horizon, oldStepSize);
+                escape = vec4(sphereIntersectionPoint[0].yzw, ESCAPE_SPHERE);
+            }
+            finishWavefrontRay(ray, escape);
+            return false;
+        }
+#endif
+
+        else if (hasEscaped(xp, dist))
+        {
+            finishWavefrontRay(ray, vec4(escapeDirection(xp), ESCAPE_INFINITY));
+            return false;
+        }
+
+        if (steps >= u_maxSteps)
+        {
+            break;
+        }
+    }
+
+    if (numDiskHits == MAX_DISK_HITS || steps >= u_maxSteps)
+    {
+        // Out of records or steps, as at the end of rayMarch().
+        vec4 escape = vec4(0.0, 0.0, 0.0, ESCAPE_NONE);
+        if (metricDistance(xp[0]) > horizon)
+        {
+            escape = vec4(pToDir(xp), ESCAPE_UNFINISHED);
+        }
+        finishWavefrontRay(ray, escape);
+        return false;
+    }
+
+    ray.xp = xp;
+    ray.FSAL = FSAL;
+    ray.stepSizes.xyz = vec3(stepSize, oldStepSize, previousError);
+    ray.counters.yz = ivec2(steps, numDiskHits);
+    return true;
+}
+
+#if defined(WAVEFRONT_GENERATE)
+void main()
+{
+    int width = int(u_ScreenSize.z);
+    int height = int(u_ScreenSize.w);
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= width * height)
+    {
+        return;
+    }
+    vec2 pixel = vec2(index % width, index / width);
+    vec3 rayDir = cameraRayDirAt((pixel + 0.5 + u_jitter) / u_ScreenSize.zw);
+    float horizon = u_BHMass + sqrt(u_BHMass * u_BHMass - u_a * u_a); // G = c = 1
+
+    WavefrontRay ray;
+    initRay(u_cameraPos, rayDir, horizon, ray.xp, ray.stepSizes.x, ray.FSAL, ray.stepSizes.z);
+    ray.stepSizes.yw = vec2(ray.stepSizes.x, 0.0);
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        ray.diskHits[i] = vec4(0.0);
+    }
+    ray.counters = ivec4(index, 0, 0, 0);
+#ifdef CAPTURE_CULLING
+    // The queue's length is set before this dispatch, so a culled ray still takes its slot in the first step
+    // dispatch, which drops it.
+    if (captureCulled(ray.xp, horizon))
+    {
+        finishWavefrontRay(ray, vec4(0.0, 0.0, 0.0, ESCAPE_CULLED));
+        ray.counters.w = 1;
+    }
+#endif
+#ifdef SCHWARZSCHILD_TABLES
+    // As are the rays the Schwarzschild tables cover.
+    vec4 crossings[SCHWARZSCHILD_MAX_CROSSINGS];
+    int numCrossings;
+    vec4 tableEscape;
+    if (ray.counters.w == 0 && schwarzschildRay(ray.xp, crossings, numCrossings, tableEscape))
+    {
+        for (int i = 0; i < min(numCrossings, MAX_DISK_HITS); i++)
+        {
+            ray.diskHits[i] = crossings[i];
+        }
+        finishWavefrontRay(ray, tableEscape);
+        ray.counters.w = 1;
+    }
+#endif
+#ifdef MINKOWSKI
+    // Straight rays are finished here as well, in closed form.
+    mat2x4 diskIntersectionPoint;
+    vec4 escape;
+    if (straightRay(ray.xp, horizon, diskIntersectionPoint, escape))
+    {
+        ray.diskHits[0] = diskHitRecord(ray.xp, diskIntersectionPoint, metricDistance(diskIntersectionPoint[0]));
+    }
+    finishWavefrontRay(ray, escape);
+    ray.counters.w = 1;
+#endif
+    inputRays[index] = ray;
+}
+#elif defined(WAVEFRONT_STEP)
+// Exclusive prefix sum of which of this workgroup's rays are still going, i.e. where each goes in the group's
+// block of the output queue.
+shared uint liveRays[WAVEFRONT_GROUP_SIZE];
+shared uint groupOffset;
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    uint localIndex = gl_LocalInvocationID.x;
+    WavefrontRay ray;
+    bool live = index < rayCount[u_parity];
+    if (live)
+    {
+        ray = inputRays[index];
+        live = stepWavefrontRay(ray);
+#ifdef SOLVER_STATISTICS
+        addSolverStatistics();
+#endif
+    }
+
+    // Hillis-Steele scan in shared memory.  Every invocation has to reach the barriers, so nothing above returns.
+    liveRays[localIndex] = live ? 1u : 0u;
+    barrier();
+    for (uint offset = 1u; offset < WAVEFRONT_GROUP_SIZE; offset *= 2u)
+    {
+        uint previous = (localIndex >= offset) ? liveRays[localIndex - offset] : 0u;
+        barrier();
+        liveRays[localIndex] += previous;
+        barrier();
+    }
+
+    // One atomic per workgroup reserves its block of the output queue.
+    if (localIndex == WAVEFRONT_GROUP_SIZE - 1)
+    {
+        groupOffset = atomicAdd(rayCount[1 - u_parity], liveRays[localIndex]);
+    }
+    barrier();
+
+    if (live)
+    {
+        outputRays[groupOffset + liveRays[localIndex] - 1] = ray;
+    }
+}
+#elif defined(WAVEFRONT_DISPATCH)
+void main()
+{
+    // The output queue becomes the next step dispatch's input, and the input queue its output.
+    numGroupsX = (rayCount[1 - u_parity] + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+    numGroupsY = 1;
+    numGroupsZ = 1;
+    rayCount[u_parity] = 0;
+}
+#endif
+#elif defined(GEODESIC_TRACE)
+void main()
+{
+    // One ray per pixel.  BlackHole only uses the G-buffer with MSAA = 1.
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        geodesicRecord.diskHits[i] = vec4(0.0);
+    }
+#if defined(GEODESIC_ENVIRONMENT)
+    // The geodesics leaving the camera in every direction, laid out on an octahedral map.  Rotating the camera
+    // only changes which of them each pixel sees.
+    vec3 rayDir = octahedralDecode(TexCoords * 2.0 - 1.0);
+#elif defined(GEODESIC_PREPASS)
+    // One ray per block corner.  u_ScreenSize is the full resolution, and this pass's pixels are the corners.
+    vec2 cornerTexCoords = (floor(gl_FragCoord.xy) * float(GEODESIC_BLOCK_SIZE) + u_jitter) / u_ScreenSize.zw;
+    vec3 rayDir = cameraRayDirAt(cornerTexCoords);
+#else
+    vec3 rayDir = cameraRayDir(0, 0);
+#endif
+
+#ifdef GEODESIC_REFINE
+    if (!interpolateBlock())
+#endif
+    {
+        vec3 rayCol = vec3(0.0);
+        bool rayHitDisk = false;
+        rayMarch(u_cameraPos, rayDir, rayCol, rayHitDisk);
+    }
+
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        diskHits[i] = geodesicRecord.diskHits[i];
+    }
+    escapeRecord = geodesicRecord.escape;
+}
+#else
+void writeColour(vec3 pixelCol)
+{
+    fragColour = vec4(pixelCol, 1.0);
+
+    float brightness = dot(fragColour.rgb, vec3(0.2126, 0.7152, 0.0722));
+    if (brightness > u_bloomThreshold)
+        brightColour = vec4(fragColour.rgb, 1.0);
+    else
+        brightColour = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+#if defined(ADAPTIVE_COUNT)
+void main()
+{
+    // Nothing is drawn; the shade pass overwrites every pixel.
+    if (needsSupersampling(ivec2(gl_FragCoord.xy)))
+    {
+        atomicAdd(markedPixels, 1u);
+    }
+    discard;
+}
+#elif defined(GEODESIC_SHADE)
+void main()
+{
+    // The shading half of rayMarch(), replayed from the trace pass's records.
+    // Turns the records about the spin axis from where they were traced to the camera.
+    float azimuth = 0.0;
+    mat3 turn = mat3(1.0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 hits[MAX_DISK_HITS];
+    vec4 escape;
+#ifdef GEODESIC_ENVIRONMENT
+    // The map's texels are several pixels across with a narrow FOV, so interpolate between the four around this
+    // pixel's direction where they agree.  Elsewhere, including across the map's folds, take the nearest one.
+    azimuth = u_environmentAzimuth;
+    turn = mat3(cos(azimuth), 0.0, -sin(azimuth), 0.0, 1.0, 0.0, sin(azimuth), 0.0, cos(azimuth));
+    ivec2 mapSize = textureSize(u_escapeRecord, 0);
+    vec2 mapUV = octahedralEncode(transpose(turn) * cameraRayDir(0, 0)) * 0.5 + 0.5;
+    texel = clamp(ivec2(mapUV * vec2(mapSize)), ivec2(0), mapSize - 1);
+    vec2 mapPos = clamp(mapUV * vec2(mapSize) - 0.5, vec2(0.0), vec2(mapSize - 1));
+    ivec2 base = min(ivec2(mapPos), mapSize - 2);
+    vec2 f = mapPos - vec2(base);
+    float weights[4] = float[4]((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+    ivec2 texels[4] = ivec2[4](base, base + ivec2(1, 0), base + ivec2(0, 1), base + ivec2(1, 1));
+    if (!interpolateRecords(texels, weights, hits, escape))
+#endif
+    {
+        for (int i = 0; i < MAX_DISK_HITS; i++)
+        {
+            hits[i] = texelFetch(u_diskHits[i], texel, 0);
+        }
+        escape = texelFetch(u_escapeRecord, texel, 0);
+    }
+    vec3 pixelCol = vec3(0.0);
+    float T = 1.0;  // Transmittance
+    bool hitDisk = false;
+    bool stopped = false;
+
+    for (int i = 0; i < MAX_DISK_HITS; i++)
+    {
+        vec4 hit = hits[i];
+        if (hit.w == 0.0)
+        {
+            break;
+        }
+        float diskDist = hit.x;
+        if (diskDist <= u_OuterRadius && diskDist >= u_InnerRadius)
+        {
+            hitDisk = true;
+            // In Kerr-Schild coordinates, the plane y = 0 at radius r is the circle x^2 + z^2 = r^2 + a^2.
+            float phi = hit.y - azimuth;
+            vec3 planeIntersectionPoint = sqrt(diskDist * diskDist + u_a * u_a) * vec3(cos(phi), 0.0, sin(phi));
+            pixelCol += getDiskColour(planeIntersectionPoint, hit.w, diskDist, hit.z, T);
+        }
+        if (T < 0.05)
+        {
+            stopped = true;
+            break;
+        }
+    }
+
+    // A ray that stops on the disk only sees the skybox through a transparent disk.  It's sampled in the direction
+    // the ray finally left in rather than where it stopped, which only matters at T < 0.05.
+    escape.xyz = turn * escape.xyz;
+    bool seeThroughDisk = u_transparentDisk && !u_useDebugDiskTexture;
+    bool drawSkybox = (escape.w == ESCAPE_INFINITY && (!stopped || seeThroughDisk))
+        || (escape.w == ESCAPE_UNFINISHED && (!hitDisk || seeThroughDisk));
+    if (drawSkybox)
+    {
+        vec3 dir = escape.xyz;
+        pixelCol += T * texture(skybox, vec3(-dir.x, dir.y, dir.z)).xyz * u_bloomBackgroundMultiplier;
+    }
+    else if (escape.w == ESCAPE_SPHERE && !stopped)
+    {
+        pixelCol += T * getSphereColour(escape.xyz);
+    }
+    else if (escape.w == ESCAPE_CULLED && u_showCaptureCulling)
+    {
+        pixelCol += u_captureCullingColour;
+    }
+
+#ifdef ADAPTIVE_SUPERSAMPLE
+    if (needsSupersampling(texel))
+    {
+        pixelCol = supersamplePixel(pixelCol);
+    }
+#endif
+    writeColour(pixelCol);
+}
+#else
 void main()
 {
     vec3 pixelCol = vec3(0.0);
@@ -1444,25 +3226,7 @@ void main()
         {
             bool rayHitDisk = false;
             vec3 rayCol = vec3(0.0);
-            //vec2 uv = ((gl_FragCoord.xy / u_ScreenSize.zw) - 0.5) * 2.0;
-
-            // TexCoords go from 0 to 1 for both x and y.  uv will go from -1 to 1.
-            // TexCoordOffset is how to offset the original uv when we're using MSAA.
-            vec2 TexCoordOffset = vec2(float(i) / float(u_msaa + 1), float(j) / float(u_msaa + 1)) / u_ScreenSize.zw;
-            vec2 uv = (TexCoords + TexCoordOffset - 0.5) * 2.0;
-
-            // https://sibaku.github.io/computer-graphics/2017/01/10/Camera-Ray-Generation.html
-            // The image "screen" we're casting through in view space.
-            // the z=0.0 value here gives us a point in the view frustrum, but we could've chosen
-            // any value <=1.0.  The w=1.0 value makes the point homogeneous without scaling the vector.
-            // Then we undo the projection matrix to get to view space.
-            vec4 screen = u_ProjInv * vec4(uv, 0.0, 1.0);
-            // We're now in view space, where the camera is at the origin by definition.
-            // Convert screen from a point to a direction in projective space.
-            screen.xyz /= screen.w;
-            screen.w = 0.0;
-            // ViewInv * screen takes the direction to world space.  Then normalize for our final unit length ray direction.
-            vec3 rayDir = normalize((u_ViewInv * screen).xyz);
+            vec3 rayDir = cameraRayDir(i, j);
 
             // For simplicity, the BH and disk are centered at (0,0,0).  The disk is in the xz-plane at y=0.
             rayMarch(u_cameraPos, rayDir, rayCol, rayHitDisk);
@@ -1477,11 +3241,7 @@ void main()
 
     pixelCol /= float(u_msaa*u_msaa);
 
-    fragColour = vec4(pixelCol, 1.0);
-
-    float brightness = dot(fragColour.rgb, vec3(0.2126, 0.7152, 0.0722));
-    if (brightness > u_bloomThreshold)
-        brightColour = vec4(fragColour.rgb, 1.0);
-    else
-        brightColour = vec4(0.0, 0.0, 0.0, 1.0);
-}
\ No newline at end of file
+    writeColour(pixelCol);
+}
+#endif
+#endif
@@ -0,0 +1,135 @@
+#shader vertex
+#version 460 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 tcs;
+
+out vec2 TexCoords;
+
+void main()
+{
+    TexCoords = tcs;
+    gl_Position = vec4(position, 1.0);
+}
+
+
+#shader fragment
+#version 460 core
+layout(location = 0) out vec4 fragColour;
+layout(location = 1) out vec4 brightColour;
+
+in vec2 TexCoords;
+
+uniform sampler2D sceneTexture;
+uniform sampler2D brightTexture;
+uniform sampler2D historyTexture;
+uniform sampler2D historyBrightTexture;
+// The first disk plane crossing and the escape record from the geodesic G-buffer, for this frame and the last.
+uniform sampler2D u_diskHit;
+uniform sampler2D u_escapeRecord;
+uniform sampler2D u_previousDiskHit;
+uniform sampler2D u_previousEscapeRecord;
+
+uniform mat4 u_ViewInv;
+uniform mat4 u_ProjInv;
+uniform mat4 u_previousViewProj;
+uniform float u_historyWeight;
+uniform float u_radiusTolerance;
+uniform float u_redshiftTolerance;
+uniform float u_escapeTolerance;
+
+// Must match KerrBlackHole.shader.
+#define ESCAPE_INFINITY 1.0
+
+
+vec3 pixelRayDir()
+{
+    // The unjittered ray through this pixel's centre, as in cameraRayDir() in KerrBlackHole.shader.
+    vec4 screen = u_ProjInv * vec4((TexCoords - 0.5) * 2.0, 0.0, 1.0);
+    screen.xyz /= screen.w;
+    screen.w = 0.0;
+    return normalize((u_ViewInv * screen).xyz);
+}
+
+bool historyMatches(const in ivec2 texel, const in ivec2 previousTexel)
+{
+    // The history is only valid if the pixel it came from saw the same thing: the geodesic ended up in the same
+    // place, and crossed the disk's plane at about the same radius and redshift.  Anything else is a disocclusion,
+    // e.g. the disk sliding over the photon ring, or a change in brightness the history can't follow.
+    vec4 escape = texelFetch(u_escapeRecord, texel, 0);
+    vec4 previousEscape = texelFetch(u_previousEscapeRecord, previousTexel, 0);
+    if (escape.w != previousEscape.w)
+    {
+        return false;
+    }
+    if (escape.w == ESCAPE_INFINITY && dot(escape.xyz, previousEscape.xyz) < cos(u_escapeTolerance))
+    {
+        return false;
+    }
+
+    vec4 hit = texelFetch(u_diskHit, texel, 0);
+    vec4 previousHit = texelFetch(u_previousDiskHit, previousTexel, 0);
+    if (hit.w != previousHit.w)
+    {
+        return false;
+    }
+    if (hit.w != 0.0)
+    {
+        if (abs(hit.x - previousHit.x) > u_radiusTolerance * hit.x || abs(hit.z - previousHit.z) > u_redshiftTolerance * hit.z)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(sceneTexture, 0);
+    vec3 current = texelFetch(sceneTexture, texel, 0).rgb;
+    vec3 currentBright = texelFetch(brightTexture, texel, 0).rgb;
+
+    // Clamping the history to this frame's 3x3 neighbourhood stops it from ghosting where the rejection test lets
+    // something through, e.g. the disk's noise rotating underneath an unchanged geodesic.
+    vec3 neighbourhoodMin = current;
+    vec3 neighbourhoodMax = current;
+    vec3 brightMin = currentBright;
+    vec3 brightMax = currentBright;
+    for (int i = -1; i <= 1; i++)
+    {
+        for (int j = -1; j <= 1; j++)
+        {
+            ivec2 neighbour = clamp(texel + ivec2(i, j), ivec2(0), size - 1);
+            vec3 colour = texelFetch(sceneTexture, neighbour, 0).rgb;
+            vec3 bright = texelFetch(brightTexture, neighbour, 0).rgb;
+            neighbourhoodMin = min(neighbourhoodMin, colour);
+            neighbourhoodMax = max(neighbourhoodMax, colour);
+            brightMin = min(brightMin, bright);
+            brightMax = max(brightMax, bright);
+        }
+    }
+
+    // Reproject through the geodesic's starting direction.  This is exact when the camera only rotates, because the
+    // same direction from the same position is the same geodesic.  When it moves, historyMatches() catches the
+    // pixels where that's no longer true.
+    float weight = 0.0;
+    vec2 previousUV = vec2(-1.0);
+    vec4 previousClip = u_previousViewProj * vec4(pixelRayDir(), 0.0);
+    if (previousClip.w > 0.0)
+    {
+        previousUV = previousClip.xy / previousClip.w * 0.5 + 0.5;
+    }
+    if (all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThan(previousUV, vec2(1.0))))
+    {
+        ivec2 previousTexel = ivec2(previousUV * vec2(size));
+        if (historyMatches(texel, previousTexel))
+        {
+            weight = u_historyWeight;
+        }
+    }
+
+    vec3 history = clamp(texture(historyTexture, previousUV).rgb, neighbourhoodMin, neighbourhoodMax);
+    vec3 historyBright = clamp(texture(historyBrightTexture, previousUV).rgb, brightMin, brightMax);
+    fragColour = vec4(mix(current, history, weight), 1.0);
+    brightColour = vec4(mix(currentBright, historyBright, weight), 1.0);
+}
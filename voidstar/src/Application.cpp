@@ -119,7 +119,14 @@ void Application::ImGuiPrintRenderStats()
 {
 	ImGui::Text("Render statistics:");
 	float frameTime = m_FrameTimer.GetAverageDeltaTime();
-	ImGui::Text("FPS: %.1f", 1 / frameTime);
+	if (m_renderWidth > 0 && m_renderHeight > 0)
+	{
+		ImGui::Text("FPS: %.1f at %d x %d", 1 / frameTime, m_renderWidth, m_renderHeight);
+	}
+	else
+	{
+		ImGui::Text("FPS: %.1f", 1 / frameTime);
+	}
 	ImGui::Text("Frame Time: %.4fs", frameTime);
 	float sceneDrawTime = m_CPUTimer.GetAverageDeltaTime();
 	ImGui::Text("CPU Time/frame: %.6fs", sceneDrawTime);
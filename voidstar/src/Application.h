@@ -29,6 +29,8 @@ public:
 	void OnClick(int x, int y);
 	void SetScreenshotTaken(const std::string& fileName);
 	void ImGuiPrintRenderStats();
+	// The scene's internal resolution, if it differs from the window's.
+	void SetRenderResolution(int width, int height) { m_renderWidth = width; m_renderHeight = height; }
 
 	Window& GetWindow() { return m_Window; }
 	Menu& GetMenu() { return m_Menu; }
@@ -65,6 +67,8 @@ private:
 	Timer m_FrameTimer;
 	Timer m_CPUTimer;
 	Timer m_GPUTimer;
+	int m_renderWidth = 0;
+	int m_renderHeight = 0;
 
 	ScreenshotOverlay m_screenshotOverlay;
 
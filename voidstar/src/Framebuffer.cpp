@@ -52,14 +52,18 @@ void Framebuffer::Initialize()
 			  << " x " << m_Specification.height << std::endl;
 #endif
 
+	bool dataAttachments = m_Specification.format == FramebufferFormat::RGBA32F;
+	GLint internalFormat = dataAttachments ? GL_RGBA32F : GL_RGBA16F;
+	GLint filter = dataAttachments ? GL_NEAREST : GL_LINEAR;
+
 	GLCall(glGenTextures(m_Specification.numColouredAttachments, m_ColourAttachments.data()));
 	std::vector<unsigned int> attachments;
 	for (unsigned int i = 0; i < m_Specification.numColouredAttachments; i++)
 	{
 		GLCall(glBindTexture(GL_TEXTURE_2D, m_ColourAttachments[i]));
-		GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_Specification.width, m_Specification.height, 0, GL_RGBA, GL_FLOAT, NULL));
-		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GLCall(glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, m_Specification.width, m_Specification.height, 0, GL_RGBA, GL_FLOAT, NULL));
+		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter));
+		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter));
 		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
 		GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, m_ColourAttachments[i], 0);
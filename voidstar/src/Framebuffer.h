@@ -3,12 +3,20 @@
 #include <vector>
 
 
+enum class FramebufferFormat
+{
+	RGBA16F, RGBA32F
+};
+
+
 struct FramebufferSpecification
 {
 	// Need to create additional stuct members for different kinds of attachments and their properties...
 	unsigned int width = 0, height = 0;
 	unsigned int samples = 1;
 	unsigned int numColouredAttachments = 1;
+	// RGBA32F attachments hold data rather than colours, so they are sampled with GL_NEAREST.
+	FramebufferFormat format = FramebufferFormat::RGBA16F;
 };
 
 
@@ -29,6 +37,7 @@ class Framebuffer
 		void Resize(unsigned int width, unsigned int height);
 
 		std::vector<unsigned int>& GetColourAttachments();
+		const FramebufferSpecification& GetSpecification() const { return m_Specification; }
 
 	private:
 		unsigned int m_RendererID = 0;
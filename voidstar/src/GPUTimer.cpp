@@ -0,0 +1,57 @@
+#include "GPUTimer.h"
+
+#include "Renderer.h"
+
+GPUTimer::GPUTimer()
+{
+    GLCall(glGenQueries(NumQueries, m_queries));
+}
+
+GPUTimer::~GPUTimer()
+{
+    GLCall(glDeleteQueries(NumQueries, m_queries));
+}
+
+void GPUTimer::Start()
+{
+    // Only happens if the GPU is NumQueries frames behind.
+    if (m_pending[m_current])
+    {
+        ReadQuery(m_current, true);
+    }
+    GLCall(glBeginQuery(GL_TIME_ELAPSED, m_queries[m_current]));
+}
+
+void GPUTimer::Stop()
+{
+    GLCall(glEndQuery(GL_TIME_ELAPSED));
+    m_pending[m_current] = true;
+    m_current = (m_current + 1) % NumQueries;
+
+    // Read whatever has finished, oldest first.
+    for (int i = 0; i < NumQueries; i++)
+    {
+        int index = (m_current + i) % NumQueries;
+        if (m_pending[index])
+        {
+            ReadQuery(index, false);
+        }
+    }
+}
+
+void GPUTimer::ReadQuery(int index, bool wait)
+{
+    if (!wait)
+    {
+        GLint available = 0;
+        GLCall(glGetQueryObjectiv(m_queries[index], GL_QUERY_RESULT_AVAILABLE, &available));
+        if (!available)
+        {
+            return;
+        }
+    }
+    GLuint64 elapsed = 0;
+    GLCall(glGetQueryObjectui64v(m_queries[index], GL_QUERY_RESULT, &elapsed));
+    m_elapsedTime = (float)(elapsed * 1e-9);
+    m_pending[index] = false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+class GPUTimer
+{
+	// Measures the GPU time between Start() and Stop() with GL_TIME_ELAPSED queries.  Timer measures CPU wall time,
+	// which only includes the GPU's work when something waits for it.  The queries are read a few frames late so
+	// that reading them never stalls the pipeline.
+public:
+	GPUTimer();
+	~GPUTimer();
+
+	void Start();
+	void Stop();
+	// Latest available measurement in seconds, or a negative value before the first one arrives.
+	float GetElapsedTime() const { return m_elapsedTime; }
+
+private:
+	void ReadQuery(int index, bool wait);
+
+	static constexpr int NumQueries = 4;
+	unsigned int m_queries[NumQueries] = {};
+	bool m_pending[NumQueries] = {};
+	int m_current = 0;
+	float m_elapsedTime = -1.0f;
+};
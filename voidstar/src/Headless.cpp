@@ -0,0 +1,551 @@
+#include "Headless.h"
+
+#include "ThreadPool.h"
+#include "scenes/blackhole/cpu/GeodesicIntegrator.h"
+#include "scenes/blackhole/cpu/CPUShading.h"
+#include "scenes/blackhole/cpu/CPURenderer.h"
+#include "scenes/blackhole/cpu/TransferAtlas.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <iostream>
+#include <format>
+#include <cmath>
+#include <vector>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+
+static bool ParseVec3(const std::string& s, glm::vec3& v)
+{
+    // Expects "x,y,z".
+    float x, y, z;
+    char comma1, comma2;
+    std::istringstream stream(s);
+    if (stream >> x >> comma1 >> y >> comma2 >> z && comma1 == ',' && comma2 == ',')
+    {
+        v = glm::vec3(x, y, z);
+        return true;
+    }
+    return false;
+}
+
+static void PrintWorkerStats(const std::vector<WorkerStats>& stats)
+{
+    double totalBusy = 0.0;
+    double maxBusy = 0.0;
+    std::cout << "Thread  Node   CPU  Tiles  Stolen  Busy (s)  Idle (s)\n";
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        const WorkerStats& s = stats[i];
+        std::string processor = s.processor >= 0 ? std::to_string(s.processor) : "-";
+        std::cout << std::format("{:>6}  {:>4}  {:>4}  {:>5}  {:>6}  {:>8.3f}  {:>8.3f}\n", i, s.numaNode, processor, s.jobs,
+            s.stolen, s.busySeconds, s.idleSeconds);
+        totalBusy += s.busySeconds;
+        maxBusy = std::max(maxBusy, s.busySeconds);
+    }
+    // 100% means every thread was busy for as long as the busiest one.
+    double balance = (maxBusy > 0.0) ? totalBusy / (stats.size() * maxBusy) : 1.0;
+    std::cout << std::format("Load balance {:.1f}%", 100.0 * balance) << std::endl;
+}
+
+static bool EndsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+Headless::Headless(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--headless")
+        {
+            m_requested = true;
+        }
+    }
+    if (m_requested)
+    {
+        m_validArguments = ParseArguments(argc, argv);
+    }
+}
+
+Headless::~Headless()
+{
+}
+
+void Headless::PrintUsage()
+{
+    std::cout << "Usage: voidstar --headless [options]\n"
+        << "  --out <file>           Output image, .hdr (linear) or .png (tone mapped).  Default voidstar.hdr\n"
+        << "  --width <n>            Image width in pixels.  Default 1280\n"
+        << "  --height <n>           Image height in pixels.  Default 720\n"
+        << "  --threads <n>          Worker threads, 0 for one per hardware thread.  Default 0\n"
+        << "  --tile <n>             Tile size in pixels.  Default 16\n"
+        << "  --nopin                Don't pin worker threads to logical processors\n"
+        << "  --msaa <n>             Rays per pixel is n*n.  Default 1\n"
+        << "  --metric <n>           0 = Kerr, 1 = Classical, 2 = Minkowski.  Default 0\n"
+        << "  --solver <n>           0 = Euler-Cromer, 1 = RK4, 2 = RK23, 3 = RK45, 4 = Tsit5, 5 = Verner 6(5),\n"
+        << "                         6 = Bulirsch-Stoer (CPU only), 7 = Gauss-Legendre, 8 = Automatic RK23/RK45,\n"
+        << "                         9 = Taylor series (CPU only, not with --metric 1), 10 = Verner 8(7) (CPU only).\n"
+        << "                         Default 2\n"
+        << "  --tolerance <x>        Adaptive solver tolerance.  Default 0.01\n"
+        << "  --hybrid <x>           Distance in masses beyond which --solver 8 always uses RK45.  Default 8\n"
+        << "  --pi                   PI step size control on the per-component error instead of --tolerance\n"
+        << "  --atol <x>             Absolute tolerance with --pi.  Default 0.001\n"
+        << "  --rtol <x>             Relative tolerance with --pi.  Default 0.001\n"
+        << "  --maxsteps <n>         Maximum integration steps per ray.  Default 200\n"
+        << "  --mass <x>             Black hole mass.  Default 1\n"
+        << "  --a <x>                Black hole spin.  Default 0.6\n"
+        << "  --inner <x>            Disk inner radius.  Default 4.5\n"
+        << "  --outer <x>            Disk outer radius.  Default 18\n"
+        << "  --Tmax <x>             Disk maximum temperature.  Default 2000\n"
+        << "  --rotation <x>         Disk rotation angle.  Default 0\n"
+        << "  --camera <x,y,z>       Camera position.  Default 0,2,-45\n"
+        << "  --target <x,y,z>       Point the camera looks at.  Default 0,0,0\n"
+        << "  --fov <degrees>        Vertical field of view.  Default 30\n"
+        << "  --nosimd               Integrate one ray at a time in double precision instead of " << simd::Width
+        << " at a time with " << simd::InstructionSet << "\n"
+        << "  --analytic             Trace Kerr geodesics in closed form, integrating only the rays it can't handle\n"
+        << "  --fp64                 With the Kerr metric, rays near the horizon or the photon orbits leave the " << simd::Width
+        << "\n                         ray packets and continue in double precision until they're clear of them\n"
+        << "  --fp64band <x>         Width of the double precision band around the horizon, in masses.  Default 0.5\n"
+        << "  --escape <x>           With the Kerr metric, stop rays heading outwards beyond x masses and the disk, and\n"
+        << "                         bend them the rest of the way with the weak-field deflection\n"
+        << "  --cull                 With the Kerr metric, don't integrate rays that fall into the black hole without\n"
+        << "                         crossing the disk, as decided from their constants of motion\n"
+        << "  --showcull             Colour the rays --cull skips\n"
+        << "  --schwarzschild        With the Kerr metric and a = 0, read rays from tables of the Schwarzschild orbits,\n"
+        << "                         integrating only those near the photon sphere or in the disk's plane\n"
+        << "  --benchmark            Compare RK23, RK45, Automatic, Bulirsch-Stoer, Taylor and --solver 4, 5 or 10\n"
+        << "                         over a range of tolerances, by steps per ray, time and difference from a\n"
+        << "                         Verner 6(5) reference render.  Uses three standard camera positions unless\n"
+        << "                         --camera is given\n"
+        << "  --atlas <file>         Instead of rendering, trace the transfer atlas for the camera's radius and\n"
+        << "                         inclination, for BlackHole to shade any camera on that circle from\n"
+        << "  --atlassize <n>        Width and height of the atlas's octahedral map.  Default 1024\n";
+}
+
+bool Headless::ParseArguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless")
+        {
+            continue;
+        }
+        if (arg == "--help")
+        {
+            return false;
+        }
+        if (arg == "--nosimd")
+        {
+            m_params.useSIMD = false;
+            continue;
+        }
+        if (arg == "--pi")
+        {
+            m_params.PIController = true;
+            continue;
+        }
+        if (arg == "--analytic")
+        {
+            m_params.analytic = true;
+            continue;
+        }
+        if (arg == "--fp64")
+        {
+            m_params.fp64Refinement = true;
+            continue;
+        }
+        if (arg == "--cull")
+        {
+            m_params.captureCulling = true;
+            continue;
+        }
+        if (arg == "--schwarzschild")
+        {
+            m_params.schwarzschildTables = true;
+            continue;
+        }
+        if (arg == "--showcull")
+        {
+            m_params.showCaptureCulling = true;
+            continue;
+        }
+        if (arg == "--nopin")
+        {
+            m_pinThreads = false;
+            continue;
+        }
+        if (arg == "--benchmark")
+        {
+            m_benchmark = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cout << "Missing value for argument " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        try
+        {
+            if (arg == "--out") m_outFileName = value;
+            else if (arg == "--atlas") m_atlasFileName = value;
+            else if (arg == "--atlassize") m_atlasSize = std::stoul(value);
+            else if (arg == "--width") m_params.width = std::stoul(value);
+            else if (arg == "--height") m_params.height = std::stoul(value);
+            else if (arg == "--threads") m_numThreads = std::stoul(value);
+            else if (arg == "--tile") m_tileSize = std::stoul(value);
+            else if (arg == "--msaa") m_params.msaa = std::stoi(value);
+            else if (arg == "--metric") m_params.metric = std::stoi(value);
+            else if (arg == "--solver") m_params.ODESolver = std::stoi(value);
+            else if (arg == "--tolerance") m_params.tolerance = std::stof(value);
+            else if (arg == "--hybrid") m_params.hybridRadius = std::stof(value);
+            else if (arg == "--fp64band") m_params.fp64Band = std::stof(value);
+            else if (arg == "--escape")
+            {
+                m_params.farFieldEscape = true;
+                m_params.escapeRadius = std::stof(value);
+            }
+            else if (arg == "--atol") m_params.absoluteTolerance = std::stof(value);
+            else if (arg == "--rtol") m_params.relativeTolerance = std::stof(value);
+            else if (arg == "--maxsteps") m_params.maxSteps = std::stoi(value);
+            else if (arg == "--mass") m_params.mass = std::stof(value);
+            else if (arg == "--a") m_params.a = std::stof(value);
+            else if (arg == "--inner") m_params.innerRadius = std::stof(value);
+            else if (arg == "--outer") m_params.outerRadius = std::stof(value);
+            else if (arg == "--Tmax") m_params.Tmax = std::stof(value);
+            else if (arg == "--rotation") m_params.diskRotationAngle = std::stof(value);
+            else if (arg == "--fov") m_FOV = std::stof(value);
+            else if (arg == "--camera")
+            {
+                if (!ParseVec3(value, m_params.cameraPos))
+                {
+                    std::cout << "Could not parse camera position " << value << std::endl;
+                    return false;
+                }
+                m_customCamera = true;
+            }
+            else if (arg == "--target")
+            {
+                if (!ParseVec3(value, m_cameraTarget))
+                {
+                    std::cout << "Could not parse camera target " << value << std::endl;
+                    return false;
+                }
+            }
+            else
+            {
+                std::cout << "Unknown argument " << arg << std::endl;
+                return false;
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cout << "Could not parse value " << value << " for argument " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (m_params.width == 0 || m_params.height == 0 || m_params.metric < 0 || m_params.metric > 2
+        || m_params.ODESolver < 0 || m_params.ODESolver > 10 || (m_params.ODESolver == 9 && m_params.metric == 1)
+        || std::abs(m_params.a) > m_params.mass || m_params.fp64Band < 0.0f
+        || (!m_atlasFileName.empty() && (m_params.metric != 0 || m_atlasSize == 0)))
+    {
+        std::cout << "Invalid parameters." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Headless::SetCamera()
+{
+    // Same matrices as Camera::GetView() and Camera::GetProj(), inverted as in Mesh.
+    glm::mat4 view = glm::lookAt(m_params.cameraPos, m_cameraTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(m_FOV), (float)m_params.width / (float)m_params.height, 0.1f, 1000.0f);
+    m_params.viewInv = glm::inverse(view);
+    m_params.projInv = glm::inverse(proj);
+
+    // Mirrors BlackHole::CalculateDrawDistance() and the settings BlackHole changes when crossing the horizon.
+    if (m_params.metric == 2)
+    {
+        m_params.a = 0.0f;
+    }
+    m_params.risco = CalculateISCORadius(m_params.mass, m_params.a);
+    if (m_params.innerRadius < m_params.risco)
+    {
+        m_params.innerRadius = m_params.risco;
+    }
+    glm::dvec4 x = glm::dvec4(0.0, glm::dvec3(m_params.cameraPos));
+    if (m_params.metric == 0)
+    {
+        float r = (float)GeodesicIntegrator(m_params).ImplicitR(x);
+        m_params.insideHorizon = r < m_params.mass + std::sqrt(m_params.mass * m_params.mass - m_params.a * m_params.a);
+        if (m_params.insideHorizon)
+        {
+            m_params.tolerance = 0.01f;
+            m_params.maxSteps = 70;
+        }
+        m_params.drawDistance = std::fmax(70.0f, r + 10.0f);
+    }
+    else
+    {
+        float r = glm::length(m_params.cameraPos);
+        // The CLASSICAL shader variant is never compiled with INSIDE_HORIZON.
+        m_params.insideHorizon = (m_params.metric == 2) && (r < 2 * m_params.mass);
+        m_params.drawDistance = std::fmax(70.0f, r + 10.0f);
+    }
+}
+
+void Headless::AttachConsole()
+{
+#ifdef _WIN32
+    // Release builds use the Windows subsystem, so there is no console attached for std::cout.  Borrow the console of
+    // the shell that launched us, if there is one.
+    if (GetConsoleWindow() == NULL && ::AttachConsole(ATTACH_PARENT_PROCESS))
+    {
+        FILE* stream;
+        freopen_s(&stream, "CONOUT$", "w", stdout);
+        freopen_s(&stream, "CONOUT$", "w", stderr);
+        std::cout.clear();
+        std::cerr.clear();
+    }
+#endif
+}
+
+int Headless::Run()
+{
+    AttachConsole();
+    if (!m_validArguments)
+    {
+        PrintUsage();
+        return 1;
+    }
+    SetCamera();
+
+    std::vector<std::string> cubeTexturePaths = {
+        // Ordering of faces must be: xpos, xneg, ypos, yneg, zpos, zneg.
+        "res/textures/px.png",
+        "res/textures/nx.png",
+        "res/textures/py.png",
+        "res/textures/ny.png",
+        "res/textures/pz.png",
+        "res/textures/nz.png"
+    };
+    CPUCubeMap skybox(cubeTexturePaths);
+    if (!skybox.IsLoaded())
+    {
+        std::cout << "Skybox failed to load, rendering with a black background." << std::endl;
+    }
+
+    ThreadPool pool(m_numThreads, m_pinThreads);
+    if (m_benchmark)
+    {
+        return RunBenchmark(pool, skybox);
+    }
+    if (!m_atlasFileName.empty())
+    {
+        return RunAtlas(pool);
+    }
+    CPURenderer renderer(m_params, skybox);
+    std::string packets = renderer.UsesAnalytic() ? "closed form Kerr geodesics" : renderer.UsesPackets()
+        ? std::format("{} rays per packet ({})", simd::Width, simd::InstructionSet) : "one ray at a time";
+    std::cout << std::format("Rendering {}x{} with {} threads, {}...", m_params.width, m_params.height,
+        pool.GetNumThreads(), packets) << std::endl;
+    float seconds = renderer.Render(pool, m_tileSize);
+    double megaRays = (double)m_params.width * m_params.height * m_params.msaa * m_params.msaa / 1.0e6;
+    std::cout << std::format("Rendered in {:.3f} s ({:.3f} Mrays/s)", seconds, megaRays / seconds) << std::endl;
+    if (renderer.GetNumIntegratedRays() > 0)
+    {
+        std::cout << std::format("{:.1f} steps per ray, H drift per ray: mean {:.2e}, max {:.2e}",
+            (double)renderer.GetNumSteps() / renderer.GetNumIntegratedRays(), renderer.GetMeanHDrift(),
+            renderer.GetMaxHDrift()) << std::endl;
+    }
+    if (renderer.GetNumRefinedRays() > 0)
+    {
+        // What the double precision band costs, next to the single precision steps of the packets.
+        double numPixels = (double)m_params.width * m_params.height;
+        uint64_t refinedSteps = renderer.GetNumRefinedSteps();
+        std::cout << std::format("Double precision: {:.2f} rays and {:.2f} steps per pixel, {:.1f}% of steps",
+            renderer.GetNumRefinedRays() / numPixels, refinedSteps / numPixels,
+            100.0 * refinedSteps / (refinedSteps + renderer.GetNumPacketSteps())) << std::endl;
+    }
+    if (renderer.GetNumCulledRays() > 0)
+    {
+        std::cout << std::format("Culled {:.1f}% of rays as captured", 100.0 * renderer.GetNumCulledRays()
+            / ((double)m_params.width * m_params.height * m_params.msaa * m_params.msaa)) << std::endl;
+    }
+    if (renderer.GetNumTableRays() > 0)
+    {
+        std::cout << std::format("Read {:.1f}% of rays from the Schwarzschild tables", 100.0 * renderer.GetNumTableRays()
+            / ((double)m_params.width * m_params.height * m_params.msaa * m_params.msaa)) << std::endl;
+    }
+    PrintWorkerStats(pool.GetStats());
+
+    bool written = EndsWith(m_outFileName, ".png") ? renderer.WritePNG(m_outFileName) : renderer.WriteHDR(m_outFileName);
+    if (!written)
+    {
+        std::cout << "Failed to write " << m_outFileName << std::endl;
+        return 1;
+    }
+    std::cout << "Saved " << m_outFileName << std::endl;
+    return 0;
+}
+
+int Headless::RunAtlas(ThreadPool& pool)
+{
+    // Only the camera's radius and inclination matter.  The atlas is traced from azimuth 0.
+    if (m_params.insideHorizon)
+    {
+        std::cout << "The transfer atlas needs the camera outside the horizon." << std::endl;
+        return 1;
+    }
+    if (m_params.captureCulling || m_params.farFieldEscape)
+    {
+        std::cout << "--cull and --escape are ignored, since their records depend on the disk's radii." << std::endl;
+    }
+    float r = (float)GeodesicIntegrator(m_params).ImplicitR(glm::dvec4(0.0, glm::dvec3(m_params.cameraPos)));
+    float inclination = std::acos(std::clamp(m_params.cameraPos.y / r, -1.0f, 1.0f));
+    std::cout << std::format("Tracing a {}x{} transfer atlas at r = {:.3f}, inclination {:.2f} degrees with {} threads...",
+        m_atlasSize, m_atlasSize, r, glm::degrees(inclination), pool.GetNumThreads()) << std::endl;
+    float seconds = TransferAtlas::Bake(m_params, r, inclination, m_atlasSize, pool, m_atlasFileName);
+    if (seconds < 0.0f)
+    {
+        std::cout << "Failed to write " << m_atlasFileName << std::endl;
+        return 1;
+    }
+    std::cout << std::format("Traced in {:.3f} s", seconds) << std::endl;
+    PrintWorkerStats(pool.GetStats());
+    std::cout << "Saved " << m_atlasFileName << std::endl;
+    return 0;
+}
+
+int Headless::RunBenchmark(ThreadPool& pool, const CPUCubeMap& skybox)
+{
+    // Work-precision comparison of the adaptive solvers.  At every camera position, each render in the tolerance sweep
+    // is compared against a Verner 6(5) render at a much smaller tolerance, so runs with the same RMS difference are
+    // at matched error.  The reference comes from a solver outside the sweep, so that it doesn't share the errors of
+    // any solver it judges; Verner 8(7) takes over if Verner 6(5) is in the sweep.  Rays are integrated one at a time in double precision, with enough steps that none of them
+    // runs out, so that only the solver and the tolerance differ.
+    std::vector<int> solvers = { 2, 3, 8, 6 };
+    if (m_params.metric != 1)
+    {
+        solvers.push_back(9);
+    }
+    if (m_params.ODESolver == 4 || m_params.ODESolver == 5 || m_params.ODESolver == 10)
+    {
+        solvers.push_back(m_params.ODESolver);
+    }
+    int referenceSolver = (m_params.ODESolver == 5) ? 10 : 5;
+    // The default view, a close view just above the disk and a view from high above, unless --camera is given.
+    std::vector<glm::vec3> cameras = { glm::vec3(0.0f, 2.0f, -45.0f), glm::vec3(0.0f, 0.5f, -15.0f),
+        glm::vec3(0.0f, 30.0f, -20.0f) };
+    if (m_customCamera)
+    {
+        cameras = { m_params.cameraPos };
+    }
+
+    struct BenchmarkRun
+    {
+        int solver;
+        float tolerance;
+        double stepsPerRay;
+        double meanHDrift;
+        float seconds;
+        ImageDifference difference;
+    };
+    auto solverName = [](int solver)
+    {
+        const char* names[] = { "Euler-Cromer", "RK4", "RK23", "RK45", "Tsit5", "Verner 6(5)", "Bulirsch-Stoer",
+            "Gauss-Legendre", "Automatic", "Taylor", "Verner 8(7)" };
+        return std::string(names[solver]);
+    };
+
+    for (const glm::vec3& camera : cameras)
+    {
+        m_params.cameraPos = camera;
+        SetCamera();
+        BlackHoleParameters params = m_params;
+        params.useSIMD = false;
+        params.analytic = false;
+        params.PIController = false;
+        // At the default thresholds the intersection points alone are off by more than the solvers at tight
+        // tolerances, which would hide the differences between them.
+        params.diskIntersectionThreshold = 1.0e-7f;
+        params.sphereIntersectionThreshold = 1.0e-7f;
+        params.maxSteps = std::max(params.maxSteps, 100000);
+        double numRays = (double)params.width * params.height * std::max(1, params.msaa) * std::max(1, params.msaa);
+
+        auto render = [&](int solver, float tolerance)
+        {
+            params.ODESolver = solver;
+            params.tolerance = tolerance;
+            CPURenderer renderer(params, skybox);
+            BenchmarkRun run = { solver, tolerance, 0.0, 0.0, renderer.Render(pool, m_tileSize), ImageDifference() };
+            run.stepsPerRay = (double)renderer.GetNumSteps() / numRays;
+            run.meanHDrift = renderer.GetMeanHDrift();
+            return std::make_pair(run, renderer.GetPixels());
+        };
+
+        std::cout << std::format("\nBenchmarking {}x{} from ({}, {}, {}) with {} threads, reference is {} at tolerance "
+            "1e-12...", params.width, params.height, camera.x, camera.y, camera.z, pool.GetNumThreads(),
+            solverName(referenceSolver)) << std::endl;
+        auto [referenceRun, reference] = render(referenceSolver, 1.0e-12f);
+        std::cout << std::format("Reference: {:.1f} steps/ray in {:.3f} s", referenceRun.stepsPerRay,
+            referenceRun.seconds) << std::endl;
+
+        std::vector<BenchmarkRun> runs;
+        std::cout << "Solver          Tolerance  Steps/ray  Time (s)  RMS diff  Mismatched  H drift\n";
+        for (int solver : solvers)
+        {
+            for (float tolerance : { 1.0e-3f, 1.0e-4f, 1.0e-5f, 1.0e-6f, 1.0e-7f, 1.0e-8f, 1.0e-10f })
+            {
+                auto [run, pixels] = render(solver, tolerance);
+                run.difference = CompareImages(reference, pixels);
+                std::cout << std::format("{:<14}  {:>9.0e}  {:>9.1f}  {:>8.3f}  {:>8.2e}  {:>9.2f}%  {:>7.1e}\n",
+                    solverName(solver), tolerance, run.stepsPerRay, run.seconds, run.difference.rmsDiff,
+                    100.0f * run.difference.fractionMismatched, run.meanHDrift);
+                runs.push_back(run);
+            }
+        }
+
+        // For every run of the other solvers, the cheapest run of each of the two fixed pairs, RK23 and RK45, that is
+        // at least as accurate.  The sweep goes from large to small tolerances, so that is the first one.
+        std::cout << "At matched error:\n";
+        for (const BenchmarkRun& candidate : runs)
+        {
+            if (candidate.solver == 2 || candidate.solver == 3)
+            {
+                continue;
+            }
+            std::string line = std::format("  {} at {:.0e}", solverName(candidate.solver), candidate.tolerance);
+            for (int baseline : { 2, 3 })
+            {
+                auto match = std::find_if(runs.begin(), runs.end(), [&candidate, baseline](const BenchmarkRun& run)
+                    {
+                        return run.solver == baseline && run.difference.rmsDiff <= candidate.difference.rmsDiff;
+                    });
+                if (match == runs.end())
+                {
+                    line += std::format(", no {} run is as accurate", solverName(baseline));
+                    continue;
+                }
+                line += std::format(", vs {} at {:.0e}: {:.2f}x the steps per ray, {:.2f}x the time", solverName(baseline),
+                    match->tolerance, candidate.stepsPerRay / match->stepsPerRay, candidate.seconds / match->seconds);
+            }
+            std::cout << line << "\n";
+        }
+    }
+    std::cout << std::flush;
+    return 0;
+}
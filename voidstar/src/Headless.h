@@ -0,0 +1,43 @@
+#pragma once
+
+#include "scenes/blackhole/cpu/BlackHoleParameters.h"
+
+#include <string>
+
+class ThreadPool;
+class CPUCubeMap;
+
+class Headless
+{
+	// Command line front end for the CPU renderer.  Started with --headless, it renders a single frame without creating
+	// a window or an OpenGL context, so it can run on machines without a GPU.
+public:
+	Headless(int argc, char** argv);
+	~Headless();
+
+	bool IsRequested() const { return m_requested; }
+	int Run();
+
+	static void PrintUsage();
+
+private:
+	void AttachConsole();
+	bool ParseArguments(int argc, char** argv);
+	void SetCamera();
+	int RunBenchmark(ThreadPool& pool, const CPUCubeMap& skybox);
+	int RunAtlas(ThreadPool& pool);
+
+	bool m_requested = false;
+	bool m_validArguments = true;
+	BlackHoleParameters m_params;
+	unsigned int m_numThreads = 0;
+	unsigned int m_tileSize = 16;
+	bool m_pinThreads = true;
+	bool m_benchmark = false;
+	bool m_customCamera = false;
+	glm::vec3 m_cameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+	float m_FOV = 30.0f;
+	std::string m_outFileName = "voidstar.hdr";
+	std::string m_atlasFileName;
+	unsigned int m_atlasSize = 1024;
+};
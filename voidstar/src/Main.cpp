@@ -1,11 +1,23 @@
 #include "Application.h"
+#include "Headless.h"
 
 #ifdef NDEBUG
 int WinMain()
 #else
-int main()
+int main(int argc, char** argv)
 #endif
 {
+#ifdef NDEBUG
+    // WinMain doesn't receive argc/argv directly, but the CRT still parses them for us.
+    int argc = __argc;
+    char** argv = __argv;
+#endif
+    Headless headless(argc, argv);
+    if (headless.IsRequested())
+    {
+        return headless.Run();
+    }
+
     Application& app = Application::Get();
     app.Run();
 
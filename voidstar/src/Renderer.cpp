@@ -194,6 +194,22 @@ std::shared_ptr<Shader> Renderer::GetShader(const std::string& filePath, const s
     }
 }
 
+std::shared_ptr<Shader> Renderer::GetComputeShader(const std::string& filePath, const std::vector<std::string>& computeDefines)
+{
+    // The same file can hold graphics and compute stages, so compute programs get their own cache keys.
+    std::string filePathwithDefines = GetShaderPath(filePath, {}, computeDefines).append("#compute");
+
+    if (m_ShaderCache.find(filePathwithDefines) != m_ShaderCache.end())
+    {
+        return m_ShaderCache[filePathwithDefines];
+    }
+    else
+    {
+        m_ShaderCache[filePathwithDefines] = std::make_shared<Shader>(filePath, computeDefines);
+        return m_ShaderCache[filePathwithDefines];
+    }
+}
+
 
 std::shared_ptr<Texture2D> Renderer::GetTexture(const std::string& filePath, bool flip)
 {
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include "Renderer.h"
 
@@ -28,6 +29,15 @@ Shader::Shader(const std::string& filepath, const std::vector<std::string>& vert
     m_RendererID = CreateShaderProgram(source.VertexSource, source.FragmentSource);
 }
 
+Shader::Shader(const std::string& filepath, const std::vector<std::string>& computeDefines)
+{
+    m_FilePath = filepath;
+    ShaderProgramSource source = ParseShader(filepath);
+    InsertDefines(source.ComputeSource, computeDefines);
+
+    m_RendererID = CreateComputeProgram(source.ComputeSource);
+}
+
 Shader::~Shader()
 {
 #ifndef NDEBUG
@@ -42,36 +52,41 @@ ShaderProgramSource Shader::ParseShader(const std::string& filepath)
 
     enum class ShaderType
     {
-        NONE = -1, VERTEX = 0, FRAGMENT = 1
+        VERTEX = 0, FRAGMENT = 1, COMPUTE = 2
     };
 
     std::string line;
-    std::stringstream ss[2];
-    ShaderType type = ShaderType::NONE;
+    std::stringstream ss[3];
+    std::vector<ShaderType> types;
     while (getline(stream, line))
     {
         if (line.find("#shader") != std::string::npos)
         {
+            // A section can be shared by several stages, e.g. "#shader fragment compute".
+            types.clear();
             if (line.find("vertex") != std::string::npos)
             {
-                type = ShaderType::VERTEX;
+                types.push_back(ShaderType::VERTEX);
             }
-
-            else if (line.find("fragment") != std::string::npos)
+            if (line.find("fragment") != std::string::npos)
+            {
+                types.push_back(ShaderType::FRAGMENT);
+            }
+            if (line.find("compute") != std::string::npos)
             {
-                type = ShaderType::FRAGMENT;
+                types.push_back(ShaderType::COMPUTE);
             }
         }
 
         else
         {
-            if (type != ShaderType::NONE)
+            for (ShaderType type : types)
             {
                 ss[(int)type] << line << '\n';
             }
         }
     }
-    return { ss[0].str(), ss[1].str() };
+    return { ss[0].str(), ss[1].str(), ss[2].str() };
 }
 
 void Shader::InsertDefines(std::string& shadersource, const std::vector<std::string>& defines)
@@ -118,7 +133,8 @@ unsigned int Shader::CompileShader(const std::string& source, unsigned int type)
         GLCall(glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length));
         char* message = new char[length];
         glGetShaderInfoLog(id, length, &length, message);
-        std::cout << "Failed to compile " << (type == GL_VERTEX_SHADER ? "vertex" : "fragment") << " shader!" << std::endl;
+        std::string typeName = type == GL_VERTEX_SHADER ? "vertex" : (type == GL_FRAGMENT_SHADER ? "fragment" : "compute");
+        std::cout << "Failed to compile " << typeName << " shader!" << std::endl;
         std::cout << message << std::endl;
         delete[] message;
         GLCall(glDeleteShader(id));
@@ -154,6 +170,28 @@ unsigned int Shader::CreateShaderProgram(const std::string& vertexShader, const
     return program;
 }
 
+unsigned int Shader::CreateComputeProgram(const std::string& computeShader)
+{
+    unsigned int program = glCreateProgram();
+    unsigned int cs = CompileShader(computeShader, GL_COMPUTE_SHADER);
+
+    GLCall(glAttachShader(program, cs));
+
+    GLCall(glLinkProgram(program));
+#ifndef NDEBUG
+    GLCall(glValidateProgram(program));
+#endif
+
+    GLCall(glDetachShader(program, cs));
+    GLCall(glDeleteShader(cs));
+
+#ifndef NDEBUG
+    std::cout << "Created compute program: " << m_FilePath << ", with RendererID: " << program << std::endl;
+#endif
+
+    return program;
+}
+
 
 void Shader::Bind() const
 {
@@ -175,6 +213,16 @@ void Shader::SetUniform1f(const std::string& name, float value)
     GLCall(glUniform1f(GetUniformLocation(name), value));
 }
 
+void Shader::SetUniform1fv(const std::string& name, int count, const float* values)
+{
+    GLCall(glUniform1fv(GetUniformLocation(name), count, values));
+}
+
+void Shader::SetUniform2f(const std::string& name, glm::vec2 v)
+{
+    GLCall(glUniform2f(GetUniformLocation(name), v.x, v.y));
+}
+
 void Shader::SetUniform3f(const std::string& name, glm::vec3 v)
 {
     GLCall(glUniform3f(GetUniformLocation(name), v.x, v.y, v.z));
@@ -9,6 +9,7 @@ struct ShaderProgramSource
 {
 	std::string VertexSource;
 	std::string FragmentSource;
+	std::string ComputeSource;
 };
 
 class Shader
@@ -22,6 +23,7 @@ public:
 	Shader();
 	Shader(const std::string& filepath);
 	Shader(const std::string& filepath, const std::vector<std::string>& vertexDefines, const std::vector<std::string>& fragmentDefines);
+	Shader(const std::string& filepath, const std::vector<std::string>& computeDefines);
 	~Shader();
 
 	void Bind() const;
@@ -31,6 +33,8 @@ public:
 
 	void SetUniform1i(const std::string& name, int value);
 	void SetUniform1f(const std::string& name, float value);
+	void SetUniform1fv(const std::string& name, int count, const float* values);
+	void SetUniform2f(const std::string& name, glm::vec2 v);
 	void SetUniform3f(const std::string& name, glm::vec3 v);
 	void SetUniform3f(const std::string& name, float v0, float v1, float v2);
 	void SetUniform4f(const std::string& name, glm::vec4 v);
@@ -42,5 +46,6 @@ private:
 	void InsertDefines(std::string& shadersource, const std::vector<std::string>& defines);
 	unsigned int CompileShader(const std::string& source, unsigned int type);
 	unsigned int CreateShaderProgram(const std::string& vertexShader, const std::string& fragmentShader);
+	unsigned int CreateComputeProgram(const std::string& computeShader);
 	int GetUniformLocation(const std::string& name);
 };
\ No newline at end of file
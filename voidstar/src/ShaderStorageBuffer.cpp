@@ -0,0 +1,51 @@
+#include "ShaderStorageBuffer.h"
+
+#include "Renderer.h"
+
+ShaderStorageBuffer::ShaderStorageBuffer(unsigned int size, const void* data)
+    : m_Size(size)
+{
+    GLCall(glGenBuffers(1, &m_RendererID));
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_RendererID));
+    GLCall(glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_COPY));
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+ShaderStorageBuffer::~ShaderStorageBuffer()
+{
+    GLCall(glDeleteBuffers(1, &m_RendererID));
+}
+
+void ShaderStorageBuffer::Bind() const
+{
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_RendererID));
+}
+
+void ShaderStorageBuffer::Unbind() const
+{
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void ShaderStorageBuffer::BindBase(unsigned int binding) const
+{
+    GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_RendererID));
+}
+
+void ShaderStorageBuffer::BindIndirect() const
+{
+    GLCall(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_RendererID));
+}
+
+void ShaderStorageBuffer::SetData(const void* data, unsigned int size, unsigned int offset) const
+{
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_RendererID));
+    GLCall(glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data));
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void ShaderStorageBuffer::GetData(void* data, unsigned int size, unsigned int offset) const
+{
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_RendererID));
+    GLCall(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, data));
+    GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
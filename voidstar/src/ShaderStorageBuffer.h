@@ -0,0 +1,23 @@
+#pragma once
+
+class ShaderStorageBuffer
+{
+	// A GPU buffer for compute shaders to read and write.  The same buffer can also hold the arguments of an
+	// indirect dispatch.
+private:
+	unsigned int m_RendererID;
+	unsigned int m_Size;
+public:
+	ShaderStorageBuffer(unsigned int size, const void* data = nullptr);
+	~ShaderStorageBuffer();
+
+	void Bind() const;
+	void Unbind() const;
+	void BindBase(unsigned int binding) const;
+	void BindIndirect() const;
+	void SetData(const void* data, unsigned int size, unsigned int offset = 0) const;
+	// Waits for the GPU to finish writing the buffer.
+	void GetData(void* data, unsigned int size, unsigned int offset = 0) const;
+
+	unsigned int GetSize() const { return m_Size; }
+};
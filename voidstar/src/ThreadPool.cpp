@@ -0,0 +1,244 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+
+struct ProcessorSlot
+{
+    int group = 0;
+    int number = 0;
+    int numaNode = 0;
+};
+
+static std::vector<ProcessorSlot> EnumerateProcessors()
+{
+    // Every logical processor the pool may run on, ordered by NUMA node.
+    std::vector<ProcessorSlot> slots;
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+    std::vector<char> buffer(length);
+    auto info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+    if (length == 0 || !GetLogicalProcessorInformationEx(RelationNumaNode, info, &length))
+    {
+        return slots;
+    }
+    for (DWORD offset = 0; offset < length; offset += info->Size)
+    {
+        info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+        const GROUP_AFFINITY& mask = info->NumaNode.GroupMask;
+        for (int bit = 0; bit < (int)(8 * sizeof(KAFFINITY)); bit++)
+        {
+            if (mask.Mask & ((KAFFINITY)1 << bit))
+            {
+                slots.push_back({ (int)mask.Group, bit, (int)info->NumaNode.NodeNumber });
+            }
+        }
+    }
+    std::stable_sort(slots.begin(), slots.end(),
+        [](const ProcessorSlot& a, const ProcessorSlot& b) { return a.numaNode < b.numaNode; });
+#endif
+    return slots;
+}
+
+static void PinCurrentThread([[maybe_unused]] const ProcessorSlot& slot)
+{
+#ifdef _WIN32
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = (WORD)slot.group;
+    affinity.Mask = (KAFFINITY)1 << slot.number;
+    SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#endif
+}
+
+
+ThreadPool::ThreadPool(unsigned int numThreads, bool pinThreads)
+{
+    if (numThreads == 0)
+    {
+        // hardware_concurrency() may return 0 if it can't tell.
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::vector<ProcessorSlot> slots = pinThreads ? EnumerateProcessors() : std::vector<ProcessorSlot>();
+    m_workers.reserve(numThreads);
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        m_workers.push_back(std::make_unique<Worker>());
+        if (!slots.empty())
+        {
+            const ProcessorSlot& slot = slots[i % slots.size()];
+            m_workers[i]->numaNode = slot.numaNode;
+            m_workers[i]->processor = 64 * slot.group + slot.number;
+        }
+    }
+
+    // Steal from workers on the same node first, starting with the next worker along so that thieves spread out.
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        std::vector<unsigned int>& victims = m_workers[i]->victims;
+        for (unsigned int j = 1; j < numThreads; j++)
+        {
+            victims.push_back((i + j) % numThreads);
+        }
+        std::stable_sort(victims.begin(), victims.end(), [this, i](unsigned int a, unsigned int b)
+            {
+                return (m_workers[a]->numaNode == m_workers[i]->numaNode) > (m_workers[b]->numaNode == m_workers[i]->numaNode);
+            });
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        ProcessorSlot slot = slots.empty() ? ProcessorSlot() : slots[i % slots.size()];
+        bool pin = !slots.empty();
+        m_workers[i]->thread = std::thread([this, i, slot, pin]()
+            {
+                if (pin)
+                {
+                    PinCurrentThread(slot);
+                }
+                WorkerLoop(i);
+            });
+    }
+    ResetStats();
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobAvailable.notify_all();
+    for (std::unique_ptr<Worker>& worker : m_workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    Submit(std::move(job), m_nextWorker++ % GetNumThreads());
+}
+
+void ThreadPool::Submit(std::function<void()> job, unsigned int worker)
+{
+    m_pendingJobs++;
+    {
+        Worker& w = *m_workers[worker % GetNumThreads()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.jobs.push_back(std::move(job));
+    }
+    {
+        // Counted under m_mutex so a worker can't miss the job between checking m_queuedJobs and going to sleep.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedJobs++;
+    }
+    m_jobAvailable.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobsFinished.wait(lock, [this] { return m_pendingJobs == 0; });
+    m_statsEnd = std::chrono::steady_clock::now();
+}
+
+void ThreadPool::ResetStats()
+{
+    // Only call while the pool is idle.
+    for (std::unique_ptr<Worker>& worker : m_workers)
+    {
+        worker->busySeconds = 0.0;
+        worker->numJobs = 0;
+        worker->numStolen = 0;
+    }
+    m_statsStart = std::chrono::steady_clock::now();
+    m_statsEnd = m_statsStart;
+}
+
+std::vector<WorkerStats> ThreadPool::GetStats() const
+{
+    std::chrono::duration<double> elapsed = m_statsEnd - m_statsStart;
+    std::vector<WorkerStats> stats(m_workers.size());
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        const Worker& worker = *m_workers[i];
+        stats[i].busySeconds = worker.busySeconds;
+        stats[i].idleSeconds = std::max(0.0, elapsed.count() - worker.busySeconds);
+        stats[i].jobs = worker.numJobs;
+        stats[i].stolen = worker.numStolen;
+        stats[i].numaNode = worker.numaNode;
+        stats[i].processor = worker.processor;
+    }
+    return stats;
+}
+
+bool ThreadPool::TakeJob(unsigned int index, std::function<void()>& job, bool& stolen)
+{
+    {
+        Worker& self = *m_workers[index];
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.jobs.empty())
+        {
+            job = std::move(self.jobs.front());
+            self.jobs.pop_front();
+            stolen = false;
+            return true;
+        }
+    }
+    for (unsigned int victimIndex : m_workers[index]->victims)
+    {
+        // Steal from the opposite end to the owner, which is the work furthest from what the owner is doing.
+        Worker& victim = *m_workers[victimIndex];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(unsigned int index)
+{
+    Worker& self = *m_workers[index];
+    while (true)
+    {
+        std::function<void()> job;
+        bool stolen = false;
+        if (TakeJob(index, job, stolen))
+        {
+            m_queuedJobs--;
+            auto start = std::chrono::steady_clock::now();
+            job();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            self.busySeconds += elapsed.count();
+            self.numJobs++;
+            self.numStolen += stolen ? 1 : 0;
+
+            if (--m_pendingJobs == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_jobsFinished.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_jobAvailable.wait(lock, [this] { return m_stopping || m_queuedJobs > 0; });
+        if (m_stopping && m_queuedJobs <= 0)
+        {
+            return;
+        }
+    }
+}
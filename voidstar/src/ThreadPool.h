@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+struct WorkerStats
+{
+	// Measured between ResetStats() and the end of the most recent Wait().
+	double busySeconds = 0.0;
+	double idleSeconds = 0.0;
+	unsigned int jobs = 0;
+	// Jobs this worker took from another worker's deque.
+	unsigned int stolen = 0;
+	int numaNode = 0;
+	// Logical processor the worker is pinned to, or -1 if it isn't pinned.
+	int processor = -1;
+};
+
+
+class ThreadPool
+{
+	// Fixed size pool of worker threads with work stealing.  Every worker has its own deque of jobs: it runs jobs from
+	// the front of its own deque, and when that is empty it steals from the back of another worker's deque, trying
+	// workers on the same NUMA node first.  With pinThreads, worker i is pinned to the i-th logical processor in NUMA
+	// node order so that memory a worker touches first is allocated on its node.  Pinning and NUMA nodes are only
+	// implemented for Windows; elsewhere every worker reports node 0 and is left to the scheduler.
+public:
+	ThreadPool(unsigned int numThreads = 0, bool pinThreads = false);
+	~ThreadPool();
+
+	// Adds the job to the workers' deques in round robin order.
+	void Submit(std::function<void()> job);
+	// Adds the job to the deque of the given worker.  Other workers can still steal it.
+	void Submit(std::function<void()> job, unsigned int worker);
+	// Blocks until every submitted job has finished.
+	void Wait();
+
+	unsigned int GetNumThreads() const { return (unsigned int)m_workers.size(); }
+	int GetNumaNode(unsigned int worker) const { return m_workers[worker]->numaNode; }
+
+	void ResetStats();
+	std::vector<WorkerStats> GetStats() const;
+
+private:
+	struct Worker
+	{
+		std::deque<std::function<void()>> jobs;
+		std::mutex mutex;
+		std::thread thread;
+		int numaNode = 0;
+		int processor = -1;
+		// Other workers in the order this worker tries to steal from them.
+		std::vector<unsigned int> victims;
+		double busySeconds = 0.0;
+		unsigned int numJobs = 0;
+		unsigned int numStolen = 0;
+	};
+
+	void WorkerLoop(unsigned int index);
+	bool TakeJob(unsigned int index, std::function<void()>& job, bool& stolen);
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::atomic<unsigned int> m_nextWorker = 0;
+	// Jobs sitting in a deque, and jobs submitted but not finished.
+	std::atomic<int> m_queuedJobs = 0;
+	std::atomic<int> m_pendingJobs = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_jobAvailable;
+	std::condition_variable m_jobsFinished;
+	bool m_stopping = false;
+	std::chrono::steady_clock::time_point m_statsStart;
+	std::chrono::steady_clock::time_point m_statsEnd;
+};
@@ -2,6 +2,8 @@
 
 #include "Application.h"
 #include <cmath>
+#include <algorithm>
+#include <cstdio>
 #include "imgui_internal.h"
 
 BlackHole::BlackHole()
@@ -56,22 +58,411 @@ void BlackHole::OnClick(int x, int y)
     }
 }
 
+static float Halton(unsigned int index, unsigned int base)
+{
+    float result = 0.0f;
+    float f = 1.0f;
+    while (index > 0)
+    {
+        f /= (float)base;
+        result += f * (float)(index % base);
+        index /= base;
+    }
+    return result;
+}
+
 void BlackHole::Draw()
 {
+    m_gpuTimer.Start();
+
+    // Everything up to the final draw is at the internal resolution.
+    GLint windowViewport[4];
+    GLCall(glGetIntegerv(GL_VIEWPORT, windowViewport));
+    GLCall(glViewport(0, 0, m_fbo->GetSpecification().width, m_fbo->GetSpecification().height));
+
     // Draw to initial off-screen FBO
-    m_fbo->Bind();
-    m_quad.SetShader(m_selectedShaderString, m_vertexDefines, m_fragmentDefines);
-    SetShaderUniforms();
-    m_quad.Draw();
-    m_fbo->Unbind();
+    if (UsesGeodesicGBuffer())
+    {
+        if (UsesTemporalAA())
+        {
+            if (!m_historyFBO)
+            {
+                CreateTemporalFBOs();
+            }
+            // Cycle through the first 8 points of the (2, 3) Halton sequence, centred on the pixel.
+            m_temporalFrame = m_temporalFrame % 8 + 1;
+            m_jitter = glm::vec2(Halton(m_temporalFrame, 2), Halton(m_temporalFrame, 3)) - 0.5f;
+        }
+        else
+        {
+            m_jitter = glm::vec2(0.0f);
+            m_hasTemporalHistory = false;
+        }
+
+        TraceGeodesics();
+        m_fbo->Bind();
+        std::vector<std::string> defines = GetGeodesicPassDefines("GEODESIC_SHADE");
+        if (UsesAdaptiveAA())
+        {
+            // The solver statistics are the trace pass's, and have already been read back.
+            std::erase(defines, "SOLVER_STATISTICS");
+            defines.push_back("ADAPTIVE_SUPERSAMPLE");
+
+            // Count the pixels that need more rays first, so that the shade pass can split the budget between them.
+            if (!m_adaptiveRayCount)
+            {
+                m_adaptiveRayCount = std::make_shared<ShaderStorageBuffer>(2 * sizeof(unsigned int));
+            }
+            unsigned int counts[2] = { 0, 0 };
+            m_adaptiveRayCount->SetData(counts, sizeof(counts));
+            std::vector<std::string> countDefines = defines;
+            countDefines.push_back("ADAPTIVE_COUNT");
+            m_quad.SetShader(m_selectedShaderString, m_vertexDefines, countDefines);
+            SetShaderUniforms();
+            SetGeodesicShadeUniforms();
+            m_quad.Draw();
+            GLCall(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+        }
+        m_quad.SetShader(m_selectedShaderString, m_vertexDefines, defines);
+        SetShaderUniforms();
+        SetGeodesicShadeUniforms();
+        m_quad.Draw();
+        if (UsesAdaptiveAA() && m_countSolverSteps)
+        {
+            // Like the solver statistics, reading the count back waits for the frame.
+            GLCall(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+            unsigned int counts[2];
+            m_adaptiveRayCount->GetData(counts, sizeof(counts));
+            // The budget is per pixel of the G-buffer, which SetGeodesicShadeUniforms() sized it from.
+            float numPixels = (float)m_gbuffer->GetSpecification().width * m_gbuffer->GetSpecification().height;
+            m_adaptiveMarkedFraction = (float)counts[0] / numPixels;
+            m_adaptiveRaysPerPixel = (float)counts[1] / numPixels;
+        }
+        m_fbo->Unbind();
+
+        if (UsesTemporalAA())
+        {
+            ResolveTemporal();
+        }
+    }
+    else
+    {
+        m_jitter = glm::vec2(0.0f);
+        m_hasTemporalHistory = false;
+        m_fbo->Bind();
+        m_quad.SetShader(m_selectedShaderString, m_vertexDefines, m_fragmentDefines);
+        SetShaderUniforms();
+        BeginSolverStatistics();
+        m_quad.Draw();
+        EndSolverStatistics();
+        m_fbo->Unbind();
+    }
 
     // Post-processing off-screen
     PostProcess();
 
-    // Final draw to screen from FBO
+    // Final draw to screen from FBO.  This also upscales from the internal resolution.
+    GLCall(glViewport(windowViewport[0], windowViewport[1], windowViewport[2], windowViewport[3]));
     m_quad.SetShader(m_BloomShaderPath);
     SetScreenShaderUniforms();
     m_quad.Draw();
+
+    m_gpuTimer.Stop();
+    UpdateRenderScale();
+}
+
+void BlackHole::UpdateRenderScale()
+{
+    float gpuTime = m_gpuTimer.GetElapsedTime();
+    if (!m_dynamicResolution || gpuTime < 0.0f)
+    {
+        return;
+    }
+    m_averageGPUTime = (m_averageGPUTime < 0.0f) ? gpuTime : 0.9f * m_averageGPUTime + 0.1f * gpuTime;
+    m_framesSinceRescale++;
+
+    // Hysteresis: let the average settle after every change, leave the scale alone while the frame time is within
+    // a band around the target, and only change it in 5% steps.  Otherwise the resolution oscillates.
+    if (m_framesSinceRescale < 30 || (m_averageGPUTime < 1.05f * m_targetFrameTime && m_averageGPUTime > 0.75f * m_targetFrameTime))
+    {
+        return;
+    }
+    // The cost is roughly proportional to the number of pixels.  Aim for the middle of the band.
+    float scale = m_renderScale * std::sqrt(0.9f * m_targetFrameTime / m_averageGPUTime);
+    scale = std::clamp(std::round(scale * 20.0f) / 20.0f, m_minRenderScale, 1.0f);
+    if (scale != m_renderScale)
+    {
+        m_renderScale = scale;
+        CreateFBOs();
+    }
+}
+
+void BlackHole::BeginSolverStatistics()
+{
+    if (!m_countSolverSteps)
+    {
+        return;
+    }
+    if (!m_solverStatistics)
+    {
+        m_solverStatistics = std::make_shared<ShaderStorageBuffer>(3 * sizeof(unsigned int));
+    }
+    unsigned int counts[3] = { 0, 0, 0 };
+    m_solverStatistics->SetData(counts, sizeof(counts));
+    m_solverStatistics->BindBase(3);
+}
+
+void BlackHole::EndSolverStatistics()
+{
+    // Reading the totals back waits for the trace to finish, which is fine for a debugging aid.
+    if (!m_countSolverSteps)
+    {
+        return;
+    }
+    GLCall(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+    unsigned int counts[3];
+    m_solverStatistics->GetData(counts, sizeof(counts));
+    m_acceptedSteps = counts[0];
+    m_rejectedSteps = counts[1];
+    m_fp64Steps = counts[2];
+    // The viewport is still the traced area's.
+    GLint vp[4];
+    GLCall(glGetIntegerv(GL_VIEWPORT, vp));
+    m_solverStatisticsPixels = vp[2] * vp[3];
+}
+
+void BlackHole::TraceGeodesics()
+{
+    // Integrating the geodesics is almost all of the frame's cost, and with a still camera they don't change from
+    // one frame to the next.  Only re-trace when something they depend on has changed.
+    if (UsesTransferAtlas())
+    {
+        // The atlas already holds the records; the shade pass turns them to the camera's azimuth.
+        if (!m_transferAtlasGBuffer || m_transferAtlasGBuffer->GetColourAttachments().size() != m_maxDiskHits + 1)
+        {
+            UploadTransferAtlas();
+        }
+        return;
+    }
+    GeodesicTraceKey key = GetGeodesicTraceKey();
+    if (key.environment && m_geodesicTraceKey.environment)
+    {
+        // Small translations reuse the environment cache.  The draw distance follows the camera, so it goes with it.
+        float threshold = m_environmentCacheTranslation * glm::length(m_geodesicTraceKey.cameraPos);
+        if (glm::distance(key.cameraPos, m_geodesicTraceKey.cameraPos) <= threshold)
+        {
+            key.cameraPos = m_geodesicTraceKey.cameraPos;
+            key.drawDistance = m_geodesicTraceKey.drawDistance;
+        }
+    }
+    if (m_hasGeodesicTrace && key == m_geodesicTraceKey)
+    {
+        return;
+    }
+
+    if (key.environment && !m_environmentGBuffer)
+    {
+        FramebufferSpecification fbospec;
+        fbospec.width = m_environmentCacheSize;
+        fbospec.height = m_environmentCacheSize;
+        fbospec.numColouredAttachments = m_maxDiskHits + 1;
+        fbospec.format = FramebufferFormat::RGBA32F;
+        m_environmentGBuffer = std::make_shared<Framebuffer>(fbospec);
+        m_environmentGBuffer->Unbind();
+    }
+
+    if (UsesTemporalAA())
+    {
+        // Keep the last frame's records for ResolveTemporal().
+        std::swap(m_gbuffer, m_previousGBuffer);
+    }
+
+    std::shared_ptr<Framebuffer> gbuffer = GetGeodesicGBuffer();
+    GLint vp[4];
+    GLCall(glGetIntegerv(GL_VIEWPORT, vp));
+    GLCall(glViewport(0, 0, gbuffer->GetSpecification().width, gbuffer->GetSpecification().height));
+    BeginSolverStatistics();
+    if (UsesWavefrontTracer())
+    {
+        TraceWavefront();
+    }
+    else
+    {
+        std::vector<std::string> defines = GetGeodesicPassDefines("GEODESIC_TRACE");
+        if (UsesBlockPrepass())
+        {
+            TraceBlockCorners();
+            defines.push_back("GEODESIC_REFINE");
+            defines.push_back("GEODESIC_BLOCK_SIZE " + std::to_string(m_blockSize));
+        }
+        gbuffer->Bind();
+        m_quad.SetShader(m_selectedShaderString, m_vertexDefines, defines);
+        SetShaderUniforms();
+        if (UsesBlockPrepass())
+        {
+            m_quad.GetShader()->SetUniform1f("u_refineTolerance", m_refineTolerance);
+            BindGeodesicRecords(m_coarseGBuffer, "u_coarseDiskHits", "u_coarseEscapeRecord");
+        }
+        m_quad.Draw();
+        gbuffer->Unbind();
+    }
+    EndSolverStatistics();
+    GLCall(glViewport(vp[0], vp[1], vp[2], vp[3]));
+
+    m_geodesicTraceKey = key;
+    m_hasGeodesicTrace = true;
+}
+
+void BlackHole::TraceBlockCorners()
+{
+    // One geodesic per corner of every block, for the refining trace pass to interpolate between.  The viewport must
+    // be at the full resolution.
+    GLint vp[4];
+    GLCall(glGetIntegerv(GL_VIEWPORT, vp));
+    unsigned int width = vp[2] / m_blockSize + 2;
+    unsigned int height = vp[3] / m_blockSize + 2;
+    if (!m_coarseGBuffer || m_coarseGBuffer->GetSpecification().width != width
+        || m_coarseGBuffer->GetSpecification().height != height)
+    {
+        FramebufferSpecification fbospec;
+        fbospec.width = width;
+        fbospec.height = height;
+        fbospec.numColouredAttachments = m_maxDiskHits + 1;
+        fbospec.format = FramebufferFormat::RGBA32F;
+        m_coarseGBuffer = std::make_shared<Framebuffer>(fbospec);
+    }
+
+    std::vector<std::string> defines = GetGeodesicPassDefines("GEODESIC_TRACE");
+    defines.push_back("GEODESIC_PREPASS");
+    defines.push_back("GEODESIC_BLOCK_SIZE " + std::to_string(m_blockSize));
+    m_coarseGBuffer->Bind();
+    m_quad.SetShader(m_selectedShaderString, m_vertexDefines, defines);
+    // u_ScreenSize has to be the full resolution, so set the uniforms before shrinking the viewport.
+    SetShaderUniforms();
+    GLCall(glViewport(0, 0, width, height));
+    m_quad.Draw();
+    GLCall(glViewport(vp[0], vp[1], vp[2], vp[3]));
+    m_coarseGBuffer->Unbind();
+}
+
+void BlackHole::TraceWavefront()
+{
+    // The same records as the fragment trace pass, written by compute dispatches over queues of rays.  Each step
+    // dispatch advances every live ray by up to m_wavefrontStepsPerDispatch steps and compacts the ones still going
+    // into the other queue, and a one thread dispatch sizes the next step dispatch from how many that was.  The
+    // viewport must be the G-buffer's size.
+    std::shared_ptr<Framebuffer> gbuffer = GetGeodesicGBuffer();
+    unsigned int numRays = gbuffer->GetSpecification().width * gbuffer->GetSpecification().height;
+    // Must match WavefrontRay in KerrBlackHole.shader: xp, FSAL, the disk hits, the step sizes and the counters.
+    unsigned int raySize = (6 + m_maxDiskHits) * 4 * sizeof(float);
+    if (!m_wavefrontCounters || m_wavefrontQueues[0]->GetSize() != numRays * raySize)
+    {
+        m_wavefrontQueues[0] = std::make_shared<ShaderStorageBuffer>(numRays * raySize);
+        m_wavefrontQueues[1] = std::make_shared<ShaderStorageBuffer>(numRays * raySize);
+        m_wavefrontCounters = std::make_shared<ShaderStorageBuffer>(5 * sizeof(unsigned int));
+    }
+
+    // The first step dispatch's size, then every pixel's ray in the first queue and none in the second.
+    unsigned int numGroups = (numRays + m_wavefrontGroupSize - 1) / m_wavefrontGroupSize;
+    unsigned int counters[5] = { numGroups, 1, 1, numRays, 0 };
+    m_wavefrontCounters->SetData(counters, sizeof(counters));
+    m_wavefrontCounters->BindBase(2);
+    m_wavefrontCounters->BindIndirect();
+
+    std::vector<unsigned int>& attachments = gbuffer->GetColourAttachments();
+    for (unsigned int i = 0; i < attachments.size(); i++)
+    {
+        GLCall(glBindImageTexture(i, attachments[i], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F));
+    }
+
+    std::vector<std::string> defines = GetGeodesicPassDefines("WAVEFRONT_TRACE");
+    defines.push_back("WAVEFRONT_GROUP_SIZE " + std::to_string(m_wavefrontGroupSize));
+    auto getKernel = [&](const std::string& kernel)
+    {
+        std::vector<std::string> kernelDefines = defines;
+        kernelDefines.push_back(kernel);
+        return Renderer::Get().GetComputeShader(m_selectedShaderString, kernelDefines);
+    };
+    std::shared_ptr<Shader> generateShader = getKernel("WAVEFRONT_GENERATE");
+    std::shared_ptr<Shader> stepShader = getKernel("WAVEFRONT_STEP");
+    std::shared_ptr<Shader> dispatchShader = getKernel("WAVEFRONT_DISPATCH");
+
+    const Camera& camera = Application::Get().GetCamera();
+    SetShaderUniforms(generateShader);
+    generateShader->SetUniformMat4f("u_ViewInv", glm::inverse(camera.GetView()));
+    generateShader->SetUniformMat4f("u_ProjInv", glm::inverse(camera.GetProj()));
+    m_wavefrontQueues[0]->BindBase(0);
+    GLCall(glDispatchCompute(numGroups, 1, 1));
+    GLCall(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+    SetShaderUniforms(stepShader);
+    stepShader->SetUniform1i("u_stepsPerDispatch", m_wavefrontStepsPerDispatch);
+    // Every ray finishes within m_maxSteps steps, so this many rounds always empties the queues.  Minkowski rays are
+    // straight lines, which the generate dispatch already finished.
+    int numRounds = (m_maxSteps + m_wavefrontStepsPerDispatch - 1) / m_wavefrontStepsPerDispatch;
+    if (m_shaderSelector == 2)
+    {
+        numRounds = 0;
+    }
+    for (int round = 0; round < numRounds; round++)
+    {
+        int parity = round % 2;
+        m_wavefrontQueues[parity]->BindBase(0);
+        m_wavefrontQueues[1 - parity]->BindBase(1);
+
+        stepShader->Bind();
+        stepShader->SetUniform1i("u_parity", parity);
+        GLCall(glDispatchComputeIndirect(0));
+        GLCall(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+        dispatchShader->Bind();
+        dispatchShader->SetUniform1i("u_parity", parity);
+        GLCall(glDispatchCompute(1, 1, 1));
+        GLCall(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+    }
+
+    // The shade pass reads the records as textures.
+    GLCall(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT));
+    GLCall(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0));
+}
+
+void BlackHole::ResolveTemporal()
+{
+    // Blend this frame into the reprojected history.  The result becomes the scene for post-processing and the
+    // history for the next frame.
+    m_resolvedFBO->Bind();
+    m_quad.SetShader(m_temporalResolveShaderPath);
+    std::shared_ptr<Shader> shader = m_quad.GetShader();
+    shader->Bind();
+    shader->SetUniformMat4f("u_previousViewProj", m_previousViewProj);
+    shader->SetUniform1f("u_historyWeight", m_hasTemporalHistory ? m_temporalHistoryWeight : 0.0f);
+    shader->SetUniform1f("u_radiusTolerance", m_temporalRadiusTolerance);
+    shader->SetUniform1f("u_redshiftTolerance", m_temporalRedshiftTolerance);
+    shader->SetUniform1f("u_escapeTolerance", m_temporalEscapeTolerance);
+
+    const std::vector<std::pair<std::string, unsigned int>> textures = {
+        { "sceneTexture", m_fbo->GetColourAttachments()[0] },
+        { "brightTexture", m_fbo->GetColourAttachments()[1] },
+        { "historyTexture", m_historyFBO->GetColourAttachments()[0] },
+        { "historyBrightTexture", m_historyFBO->GetColourAttachments()[1] },
+        { "u_diskHit", m_gbuffer->GetColourAttachments()[0] },
+        { "u_escapeRecord", m_gbuffer->GetColourAttachments()[m_maxDiskHits] },
+        { "u_previousDiskHit", m_previousGBuffer->GetColourAttachments()[0] },
+        { "u_previousEscapeRecord", m_previousGBuffer->GetColourAttachments()[m_maxDiskHits] }
+    };
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        shader->SetUniform1i(textures[i].first, m_screenTextureSlot + i);
+        GLCall(glActiveTexture(GL_TEXTURE0 + m_screenTextureSlot + i));
+        GLCall(glBindTexture(GL_TEXTURE_2D, textures[i].second));
+    }
+    m_quad.Draw();
+    m_resolvedFBO->Unbind();
+
+    const Camera& camera = Application::Get().GetCamera();
+    m_previousViewProj = camera.GetProj() * camera.GetView();
+    m_hasTemporalHistory = true;
+    std::swap(m_historyFBO, m_resolvedFBO);
 }
 
 void BlackHole::CreateScreenQuad()
@@ -172,8 +563,11 @@ void BlackHole::CreateFBOs()
     FramebufferSpecification fbospec;
     int width, height;
     glfwGetWindowSize(Application::Get().GetWindow().GetGLFWWindow(), &width, &height);
-    fbospec.height = height;
-    fbospec.width = width;
+    fbospec.height = std::max(1, (int)std::round(m_renderScale * height));
+    fbospec.width = std::max(1, (int)std::round(m_renderScale * width));
+    Application::Get().SetRenderResolution(fbospec.width, fbospec.height);
+    m_framesSinceRescale = 0;
+    m_averageGPUTime = -1.0f;
     fbospec.numColouredAttachments = 1;
     m_pingFBO = std::make_shared<Framebuffer>(fbospec);
     m_pingFBO->Unbind();
@@ -182,14 +576,43 @@ void BlackHole::CreateFBOs()
     fbospec.numColouredAttachments = 2;
     m_fbo = std::make_shared<Framebuffer>(fbospec);
     m_fbo->Unbind();
+
+    // The geodesic G-buffer holds radii, angles and directions, so it needs full precision.
+    fbospec.numColouredAttachments = m_maxDiskHits + 1;
+    fbospec.format = FramebufferFormat::RGBA32F;
+    m_gbuffer = std::make_shared<Framebuffer>(fbospec);
+    m_gbuffer->Unbind();
+    m_hasGeodesicTrace = false;
+
+    m_coarseGBuffer.reset();
+    m_previousGBuffer.reset();
+    m_historyFBO.reset();
+    m_resolvedFBO.reset();
+    m_hasTemporalHistory = false;
+}
+
+void BlackHole::CreateTemporalFBOs()
+{
+    // Only allocated once temporal anti-aliasing is turned on.
+    m_previousGBuffer = std::make_shared<Framebuffer>(m_gbuffer->GetSpecification());
+    m_previousGBuffer->Unbind();
+    m_historyFBO = std::make_shared<Framebuffer>(m_fbo->GetSpecification());
+    m_historyFBO->Unbind();
+    m_resolvedFBO = std::make_shared<Framebuffer>(m_fbo->GetSpecification());
+    m_resolvedFBO->Unbind();
+    m_hasTemporalHistory = false;
 }
 
 void BlackHole::SetShaderUniforms()
+{
+    SetShaderUniforms(m_quad.GetShader());
+}
+
+void BlackHole::SetShaderUniforms(const std::shared_ptr<Shader>& shader)
 {
     GLint vp[4];
     GLCall(glGetIntegerv(GL_VIEWPORT, vp));
 
-    std::shared_ptr<Shader> shader = m_quad.GetShader();
     shader->Bind();
 
     float elapsedTime = Application::Get().GetTimer().GetElapsedTime();
@@ -206,11 +629,17 @@ void BlackHole::SetShaderUniforms()
     shader->SetUniform1f("u_diskThickness", m_diskThickness);
 
     shader->SetUniform1i("u_msaa", m_msaa);
+    shader->SetUniform2f("u_jitter", m_jitter);
 
     shader->SetUniform1i("u_maxSteps", m_maxSteps);
     shader->SetUniform1f("u_drawDistance", m_drawDistance);
     shader->SetUniform1i("u_ODESolver", m_ODESolverSelector);
     shader->SetUniform1f("u_tolerance", m_tolerance);
+    shader->SetUniform1f("u_hybridRadius", m_hybridRadius);
+    shader->SetUniform1f("u_fp64Band", m_fp64Band);
+    shader->SetUniform1f("u_escapeRadius", m_escapeRadius);
+    shader->SetUniform1f("u_absoluteTolerance", m_absoluteTolerance);
+    shader->SetUniform1f("u_relativeTolerance", m_relativeTolerance);
     shader->SetUniform1f("u_diskIntersectionThreshold", m_diskIntersectionThreshold);
     shader->SetUniform1f("u_sphereIntersectionThreshold", m_sphereIntersectionThreshold);
     shader->SetUniform1f("u_insideDiskStepSize", m_insideDiskStepSize);
@@ -231,6 +660,8 @@ void BlackHole::SetShaderUniforms()
     shader->SetUniform3f("u_diskDebugColourTop2", m_diskDebugColourTop2);
     shader->SetUniform3f("u_diskDebugColourBottom1", m_diskDebugColourBottom1);
     shader->SetUniform3f("u_diskDebugColourBottom2", m_diskDebugColourBottom2);
+    shader->SetUniform1i("u_showCaptureCulling", (int)m_showCaptureCulling);
+    shader->SetUniform3f("u_captureCullingColour", m_captureCullingColour);
 
     shader->SetUniform1i("u_bloom", m_useBloom);
     shader->SetUniform1f("u_bloomThreshold", m_bloomThreshold);
@@ -244,6 +675,27 @@ void BlackHole::SetShaderUniforms()
 
     glm::vec3 cameraPos = Application::Get().GetCamera().GetPosition();
     shader->SetUniform3f("u_cameraPos", cameraPos);
+    if (m_captureCulling && m_shaderSelector == 0 && !m_insideHorizon)
+    {
+        // Only re-tabulated when the camera's radius or the black hole changes.
+        m_captureCurve.Update(m_mass, m_a, CalculateKerrDistance(cameraPos));
+        shader->SetUniform1fv("u_captureCurve", CaptureCulling::NumSamples, m_captureCurve.GetCurve());
+        shader->SetUniform1f("u_captureLambdaRange", m_captureCurve.GetLambdaRange());
+        shader->SetUniform1f("u_captureMargin", m_captureCurve.GetMargin());
+    }
+    if (m_useSchwarzschildTables && m_shaderSelector == 0 && !m_insideHorizon)
+    {
+        // The tables are in units of the mass, so they're built and uploaded once.
+        if (!m_schwarzschildTableBuffer)
+        {
+            m_schwarzschildTables.Build();
+            const std::vector<float>& data = m_schwarzschildTables.GetData();
+            m_schwarzschildTableBuffer = std::make_shared<ShaderStorageBuffer>(
+                (unsigned int)(data.size() * sizeof(float)), data.data());
+        }
+        m_schwarzschildTableBuffer->BindBase(4);
+        shader->SetUniform1i("u_useSchwarzschildTables", (int)(m_a == 0.0f));
+    }
 
     if (m_diskTexture)
     {
@@ -260,6 +712,53 @@ void BlackHole::SetShaderUniforms()
     }
 }
 
+void BlackHole::SetGeodesicShadeUniforms()
+{
+    BindGeodesicRecords(GetGeodesicGBuffer(), "u_diskHits", "u_escapeRecord");
+    if (UsesEnvironmentCache() || UsesTransferAtlas())
+    {
+        // The environment cache is traced from the camera itself, so it isn't turned.
+        float azimuth = 0.0f;
+        if (UsesTransferAtlas())
+        {
+            m_transferAtlas.Covers(m_mass, m_a, m_useDebugSphereTexture, m_drawDistance,
+                Application::Get().GetCamera().GetPosition(), m_transferAtlasTolerance, azimuth);
+        }
+        m_quad.GetShader()->SetUniform1f("u_environmentAzimuth", azimuth);
+        m_quad.GetShader()->SetUniform1f("u_refineTolerance", m_refineTolerance);
+    }
+
+    if (UsesAdaptiveAA())
+    {
+        // Draw() has already reset the counts for this frame.
+        m_adaptiveRayCount->BindBase(5);
+        const FramebufferSpecification& spec = m_gbuffer->GetSpecification();
+        std::shared_ptr<Shader> shader = m_quad.GetShader();
+        shader->SetUniform1i("u_adaptiveSamples", m_adaptiveSamples);
+        shader->SetUniform1f("u_adaptiveTolerance", m_adaptiveTolerance);
+        shader->SetUniform1i("u_adaptiveRayBudget", (int)(m_adaptiveRayBudget * spec.width * spec.height));
+    }
+}
+
+void BlackHole::BindGeodesicRecords(const std::shared_ptr<Framebuffer>& gbuffer, const std::string& diskHitsName,
+    const std::string& escapeRecordName)
+{
+    // No pass reads two G-buffers, so they all use the same texture slots.
+    std::shared_ptr<Shader> shader = m_quad.GetShader();
+    shader->Bind();
+    std::vector<unsigned int>& attachments = gbuffer->GetColourAttachments();
+    for (int i = 0; i < m_maxDiskHits; i++)
+    {
+        shader->SetUniform1i(diskHitsName + "[" + std::to_string(i) + "]", m_gbufferTextureSlot + i);
+    }
+    shader->SetUniform1i(escapeRecordName, m_gbufferTextureSlot + m_maxDiskHits);
+    for (unsigned int i = 0; i < attachments.size(); i++)
+    {
+        GLCall(glActiveTexture(GL_TEXTURE0 + m_gbufferTextureSlot + i));
+        GLCall(glBindTexture(GL_TEXTURE_2D, attachments[i]));
+    }
+}
+
 void BlackHole::SetScreenShaderUniforms()
 {
     std::shared_ptr<Shader> shader = m_quad.GetShader();
@@ -271,7 +770,7 @@ void BlackHole::SetScreenShaderUniforms()
     shader->SetUniform1f("u_exposure", m_exposure);
     shader->SetUniform1f("u_gamma", m_gamma);
     GLCall(glActiveTexture(GL_TEXTURE0 + m_screenTextureSlot));
-    GLCall(glBindTexture(GL_TEXTURE_2D, m_fbo->GetColourAttachments()[0]));
+    GLCall(glBindTexture(GL_TEXTURE_2D, GetSceneFBO()->GetColourAttachments()[0]));
     GLCall(glActiveTexture(GL_TEXTURE0 + m_screenTextureSlot + 1));
     if (m_horizontalPass)
     {
@@ -306,7 +805,7 @@ void BlackHole::PostProcess()
                 GLCall(GLCall(glActiveTexture(GL_TEXTURE0 + m_screenTextureSlot)));
                 if (m_firstIteration)
                 {
-                    GLCall(glBindTexture(GL_TEXTURE_2D, m_fbo->GetColourAttachments()[1]));
+                    GLCall(glBindTexture(GL_TEXTURE_2D, GetSceneFBO()->GetColourAttachments()[1]));
                 }
                 else
                 {
@@ -319,7 +818,7 @@ void BlackHole::PostProcess()
                 GLCall(GLCall(glActiveTexture(GL_TEXTURE0 + m_screenTextureSlot)));
                 if (m_firstIteration)
                 {
-                    GLCall(glBindTexture(GL_TEXTURE_2D, m_fbo->GetColourAttachments()[1]));
+                    GLCall(glBindTexture(GL_TEXTURE_2D, GetSceneFBO()->GetColourAttachments()[1]));
                 }
                 else
                 {
@@ -344,7 +843,8 @@ float BlackHole::CalculateKerrDistance(const glm::vec3 p) const
 {
     float b = m_a * m_a - glm::dot(p, p);
     float c = -m_a * m_a * p.y * p.y;
-    float r2 = 0.5f * (-b + sqrt(b * b - 4.0f * c));
+    float sq = sqrt(b * b - 4.0f * c);
+    float r2 = (b > 0.0f) ? -2.0f * c / (b + sq) : 0.5f * (sq - b);
     return sqrt(r2);
 }
 
@@ -392,19 +892,8 @@ float BlackHole::CalculateDrawDistance()
 
 void BlackHole::CalculateISCO()
 {
-    // Calculate in the innermost stable circular orbit for a black hole with parameters mass m and rotation a.
-    // Result is the theoretically smallest inner radius for a stable accretion disk.
-    // Assumes G = c = 1
-    if (m_mass == 0)
-    {
-        // In this case, there is no stable orbit because there is no mass.  So the result is actually infinity.
-        m_risco = 0.0f;
-    }
-    float rs = 2.0f * m_mass;
-    float chi = 2.0f * m_a / rs;
-    float z1 = 1.0f + std::powf(1.0f - chi*chi, 1.0f/3.0f) * (std::powf(1.0f + chi, 1.0f/3.0f) + std::powf(1.0f - chi, 1.0f/3.0f));
-    float z2 = std::powf(3.0f*chi*chi + z1*z1, 1.0f / 2.0f);
-    m_risco = m_mass * (3.0f + z2 - std::powf((3.0f-z1)*(3.0f+z1+2.0f*z2), 1.0f / 2.0f));
+    // The disk's inner radius can't be inside the innermost stable circular orbit.
+    m_risco = CalculateISCORadius(m_mass, m_a);
     if (m_diskInnerRadius < m_risco)
     {
         m_diskInnerRadius = m_risco;
@@ -509,6 +998,54 @@ void BlackHole::ImGuiRenderStats()
                 "MSAA=1 is F, then your framerate at MSAA=x will be roughly F/(x*x).  So, for example, going from MSAA=1 "
                 "to MSAA=3 will reduce framerate by a factor of 9.");
     ImGui::SliderInt("##MSAA", &m_msaa, 1, 4, "MSAA = %d");
+    if (m_msaa == 1 && m_cacheGeodesics)
+    {
+        ImGui::Checkbox("Temporal Anti-Aliasing", &m_temporalAA);
+        ImGui::SameLine();
+        HelpMarker("Traces one ray per pixel at a different sub-pixel position each frame and blends it with the previous "
+                    "frames, which gives MSAA quality edges at the cost of MSAA=1.  Pixels that saw something different "
+                    "last frame, e.g. while the camera moves, start again from the current frame.");
+        if (!m_temporalAA)
+        {
+            ImGui::Checkbox("Adaptive Anti-Aliasing", &m_adaptiveAA);
+            ImGui::SameLine();
+            HelpMarker("Traces one ray per pixel, then more rays only in the pixels that see something different from "
+                        "a neighbour: the shadow's edge, the photon rings, the disk's edges and fine detail on the disk.  "
+                        "The budget, in rays per pixel of the screen, is shared evenly between those pixels, so a "
+                        "budget of 1 traces at most twice the rays of MSAA=1, against 16 times for MSAA=4.  They are "
+                        "traced every frame, even with a still camera.  \"Compare Shader Against CPU\" compares the "
+                        "result with MSAA=4.  Not used with the environment cache.");
+            if (m_adaptiveAA)
+            {
+                ImGui::SliderInt("##AdaptiveSamples", &m_adaptiveSamples, 2, 4, "Max Extra Rays = %d^2");
+                ImGui::SliderFloat("##AdaptiveTolerance", &m_adaptiveTolerance, 0.005f, 0.2f, "Tolerance = %.3f");
+                ImGui::SliderFloat("##AdaptiveRayBudget", &m_adaptiveRayBudget, 0.1f, 4.0f, "Ray Budget = %.1f");
+                if (m_countSolverSteps)
+                {
+                    ImGui::Text("Extra Rays: %.2f per pixel in %.1f%% of pixels", m_adaptiveRaysPerPixel,
+                        100.0f * m_adaptiveMarkedFraction);
+                }
+            }
+        }
+    }
+
+    if (ImGui::Checkbox("Dynamic Resolution", &m_dynamicResolution) && !m_dynamicResolution)
+    {
+        m_renderScale = 1.0f;
+        CreateFBOs();
+    }
+    ImGui::SameLine();
+    HelpMarker("Lowers the resolution the black hole is rendered at, down to half of the window's, whenever the GPU "
+                "takes longer than the target frame time.  The image is upscaled to the window.");
+    if (m_dynamicResolution)
+    {
+        float targetFPS = 1.0f / m_targetFrameTime;
+        if (ImGui::SliderFloat("##TargetFPS", &targetFPS, 20.0f, 240.0f, "Target FPS = %.0f"))
+        {
+            m_targetFrameTime = 1.0f / targetFPS;
+        }
+        ImGui::Text("Render Scale: %.0f%%", 100.0f * m_renderScale);
+    }
 }
 
 void BlackHole::ImGuiChooseBH()
@@ -539,14 +1076,14 @@ void BlackHole::ImGuiChooseBH()
     {
         m_selectedShaderString = m_kerrBlackHoleShaderPath;
         SetShader(m_selectedShaderString);
-        m_maxSteps = 2000;
         m_a = 0.0;
         float inner_radius = m_diskInnerRadius;
         CalculateISCO();
         m_diskInnerRadius = inner_radius;
     }
     ImGui::SameLine();
-    HelpMarker("Minkowski metric of General Relativity.  This is standard Euclidean 3-space.");
+    HelpMarker("Minkowski metric of General Relativity.  This is standard Euclidean 3-space.  Rays are straight lines, "
+        "so they are traced in closed form without any integration steps.");
 }
 
 void BlackHole::ImGuiBHProperties()
@@ -629,6 +1166,41 @@ void BlackHole::ImGuiChooseODESolver()
         "  Note that because of its high accuracy, this solver takes very large steps.  This can cause issues with "
         "detecting that the rays hit the accretion disk.  As a result, the disk may have strange holes in it.  "
         "If this occurs, decrease the Tolerance slider below.");
+    if (ImGui::RadioButton("Adaptive Tsit5", &m_ODESolverSelector, 4))
+    {
+        SetShader(m_selectedShaderString);
+    }
+    ImGui::SameLine();
+    HelpMarker("Tsitouras 5(4) Method.  Costs the same per step as Dormand-Prince, but is more accurate, so it takes "
+        "fewer steps for the same tolerance.  Also see the note on RK4/5 about holes in the disk.");
+    if (ImGui::RadioButton("Adaptive Verner 6(5)", &m_ODESolverSelector, 5))
+    {
+        SetShader(m_selectedShaderString);
+    }
+    ImGui::SameLine();
+    HelpMarker("Verner's 6(5) Method.  Each step costs more than Dormand-Prince, but at small tolerances it needs far "
+        "fewer of them.  Best for still images with a low tolerance.");
+    if (ImGui::RadioButton("Automatic RK2/3 + RK4/5", &m_ODESolverSelector, 8))
+    {
+        SetShader(m_selectedShaderString);
+    }
+    ImGui::SameLine();
+    HelpMarker("Chooses the solver for every step of every light ray: Dormand-Prince far from the black hole and "
+        "wherever the last step's error was well under the tolerance, Bogacki-Shampine elsewhere.  Set the distance "
+        "beyond which it always uses Dormand-Prince with the Switch Radius slider below.");
+    if (m_ODESolverSelector == 8)
+    {
+        ImGui::SliderFloat("##HybridRadius", &m_hybridRadius, 4.0f, 30.0f, "Switch Radius = %.1f M");
+    }
+    if (ImGui::RadioButton("Gauss-Legendre", &m_ODESolverSelector, 7))
+    {
+        SetShader(m_selectedShaderString);
+    }
+    ImGui::SameLine();
+    HelpMarker("Two stage Gauss-Legendre Method.  Implicit, and symplectic at a fixed step size.  It takes the same "
+        "steps as Classic RK4, which grow with the distance, so it isn't symplectic here, but the light rays drift off "
+        "the null cone less than with RK4.  Each step costs several evaluations.  The CPU comparison reports the drift "
+        "of H.");
 }
 
 void BlackHole::ImGuiSimQuality()
@@ -642,17 +1214,167 @@ void BlackHole::ImGuiSimQuality()
     ImGui::SliderInt("##MaxSteps", &m_maxSteps, 1, 1000, "Max Steps = %d");
     ImGui::SliderFloat("##Disk Intersection Threshold", &m_diskIntersectionThreshold, 0.0001f, 0.1f, "Disk Intersection Error = %.4f");
     ImGui::SliderFloat("##Sphere Intersection Threshold", &m_sphereIntersectionThreshold, 0.0001f, 0.1f, "Sphere Intersection Error = %.4f");
+    if (m_shaderSelector == 0 && !m_insideHorizon)
+    {
+        if (ImGui::Checkbox("Far-Field Escape", &m_farFieldEscape))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        ImGui::SameLine();
+        HelpMarker("Stops integrating rays that are heading away from the black hole beyond the Escape Radius and the "
+            "disk, and bends them the rest of the way to the draw distance with the weak-field deflection.  Most of "
+            "the steps of the sky's pixels are spent out there.");
+        if (m_farFieldEscape)
+        {
+            ImGui::SliderFloat("##EscapeRadius", &m_escapeRadius, 20.0f, 60.0f, "Escape Radius = %.0f M");
+        }
+        if (ImGui::Checkbox("Capture Culling", &m_captureCulling))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        ImGui::SameLine();
+        HelpMarker("Skips the rays that are bound to fall into the black hole, i.e. those inside the critical curve of "
+            "the photon shell, unless they could cross the disk on the way in.  Decided from each ray's constants of "
+            "motion before it takes a step, so most of the shadow costs nothing.  Not used with the sphere's debug "
+            "texture.  \"Show Culled Rays\" in the debug options colours them.");
+        if (ImGui::Checkbox("Schwarzschild Tables", &m_useSchwarzschildTables))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        ImGui::SameLine();
+        HelpMarker("For a = 0, reads each ray's crossings of the disk's plane and where it ends from tables of the "
+            "Schwarzschild orbits instead of integrating it.  The tables are built once, as they don't depend on the "
+            "mass or the camera.  Rays very close to the photon sphere, and those in the disk's plane, are still "
+            "integrated.");
+    }
     if (m_use3DDisk)
     {
         ImGui::SliderFloat("##Inside Disk Stepsize", &m_insideDiskStepSize, 0.001f, 1.0f, "Inside Disk Stepsize = %.3f");
     }
-    if (m_ODESolverSelector == 2 || m_ODESolverSelector == 3)
+    ImGui::Checkbox("Cache Geodesics", &m_cacheGeodesics);
+    ImGui::SameLine();
+    HelpMarker("Only trace the light rays again when the camera, the black hole or the simulation quality changes.  "
+        "The disk's rotation and lighting are applied to the stored rays each frame, which makes a still camera much "
+        "faster.  Not used with MSAA.");
+    if (m_cacheGeodesics)
+    {
+        if (ImGui::Checkbox("Cache Environment", &m_cacheEnvironment) && !m_cacheEnvironment)
+        {
+            m_environmentGBuffer.reset();
+        }
+        ImGui::SameLine();
+        HelpMarker("Trace the light rays in every direction around the camera, so that looking around doesn't trace "
+            "them again.  Moving the camera still does.  The rays are stored at a fixed resolution and interpolated "
+            "where the Refine Tolerance allows, so fine detail is lost with a narrow FOV.  Uses about 350 MB of "
+            "video memory.");
+
+        ImGui::Checkbox("Transfer Atlas", &m_useTransferAtlas);
+        ImGui::SameLine();
+        HelpMarker("Shade from records traced in advance with --atlas in headless mode, for every direction from every "
+            "camera on one circle around the spin axis.  Nothing is traced while the camera stays on that circle, "
+            "to within the tolerance, for the same mass and spin.  Otherwise the rays are traced as usual.");
+        if (m_useTransferAtlas)
+        {
+            ImGui::InputText("##TransferAtlasPath", m_transferAtlasPath, sizeof(m_transferAtlasPath));
+            ImGui::SameLine();
+            if (ImGui::Button("Load Atlas"))
+            {
+                LoadTransferAtlas();
+            }
+            ImGui::SliderFloat("##TransferAtlasTolerance", &m_transferAtlasTolerance, 0.0001f, 0.01f,
+                "Atlas Tolerance = %.4f");
+            if (!m_transferAtlasStatus.empty())
+            {
+                ImGui::Text("%s", m_transferAtlasStatus.c_str());
+            }
+            if (m_transferAtlas.IsLoaded())
+            {
+                ImGui::Text("Camera is %s the atlas's circle.", UsesTransferAtlas() ? "on" : "off");
+            }
+        }
+
+        ImGui::Checkbox("Block Prepass", &m_blockPrepass);
+        ImGui::SameLine();
+        HelpMarker("Traces one light ray per corner of each block of pixels first.  Only blocks whose corners see "
+            "something different, like the edge of the shadow or the photon ring, are traced at full resolution.  "
+            "The rest are interpolated.  A larger tolerance traces fewer rays, but can miss thin features.");
+        if (m_blockPrepass)
+        {
+            ImGui::SliderInt("##BlockSize", &m_blockSize, 2, 16, "Block Size = %d");
+        }
+        if (m_blockPrepass || m_cacheEnvironment || m_useTransferAtlas)
+        {
+            ImGui::SliderFloat("##RefineTolerance", &m_refineTolerance, 0.005f, 0.2f, "Refine Tolerance = %.3f");
+        }
+
+        ImGui::Checkbox("Wavefront Tracer", &m_wavefrontTracer);
+        ImGui::SameLine();
+        HelpMarker("Trace the light rays with compute shaders that advance them a few steps at a time and drop the "
+            "finished ones between dispatches, so that rays which escape quickly don't wait on their neighbours.  "
+            "Gives the same image.  Not used with the environment cache or the block prepass.");
+        if (m_wavefrontTracer)
+        {
+            ImGui::SliderInt("##StepsPerDispatch", &m_wavefrontStepsPerDispatch, 1, 64, "Steps Per Dispatch = %d");
+        }
+    }
+    if (m_shaderSelector == 0)
+    {
+        if (ImGui::Checkbox("Double Precision Near Horizon", &m_fp64Refinement))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        ImGui::SameLine();
+        HelpMarker("Takes the steps within the band around the horizon, and those of rays circling the photon orbits, "
+            "in double precision, where single precision loses accuracy.  The band is twice as wide for spins above "
+            "0.95.  Most GPUs are much slower in double precision; count the solver steps to see what it costs.");
+        if (m_fp64Refinement)
+        {
+            ImGui::SliderFloat("##FP64Band", &m_fp64Band, 0.0f, 3.0f, "Band = %.2f M");
+        }
+    }
+    if (UsesAdaptiveSolver())
     {
         ImGui::Text("Tolerance:");
         ImGui::SameLine();
         HelpMarker("Tolerance is the maximum allowed local error in the integration step.  A smaller tolerance leads to"
         " a more accurate simulation.");
-        ImGui::SliderFloat("##Tolerance", &m_tolerance, 0.00005f, 0.01f, "Tolerance = %.5f");
+        if (ImGui::Checkbox("PI Step Control", &m_PIController))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        ImGui::SameLine();
+        HelpMarker("Chooses each step from the error of the last two steps instead of just the last one, and measures "
+            "the error of every position and momentum component relative to its size.  This rejects fewer steps "
+            "near the horizon, where the error changes quickly.");
+        if (m_PIController)
+        {
+            ImGui::SliderFloat("##AbsoluteTolerance", &m_absoluteTolerance, 0.000001f, 0.01f, "Absolute Tolerance = %.6f",
+                ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("##RelativeTolerance", &m_relativeTolerance, 0.000001f, 0.01f, "Relative Tolerance = %.6f",
+                ImGuiSliderFlags_Logarithmic);
+        }
+        else
+        {
+            ImGui::SliderFloat("##Tolerance", &m_tolerance, 0.00005f, 0.01f, "Tolerance = %.5f");
+        }
+
+        if (ImGui::Checkbox("Count Solver Steps", &m_countSolverSteps))
+        {
+            SetShader(m_selectedShaderString);
+        }
+        if (m_countSolverSteps)
+        {
+            unsigned int totalSteps = m_acceptedSteps + m_rejectedSteps;
+            ImGui::Text("Accepted: %u  Rejected: %u (%.1f%%)", m_acceptedSteps, m_rejectedSteps,
+                totalSteps ? 100.0f * m_rejectedSteps / totalSteps : 0.0f);
+            if (m_fp64Refinement && m_shaderSelector == 0)
+            {
+                // The double precision steps are counted separately from the adaptive solver's.
+                ImGui::Text("Double Precision: %u (%.2f per pixel, %.1f%% of steps)", m_fp64Steps,
+                    m_solverStatisticsPixels ? (float)m_fp64Steps / m_solverStatisticsPixels : 0.0f,
+                    (m_fp64Steps + m_acceptedSteps) ? 100.0f * m_fp64Steps / (m_fp64Steps + m_acceptedSteps) : 0.0f);
+            }
+        }
     }
 }
 
@@ -682,6 +1404,69 @@ void BlackHole::ImGuiDebug()
         ImGui::Text("Sphere Debug Colour 2");
         ImGui::ColorEdit3("##SphereColour2", &m_sphereDebugColour2[0]);
     }
+    if (m_captureCulling)
+    {
+        ImGui::Checkbox("Show Culled Rays", &m_showCaptureCulling);
+        if (m_showCaptureCulling)
+        {
+            ImGui::ColorEdit3("##CaptureCullingColour", &m_captureCullingColour[0]);
+        }
+    }
+
+    ImGui::Separator();
+    ImGuiCPUReference();
+}
+
+void BlackHole::ImGuiCPUReference()
+{
+    ImGui::Text("CPU Reference:");
+    ImGui::SameLine();
+    HelpMarker("Renders the current frame again with the CPU renderer and compares it against the shader's output.  "
+               "Both images are saved as linear .hdr files next to the executable.  This is slow: expect seconds to "
+               "minutes depending on resolution, MSAA and core count.");
+
+    bool rendering = m_cpuReferenceFuture.valid();
+    if (rendering && m_cpuReferenceFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        m_cpuReferenceResult = m_cpuReferenceFuture.get();
+        m_hasCPUReferenceResult = true;
+        rendering = false;
+    }
+
+    if (rendering)
+    {
+        ImGui::Text("Rendering on the CPU...");
+    }
+    else if (ImGui::Button("Compare Shader Against CPU"))
+    {
+        StartCPUReference();
+    }
+
+    if (m_hasCPUReferenceResult)
+    {
+        const ImageDifference& diff = m_cpuReferenceResult.difference;
+        ImGui::Text("CPU time: %.2f s on %u threads at MSAA=%d", m_cpuReferenceResult.renderTime,
+            m_cpuReferenceResult.numThreads, m_cpuReferenceResult.msaa);
+        ImGui::Text("Mean |diff| = %.5f", diff.meanAbsDiff);
+        ImGui::Text("RMS diff = %.5f", diff.rmsDiff);
+        ImGui::Text("Max |diff| = %.5f", diff.maxAbsDiff);
+        ImGui::Text("Mismatched pixels = %.3f%%", 100.0f * diff.fractionMismatched);
+        ImGui::Text("H drift per ray: mean %.2e, max %.2e", m_cpuReferenceResult.meanHDrift,
+            m_cpuReferenceResult.maxHDrift);
+
+        // Fraction of the frame each thread spent rendering tiles.
+        std::vector<float> busy;
+        for (const WorkerStats& stats : m_cpuReferenceResult.workerStats)
+        {
+            double total = stats.busySeconds + stats.idleSeconds;
+            busy.push_back(total > 0.0 ? (float)(stats.busySeconds / total) : 0.0f);
+        }
+        if (!busy.empty())
+        {
+            ImGui::PlotHistogram("##ThreadBusy", busy.data(), (int)busy.size(), 0, "Busy time per thread", 0.0f, 1.0f,
+                ImVec2(0.0f, 60.0f));
+        }
+    }
 }
 
 void BlackHole::ImGuiCinematic()
@@ -741,6 +1526,110 @@ void BlackHole::SetProjectionMatrix()
     m_quad.SetProjection(camera_proj, false);
 }
 
+BlackHoleParameters BlackHole::GetParameters() const
+{
+    // Snapshot of everything SetShaderUniforms() and SetShaderDefines() pass to the black hole shader.
+    BlackHoleParameters params;
+    params.metric = m_shaderSelector;
+    params.insideHorizon = m_insideHorizon && m_shaderSelector != 1;
+    params.ODESolver = m_ODESolverSelector;
+
+    params.mass = m_mass;
+    params.a = m_a;
+    params.dMdt = m_dMdt;
+    params.risco = m_risco;
+    params.innerRadius = m_diskInnerRadius;
+    params.outerRadius = m_diskOuterRadius;
+    params.Tmax = m_Tmax;
+    params.diskRotationAngle = m_diskRotationAngle;
+
+    params.msaa = m_msaa;
+    params.maxSteps = m_maxSteps;
+    params.drawDistance = m_drawDistance;
+    params.tolerance = m_tolerance;
+    params.hybridRadius = m_hybridRadius;
+    params.fp64Refinement = m_fp64Refinement && m_shaderSelector == 0;
+    params.fp64Band = m_fp64Band;
+    params.farFieldEscape = m_farFieldEscape && m_shaderSelector == 0;
+    params.escapeRadius = m_escapeRadius;
+    params.captureCulling = m_captureCulling && m_shaderSelector == 0;
+    params.schwarzschildTables = m_useSchwarzschildTables && m_shaderSelector == 0;
+    params.PIController = m_PIController;
+    params.absoluteTolerance = m_absoluteTolerance;
+    params.relativeTolerance = m_relativeTolerance;
+    params.diskIntersectionThreshold = m_diskIntersectionThreshold;
+    params.sphereIntersectionThreshold = m_sphereIntersectionThreshold;
+
+    params.useSphereTexture = m_useSphereTexture;
+    params.useDebugSphereTexture = m_useDebugSphereTexture;
+    params.drawBasicDisk = m_drawBasicDisk;
+    params.transparentDisk = m_transparentDisk;
+    params.useDebugDiskTexture = m_useDebugDiskTexture;
+    params.sphereDebugColour1 = m_sphereDebugColour1;
+    params.sphereDebugColour2 = m_sphereDebugColour2;
+    params.showCaptureCulling = m_showCaptureCulling;
+    params.captureCullingColour = m_captureCullingColour;
+    params.diskDebugDivisions = m_diskDebugDivisions;
+    params.diskDebugColourTop1 = m_diskDebugColourTop1;
+    params.diskDebugColourTop2 = m_diskDebugColourTop2;
+    params.diskDebugColourBottom1 = m_diskDebugColourBottom1;
+    params.diskDebugColourBottom2 = m_diskDebugColourBottom2;
+
+    params.diskAbsorption = m_diskAbsorption;
+    params.bloomBackgroundMultiplier = m_bloomBackgroundMultiplier;
+    params.bloomDiskMultiplier = m_bloomDiskMultiplier;
+    params.brightnessFromDiskVel = m_brightnessFromDiskVel;
+    params.blueshiftPower = m_blueshiftPower;
+    params.exposure = m_exposure;
+    params.gamma = m_gamma;
+
+    const Camera& camera = Application::Get().GetCamera();
+    params.width = m_fbo->GetSpecification().width;
+    params.height = m_fbo->GetSpecification().height;
+    params.cameraPos = camera.GetPosition();
+    params.viewInv = glm::inverse(camera.GetView());
+    params.projInv = glm::inverse(camera.GetProj());
+    return params;
+}
+
+void BlackHole::StartCPUReference()
+{
+    BlackHoleParameters params = GetParameters();
+    // Adaptive anti-aliasing is compared against the MSAA=4 image it stands in for, rather than the one ray per pixel
+    // it starts from.
+    if (UsesAdaptiveAA())
+    {
+        params.msaa = 4;
+    }
+
+    // Read back the shader's output for this frame before it gets overwritten.
+    PixelBuffer gpuPixels((size_t)params.width * params.height);
+    GLCall(glBindTexture(GL_TEXTURE_2D, m_fbo->GetColourAttachments()[0]));
+    GLCall(glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, gpuPixels.data()));
+    GLCall(glBindTexture(GL_TEXTURE_2D, 0));
+
+    // The CPU render runs on its own thread pool so the UI stays responsive.
+    m_cpuReferenceFuture = std::async(std::launch::async,
+        [params, gpuPixels = std::move(gpuPixels), cubeTexturePaths = m_cubeTexturePaths,
+        cpuFileName = m_cpuReferenceFileName, gpuFileName = m_gpuReferenceFileName]()
+        {
+            CPUReferenceResult result;
+            CPUCubeMap skybox(cubeTexturePaths);
+            ThreadPool pool;
+            CPURenderer renderer(params, skybox);
+            result.renderTime = renderer.Render(pool);
+            result.numThreads = pool.GetNumThreads();
+            result.msaa = params.msaa;
+            result.workerStats = pool.GetStats();
+            result.difference = CompareImages(gpuPixels, renderer.GetPixels());
+            result.meanHDrift = renderer.GetMeanHDrift();
+            result.maxHDrift = renderer.GetMaxHDrift();
+            renderer.WriteHDR(cpuFileName);
+            CPURenderer::WriteHDR(gpuFileName, params.width, params.height, gpuPixels);
+            return result;
+        });
+}
+
 void BlackHole::SetGraphicsPreset(const graphicsPreset &preset)
 {
     m_diskInnerRadius = preset.innerRadius;
@@ -784,6 +1673,22 @@ void BlackHole::SetShaderDefines()
         {
             m_fragmentDefines.push_back("INSIDE_HORIZON");
         }
+        if (m_fp64Refinement)
+        {
+            m_fragmentDefines.push_back("FP64_REFINEMENT");
+        }
+        if (m_farFieldEscape && !m_insideHorizon)
+        {
+            m_fragmentDefines.push_back("FAR_FIELD_ESCAPE");
+        }
+        if (m_captureCulling && !m_insideHorizon)
+        {
+            m_fragmentDefines.push_back("CAPTURE_CULLING");
+        }
+        if (m_useSchwarzschildTables && !m_insideHorizon)
+        {
+            m_fragmentDefines.push_back("SCHWARZSCHILD_TABLES");
+        }
         break;
     case 1:
         // Classical black hole
@@ -803,4 +1708,199 @@ void BlackHole::SetShaderDefines()
         // Classical ray-traced flatspace.
         break;
     }
+
+    if (m_PIController && UsesAdaptiveSolver())
+    {
+        m_fragmentDefines.push_back("PI_CONTROLLER");
+    }
+    if (m_countSolverSteps)
+    {
+        m_fragmentDefines.push_back("SOLVER_STATISTICS");
+    }
+}
+
+bool BlackHole::UsesGeodesicGBuffer() const
+{
+    // Storing every MSAA sample's geodesic would multiply the G-buffer's size by msaa^2, so MSAA uses the single pass.
+    return m_cacheGeodesics && m_msaa == 1;
+}
+
+bool BlackHole::UsesEnvironmentCache() const
+{
+    // The environment cache's fixed directions can't be jittered, so temporal anti-aliasing takes precedence.
+    return UsesGeodesicGBuffer() && m_cacheEnvironment && !m_temporalAA;
+}
+
+bool BlackHole::UsesTransferAtlas() const
+{
+    // Only the Kerr shader outside the horizon has the records the atlas stores, and like the environment cache it
+    // can't be jittered.
+    float azimuth;
+    return UsesGeodesicGBuffer() && m_useTransferAtlas && !m_temporalAA && m_shaderSelector == 0 && !m_insideHorizon
+        && m_transferAtlas.Covers(m_mass, m_a, m_useDebugSphereTexture, m_drawDistance,
+            Application::Get().GetCamera().GetPosition(), m_transferAtlasTolerance, azimuth);
+}
+
+bool BlackHole::UsesTemporalAA() const
+{
+    return UsesGeodesicGBuffer() && m_temporalAA;
+}
+
+bool BlackHole::UsesAdaptiveAA() const
+{
+    // The neighbours it compares are the screen's, and temporal anti-aliasing already spreads its rays over the pixel.
+    return UsesGeodesicGBuffer() && m_adaptiveAA && !m_temporalAA && !UsesEnvironmentCache() && !UsesTransferAtlas();
+}
+
+bool BlackHole::UsesBlockPrepass() const
+{
+    return UsesGeodesicGBuffer() && m_blockPrepass && !UsesEnvironmentCache() && !UsesWavefrontTracer();
+}
+
+bool BlackHole::UsesWavefrontTracer() const
+{
+    // Only the screen's trace pass has a compute version.
+    return UsesGeodesicGBuffer() && m_wavefrontTracer && !UsesEnvironmentCache();
+}
+
+bool BlackHole::UsesAdaptiveSolver() const
+{
+    // The embedded Runge-Kutta pairs and the automatic solver that switches between two of them.
+    return (m_ODESolverSelector >= 2 && m_ODESolverSelector <= 5) || m_ODESolverSelector == 8;
+}
+
+std::shared_ptr<Framebuffer> BlackHole::GetGeodesicGBuffer() const
+{
+    if (UsesTransferAtlas())
+    {
+        return m_transferAtlasGBuffer;
+    }
+    return UsesEnvironmentCache() ? m_environmentGBuffer : m_gbuffer;
+}
+
+std::shared_ptr<Framebuffer> BlackHole::GetSceneFBO() const
+{
+    // The frame after temporal resolve, if it's on.  Otherwise the black hole shader's output.
+    return (UsesTemporalAA() && m_historyFBO) ? m_historyFBO : m_fbo;
+}
+
+GeodesicTraceKey BlackHole::GetGeodesicTraceKey() const
+{
+    GeodesicTraceKey key;
+    key.environment = UsesEnvironmentCache();
+    key.shaderSelector = m_shaderSelector;
+    key.insideHorizon = m_insideHorizon;
+    key.ODESolver = m_ODESolverSelector;
+    key.mass = m_mass;
+    key.a = m_a;
+    key.maxSteps = m_maxSteps;
+    key.drawDistance = m_drawDistance;
+    key.tolerance = m_tolerance;
+    key.hybridRadius = m_hybridRadius;
+    key.PIController = m_PIController;
+    key.absoluteTolerance = m_absoluteTolerance;
+    key.relativeTolerance = m_relativeTolerance;
+    key.countSolverSteps = m_countSolverSteps;
+    key.fp64Refinement = m_fp64Refinement;
+    key.fp64Band = m_fp64Band;
+    key.farFieldEscape = m_farFieldEscape;
+    key.escapeRadius = m_escapeRadius;
+    // The trace records every crossing of the disk's plane so that the radii can change afterwards, but rays stop
+    // early beyond the outer radius with the far-field escape, so then it depends on the outer radius as well.
+    key.escapeOuterRadius = m_farFieldEscape ? m_diskOuterRadius : 0.0f;
+    // Likewise, culled rays don't record their crossings inside the inner radius.
+    key.captureCulling = m_captureCulling;
+    key.captureInnerRadius = m_captureCulling ? m_diskInnerRadius : 0.0f;
+    key.schwarzschildTables = m_useSchwarzschildTables;
+    key.diskIntersectionThreshold = m_diskIntersectionThreshold;
+    key.sphereIntersectionThreshold = m_sphereIntersectionThreshold;
+    key.useDebugSphereTexture = m_useDebugSphereTexture;
+
+    const Camera& camera = Application::Get().GetCamera();
+    key.cameraPos = camera.GetPosition();
+    key.jitter = m_jitter;
+    key.blockPrepass = UsesBlockPrepass();
+    key.blockSize = m_blockSize;
+    key.refineTolerance = m_refineTolerance;
+    key.wavefront = UsesWavefrontTracer();
+    key.stepsPerDispatch = m_wavefrontStepsPerDispatch;
+    if (key.environment)
+    {
+        // The environment cache doesn't depend on where the camera looks.
+        key.width = m_environmentCacheSize;
+        key.height = m_environmentCacheSize;
+        return key;
+    }
+
+    GLint vp[4];
+    GLCall(glGetIntegerv(GL_VIEWPORT, vp));
+    key.width = vp[2];
+    key.height = vp[3];
+    key.view = camera.GetView();
+    key.proj = camera.GetProj();
+    return key;
+}
+
+std::vector<std::string> BlackHole::GetGeodesicPassDefines(const std::string& pass) const
+{
+    std::vector<std::string> defines = m_fragmentDefines;
+    defines.push_back(pass);
+    if (UsesEnvironmentCache() || UsesTransferAtlas())
+    {
+        defines.push_back("GEODESIC_ENVIRONMENT");
+    }
+    defines.push_back("MAX_DISK_HITS " + std::to_string(m_maxDiskHits));
+    return defines;
+}
+
+void BlackHole::LoadTransferAtlas()
+{
+    m_transferAtlasGBuffer.reset();
+    if (!m_transferAtlas.Load(m_transferAtlasPath))
+    {
+        m_transferAtlasStatus = "Couldn't load " + std::string(m_transferAtlasPath) + ".";
+        return;
+    }
+    const TransferAtlas::Header& header = m_transferAtlas.GetHeader();
+    char status[128];
+    std::snprintf(status, sizeof(status), "r = %.2f M, inclination = %.1f deg, a = %.3f, %u^2 texels", header.radius,
+        glm::degrees(header.inclination), header.a, header.size);
+    m_transferAtlasStatus = status;
+}
+
+void BlackHole::UploadTransferAtlas()
+{
+    // The file's planes are already laid out as the G-buffer's textures, so they go up as they are.  Disk hits past
+    // the atlas's are left empty, and the ones the G-buffer has no room for are dropped.
+    const TransferAtlas::Header& header = m_transferAtlas.GetHeader();
+    FramebufferSpecification fbospec;
+    fbospec.width = header.size;
+    fbospec.height = header.size;
+    fbospec.numColouredAttachments = m_maxDiskHits + 1;
+    fbospec.format = FramebufferFormat::RGBA32F;
+    m_transferAtlasGBuffer = std::make_shared<Framebuffer>(fbospec);
+    m_transferAtlasGBuffer->Unbind();
+
+    std::vector<unsigned int>& attachments = m_transferAtlasGBuffer->GetColourAttachments();
+    std::vector<glm::vec4> empty;
+    for (int i = 0; i <= m_maxDiskHits; i++)
+    {
+        const glm::vec4* plane = nullptr;
+        if (i == m_maxDiskHits)
+        {
+            plane = m_transferAtlas.GetPlane(header.numDiskHits);
+        }
+        else if (i < (int)header.numDiskHits)
+        {
+            plane = m_transferAtlas.GetPlane(i);
+        }
+        else
+        {
+            empty.resize((size_t)header.size * header.size, glm::vec4(0.0f));
+            plane = empty.data();
+        }
+        GLCall(glBindTexture(GL_TEXTURE_2D, attachments[i]));
+        GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, header.size, header.size, GL_RGBA, GL_FLOAT, plane));
+    }
+    GLCall(glBindTexture(GL_TEXTURE_2D, 0));
 }
@@ -3,11 +3,19 @@
 #include "Texture.h"
 #include "Shapes.h"
 #include "Framebuffer.h"
+#include "GPUTimer.h"
+#include "ShaderStorageBuffer.h"
+#include "cpu/BlackHoleParameters.h"
+#include "cpu/CPURenderer.h"
+#include "cpu/CaptureCulling.h"
+#include "cpu/SchwarzschildTables.h"
+#include "cpu/TransferAtlas.h"
 
 #include "glm/gtc/matrix_transform.hpp"
 
 #include <vector>
 #include <iostream>
+#include <future>
 
 
 struct graphicsPreset {
@@ -27,6 +35,59 @@ struct graphicsPreset {
 	float gamma;
 };
 
+struct CPUReferenceResult {
+	ImageDifference difference;
+	float renderTime = 0.0f;
+	unsigned int numThreads = 0;
+	int msaa = 1;
+	std::vector<WorkerStats> workerStats;
+	double meanHDrift = 0.0;
+	double maxHDrift = 0.0;
+};
+
+struct GeodesicTraceKey {
+	// Everything the geodesics in the trace pass depend on.  The disk's radii, rotation and lighting aren't in here
+	// because the shade pass applies them.
+	bool environment = false;
+	int shaderSelector = -1;
+	bool insideHorizon = false;
+	int ODESolver = 0;
+	float mass = 0.0f;
+	float a = 0.0f;
+	int maxSteps = 0;
+	float drawDistance = 0.0f;
+	float tolerance = 0.0f;
+	float hybridRadius = 0.0f;
+	bool PIController = false;
+	float absoluteTolerance = 0.0f;
+	float relativeTolerance = 0.0f;
+	bool countSolverSteps = false;
+	bool fp64Refinement = false;
+	float fp64Band = 0.0f;
+	bool farFieldEscape = false;
+	float escapeRadius = 0.0f;
+	float escapeOuterRadius = 0.0f;
+	bool captureCulling = false;
+	float captureInnerRadius = 0.0f;
+	bool schwarzschildTables = false;
+	float diskIntersectionThreshold = 0.0f;
+	float sphereIntersectionThreshold = 0.0f;
+	bool useDebugSphereTexture = false;
+	int width = 0;
+	int height = 0;
+	glm::vec3 cameraPos = glm::vec3(0.0f);
+	glm::mat4 view = glm::mat4(1.0f);
+	glm::mat4 proj = glm::mat4(1.0f);
+	glm::vec2 jitter = glm::vec2(0.0f);
+	bool blockPrepass = false;
+	int blockSize = 0;
+	float refineTolerance = 0.0f;
+	bool wavefront = false;
+	int stepsPerDispatch = 0;
+
+	bool operator==(const GeodesicTraceKey&) const = default;
+};
+
 class BlackHole
 {
 public:
@@ -36,6 +97,10 @@ public:
 	void OnUpdate();
 	void OnClick(int x, int y);
 	void Draw();
+	void TraceGeodesics();
+	void TraceBlockCorners();
+	void TraceWavefront();
+	void ResolveTemporal();
 	void PostProcess();
 
 	void CreateScreenQuad();
@@ -43,8 +108,16 @@ public:
 	void CompileBHShaders();
 	void CompilePostShaders() const;
 	void CreateFBOs();
+	void CreateTemporalFBOs();
+	void UpdateRenderScale();
+	void BeginSolverStatistics();
+	void EndSolverStatistics();
 
 	void SetShaderUniforms();
+	void SetShaderUniforms(const std::shared_ptr<Shader>& shader);
+	void SetGeodesicShadeUniforms();
+	void BindGeodesicRecords(const std::shared_ptr<Framebuffer>& gbuffer, const std::string& diskHitsName,
+		const std::string& escapeRecordName);
 	void SetScreenShaderUniforms();
 
 	float CalculateKerrDistance(const glm::vec3 p) const;
@@ -59,6 +132,7 @@ public:
 	void ImGuiChooseODESolver();
 	void ImGuiSimQuality();
 	void ImGuiDebug();
+	void ImGuiCPUReference();
 	void ImGuiCinematic();
 
 	void OnResize();
@@ -66,6 +140,23 @@ public:
 	void SetGraphicsPreset(const graphicsPreset &preset);
 	void SetShader(const std::string& filePath);
 	void SetShaderDefines();
+	bool UsesGeodesicGBuffer() const;
+	bool UsesEnvironmentCache() const;
+	bool UsesTransferAtlas() const;
+	bool UsesTemporalAA() const;
+	bool UsesAdaptiveAA() const;
+	bool UsesBlockPrepass() const;
+	bool UsesWavefrontTracer() const;
+	bool UsesAdaptiveSolver() const;
+	std::shared_ptr<Framebuffer> GetGeodesicGBuffer() const;
+	std::shared_ptr<Framebuffer> GetSceneFBO() const;
+	GeodesicTraceKey GetGeodesicTraceKey() const;
+	std::vector<std::string> GetGeodesicPassDefines(const std::string& pass) const;
+	void LoadTransferAtlas();
+	void UploadTransferAtlas();
+
+	BlackHoleParameters GetParameters() const;
+	void StartCPUReference();
 
 private:
 	float m_mass = 1.0f;
@@ -108,12 +199,23 @@ private:
 		{ "Realistic", 3.85f, 0.6f, 10000.0f, 3.0f, 0.0f, 1.0f, 3000.0f, 1.0f, 4.0f, true, 4.0f, 1.0f, 0.5f },
 	};
 
+	// Dynamic resolution: the black hole is rendered at m_renderScale times the window's size, adjusted to keep the
+	// measured GPU time per frame near m_targetFrameTime.  FinalBloom upscales it to the window.
+	bool m_dynamicResolution = false;
+	float m_targetFrameTime = 1.0f / 60.0f;
+	float m_renderScale = 1.0f;
+	float m_minRenderScale = 0.5f;
+	float m_averageGPUTime = -1.0f;
+	int m_framesSinceRescale = 0;
+	GPUTimer m_gpuTimer;
+
 	bool m_ImGuiFirstTime = true;
 	bool m_ImGuiAllowMoveableDock = true;
 
 	std::string m_kerrBlackHoleShaderPath = "res/shaders/KerrBlackHole.shader";
 	std::string m_gaussianBlurShaderPath = "res/shaders/GaussianBlur.shader";
 	std::string m_BloomShaderPath = "res/shaders/FinalBloom.shader";
+	std::string m_temporalResolveShaderPath = "res/shaders/TemporalResolve.shader";
 	int m_shaderSelector = 0;
 	std::string m_selectedShaderString = m_kerrBlackHoleShaderPath;
 	std::vector<std::string> m_vertexDefines = {};
@@ -124,6 +226,76 @@ private:
 	std::shared_ptr<Framebuffer> m_pingFBO;
 	std::shared_ptr<Framebuffer> m_pongFBO;
 
+	// Geodesic G-buffer: the trace pass writes m_maxDiskHits disk plane crossings and an escape record per pixel.
+	bool m_cacheGeodesics = true;
+	int m_maxDiskHits = 4;
+	std::shared_ptr<Framebuffer> m_gbuffer;
+	GeodesicTraceKey m_geodesicTraceKey;
+	bool m_hasGeodesicTrace = false;
+
+	// Environment cache: the same records for every direction around the camera on an m_environmentCacheSize^2
+	// octahedral map, so looking around only resamples it.  It is re-traced once the camera moves further than
+	// m_environmentCacheTranslation times its distance from the black hole.
+	bool m_cacheEnvironment = false;
+	int m_environmentCacheSize = 2048;
+	float m_environmentCacheTranslation = 0.001f;
+	std::shared_ptr<Framebuffer> m_environmentGBuffer;
+
+	// Transfer atlas: environment cache records traced offline with Headless --atlas for one circle about the spin
+	// axis.  While the camera is within m_transferAtlasTolerance times the circle's radius of it, the records are
+	// uploaded once to m_transferAtlasGBuffer and turned to the camera's azimuth in the shade pass, so nothing is traced.
+	// The same 0.001 as m_environmentCacheTranslation: an offset of 0.01 moves things near the black hole by about
+	// 0.6 degrees, three texels of a 1024^2 map.
+	bool m_useTransferAtlas = false;
+	char m_transferAtlasPath[256] = "atlas.bin";
+	float m_transferAtlasTolerance = 0.001f;
+	std::string m_transferAtlasStatus;
+	TransferAtlas m_transferAtlas;
+	std::shared_ptr<Framebuffer> m_transferAtlasGBuffer;
+
+	// Block prepass: trace the corners of m_blockSize square blocks first, then only trace the pixels of blocks
+	// whose corners differ by more than m_refineTolerance and interpolate the rest.  The environment cache and the
+	// transfer atlas interpolate between their texels with the same tolerance.
+	bool m_blockPrepass = false;
+	int m_blockSize = 8;
+	float m_refineTolerance = 0.05f;
+	std::shared_ptr<Framebuffer> m_coarseGBuffer;
+
+	// Wavefront tracer: the trace pass as compute dispatches that advance the live rays m_wavefrontStepsPerDispatch
+	// steps at a time and compact the survivors into the other queue, instead of one long fragment per pixel.
+	bool m_wavefrontTracer = false;
+	int m_wavefrontStepsPerDispatch = 16;
+	int m_wavefrontGroupSize = 64;
+	std::shared_ptr<ShaderStorageBuffer> m_wavefrontQueues[2];
+	std::shared_ptr<ShaderStorageBuffer> m_wavefrontCounters;
+
+	// Temporal anti-aliasing: one jittered ray per pixel each frame, blended with the reprojected history.  The
+	// previous frame's G-buffer is kept to reject history that saw something else.
+	bool m_temporalAA = false;
+	float m_temporalHistoryWeight = 0.9f;
+	float m_temporalRadiusTolerance = 0.05f;
+	float m_temporalRedshiftTolerance = 0.05f;
+	float m_temporalEscapeTolerance = 0.02f;
+	unsigned int m_temporalFrame = 0;
+	glm::vec2 m_jitter = glm::vec2(0.0f);
+	glm::mat4 m_previousViewProj = glm::mat4(1.0f);
+	bool m_hasTemporalHistory = false;
+	std::shared_ptr<Framebuffer> m_previousGBuffer;
+	std::shared_ptr<Framebuffer> m_historyFBO;
+	std::shared_ptr<Framebuffer> m_resolvedFBO;
+
+	// Adaptive anti-aliasing: the shade pass traces up to m_adaptiveSamples^2 more rays in the pixels whose records
+	// disagree with a neighbour's, splitting m_adaptiveRayBudget extra rays per pixel of the screen evenly between them.
+	// m_adaptiveRayCount holds the number of these pixels, counted in a pass before the shade pass, and the rays they
+	// traced.  m_adaptiveMarkedFraction and m_adaptiveRaysPerPixel are read back from it with the solver statistics.
+	bool m_adaptiveAA = false;
+	int m_adaptiveSamples = 4;
+	float m_adaptiveTolerance = 0.05f;
+	float m_adaptiveRayBudget = 1.0f;
+	std::shared_ptr<ShaderStorageBuffer> m_adaptiveRayCount;
+	float m_adaptiveMarkedFraction = 0.0f;
+	float m_adaptiveRaysPerPixel = 0.0f;
+
 	std::vector<std::string> m_cubeTexturePaths = {
 		// Ordering of faces must be: xpos, xneg, ypos, yneg, zpos, zneg.
 		"res/textures/px.png",
@@ -144,6 +316,38 @@ private:
 	int m_maxSteps = 200;
 	float m_drawDistance = 100.0f;
 	float m_tolerance = 0.01f;
+	// Distance from the black hole, in masses, beyond which the automatic solver always uses Dormand-Prince.
+	float m_hybridRadius = 8.0f;
+	// PI step size control for the adaptive solvers, with mixed absolute and relative tolerances per component in
+	// place of m_tolerance.
+	bool m_PIController = false;
+	float m_absoluteTolerance = 0.001f;
+	float m_relativeTolerance = 0.001f;
+	// Kerr only.  Steps within m_fp64Band masses of the horizon, or on rays circling the photon orbits, are taken in
+	// double precision.
+	bool m_fp64Refinement = false;
+	float m_fp64Band = 0.5f;
+	// Kerr only, outside the horizon.  Outgoing rays beyond m_escapeRadius masses and the disk stop integrating and
+	// take the rest of their bending from the weak-field limit.
+	bool m_farFieldEscape = false;
+	float m_escapeRadius = 30.0f;
+	// Kerr only, outside the horizon.  Rays inside the critical curve that can't reach the disk before the horizon
+	// aren't integrated.  m_captureCurve tabulates the curve for the camera's radius.
+	bool m_captureCulling = false;
+	CaptureCulling m_captureCurve;
+	// Kerr only, outside the horizon, and only used while a = 0.  The rays m_schwarzschildTables covers are read from
+	// it, uploaded to m_schwarzschildTableBuffer, instead of integrated.
+	bool m_useSchwarzschildTables = false;
+	SchwarzschildTables m_schwarzschildTables;
+	std::shared_ptr<ShaderStorageBuffer> m_schwarzschildTableBuffer;
+	// Total accepted and rejected adaptive steps and double precision steps of the last trace, read back from
+	// m_solverStatistics, and the number of pixels it traced.
+	bool m_countSolverSteps = false;
+	std::shared_ptr<ShaderStorageBuffer> m_solverStatistics;
+	unsigned int m_acceptedSteps = 0;
+	unsigned int m_rejectedSteps = 0;
+	unsigned int m_fp64Steps = 0;
+	int m_solverStatisticsPixels = 0;
 	float m_insideDiskStepSize = 0.1f;
 	float m_diskIntersectionThreshold = 0.001f;
 	float m_sphereIntersectionThreshold = 0.001f;
@@ -158,10 +362,21 @@ private:
 	glm::vec3 m_sphereDebugColour1 = glm::vec3(0.8, 0.0, 0.0);
 	glm::vec3 m_sphereDebugColour2 = glm::vec3(0.23, 0.04, 0.36);
 
+	bool m_showCaptureCulling = false;
+	glm::vec3 m_captureCullingColour = glm::vec3(0.9, 0.0, 0.9);
+
 	unsigned int m_spectrumTextureSlot = 5;
 	unsigned int m_diskTextureSlot = 4;
 	unsigned int m_sphereTextureSlot = 2;
 	unsigned int m_skyboxTextureSlot = 3;
 	unsigned int m_screenTextureSlot = 0;
+	// The G-buffer's attachments use consecutive slots from here.
+	unsigned int m_gbufferTextureSlot = 6;
+
+	std::future<CPUReferenceResult> m_cpuReferenceFuture;
+	CPUReferenceResult m_cpuReferenceResult;
+	bool m_hasCPUReferenceResult = false;
+	std::string m_cpuReferenceFileName = "cpu_reference.hdr";
+	std::string m_gpuReferenceFileName = "gpu_reference.hdr";
 };
 
@@ -0,0 +1,406 @@
+#include "AnalyticKerrTracer.h"
+#include "EllipticIntegrals.h"
+
+#include <cmath>
+#include <complex>
+#include <algorithm>
+
+static constexpr double PI = 3.14159265358979323846;
+
+
+AnalyticKerrTracer::AnalyticKerrTracer(const BlackHoleParameters& params, const GeodesicIntegrator& integrator)
+    : m_params(params), m_integrator(integrator), m_mass(params.mass), m_a(params.a)
+{
+    double root = std::sqrt(std::max(0.0, m_mass * m_mass - m_a * m_a));
+    m_rplus = m_mass + root;
+    m_rminus = m_mass - root;
+}
+
+AnalyticKerrTracer::~AnalyticKerrTracer()
+{
+}
+
+
+/////////////////////////////////////////////////////
+/////////////////   RADIAL MOTION   /////////////////
+/////////////////////////////////////////////////////
+
+bool AnalyticKerrTracer::SolveRadial(double lambda, double eta, double r0, double sign, RadialMotion& motion) const
+{
+    // Roots of R(r) = r^4 + A r^2 + B r + C by Ferrari's method, in the form of Gralla and Lupsasca (2020) eq. (95).
+    double a2 = m_a * m_a;
+    double A = a2 - eta - lambda * lambda;
+    double B = 2.0 * m_mass * (eta + (lambda - m_a) * (lambda - m_a));
+    double C = -a2 * eta;
+    double P = -A * A / 12.0 - C;
+    double Q = -A / 3.0 * ((A / 6.0) * (A / 6.0) - C) - B * B / 8.0;
+
+    // The three branches of the cube root give the three roots of the resolvent cubic.  We need the positive one.
+    std::complex<double> discriminant = std::sqrt(std::complex<double>(P * P * P / 27.0 + Q * Q / 4.0));
+    std::complex<double> omegaPlus = std::pow(-Q / 2.0 + discriminant, 1.0 / 3.0);
+    std::complex<double> rotation = std::polar(1.0, 2.0 * PI / 3.0);
+    double xi0 = -1.0;
+    for (int branch = 0; branch < 3; branch++)
+    {
+        std::complex<double> omegaMinus = (std::abs(omegaPlus) > 0.0) ? -P / (3.0 * omegaPlus) : 0.0;
+        std::complex<double> xi = omegaPlus + omegaMinus - A / 3.0;
+        if (std::abs(xi.imag()) < 1e-8 * (1.0 + std::abs(xi.real())))
+        {
+            xi0 = std::max(xi0, xi.real());
+        }
+        omegaPlus *= rotation;
+    }
+    if (!(xi0 > 0.0))
+    {
+        return false;
+    }
+    double z = std::sqrt(0.5 * xi0);
+    double radicand12 = -0.5 * A - z * z + B / (4.0 * z);
+    double radicand34 = -0.5 * A - z * z - B / (4.0 * z);
+    if (radicand12 < 0.0)
+    {
+        return false;
+    }
+
+    auto polish = [A, B, C](double r)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            double derivative = (4.0 * r * r + 2.0 * A) * r + B;
+            if (std::abs(derivative) > 1e-12)
+            {
+                r -= (((r * r + A) * r + B) * r + C) / derivative;
+            }
+        }
+        return r;
+    };
+
+    motion.r1 = polish(-z - std::sqrt(radicand12));
+    motion.r2 = polish(-z + std::sqrt(radicand12));
+    motion.fourRealRoots = radicand34 >= 0.0;
+    if (motion.fourRealRoots)
+    {
+        double roots[4] = { motion.r1, motion.r2, polish(z - std::sqrt(radicand34)), polish(z + std::sqrt(radicand34)) };
+        std::sort(roots, roots + 4);
+        motion.r1 = roots[0];
+        motion.r2 = roots[1];
+        motion.r3 = roots[2];
+        motion.r4 = roots[3];
+        if (r0 < motion.r4)
+        {
+            // The camera is between r2 and r3, i.e. inside the photon shell's turning point.
+            return false;
+        }
+        double r31 = motion.r3 - motion.r1;
+        double r32 = motion.r3 - motion.r2;
+        double r41 = motion.r4 - motion.r1;
+        double r42 = motion.r4 - motion.r2;
+        motion.anchor = motion.r4;
+        motion.k = r32 * r41 / (r31 * r42);
+        motion.scale = 0.5 * std::sqrt(r31 * r42);
+    }
+    else
+    {
+        motion.r3 = z;
+        motion.r4 = z;
+        motion.r3im = std::sqrt(-radicand34);
+        motion.rootA = std::hypot(motion.r3 - motion.r2, motion.r3im);
+        motion.rootB = std::hypot(motion.r3 - motion.r1, motion.r3im);
+        double r21 = motion.r2 - motion.r1;
+        double AplusB = motion.rootA + motion.rootB;
+        motion.anchor = motion.r2;
+        motion.k = (AplusB * AplusB - r21 * r21) / (4.0 * motion.rootA * motion.rootB);
+        motion.scale = std::sqrt(motion.rootA * motion.rootB);
+    }
+
+    motion.sign = sign;
+    motion.tauPrime0 = MinoTimeFromAnchor(motion, r0);
+    double tauInfinity = MinoTimeToInfinity(motion);
+    if (sign > 0.0)
+    {
+        motion.escapes = true;
+        motion.tauEnd = tauInfinity - motion.tauPrime0;
+    }
+    else if (motion.anchor > m_rplus)
+    {
+        // Turns around at the anchor and escapes.
+        motion.escapes = true;
+        motion.tauEnd = motion.tauPrime0 + tauInfinity;
+    }
+    else
+    {
+        motion.escapes = false;
+        motion.tauEnd = motion.tauPrime0 - MinoTimeFromAnchor(motion, m_rplus);
+    }
+    return std::isfinite(motion.tauEnd) && motion.tauEnd > 0.0;
+}
+
+double AnalyticKerrTracer::MinoTimeFromAnchor(const RadialMotion& motion, double r) const
+{
+    if (r <= motion.anchor)
+    {
+        return 0.0;
+    }
+    if (motion.fourRealRoots)
+    {
+        // Invert r(X) = (r4 r31 - r3 r41 sn^2(X|k)) / (r31 - r41 sn^2(X|k)) with X = scale * tau.
+        double sn2 = (motion.r3 - motion.r1) * (r - motion.r4) / ((motion.r4 - motion.r1) * (r - motion.r3));
+        return EllipticF(std::asin(std::sqrt(std::clamp(sn2, 0.0, 1.0))), motion.k) / motion.scale;
+    }
+    // Invert r(X) = ((B r2 - A r1) + (B r2 + A r1) cn(X|k)) / ((B - A) + (B + A) cn(X|k)) with X = scale * tau.
+    double A = motion.rootA;
+    double B = motion.rootB;
+    double cn = (B * (motion.r2 - r) + A * (r - motion.r1)) / (B * (r - motion.r2) + A * (r - motion.r1));
+    return EllipticF(std::acos(std::clamp(cn, -1.0, 1.0)), motion.k) / motion.scale;
+}
+
+double AnalyticKerrTracer::MinoTimeToInfinity(const RadialMotion& motion) const
+{
+    if (motion.fourRealRoots)
+    {
+        double sn2 = (motion.r3 - motion.r1) / (motion.r4 - motion.r1);
+        return EllipticF(std::asin(std::sqrt(sn2)), motion.k) / motion.scale;
+    }
+    double cn = (motion.rootA - motion.rootB) / (motion.rootA + motion.rootB);
+    return EllipticF(std::acos(cn), motion.k) / motion.scale;
+}
+
+double AnalyticKerrTracer::RadiusAtMinoTime(const RadialMotion& motion, double tau) const
+{
+    // r is even in the Mino time from the anchor, so the same formula covers both sides of a turning point.
+    double X = motion.scale * std::abs(motion.tauPrime0 + motion.sign * tau);
+    double sn, cn, dn;
+    JacobiElliptic(X, motion.k, sn, cn, dn);
+    if (motion.fourRealRoots)
+    {
+        double r31 = motion.r3 - motion.r1;
+        double r41 = motion.r4 - motion.r1;
+        double sn2 = sn * sn;
+        return (motion.r4 * r31 - motion.r3 * r41 * sn2) / (r31 - r41 * sn2);
+    }
+    double A = motion.rootA;
+    double B = motion.rootB;
+    return ((B * motion.r2 - A * motion.r1) + (B * motion.r2 + A * motion.r1) * cn) / ((B - A) + (B + A) * cn);
+}
+
+double AnalyticKerrTracer::AzimuthQuadrature(const RadialMotion& motion, double lambda, double tau0, double tau1,
+    int depth) const
+{
+    if (m_a == 0.0 || tau1 <= tau0)
+    {
+        return 0.0;
+    }
+    // The integrand is smooth but sharply peaked for rays that pass close to the horizon of a near-extremal hole, so
+    // halve the interval until the error estimate is small enough.
+    double error;
+    double integral = GaussKronrod(motion, lambda, tau0, tau1, error);
+    if (depth >= 20 || error < 1e-9 * (1.0 + std::abs(integral)))
+    {
+        return integral;
+    }
+    double middle = 0.5 * (tau0 + tau1);
+    return AzimuthQuadrature(motion, lambda, tau0, middle, depth + 1) + AzimuthQuadrature(motion, lambda, middle, tau1, depth + 1);
+}
+
+double AnalyticKerrTracer::GaussKronrod(const RadialMotion& motion, double lambda, double tau0, double tau1,
+    double& error) const
+{
+    // 15 point Kronrod rule and the 7 point Gauss rule embedded in it, as in QUADPACK's QK15.  Odd indices are the
+    // Gauss nodes.
+    static constexpr double nodes[8] = { 0.991455371120812639, 0.949107912342758525, 0.864864423359769073,
+        0.741531185599394440, 0.586087235467691130, 0.405845151377397167, 0.207784955007898468, 0.0 };
+    static constexpr double kronrodWeights[8] = { 0.022935322010529225, 0.063092092629978553, 0.104790010322250184,
+        0.140653259715525919, 0.169004726639267903, 0.190350578064785410, 0.204432940075298892, 0.209482141084727828 };
+    static constexpr double gaussWeights[4] = { 0.129484966168869693, 0.279705391489276668, 0.381830050505118945,
+        0.417959183673469388 };
+
+    // a (2 M r - a lambda) / Delta written in 1/r, so that it goes smoothly to 0 as r goes to infinity.
+    auto integrand = [&](double tau)
+    {
+        double invr = 1.0 / RadiusAtMinoTime(motion, tau);
+        return m_a * (2.0 * m_mass - m_a * lambda * invr) * invr / (1.0 - 2.0 * m_mass * invr + m_a * m_a * invr * invr);
+    };
+
+    double middle = 0.5 * (tau0 + tau1);
+    double halfWidth = 0.5 * (tau1 - tau0);
+    double centre = integrand(middle);
+    double kronrod = kronrodWeights[7] * centre;
+    double gauss = gaussWeights[3] * centre;
+    for (int i = 0; i < 7; i++)
+    {
+        double sum = integrand(middle - halfWidth * nodes[i]) + integrand(middle + halfWidth * nodes[i]);
+        kronrod += kronrodWeights[i] * sum;
+        if (i % 2 == 1)
+        {
+            gauss += gaussWeights[i / 2] * sum;
+        }
+    }
+    error = std::abs(halfWidth * (kronrod - gauss));
+    return halfWidth * kronrod;
+}
+
+double AnalyticKerrTracer::KerrSchildAzimuthShift(double r) const
+{
+    // phi_KS = phi_BL + integral of a / Delta dr.  Zero at infinity.
+    if (m_a == 0.0)
+    {
+        return 0.0;
+    }
+    double horizonSeparation = m_rplus - m_rminus;
+    if (horizonSeparation < 1e-10)
+    {
+        return -m_a / (r - m_rplus);
+    }
+    return m_a / horizonSeparation * std::log((r - m_rplus) / (r - m_rminus));
+}
+
+
+/////////////////////////////////////////////////////
+//////////////////////   RAYS   /////////////////////
+/////////////////////////////////////////////////////
+
+bool AnalyticKerrTracer::Trace(const glm::dmat2x4& xp, AnalyticRay& ray) const
+{
+    glm::dvec4 x = xp[0];
+    glm::dvec4 p = xp[1];
+    double X = x.y;
+    double Y = x.z;
+    double Z = x.w;
+    double a = m_a;
+    double a2 = a * a;
+
+    double r0 = m_integrator.ImplicitR(x);
+    double cosTheta = Y / r0;
+    double sin2Theta = 1.0 - cosTheta * cosTheta;
+    if (r0 <= m_rplus || sin2Theta < 1e-12)
+    {
+        return false;
+    }
+    double sinTheta = std::sqrt(sin2Theta);
+
+    // p = g (1, rayDir) is null in flat space but not quite in Kerr-Schild coordinates, and Q is only conserved in the
+    // form below for null geodesics.  Solve g^{mu nu} p_mu p_nu = 0 for p_t, taking the root nearest the original.
+    glm::dmat4 invMetric = m_integrator.InvMetric(x);
+    double quadraticA = invMetric[0][0];
+    double quadraticB = 0.0;
+    double quadraticC = 0.0;
+    for (int i = 1; i < 4; i++)
+    {
+        quadraticB += 2.0 * invMetric[0][i] * p[i];
+        for (int j = 1; j < 4; j++)
+        {
+            quadraticC += invMetric[i][j] * p[i] * p[j];
+        }
+    }
+    double discriminant = quadraticB * quadraticB - 4.0 * quadraticA * quadraticC;
+    if (discriminant < 0.0)
+    {
+        return false;
+    }
+    double root1 = (-quadraticB + std::sqrt(discriminant)) / (2.0 * quadraticA);
+    double root2 = (-quadraticB - std::sqrt(discriminant)) / (2.0 * quadraticA);
+    p.x = (std::abs(root1 - p.x) < std::abs(root2 - p.x)) ? root1 : root2;
+
+    // Kerr-Schild Cartesian coordinates relate to the spheroidal ones by X - iZ = (r + ia) sin(theta) e^{i phi} and
+    // Y = r cos(theta).  d/dphi is then Z d/dX - X d/dZ and d/dtheta is cot(theta) (X d/dX + Z d/dZ) - r sin(theta)
+    // d/dY, which give p_phi and p_theta.  p_t and p_phi are the same as in Boyer-Lindquist coordinates.
+    double E = -p.x;
+    double L = Z * p.y - X * p.w;
+    double pTheta = cosTheta / sinTheta * (X * p.y + Z * p.w) - r0 * sinTheta * p.z;
+    double Q = pTheta * pTheta + cosTheta * cosTheta * (L * L / sin2Theta - a2 * E * E);
+    ray.E = E;
+    ray.L = L;
+    ray.Q = Q;
+    if (E <= 0.0)
+    {
+        return false;
+    }
+    double lambda = L / E;
+    double eta = Q / (E * E);
+    if (eta <= 1e-10)
+    {
+        // Rays that never cross the equatorial plane, or stay in it.
+        return false;
+    }
+
+    // Direction of the radial motion from dx/dl = g^-1 p, by differentiating r^4 - (|x|^2 - a^2) r^2 - a^2 Y^2 = 0.
+    glm::dvec4 v = invMetric * p;
+    double drdl = r0 * r0 * (X * v.y + Z * v.w) + (r0 * r0 + a2) * Y * v.z;
+    RadialMotion motion;
+    if (!SolveRadial(lambda, eta, r0, (drdl >= 0.0) ? 1.0 : -1.0, motion))
+    {
+        return false;
+    }
+    if (!motion.escapes && m_params.useDebugSphereTexture)
+    {
+        // The horizon crossing point is needed for the sphere's debug texture, and the azimuth diverges there.
+        return false;
+    }
+
+    // Polar motion.  With u = cos(theta), Theta sin^2(theta) = (u+ - u^2)(a^2 u^2 + A) and the substitution
+    // u = sqrt(u+) sin(psi) gives dtau = dpsi / (sqrt(A) sqrt(1 - m sin^2(psi))), with m = -a^2 u+ / A.  psi increases
+    // along the ray, and the equatorial plane is crossed at every multiple of pi.
+    double Btheta = eta + lambda * lambda - a2;
+    double D = std::sqrt(Btheta * Btheta + 4.0 * a2 * eta);
+    double uplus = 2.0 * eta / (Btheta + D);
+    double Atheta = 0.5 * (Btheta + D);
+    double sqrtAtheta = std::sqrt(Atheta);
+    double m = -a2 * uplus / Atheta;
+    double psi0 = std::asin(std::clamp(cosTheta / std::sqrt(uplus), -1.0, 1.0));
+    if (pTheta > 0.0)
+    {
+        // theta is increasing, so u is decreasing.
+        psi0 = PI - psi0;
+    }
+    double F0 = EllipticF(psi0, m);
+    double K = EllipticK(m);
+    double Pi0 = EllipticPi(uplus, psi0, m);
+
+    // The azimuth is phi0 + lambda / sqrt(A) (Pi(psi) - Pi(psi0)) from the polar motion, plus the quadrature of the
+    // radial part, plus the shift between Boyer-Lindquist and Kerr-Schild azimuths.  The -a tau of the polar part
+    // and the a tau of the radial part cancel.
+    double phi0 = std::atan2(-Z, X) - std::atan2(a, r0);
+    double shift0 = KerrSchildAzimuthShift(r0);
+    double quadrature = 0.0;
+    double previousTau = 0.0;
+
+    ray.numCrossings = 0;
+    for (int j = (int)std::floor(psi0 / PI) + 1; ray.numCrossings < AnalyticRay::MaxCrossings; j++)
+    {
+        double tau = (2.0 * j * K - F0) / sqrtAtheta;
+        if (tau >= motion.tauEnd)
+        {
+            break;
+        }
+        quadrature += AzimuthQuadrature(motion, lambda, previousTau, tau);
+        previousTau = tau;
+
+        double r = RadiusAtMinoTime(motion, tau);
+        double phi = phi0 + lambda / sqrtAtheta * (EllipticPi(uplus, j * PI, m) - Pi0) + quadrature
+            + KerrSchildAzimuthShift(r) - shift0;
+        double Xc = r * std::cos(phi) - a * std::sin(phi);
+        double Zc = -(r * std::sin(phi) + a * std::cos(phi));
+
+        // GetDiskColour() only uses p_t and p_phi because the disk's velocity has no r or theta component, so the
+        // momentum is given as (-E, L d/dphi / |d/dphi|^2) rather than working out p_r and p_theta.
+        double rho2 = Xc * Xc + Zc * Zc;
+        int n = ray.numCrossings++;
+        ray.crossing[n][0] = glm::dvec4(0.0, Xc, 0.0, Zc);
+        ray.crossing[n][1] = glm::dvec4(-E, L * Zc / rho2, 0.0, -L * Xc / rho2);
+        ray.crossingRadius[n] = r;
+        // u is increasing through 0 at even multiples of pi, so the ray came from y < 0.
+        ray.previousy[n] = (j % 2 == 0) ? -1.0f : 1.0f;
+    }
+
+    ray.escapes = motion.escapes;
+    if (motion.escapes)
+    {
+        quadrature += AzimuthQuadrature(motion, lambda, previousTau, motion.tauEnd);
+        double psiEnd = JacobiAmplitude(F0 + sqrtAtheta * motion.tauEnd, m);
+        double u = std::sqrt(uplus) * std::sin(psiEnd);
+        double sinThetaEnd = std::sqrt(std::max(0.0, 1.0 - u * u));
+        double phi = phi0 + lambda / sqrtAtheta * (EllipticPi(uplus, psiEnd, m) - Pi0) + quadrature - shift0;
+        ray.escapeDirection = glm::dvec3(sinThetaEnd * std::cos(phi), u, -sinThetaEnd * std::sin(phi));
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "GeodesicIntegrator.h"
+
+#include "glm/glm.hpp"
+
+
+struct AnalyticRay
+{
+	// Everything rayMarch() needs from a geodesic, without the steps in between.
+	static constexpr int MaxCrossings = 3;
+
+	// Equatorial plane crossings outside the horizon in the order the ray meets them, i.e. the n = 0, 1, 2 images of
+	// the disk.  crossing[i] is laid out like the xp that GeodesicIntegrator::BSDiskIntersectionPoint() returns.
+	int numCrossings = 0;
+	glm::dmat2x4 crossing[MaxCrossings];
+	double crossingRadius[MaxCrossings] = {};
+	// Sign of the y coordinate just before the crossing, like previousxp[0][2] in rayMarch().
+	float previousy[MaxCrossings] = {};
+
+	// Rays that don't escape fall through the horizon, at horizonPoint if the tracer supports the sphere's debug
+	// texture.  AnalyticKerrTracer doesn't, and returns false for them instead.
+	bool escapes = false;
+	glm::dvec3 escapeDirection = glm::dvec3(0.0);
+	glm::dvec3 horizonPoint = glm::dvec3(0.0);
+
+	// Constants of motion, E = -p_t, L = p_phi and the Carter constant Q.
+	double E = 0.0;
+	double L = 0.0;
+	double Q = 0.0;
+};
+
+
+class AnalyticKerrTracer
+{
+	// Traces Kerr null geodesics without integrating them.  The energy E, angular momentum L and Carter constant Q
+	// separate the motion in Mino time tau (d lambda = Sigma d tau):
+	//     dr/dtau = +-sqrt(R(r)),    R(r) = (r^2 + a^2 - a lambda)^2 - Delta (eta + (lambda - a)^2)
+	//     dtheta/dtau = +-sqrt(Theta(theta)),    Theta(theta) = eta + a^2 cos^2(theta) - lambda^2 cot^2(theta)
+	// with lambda = L / E and eta = Q / E^2.  Both have closed form solutions in terms of elliptic integrals and Jacobi
+	// elliptic functions (S. E. Gralla and A. Lupsasca, "Null geodesics of the Kerr exterior", 2020), so the Mino
+	// times of the equatorial crossings, the radius at each crossing, and the escape or capture time follow directly
+	// from the camera ray.  The azimuth is the closed form polar part plus the radial part, which is smooth in Mino
+	// time and integrated with adaptive Gauss-Kronrod quadrature between crossings.
+	//
+	// Only the Kerr metric with the camera outside the horizon is supported.  Trace() also returns false for the rare
+	// rays it doesn't handle (camera on the axis, eta <= 0, camera inside the photon shell's turning point), which
+	// must be integrated numerically instead.
+public:
+	AnalyticKerrTracer(const BlackHoleParameters& params, const GeodesicIntegrator& integrator);
+	~AnalyticKerrTracer();
+
+	static bool IsSupported(const BlackHoleParameters& params) { return params.metric == 0 && !params.insideHorizon; }
+
+	// xp is the initial position and momentum as set up in rayMarch().
+	bool Trace(const glm::dmat2x4& xp, AnalyticRay& ray) const;
+
+private:
+	struct RadialMotion
+	{
+		// Four real roots r1 <= r2 <= r3 <= r4, or real r1 < r2 and the complex pair r3 = conj(r4) = r3re + i r3im.
+		bool fourRealRoots = true;
+		double r1 = 0.0;
+		double r2 = 0.0;
+		double r3 = 0.0;
+		double r4 = 0.0;
+		double r3im = 0.0;
+		// The turning point the closed form solution is anchored on: r4, or r2 with complex roots.
+		double anchor = 0.0;
+		double k = 0.0;
+		double rootA = 0.0;
+		double rootB = 0.0;
+		double scale = 0.0;
+		// Mino time from the anchor, taken positive on both sides of it.  tauPrime = tauPrime0 + sign * tau.
+		double tauPrime0 = 0.0;
+		double sign = 1.0;
+		double tauEnd = 0.0;
+		bool escapes = false;
+	};
+
+	bool SolveRadial(double lambda, double eta, double r0, double sign, RadialMotion& motion) const;
+	double MinoTimeFromAnchor(const RadialMotion& motion, double r) const;
+	double MinoTimeToInfinity(const RadialMotion& motion) const;
+	double RadiusAtMinoTime(const RadialMotion& motion, double tau) const;
+	// Integral of a (2 M r - a lambda) / Delta over Mino time, the part of dphi/dtau that is not closed form.
+	double AzimuthQuadrature(const RadialMotion& motion, double lambda, double tau0, double tau1, int depth = 0) const;
+	double GaussKronrod(const RadialMotion& motion, double lambda, double tau0, double tau1, double& error) const;
+	// Antiderivative of a / Delta in r, the difference between the Kerr-Schild and Boyer-Lindquist azimuths.
+	double KerrSchildAzimuthShift(double r) const;
+
+	const BlackHoleParameters& m_params;
+	const GeodesicIntegrator& m_integrator;
+	double m_mass;
+	double m_a;
+	double m_rplus;
+	double m_rminus;
+};
@@ -0,0 +1,21 @@
+#include "BlackHoleParameters.h"
+
+#include <cmath>
+
+
+float CalculateISCORadius(float mass, float a)
+{
+    // Calculate in the innermost stable circular orbit for a black hole with parameters mass m and rotation a.
+    // Result is the theoretically smallest inner radius for a stable accretion disk.
+    // Assumes G = c = 1
+    if (mass == 0)
+    {
+        // In this case, there is no stable orbit because there is no mass.  So the result is actually infinity.
+        return 0.0f;
+    }
+    float rs = 2.0f * mass;
+    float chi = 2.0f * a / rs;
+    float z1 = 1.0f + std::powf(1.0f - chi*chi, 1.0f/3.0f) * (std::powf(1.0f + chi, 1.0f/3.0f) + std::powf(1.0f - chi, 1.0f/3.0f));
+    float z2 = std::powf(3.0f*chi*chi + z1*z1, 1.0f / 2.0f);
+    return mass * (3.0f + z2 - std::powf((3.0f-z1)*(3.0f+z1+2.0f*z2), 1.0f / 2.0f));
+}
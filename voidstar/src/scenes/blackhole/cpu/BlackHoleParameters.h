@@ -0,0 +1,97 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+
+float CalculateISCORadius(float mass, float a);
+
+
+struct BlackHoleParameters
+{
+	// Everything KerrBlackHole.shader reads from its uniforms and defines, gathered in one place so that a frame can be
+	// reproduced without an OpenGL context.  The defaults match the defaults in BlackHole.h.
+
+	// Defines.
+	int metric = 0; // Same numbering as BlackHole::m_shaderSelector: 0 = Kerr, 1 = Classical, 2 = Minkowski.
+	bool insideHorizon = false;
+	int ODESolver = 2;
+
+	// Black hole and disk.
+	float mass = 1.0f;
+	float a = 0.6f;
+	float dMdt = 10000.0f;
+	float risco = 0.0f;
+	float innerRadius = 4.5f;
+	float outerRadius = 18.0f;
+	float Tmax = 2000.0f;
+	float diskRotationAngle = 0.0f;
+
+	// Simulation quality.
+	int msaa = 1;
+	int maxSteps = 200;
+	float drawDistance = 100.0f;
+	float tolerance = 0.01f;
+	// ODESolver 8 uses Dormand-Prince beyond this many masses from the black hole, and Bogacki-Shampine inside.
+	float hybridRadius = 8.0f;
+	// PI_CONTROLLER.  The adaptive solvers use a PI step size controller on the error relative to these tolerances
+	// instead of tolerance.
+	bool PIController = false;
+	float absoluteTolerance = 0.001f;
+	float relativeTolerance = 0.001f;
+	float diskIntersectionThreshold = 0.001f;
+	float sphereIntersectionThreshold = 0.001f;
+	// FP64_REFINEMENT, Kerr only.  Steps within fp64Band masses of the horizon (twice that for spins above 0.95), or
+	// with |p| more than 20 times the energy, are taken in double precision.  On the CPU this applies to the SIMD path,
+	// whose lanes continue in the double precision GeodesicIntegrator until they leave the band.
+	bool fp64Refinement = false;
+	float fp64Band = 0.5f;
+	// FAR_FIELD_ESCAPE, Kerr only.  Rays heading outwards beyond escapeRadius masses and the disk's outer radius stop
+	// integrating, and the rest of their bending up to the draw distance is the weak-field deflection.
+	bool farFieldEscape = false;
+	float escapeRadius = 30.0f;
+	// CAPTURE_CULLING, Kerr only.  Rays inside the photon shell's critical curve that can't cross the disk before the
+	// horizon aren't integrated.  See CaptureCulling.
+	bool captureCulling = false;
+	// SCHWARZSCHILD_TABLES, Kerr with a = 0 only.  The disk crossings and escape direction of each ray are looked up
+	// from its impact parameter and the camera's radius in SchwarzschildTables instead of integrating it, with the ODE
+	// solver as the fallback for the rays the tables don't cover.
+	bool schwarzschildTables = false;
+	// CPU renderer only.  Integrate several rays at once with SIMD instructions where the metric allows it.
+	bool useSIMD = true;
+	// CPU renderer only.  Find the disk crossings and escape direction of Kerr geodesics in closed form instead of
+	// integrating them, with the ODE solver as the fallback for rays the closed form doesn't cover.
+	bool analytic = false;
+
+	// Debug colouring.
+	bool useSphereTexture = false;
+	bool useDebugSphereTexture = false;
+	bool drawBasicDisk = false;
+	bool transparentDisk = true;
+	bool useDebugDiskTexture = false;
+	glm::vec3 sphereDebugColour1 = glm::vec3(0.8, 0.0, 0.0);
+	glm::vec3 sphereDebugColour2 = glm::vec3(0.23, 0.04, 0.36);
+	int diskDebugDivisions = 5;
+	glm::vec3 diskDebugColourTop1 = glm::vec3(0.09, 0.73, 0.18);
+	glm::vec3 diskDebugColourTop2 = glm::vec3(0.02, 0.47, 0.87);
+	glm::vec3 diskDebugColourBottom1 = glm::vec3(0.98, 0.4, 0.0);
+	glm::vec3 diskDebugColourBottom2 = glm::vec3(0.90, 0.75, 0.0);
+	bool showCaptureCulling = false;
+	glm::vec3 captureCullingColour = glm::vec3(0.9, 0.0, 0.9);
+
+	// Lighting.
+	float diskAbsorption = 1.0f;
+	float bloomBackgroundMultiplier = 0.8f;
+	float bloomDiskMultiplier = 2.5f;
+	float brightnessFromDiskVel = 4.0f;
+	float blueshiftPower = 1.0f;
+	// Only used when tone mapping LDR output, as in FinalBloom.shader.
+	float exposure = 0.4f;
+	float gamma = 0.7f;
+
+	// Camera.  viewInv and projInv are the same matrices that Mesh passes as u_ViewInv and u_ProjInv.
+	unsigned int width = 1280;
+	unsigned int height = 720;
+	glm::vec3 cameraPos = glm::vec3(0.0f, 2.0f, -45.0f);
+	glm::mat4 viewInv = glm::mat4(1.0f);
+	glm::mat4 projInv = glm::mat4(1.0f);
+};
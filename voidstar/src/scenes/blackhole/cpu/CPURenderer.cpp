@@ -0,0 +1,891 @@
+#include "CPURenderer.h"
+
+#include "stb_image_write.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <bit>
+
+
+ImageDifference CompareImages(const PixelBuffer& a, const PixelBuffer& b, float tolerance)
+{
+    ImageDifference difference;
+    if (a.size() != b.size() || a.empty())
+    {
+        return difference;
+    }
+
+    double sumAbs = 0.0;
+    double sumSquares = 0.0;
+    unsigned int mismatched = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        bool mismatch = false;
+        for (int c = 0; c < 3; c++)
+        {
+            float diff = std::abs(a[i][c] - b[i][c]);
+            if (std::isnan(diff))
+            {
+                // NaNs in one image and not the other always count as a mismatch.
+                mismatch = mismatch || (std::isnan(a[i][c]) != std::isnan(b[i][c]));
+                continue;
+            }
+            sumAbs += diff;
+            sumSquares += (double)diff * diff;
+            difference.maxAbsDiff = std::max(difference.maxAbsDiff, diff);
+            mismatch = mismatch || diff > tolerance * std::max(1.0f, std::abs(a[i][c]));
+        }
+        if (mismatch)
+        {
+            mismatched++;
+        }
+    }
+    double numValues = 3.0 * a.size();
+    difference.meanAbsDiff = (float)(sumAbs / numValues);
+    difference.rmsDiff = (float)std::sqrt(sumSquares / numValues);
+    difference.fractionMismatched = (float)mismatched / (float)a.size();
+    difference.numPixels = (unsigned int)a.size();
+    return difference;
+}
+
+
+CPURenderer::CPURenderer(const BlackHoleParameters& params, const CPUCubeMap& skybox)
+    : m_params(params), m_integrator(m_params), m_packetIntegrator(m_params),
+    m_usePackets(params.useSIMD && PacketIntegrator::IsSupported(params)
+        && !(params.analytic && AnalyticKerrTracer::IsSupported(params))), m_analyticTracer(m_params, m_integrator),
+    m_useAnalytic(params.analytic && AnalyticKerrTracer::IsSupported(params)), m_shading(m_params, m_integrator, skybox),
+    m_pixels((size_t)params.width * params.height),
+    m_useFarFieldEscape(params.farFieldEscape && params.metric == 0 && !params.insideHorizon),
+    m_escapeRadius(std::max(params.escapeRadius * params.mass, params.outerRadius)),
+    m_useCaptureCulling(params.captureCulling && CaptureCulling::IsSupported(params)),
+    m_useSchwarzschildTables(params.schwarzschildTables && SchwarzschildTables::IsSupported(params))
+{
+    if (m_useSchwarzschildTables)
+    {
+        m_schwarzschildTables.Build();
+    }
+    if (m_useCaptureCulling)
+    {
+        glm::dvec4 cameraPos = glm::dvec4(0.0, glm::dvec3(params.cameraPos));
+        m_captureCulling.Update(params.mass, params.a, m_integrator.ImplicitR(cameraPos));
+    }
+}
+
+CPURenderer::~CPURenderer()
+{
+}
+
+float CPURenderer::Render(ThreadPool& pool, unsigned int tileSize)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    tileSize = std::max(1u, tileSize);
+    unsigned int tilesX = (m_params.width + tileSize - 1) / tileSize;
+    unsigned int tilesY = (m_params.height + tileSize - 1) / tileSize;
+    size_t numTiles = (size_t)tilesX * tilesY;
+    size_t numThreads = pool.GetNumThreads();
+
+    // Tiles are in raster order, so giving each worker a contiguous range of them gives it a band of rows.  The
+    // deques are filled a tile at a time in turn so no worker starts out stealing while the others are still empty.
+    auto firstTile = [numTiles, numThreads](size_t worker) { return worker * numTiles / numThreads; };
+    pool.ResetStats();
+    for (size_t k = 0; k < (numTiles + numThreads - 1) / numThreads; k++)
+    {
+        for (size_t worker = 0; worker < numThreads; worker++)
+        {
+            size_t tile = firstTile(worker) + k;
+            if (tile >= firstTile(worker + 1))
+            {
+                continue;
+            }
+            unsigned int x0 = (unsigned int)(tile % tilesX) * tileSize;
+            unsigned int y0 = (unsigned int)(tile / tilesX) * tileSize;
+            unsigned int x1 = std::min(x0 + tileSize, m_params.width);
+            unsigned int y1 = std::min(y0 + tileSize, m_params.height);
+            if (m_usePackets)
+            {
+                pool.Submit([this, x0, y0, x1, y1]() { RenderTilePacket(x0, y0, x1, y1); }, (unsigned int)worker);
+            }
+            else
+            {
+                pool.Submit([this, x0, y0, x1, y1]() { RenderTile(x0, y0, x1, y1); }, (unsigned int)worker);
+            }
+        }
+    }
+    pool.Wait();
+
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void CPURenderer::RenderTile(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    // Tiles never overlap, so each pixel is written by exactly one thread.
+    for (unsigned int y = y0; y < y1; y++)
+    {
+        for (unsigned int x = x0; x < x1; x++)
+        {
+            m_pixels[(size_t)y * m_params.width + x] = glm::vec4(RenderPixel(x, y), 1.0f);
+        }
+    }
+}
+
+void CPURenderer::RenderTilePacket(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    // Same result as RenderTile(), up to single precision, but every ray of the tile goes through a queue feeding the
+    // simd::Width lanes of a PacketIntegrator.  When a lane's ray finishes, the next ray from the queue takes its lane
+    // so the packet stays full until the queue runs dry.  Only the rare steps that need attention (crossing the disk's
+    // plane, reaching the horizon or the draw distance, running out of steps) drop down to the scalar code.  With
+    // BlackHoleParameters::fp64Refinement, lanes in the band where single precision isn't enough continue in the double
+    // precision IntegrateRay() until they leave it, and then rejoin the packet.
+    using simd::Floats;
+    using simd::Mask;
+
+    unsigned int tileWidth = x1 - x0;
+    unsigned int numPixels = tileWidth * (y1 - y0);
+    int msaa = std::max(1, m_params.msaa);
+    unsigned int samplesPerPixel = (unsigned int)(msaa * msaa);
+    unsigned int numRays = numPixels * samplesPerPixel;
+    std::vector<glm::vec3> tileColours(numPixels, glm::vec3(0.0f));
+
+    double horizon = m_integrator.GetHorizon();
+    bool insideHorizon = m_params.insideHorizon;
+    int solver = m_params.ODESolver;
+    bool adaptive = m_integrator.IsAdaptive();
+
+    PacketXP xp;
+    PacketXP previousxp;
+    PacketXP FSAL;
+    Floats stepSize = Floats(1.0f);
+    Floats oldStepSize = Floats(0.0f);
+    Floats steps = Floats(0.0f);
+    unsigned int laneRay[simd::Width];
+    RayState laneState[simd::Width];
+    unsigned int activeLanes = 0;
+    unsigned int nextRay = 0;
+
+    auto startRays = [&](unsigned int lanes)
+    {
+        for (int lane = 0; lane < simd::Width; lane++)
+        {
+            if (!((lanes >> lane) & 1u))
+            {
+                continue;
+            }
+            // Culled rays and rays from the Schwarzschild tables are finished as soon as they start, so the lane goes
+            // to the next one in the queue.
+            unsigned int ray;
+            double laneStepSize;
+            glm::dmat2x4 laneFSAL;
+            glm::dmat2x4 lanexp;
+            bool finished = true;
+            while (finished && nextRay < numRays)
+            {
+                ray = nextRay++;
+                unsigned int pixel = ray / samplesPerPixel;
+                unsigned int sample = ray % samplesPerPixel;
+                glm::vec3 rayDir = RayDirection(x0 + pixel % tileWidth, y0 + pixel / tileWidth, sample / msaa,
+                    sample % msaa);
+                lanexp = StartRay(m_params.cameraPos, rayDir, laneStepSize, laneFSAL);
+                RayState finishedRay;
+                finished = CullRay(lanexp, finishedRay)
+                    || (m_useSchwarzschildTables && AnalyticRayMarch(lanexp, finishedRay));
+                if (finished)
+                {
+                    tileColours[pixel] += finishedRay.colour;
+                }
+            }
+            if (finished)
+            {
+                continue;
+            }
+
+            xp.SetLane(lane, lanexp);
+            if (adaptive)
+            {
+                FSAL.SetLane(lane, laneFSAL);
+            }
+            simd::SetLane(stepSize, lane, (float)laneStepSize);
+            simd::SetLane(oldStepSize, lane, 0.0f);
+            simd::SetLane(steps, lane, 0.0f);
+            laneRay[lane] = ray;
+            laneState[lane] = RayState();
+            activeLanes |= 1u << lane;
+        }
+    };
+
+    uint64_t packetSteps = 0;
+    uint64_t refinedSteps = 0;
+    uint64_t refinedRays = 0;
+    unsigned int refinedLanes = 0;
+
+    startRays(simd::Bits(simd::AllLanes()));
+    while (activeLanes != 0)
+    {
+        Mask active = simd::FromBits(activeLanes);
+        previousxp = xp;
+        packetSteps += std::popcount(activeLanes);
+
+        Floats dist;
+        if (solver == 0 || solver == 1)
+        {
+            PacketXP nextxp = (solver == 0) ? m_packetIntegrator.IntegrationStep(xp, stepSize)
+                : m_packetIntegrator.RK4IntegrationStep(xp, stepSize);
+            xp = Select(active, nextxp, xp);
+            dist = m_packetIntegrator.MetricDistance(xp.x);
+            oldStepSize = stepSize;
+            Floats nextStepSize = insideHorizon ? dist / (10.0f * (float)horizon)
+                : 0.01f + (dist - (float)horizon) / ((solver == 0) ? 10.0f : 5.0f);
+            stepSize = simd::Select(active, nextStepSize, stepSize);
+        }
+        else
+        {
+            xp = m_packetIntegrator.AdaptiveRKDriver(xp, stepSize, oldStepSize, FSAL, active);
+            dist = m_packetIntegrator.MetricDistance(xp.x);
+        }
+        steps += Floats(1.0f);
+
+        // Lanes that ProcessStep() might act on.  Everything else just keeps integrating.
+        Mask attention = (xp.x[2] * previousxp.x[2] < Floats(0.0f)) | (dist > Floats(m_params.drawDistance))
+            | (steps >= Floats((float)m_params.maxSteps));
+        if (m_useFarFieldEscape)
+        {
+            Floats xdotp = xp.x[1] * xp.p[1] + xp.x[2] * xp.p[2] + xp.x[3] * xp.p[3];
+            attention = attention | ((dist > Floats((float)m_escapeRadius)) & (xdotp > Floats(0.0f)));
+        }
+        if (!insideHorizon)
+        {
+            attention = attention | (dist < Floats((float)horizon));
+        }
+        attention = attention & active;
+
+        unsigned int finishedLanes = 0;
+        for (unsigned int bits = simd::Bits(attention); bits != 0; bits &= bits - 1)
+        {
+            int lane = std::countr_zero(bits);
+            RayState& ray = laneState[lane];
+            glm::dmat2x4 lanexp = xp.GetLane(lane);
+            bool finished = ProcessStep(previousxp.GetLane(lane), lanexp, simd::GetLane(dist, lane),
+                simd::GetLane(oldStepSize, lane), ray);
+            if (finished || simd::GetLane(steps, lane) >= (float)m_params.maxSteps)
+            {
+                FinishRay(lanexp, ray);
+                tileColours[laneRay[lane] / samplesPerPixel] += ray.colour;
+                finishedLanes |= 1u << lane;
+            }
+        }
+
+        Mask refine = m_packetIntegrator.NeedsDoublePrecision(xp, dist) & active & !simd::FromBits(finishedLanes);
+        for (unsigned int bits = simd::Bits(refine); bits != 0; bits &= bits - 1)
+        {
+            int lane = std::countr_zero(bits);
+            RayState& ray = laneState[lane];
+            glm::dmat2x4 lanexp = xp.GetLane(lane);
+            double laneStepSize = simd::GetLane(stepSize, lane);
+            double laneOldStepSize = simd::GetLane(oldStepSize, lane);
+            // The float FSAL isn't accurate enough to start the double precision steps from.
+            glm::dmat2x4 laneFSAL = adaptive ? m_integrator.FasterXPUpdate(lanexp, laneStepSize) / laneStepSize
+                : glm::dmat2x4(0.0);
+            int remainingSteps = m_params.maxSteps - (int)simd::GetLane(steps, lane);
+            bool finished;
+            int laneSteps = IntegrateRay(lanexp, laneStepSize, laneOldStepSize, laneFSAL, remainingSteps, true, ray,
+                finished);
+            refinedSteps += laneSteps;
+            if (!((refinedLanes >> lane) & 1u))
+            {
+                refinedRays++;
+                refinedLanes |= 1u << lane;
+            }
+            if (finished || laneSteps == remainingSteps)
+            {
+                FinishRay(lanexp, ray);
+                tileColours[laneRay[lane] / samplesPerPixel] += ray.colour;
+                finishedLanes |= 1u << lane;
+                continue;
+            }
+            xp.SetLane(lane, lanexp);
+            if (adaptive)
+            {
+                FSAL.SetLane(lane, laneFSAL);
+            }
+            simd::SetLane(stepSize, lane, (float)laneStepSize);
+            simd::SetLane(oldStepSize, lane, (float)laneOldStepSize);
+            simd::SetLane(steps, lane, simd::GetLane(steps, lane) + (float)laneSteps);
+        }
+
+        if (finishedLanes != 0)
+        {
+            activeLanes &= ~finishedLanes;
+            refinedLanes &= ~finishedLanes;
+            startRays(finishedLanes);
+        }
+    }
+    m_numPacketSteps.fetch_add(packetSteps, std::memory_order_relaxed);
+    if (refinedRays != 0)
+    {
+        m_numRefinedSteps.fetch_add(refinedSteps, std::memory_order_relaxed);
+        m_numRefinedRays.fetch_add(refinedRays, std::memory_order_relaxed);
+    }
+
+    for (unsigned int pixel = 0; pixel < numPixels; pixel++)
+    {
+        unsigned int x = x0 + pixel % tileWidth;
+        unsigned int y = y0 + pixel / tileWidth;
+        m_pixels[(size_t)y * m_params.width + x] = glm::vec4(tileColours[pixel] / (float)samplesPerPixel, 1.0f);
+    }
+}
+
+glm::vec3 CPURenderer::RenderPixel(unsigned int x, unsigned int y) const
+{
+    // Equivalent of main() in KerrBlackHole.shader.
+    glm::vec3 pixelCol = glm::vec3(0.0f);
+    int msaa = std::max(1, m_params.msaa);
+
+    for (int i = 0; i < msaa; i++)
+    {
+        for (int j = 0; j < msaa; j++)
+        {
+            bool rayHitDisk = false;
+            glm::vec3 rayCol = glm::vec3(0.0f);
+            RayMarch(m_params.cameraPos, RayDirection(x, y, i, j), rayCol, rayHitDisk);
+            pixelCol += rayCol;
+        }
+    }
+
+    return pixelCol / (float)(msaa * msaa);
+}
+
+glm::vec3 CPURenderer::RayDirection(unsigned int x, unsigned int y, int i, int j) const
+{
+    // TexCoords is the interpolated full screen quad coordinate at the pixel centre.
+    glm::vec2 screenSize = glm::vec2((float)m_params.width, (float)m_params.height);
+    glm::vec2 TexCoords = (glm::vec2((float)x, (float)y) + 0.5f) / screenSize;
+    int msaa = std::max(1, m_params.msaa);
+
+    glm::vec2 TexCoordOffset = glm::vec2((float)i / (float)(msaa + 1), (float)j / (float)(msaa + 1)) / screenSize;
+    glm::vec2 uv = (TexCoords + TexCoordOffset - 0.5f) * 2.0f;
+
+    glm::vec4 screen = m_params.projInv * glm::vec4(uv, 0.0f, 1.0f);
+    screen = glm::vec4(glm::vec3(screen) / screen.w, 0.0f);
+    return glm::normalize(glm::vec3(m_params.viewInv * screen));
+}
+
+void CPURenderer::RayMarch(const glm::vec3& cameraPos, const glm::vec3& rayDir, glm::vec3& rayCol, bool& hitDisk) const
+{
+    RayState ray;
+    MarchRay(cameraPos, rayDir, ray);
+    rayCol = ray.colour;
+    hitDisk = ray.hitDisk;
+}
+
+void CPURenderer::TraceRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, GeodesicRecord& record) const
+{
+    record = GeodesicRecord();
+    RayState ray;
+    ray.record = &record;
+    MarchRay(cameraPos, rayDir, ray);
+}
+
+void CPURenderer::MarchRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, RayState& ray) const
+{
+    // Port of rayMarch() in KerrBlackHole.shader.  The geodesic is integrated in double precision; colours stay in
+    // single precision.
+    double stepSize;
+    glm::dmat2x4 FSAL;
+    glm::dmat2x4 xp = StartRay(cameraPos, rayDir, stepSize, FSAL);
+    double startH = m_integrator.H(xp[0], xp[1]);
+
+    if (CullRay(xp, ray))
+    {
+        return;
+    }
+
+    if (m_params.metric == 2)
+    {
+        StraightRayMarch(xp, ray);
+        return;
+    }
+
+    if ((m_useAnalytic || m_useSchwarzschildTables) && AnalyticRayMarch(xp, ray))
+    {
+        return;
+    }
+
+    double oldStepSize = 0.0;
+    bool finished;
+    int numSteps = IntegrateRay(xp, stepSize, oldStepSize, FSAL, m_params.maxSteps, false, ray, finished);
+    m_numSteps.fetch_add(numSteps, std::memory_order_relaxed);
+    m_numIntegratedRays.fetch_add(1, std::memory_order_relaxed);
+    double drift = std::abs(m_integrator.H(xp[0], xp[1]) - startH);
+    m_sumHDrift.fetch_add(drift, std::memory_order_relaxed);
+    double maxDrift = m_maxHDrift.load(std::memory_order_relaxed);
+    while (drift > maxDrift && !m_maxHDrift.compare_exchange_weak(maxDrift, drift, std::memory_order_relaxed))
+    {
+    }
+
+    FinishRay(xp, ray);
+}
+
+bool CPURenderer::RecordDiskHit(const glm::dmat2x4& diskIntersectionPoint, float previousy, double diskDist,
+    RayState& ray) const
+{
+    glm::dvec4 planeIntersectionPoint = diskIntersectionPoint[0];
+    ray.record->diskHits[ray.numDiskHits++] = glm::vec4((float)diskDist,
+        (float)std::atan2(planeIntersectionPoint.w, planeIntersectionPoint.y),
+        (float)m_shading.DiskRedshift(diskIntersectionPoint, diskDist), previousy);
+    return ray.numDiskHits == GeodesicRecord::MaxDiskHits;
+}
+
+int CPURenderer::IntegrateRay(glm::dmat2x4& xp, double& stepSize, double& oldStepSize, glm::dmat2x4& FSAL, int maxSteps,
+    bool untilSinglePrecision, RayState& ray, bool& finished) const
+{
+    // The main loop of RayMarch(), also used by RenderTilePacket() for the lanes that need double precision, which
+    // stop as soon as the packet can take them back.
+    double horizon = m_integrator.GetHorizon();
+    bool insideHorizon = m_params.insideHorizon;
+    int solver = m_params.ODESolver;
+
+    // The PI controller's history before the first step, as in initRay().
+    double previousError = 1.0e-4;
+    // Bulirsch-Stoer's column, chosen on the first step.
+    int targetColumn = 0;
+    glm::dmat2x4 previousxp;
+    double dist;
+
+    // MAIN RAYMARCH LOOP
+    finished = false;
+    int numSteps = 0;
+    for (int i = 0; i < maxSteps; i++)
+    {
+        previousxp = xp;
+        numSteps++;
+
+        if (solver == 0 || solver == 1 || solver == 7)
+        {
+            if (solver == 0)
+            {
+                xp = m_integrator.IntegrationStep(xp, stepSize);
+            }
+            else if (solver == 1)
+            {
+                xp = m_integrator.RK4IntegrationStep(xp, stepSize);
+            }
+            else
+            {
+                xp = m_integrator.GaussLegendreIntegrationStep(xp, stepSize);
+            }
+            dist = m_integrator.MetricDistance(xp[0]);
+            oldStepSize = stepSize;
+            if (insideHorizon)
+            {
+                stepSize = dist / (10.0 * horizon);
+            }
+            else
+            {
+                stepSize = 0.01 + (dist - horizon) / ((solver == 0) ? 10.0 : 5.0);
+            }
+        }
+        else if (m_integrator.IsBulirschStoer())
+        {
+            xp = m_integrator.BulirschStoerDriver(xp, stepSize, oldStepSize, targetColumn);
+            dist = m_integrator.MetricDistance(xp[0]);
+        }
+        else if (m_integrator.IsTaylor())
+        {
+            xp = m_integrator.TaylorDriver(xp, stepSize, oldStepSize);
+            dist = m_integrator.MetricDistance(xp[0]);
+        }
+        else
+        {
+            xp = m_integrator.AdaptiveRKDriver(xp, stepSize, oldStepSize, FSAL, previousError);
+            dist = m_integrator.MetricDistance(xp[0]);
+        }
+
+        if (ProcessStep(previousxp, xp, dist, oldStepSize, ray))
+        {
+            finished = true;
+            break;
+        }
+        if (untilSinglePrecision && !m_packetIntegrator.NeedsDoublePrecision(xp, dist))
+        {
+            break;
+        }
+    }
+    return numSteps;
+}
+
+glm::dmat2x4 CPURenderer::StartRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, double& stepSize,
+    glm::dmat2x4& FSAL) const
+{
+    double horizon = m_integrator.GetHorizon();
+    bool insideHorizon = m_params.insideHorizon;
+
+    glm::dmat2x4 xp;
+    xp[0] = glm::dvec4(0.0, glm::dvec3(cameraPos));
+    double dist = m_integrator.MetricDistance(xp[0]);
+    // Inside the event horizon, the metric uses outgoing coordinates.  We adjust p accordingly.
+    xp[1] = m_integrator.Metric(xp[0]) * glm::dvec4(insideHorizon ? -1.0 : 1.0, glm::dvec3(rayDir));
+
+    // Cheap, dumb initial stepsize heuristic
+    if (insideHorizon)
+    {
+        stepSize = dist / (100.0 * horizon);
+    }
+    else
+    {
+        stepSize = 0.01 + (dist - horizon) / 10.0;
+    }
+
+    if (m_integrator.IsAdaptive())
+    {
+        // Prepare adaptive ODE solvers for first-same-as-last (FSAL).
+        FSAL = m_integrator.FasterXPUpdate(xp, stepSize) / stepSize;
+    }
+    return xp;
+}
+
+bool CPURenderer::ProcessStep(const glm::dmat2x4& previousxp, const glm::dmat2x4& xp, double dist, double oldStepSize,
+    RayState& ray) const
+{
+    double horizon = m_integrator.GetHorizon();
+
+    // Check if the ray crossed the disk's plane.
+    bool crossedPlane = xp[0][2] * previousxp[0][2] < 0.0;
+    if (crossedPlane)
+    {
+        if (dist > horizon)
+        {
+            glm::dmat2x4 diskIntersectionPoint;
+            m_integrator.BSDiskIntersectionPoint(previousxp, xp, diskIntersectionPoint, oldStepSize);
+            double diskDist = m_integrator.MetricDistance(diskIntersectionPoint[0]);
+            float previousy = (float)glm::sign(previousxp[0][2]);
+            if (ray.record)
+            {
+                // Every crossing is recorded, and the shade pass decides where the ray stops.
+                if (RecordDiskHit(diskIntersectionPoint, previousy, diskDist, ray))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                if (diskDist <= m_params.outerRadius && diskDist >= m_params.innerRadius)
+                {
+                    ray.hitDisk = true;
+                    ray.colour += m_shading.GetDiskColour(diskIntersectionPoint, previousy, (float)diskDist, ray.T);
+                }
+                if (ray.T < 0.05f)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    if (!m_params.insideHorizon)
+    {
+        // If the camera is outside the horizon, check if the ray hit the sphere.
+        if (dist < horizon)
+        {
+            ray.hitSphere = true;
+            if (m_params.useDebugSphereTexture)
+            {
+                glm::dmat2x4 sphereIntersectionPoint;
+                m_integrator.BSSphereIntersectionPoint(previousxp, sphereIntersectionPoint, horizon, oldStepSize);
+                glm::vec3 spherePoint = glm::vec3(sphereIntersectionPoint[0].y, sphereIntersectionPoint[0].z,
+                    sphereIntersectionPoint[0].w);
+                if (ray.record)
+                {
+                    ray.record->escape = glm::vec4(spherePoint, (float)EscapeRecord::Sphere);
+                }
+                else
+                {
+                    ray.colour += ray.T * m_shading.GetSphereColour(spherePoint);
+                }
+            }
+            return true;
+        }
+    }
+    else if (crossedPlane)
+    {
+        // With INSIDE_HORIZON defined, the sphere check is compiled out of the shader and the draw distance check
+        // below becomes the else branch of the disk crossing check.
+        return false;
+    }
+
+    // Check if the ray escaped the black hole and hit the skybox.
+    if (HasEscaped(xp, dist))
+    {
+        ray.hitInfinity = true;
+        glm::dvec3 dir = EscapeDirection(xp);
+        if (ray.record)
+        {
+            ray.record->escape = glm::vec4(glm::vec3(dir), (float)EscapeRecord::Infinity);
+        }
+        else
+        {
+            ray.colour += ray.T * m_shading.GetSkyboxColour(glm::vec3(dir)) * m_params.bloomBackgroundMultiplier;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool CPURenderer::HasEscaped(const glm::dmat2x4& xp, double dist) const
+{
+    // hasEscaped() in the shader.  With the far-field escape, rays heading outwards (x.p > 0) beyond the escape radius
+    // stop as well.
+    if (dist > m_params.drawDistance)
+    {
+        return true;
+    }
+    return m_useFarFieldEscape && dist > m_escapeRadius
+        && xp[0][1] * xp[1][1] + xp[0][2] * xp[1][2] + xp[0][3] * xp[1][3] > 0.0;
+}
+
+glm::dvec3 CPURenderer::EscapeDirection(const glm::dmat2x4& xp) const
+{
+    // escapeDirection() in the shader, which has the derivation.  The direction turns towards the black hole by the
+    // rest of the weak-field bending up to the draw distance D, (M / b) * ((2 + w^2) * sqrt(1 - w^2) - (2 + sin^2(psi))
+    // * cos(psi)) with b = r sin(psi) and w = b / D, and the Kerr-Schild twist about the spin axis is moved from r to D.
+    glm::dvec3 dir = m_integrator.PToDir(xp);
+    if (!m_useFarFieldEscape)
+    {
+        return dir;
+    }
+    double mass = m_params.mass;
+    glm::dvec3 x = glm::dvec3(xp[0][1], xp[0][2], xp[0][3]);
+    double r = glm::length(x);
+    double cosPsi = glm::dot(x, dir) / r;
+    glm::dvec3 inwards = cosPsi * dir - x / r;
+    double sinPsi = glm::length(inwards);
+    double D = std::max((double)m_params.drawDistance, r);
+    double b = r * sinPsi;
+    double sD = std::sqrt(std::max(0.0, D * D - b * b));
+    glm::dvec3 xD = x + (sD - r * cosPsi) * dir;
+    glm::dvec3 spinAxis = glm::dvec3(0.0, 1.0, 0.0);
+    glm::dvec3 twist = (2.0 * m_params.a * mass) * ((sD / (D * D * D * D)) * glm::cross(spinAxis, xD)
+        - (cosPsi / (r * r * r)) * glm::cross(spinAxis, x));
+    if (b > 1.0e-4 * r)
+    {
+        double deflection = (mass / b) * ((2.0 + b * b / (D * D)) * sD / D - (2.0 + sinPsi * sinPsi) * cosPsi);
+        dir = std::cos(deflection) * dir + std::sin(deflection) * inwards / sinPsi;
+    }
+    return glm::normalize(dir + twist);
+}
+
+void CPURenderer::FinishRay(const glm::dmat2x4& xp, RayState& ray) const
+{
+    if (ray.record)
+    {
+        // The shade pass applies the test below once it knows whether the ray hit the disk.
+        if (!ray.hitSphere && !ray.hitInfinity && m_integrator.MetricDistance(xp[0]) > m_integrator.GetHorizon())
+        {
+            ray.record->escape = glm::vec4(glm::vec3(m_integrator.PToDir(xp)), (float)EscapeRecord::Unfinished);
+        }
+        return;
+    }
+    // If the ray went max steps without hitting anything, just cast the ray to the skybox.
+    if ((!ray.hitDisk && !ray.hitSphere && !ray.hitInfinity)
+        || (!ray.hitSphere && !ray.hitInfinity && m_params.transparentDisk && !m_params.useDebugDiskTexture))
+    {
+        double dist = m_integrator.MetricDistance(xp[0]);
+        if (dist > m_integrator.GetHorizon())
+        {
+            glm::dvec3 dir = m_integrator.PToDir(xp);
+            ray.colour += ray.T * m_shading.GetSkyboxColour(glm::vec3(dir)) * m_params.bloomBackgroundMultiplier;
+        }
+    }
+}
+
+bool CPURenderer::CullRay(const glm::dmat2x4& xp, RayState& ray) const
+{
+    if (!m_useCaptureCulling || !m_captureCulling.IsCulled(xp, m_integrator, m_params.innerRadius))
+    {
+        return false;
+    }
+    // Black like any other ray that falls in without crossing the disk, unless it's shown for debugging.
+    ray.hitSphere = true;
+    if (ray.record)
+    {
+        ray.record->escape = glm::vec4(0.0f, 0.0f, 0.0f, (float)EscapeRecord::Culled);
+    }
+    else if (m_params.showCaptureCulling)
+    {
+        ray.colour += m_params.captureCullingColour;
+    }
+    m_numCulledRays.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool CPURenderer::AnalyticRayMarch(const glm::dmat2x4& xp, RayState& ray) const
+{
+    // Same shading as ProcessStep() and FinishRay(), applied to the crossings in the order the ray meets them.
+    AnalyticRay analyticRay;
+    if (m_useSchwarzschildTables && m_schwarzschildTables.Trace(xp, m_integrator, m_params.mass, m_params.drawDistance,
+        analyticRay))
+    {
+        m_numTableRays.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (!m_useAnalytic || !m_analyticTracer.Trace(xp, analyticRay))
+    {
+        return false;
+    }
+
+    if (ray.record)
+    {
+        for (int i = 0; i < analyticRay.numCrossings; i++)
+        {
+            if (RecordDiskHit(analyticRay.crossing[i], analyticRay.previousy[i], analyticRay.crossingRadius[i], ray))
+            {
+                break;
+            }
+        }
+        if (analyticRay.escapes)
+        {
+            ray.record->escape = glm::vec4(glm::vec3(analyticRay.escapeDirection), (float)EscapeRecord::Infinity);
+        }
+        else if (m_params.useDebugSphereTexture)
+        {
+            ray.record->escape = glm::vec4(glm::vec3(analyticRay.horizonPoint), (float)EscapeRecord::Sphere);
+        }
+        return true;
+    }
+
+    bool stopped = false;
+    for (int i = 0; i < analyticRay.numCrossings; i++)
+    {
+        double diskDist = analyticRay.crossingRadius[i];
+        if (diskDist <= m_params.outerRadius && diskDist >= m_params.innerRadius)
+        {
+            ray.hitDisk = true;
+            ray.colour += m_shading.GetDiskColour(analyticRay.crossing[i], analyticRay.previousy[i], (float)diskDist, ray.T);
+        }
+        if (ray.T < 0.05f)
+        {
+            stopped = true;
+            break;
+        }
+    }
+
+    // A ray that stops on the disk only sees the sky through a transparent disk, as in FinishRay().
+    if (analyticRay.escapes && (!stopped || (m_params.transparentDisk && !m_params.useDebugDiskTexture)))
+    {
+        ray.hitInfinity = !stopped;
+        glm::vec3 dir = glm::vec3(analyticRay.escapeDirection);
+        ray.colour += ray.T * m_shading.GetSkyboxColour(dir) * m_params.bloomBackgroundMultiplier;
+    }
+    else if (!analyticRay.escapes && !stopped && m_params.useDebugSphereTexture)
+    {
+        ray.colour += ray.T * m_shading.GetSphereColour(glm::vec3(analyticRay.horizonPoint));
+    }
+    ray.hitSphere = !analyticRay.escapes;
+    return true;
+}
+
+void CPURenderer::StraightRayMarch(const glm::dmat2x4& xp, RayState& ray) const
+{
+    // p is constant, so the ray is x + l * dx/dl.  It crosses the disk's plane at most once, outside the sphere if
+    // that comes first, and otherwise ends on the sphere or at the skybox in the direction it started in.
+    double horizon = m_integrator.GetHorizon();
+    glm::dvec4 dxdl = m_integrator.InvMetric(xp[0]) * xp[1];
+    glm::dvec3 x = glm::dvec3(xp[0][1], xp[0][2], xp[0][3]);
+    glm::dvec3 dir = glm::dvec3(dxdl.y, dxdl.z, dxdl.w);
+    double lSphere = -1.0;
+    if (!m_params.insideHorizon)
+    {
+        // The nearer root of |x + l dir|^2 = horizon^2, in the form that doesn't cancel.
+        double b = glm::dot(x, dir);
+        double c = glm::dot(x, x) - horizon * horizon;
+        double discriminant = b * b - c;
+        if (b < 0.0 && discriminant > 0.0)
+        {
+            lSphere = c / (std::sqrt(discriminant) - b);
+        }
+    }
+
+    if (x.y * dir.y < 0.0)
+    {
+        double lDisk = -x.y / dir.y;
+        glm::dmat2x4 diskIntersectionPoint;
+        diskIntersectionPoint[0] = xp[0] + lDisk * dxdl;
+        diskIntersectionPoint[0][2] = 0.0;
+        diskIntersectionPoint[1] = xp[1];
+        double diskDist = m_integrator.MetricDistance(diskIntersectionPoint[0]);
+        bool crossesPlane = (lSphere < 0.0 || lDisk < lSphere) && diskDist > horizon;
+        if (ray.record && crossesPlane)
+        {
+            // Like the trace pass, the record keeps the crossing whatever the disk's radii.
+            RecordDiskHit(diskIntersectionPoint, (float)glm::sign(x.y), diskDist, ray);
+        }
+        else if (!ray.record && crossesPlane && diskDist <= m_params.outerRadius && diskDist >= m_params.innerRadius)
+        {
+            ray.hitDisk = true;
+            float previousy = (float)glm::sign(x.y);
+            ray.colour += m_shading.GetDiskColour(diskIntersectionPoint, previousy, (float)diskDist, ray.T);
+        }
+    }
+
+    if (ray.record)
+    {
+        ray.hitSphere = lSphere >= 0.0;
+        ray.hitInfinity = !ray.hitSphere;
+        if (ray.hitSphere && m_params.useDebugSphereTexture)
+        {
+            ray.record->escape = glm::vec4(glm::vec3(x + lSphere * dir), (float)EscapeRecord::Sphere);
+        }
+        else if (ray.hitInfinity)
+        {
+            ray.record->escape = glm::vec4(glm::vec3(glm::normalize(dir)), (float)EscapeRecord::Infinity);
+        }
+        return;
+    }
+
+    // As in the shade pass, a ray that stops on the disk only sees the skybox through a transparent disk.
+    bool stopped = ray.T < 0.05f;
+    if (lSphere >= 0.0)
+    {
+        ray.hitSphere = true;
+        if (m_params.useDebugSphereTexture && !stopped)
+        {
+            glm::dvec3 spherePoint = x + lSphere * dir;
+            ray.colour += ray.T * m_shading.GetSphereColour(glm::vec3(spherePoint));
+        }
+    }
+    else if (!stopped || (m_params.transparentDisk && !m_params.useDebugDiskTexture))
+    {
+        ray.hitInfinity = !stopped;
+        ray.colour += ray.T * m_shading.GetSkyboxColour(glm::vec3(glm::normalize(dir)))
+            * m_params.bloomBackgroundMultiplier;
+    }
+}
+
+bool CPURenderer::WriteHDR(const std::string& fileName) const
+{
+    return WriteHDR(fileName, m_params.width, m_params.height, m_pixels);
+}
+
+bool CPURenderer::WriteHDR(const std::string& fileName, unsigned int width, unsigned int height, const PixelBuffer& pixels)
+{
+    // Rows are stored bottom to top like an OpenGL texture.
+    stbi_flip_vertically_on_write(1);
+    return stbi_write_hdr(fileName.c_str(), width, height, 4, &pixels[0].x) != 0;
+}
+
+bool CPURenderer::WritePNG(const std::string& fileName) const
+{
+    std::vector<unsigned char> dataBuffer((size_t)m_params.width * m_params.height * 3);
+    for (size_t i = 0; i < m_pixels.size(); i++)
+    {
+        // Tone mapping and gamma correction, as in FinalBloom.shader (without the bloom term).
+        glm::vec3 result = glm::vec3(1.0f) - glm::exp(-glm::vec3(m_pixels[i]) * m_params.exposure);
+        result = glm::pow(result, glm::vec3(1.0f / m_params.gamma));
+        for (int c = 0; c < 3; c++)
+        {
+            dataBuffer[3 * i + c] = (unsigned char)std::clamp(std::lround(result[c] * 255.0f), 0l, 255l);
+        }
+    }
+    stbi_flip_vertically_on_write(1);
+    return stbi_write_png(fileName.c_str(), m_params.width, m_params.height, 3, dataBuffer.data(), m_params.width * 3) != 0;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "GeodesicIntegrator.h"
+#include "PacketIntegrator.h"
+#include "AnalyticKerrTracer.h"
+#include "CaptureCulling.h"
+#include "SchwarzschildTables.h"
+#include "TransferAtlas.h"
+#include "CPUShading.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <atomic>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+	// Default initialises elements instead of value initialising them, so constructing a std::vector of glm::vec4
+	// doesn't write to its memory.  Each page is then placed on the NUMA node of the thread that writes to it first.
+	template <typename U>
+	struct rebind
+	{
+		using other = FirstTouchAllocator<U>;
+	};
+
+	FirstTouchAllocator() = default;
+	template <typename U>
+	FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+	template <typename U>
+	void construct(U* p) { ::new ((void*)p) U; }
+	template <typename U, typename... Args>
+	void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+};
+
+using PixelBuffer = std::vector<glm::vec4, FirstTouchAllocator<glm::vec4>>;
+
+
+struct ImageDifference
+{
+	// Statistics over the RGB channels of two images of the same size.
+	float meanAbsDiff = 0.0f;
+	float rmsDiff = 0.0f;
+	float maxAbsDiff = 0.0f;
+	// Fraction of pixels where some channel differs by more than the tolerance, relative to max(1, |value|).
+	float fractionMismatched = 0.0f;
+	unsigned int numPixels = 0;
+};
+
+ImageDifference CompareImages(const PixelBuffer& a, const PixelBuffer& b, float tolerance = 0.05f);
+
+
+class CPURenderer
+{
+	// CPU version of the KerrBlackHole.shader fragment stage.  The image is split into square tiles which are rendered
+	// on a ThreadPool.  Pixels are stored as linear RGBA floats with row 0 at the bottom, the same layout as the
+	// colour attachment of BlackHole's framebuffer, so the result can be compared directly against glGetTexImage.
+	// With BlackHoleParameters::useSIMD, each tile integrates simd::Width rays at once with the PacketIntegrator.
+	// With BlackHoleParameters::analytic, RayMarch() asks the AnalyticKerrTracer first and only integrates the rays it
+	// can't handle.  With BlackHoleParameters::captureCulling, both paths skip the rays that CaptureCulling says fall
+	// in, and with BlackHoleParameters::schwarzschildTables, the rays SchwarzschildTables covers.  Minkowski rays are
+	// straight lines, which RayMarch() traces in closed form without packets.  TraceRay() records a ray's disk crossings
+	// and how it ended instead of shading it, for the TransferAtlas.  The pixels are left uninitialised until Render()
+	// so that the workers, not the constructing thread, touch them first.
+public:
+	CPURenderer(const BlackHoleParameters& params, const CPUCubeMap& skybox);
+	~CPURenderer();
+
+	// Renders the whole frame and returns the wall clock time taken in seconds.  Each worker starts with a contiguous
+	// band of tiles and steals from the others when it runs out.  pool.GetStats() has the load balance afterwards.
+	float Render(ThreadPool& pool, unsigned int tileSize = 16);
+	void RenderTile(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+	void RenderTilePacket(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+	glm::vec3 RenderPixel(unsigned int x, unsigned int y) const;
+	// Direction of sample (i, j) of the msaa x msaa grid in pixel (x, y).
+	glm::vec3 RayDirection(unsigned int x, unsigned int y, int i, int j) const;
+	void RayMarch(const glm::vec3& cameraPos, const glm::vec3& rayDir, glm::vec3& rayCol, bool& hitDisk) const;
+	// The trace pass of the shader's geodesic G-buffer: every crossing of the disk's plane, whatever the disk's radii,
+	// up to GeodesicRecord::MaxDiskHits, and how the ray ended.
+	void TraceRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, GeodesicRecord& record) const;
+	bool UsesPackets() const { return m_usePackets; }
+	bool UsesAnalytic() const { return m_useAnalytic; }
+	// Rays AnalyticRayMarch() finished from the Schwarzschild tables, on both paths.
+	uint64_t GetNumTableRays() const { return m_numTableRays.load(); }
+	// Integration steps taken by RayMarch() since the renderer was created, and how far H = g^{\mu\nu} p_\mu p_\nu / 2
+	// drifted from its starting value over each of its rays.  H is conserved along geodesics, so the drift measures
+	// the ODE solver's error.  The packet path doesn't count its rays.
+	uint64_t GetNumSteps() const { return m_numSteps.load(); }
+	uint64_t GetNumIntegratedRays() const { return m_numIntegratedRays.load(); }
+	double GetMeanHDrift() const { return m_numIntegratedRays ? m_sumHDrift.load() / m_numIntegratedRays.load() : 0.0; }
+	double GetMaxHDrift() const { return m_maxHDrift.load(); }
+	// Steps the packet path took in single precision, and with BlackHoleParameters::fp64Refinement, the steps its lanes
+	// took in double precision and the number of rays that took any.
+	uint64_t GetNumPacketSteps() const { return m_numPacketSteps.load(); }
+	uint64_t GetNumRefinedSteps() const { return m_numRefinedSteps.load(); }
+	uint64_t GetNumRefinedRays() const { return m_numRefinedRays.load(); }
+	// Rays that BlackHoleParameters::captureCulling finished without integrating them, on both paths.
+	uint64_t GetNumCulledRays() const { return m_numCulledRays.load(); }
+
+	unsigned int GetWidth() const { return m_params.width; }
+	unsigned int GetHeight() const { return m_params.height; }
+	const PixelBuffer& GetPixels() const { return m_pixels; }
+
+	// Radiance .hdr keeps the linear values.  PNG is tone mapped with the FinalBloom exposure and gamma.
+	bool WriteHDR(const std::string& fileName) const;
+	bool WritePNG(const std::string& fileName) const;
+	static bool WriteHDR(const std::string& fileName, unsigned int width, unsigned int height, const PixelBuffer& pixels);
+
+private:
+	struct RayState
+	{
+		glm::vec3 colour = glm::vec3(0.0f);
+		float T = 1.0f;  // Transmittance
+		bool hitDisk = false;
+		bool hitSphere = false;
+		bool hitInfinity = false;
+		// Set by TraceRay(), which records the ray here instead of shading it.
+		GeodesicRecord* record = nullptr;
+		int numDiskHits = 0;
+	};
+
+	// RayMarch() and TraceRay(), which only differ in whether ray.record is set.
+	void MarchRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, RayState& ray) const;
+	// Adds a crossing of the disk's plane to ray.record as diskHitRecord() does, and returns true once it's full.
+	bool RecordDiskHit(const glm::dmat2x4& diskIntersectionPoint, float previousy, double diskDist, RayState& ray) const;
+
+	// The pieces of RayMarch() that are shared with RenderTilePacket().  ProcessStep() handles the disk, sphere and
+	// draw distance checks after a step from previousxp to xp and returns true if the ray is finished.  FinishRay()
+	// is the skybox fallback after the main loop.  IntegrateRay() is the main loop, which takes up to maxSteps steps
+	// and sets finished if ProcessStep() ended the ray.  With untilSinglePrecision, it also stops once the packet
+	// integrator no longer needs double precision for the ray.  Returns the number of steps taken.
+	glm::dmat2x4 StartRay(const glm::vec3& cameraPos, const glm::vec3& rayDir, double& stepSize, glm::dmat2x4& FSAL) const;
+	bool ProcessStep(const glm::dmat2x4& previousxp, const glm::dmat2x4& xp, double dist, double oldStepSize,
+		RayState& ray) const;
+	void FinishRay(const glm::dmat2x4& xp, RayState& ray) const;
+	// HasEscaped() is whether the ray has reached the skybox, and EscapeDirection() the direction it samples it in,
+	// both including BlackHoleParameters::farFieldEscape.
+	bool HasEscaped(const glm::dmat2x4& xp, double dist) const;
+	glm::dvec3 EscapeDirection(const glm::dmat2x4& xp) const;
+	int IntegrateRay(glm::dmat2x4& xp, double& stepSize, double& oldStepSize, glm::dmat2x4& FSAL, int maxSteps,
+		bool untilSinglePrecision, RayState& ray, bool& finished) const;
+	// Shades the ray and returns true if CaptureCulling says it falls in without reaching the disk.
+	bool CullRay(const glm::dmat2x4& xp, RayState& ray) const;
+	// Shades the ray from its closed form solution, from the Schwarzschild tables if they're in use and otherwise the
+	// AnalyticKerrTracer.  Returns false if the ray has to be integrated instead.
+	bool AnalyticRayMarch(const glm::dmat2x4& xp, RayState& ray) const;
+	// Shades a Minkowski ray as the straight line it is, like straightRayMarch() in the shader.
+	void StraightRayMarch(const glm::dmat2x4& xp, RayState& ray) const;
+
+	BlackHoleParameters m_params;
+	GeodesicIntegrator m_integrator;
+	PacketIntegrator m_packetIntegrator;
+	bool m_usePackets;
+	AnalyticKerrTracer m_analyticTracer;
+	bool m_useAnalytic;
+	CPUShading m_shading;
+	PixelBuffer m_pixels;
+	bool m_useFarFieldEscape;
+	// Larger of BlackHoleParameters::escapeRadius, in units of the mass, and the disk's outer radius.
+	double m_escapeRadius;
+	bool m_useCaptureCulling;
+	CaptureCulling m_captureCulling;
+	bool m_useSchwarzschildTables;
+	SchwarzschildTables m_schwarzschildTables;
+	mutable std::atomic<uint64_t> m_numSteps{ 0 };
+	mutable std::atomic<uint64_t> m_numIntegratedRays{ 0 };
+	mutable std::atomic<double> m_sumHDrift{ 0.0 };
+	mutable std::atomic<double> m_maxHDrift{ 0.0 };
+	std::atomic<uint64_t> m_numPacketSteps{ 0 };
+	std::atomic<uint64_t> m_numRefinedSteps{ 0 };
+	std::atomic<uint64_t> m_numRefinedRays{ 0 };
+	mutable std::atomic<uint64_t> m_numCulledRays{ 0 };
+	mutable std::atomic<uint64_t> m_numTableRays{ 0 };
+};
@@ -0,0 +1,480 @@
+#include "CPUShading.h"
+
+#include "Texture.h"
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+
+static float Map(float val, float min1, float max1, float min2, float max2)
+{
+    float percent = (val - min1) / (max1 - min1);
+    return percent * (max2 - min2) + min2;
+}
+
+
+/////////////////////////////////////////////////////
+/////////////////////   SKYBOX   ////////////////////
+/////////////////////////////////////////////////////
+
+CPUCubeMap::CPUCubeMap()
+{
+}
+
+CPUCubeMap::CPUCubeMap(const std::vector<std::string>& paths)
+{
+    Load(paths);
+}
+
+CPUCubeMap::~CPUCubeMap()
+{
+}
+
+bool CPUCubeMap::Load(const std::vector<std::string>& paths)
+{
+    m_loaded = false;
+    if (paths.size() != 6)
+    {
+        std::cout << "CPUCubeMap needs exactly 6 faces, got " << paths.size() << std::endl;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < 6; i++)
+    {
+        // Same flip as TextureCubeMap, so that row 0 of the buffer is t = 0 exactly as glTexImage2D sees it.
+        Image image(paths[i], 0);
+        unsigned char* buffer = image.GetBuffer();
+        if (!buffer)
+        {
+            return false;
+        }
+        int channels = image.GetNumChannels();
+        Face& face = m_faces[i];
+        face.width = image.GetWidth();
+        face.height = image.GetHeight();
+        face.texels.resize((size_t)face.width * face.height);
+        for (size_t j = 0; j < face.texels.size(); j++)
+        {
+            // The GL textures are GL_RGB/GL_RGBA (not sRGB), so the shader sees byte / 255.
+            const unsigned char* texel = buffer + j * channels;
+            if (channels >= 3)
+            {
+                face.texels[j] = glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+            }
+            else
+            {
+                face.texels[j] = glm::vec3(texel[0] / 255.0f, 0.0f, 0.0f);
+            }
+        }
+    }
+    m_loaded = true;
+    return true;
+}
+
+glm::vec3 CPUCubeMap::Bilinear(const Face& face, float s, float t) const
+{
+    // GL_LINEAR with GL_CLAMP_TO_EDGE.
+    float u = s * face.width - 0.5f;
+    float v = t * face.height - 0.5f;
+    float u0f = std::floor(u);
+    float v0f = std::floor(v);
+    float alpha = u - u0f;
+    float beta = v - v0f;
+    int u0 = std::clamp((int)u0f, 0, face.width - 1);
+    int u1 = std::clamp((int)u0f + 1, 0, face.width - 1);
+    int v0 = std::clamp((int)v0f, 0, face.height - 1);
+    int v1 = std::clamp((int)v0f + 1, 0, face.height - 1);
+
+    const glm::vec3& t00 = face.texels[(size_t)v0 * face.width + u0];
+    const glm::vec3& t10 = face.texels[(size_t)v0 * face.width + u1];
+    const glm::vec3& t01 = face.texels[(size_t)v1 * face.width + u0];
+    const glm::vec3& t11 = face.texels[(size_t)v1 * face.width + u1];
+    return (1.0f - beta) * ((1.0f - alpha) * t00 + alpha * t10) + beta * ((1.0f - alpha) * t01 + alpha * t11);
+}
+
+glm::vec3 CPUCubeMap::Sample(const glm::vec3& dir) const
+{
+    if (!m_loaded)
+    {
+        return glm::vec3(0.0f);
+    }
+
+    // Face selection from table 8.19 of the OpenGL 4.6 specification.
+    float ax = std::abs(dir.x);
+    float ay = std::abs(dir.y);
+    float az = std::abs(dir.z);
+    int faceIndex;
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az)
+    {
+        ma = ax;
+        faceIndex = dir.x >= 0.0f ? 0 : 1;
+        sc = dir.x >= 0.0f ? -dir.z : dir.z;
+        tc = -dir.y;
+    }
+    else if (ay >= az)
+    {
+        ma = ay;
+        faceIndex = dir.y >= 0.0f ? 2 : 3;
+        sc = dir.x;
+        tc = dir.y >= 0.0f ? dir.z : -dir.z;
+    }
+    else
+    {
+        ma = az;
+        faceIndex = dir.z >= 0.0f ? 4 : 5;
+        sc = dir.z >= 0.0f ? dir.x : -dir.x;
+        tc = -dir.y;
+    }
+    if (ma == 0.0f)
+    {
+        return glm::vec3(0.0f);
+    }
+    float s = 0.5f * (sc / ma + 1.0f);
+    float t = 0.5f * (tc / ma + 1.0f);
+    return Bilinear(m_faces[faceIndex], s, t);
+}
+
+
+/////////////////////////////////////////////////////
+/////////////////////   NOISE   /////////////////////
+/////////////////////////////////////////////////////
+
+static glm::vec3 mod289(const glm::vec3& x)
+{
+    return x - glm::floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+static glm::vec4 mod289(const glm::vec4& x)
+{
+    return x - glm::floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+static glm::vec4 permute(const glm::vec4& x)
+{
+    return mod289(((x * 34.0f) + 10.0f) * x);
+}
+
+static glm::vec4 taylorInvSqrt(const glm::vec4& r)
+{
+    return 1.79284291400159f - 0.85373472095314f * r;
+}
+
+static glm::vec3 fade(const glm::vec3& t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float CPUShading::CNoise3D(const glm::vec3& P)
+{
+    // Classic Perlin noise created by Ken Perlin.
+    // Implementation by Stefan Gustavson: https://stegu.github.io/webgl-noise/
+    glm::vec3 Pi0 = glm::floor(P); // Integer part for indexing
+    glm::vec3 Pi1 = Pi0 + glm::vec3(1.0f); // Integer part + 1
+    Pi0 = mod289(Pi0);
+    Pi1 = mod289(Pi1);
+    glm::vec3 Pf0 = glm::fract(P); // Fractional part for interpolation
+    glm::vec3 Pf1 = Pf0 - glm::vec3(1.0f); // Fractional part - 1.0
+    glm::vec4 ix = glm::vec4(Pi0.x, Pi1.x, Pi0.x, Pi1.x);
+    glm::vec4 iy = glm::vec4(Pi0.y, Pi0.y, Pi1.y, Pi1.y);
+    glm::vec4 iz0 = glm::vec4(Pi0.z);
+    glm::vec4 iz1 = glm::vec4(Pi1.z);
+
+    glm::vec4 ixy = permute(permute(ix) + iy);
+    glm::vec4 ixy0 = permute(ixy + iz0);
+    glm::vec4 ixy1 = permute(ixy + iz1);
+
+    glm::vec4 gx0 = ixy0 * (1.0f / 7.0f);
+    glm::vec4 gy0 = glm::fract(glm::floor(gx0) * (1.0f / 7.0f)) - 0.5f;
+    gx0 = glm::fract(gx0);
+    glm::vec4 gz0 = glm::vec4(0.5f) - glm::abs(gx0) - glm::abs(gy0);
+    glm::vec4 sz0 = glm::step(gz0, glm::vec4(0.0f));
+    gx0 -= sz0 * (glm::step(glm::vec4(0.0f), gx0) - 0.5f);
+    gy0 -= sz0 * (glm::step(glm::vec4(0.0f), gy0) - 0.5f);
+
+    glm::vec4 gx1 = ixy1 * (1.0f / 7.0f);
+    glm::vec4 gy1 = glm::fract(glm::floor(gx1) * (1.0f / 7.0f)) - 0.5f;
+    gx1 = glm::fract(gx1);
+    glm::vec4 gz1 = glm::vec4(0.5f) - glm::abs(gx1) - glm::abs(gy1);
+    glm::vec4 sz1 = glm::step(gz1, glm::vec4(0.0f));
+    gx1 -= sz1 * (glm::step(glm::vec4(0.0f), gx1) - 0.5f);
+    gy1 -= sz1 * (glm::step(glm::vec4(0.0f), gy1) - 0.5f);
+
+    glm::vec3 g000 = glm::vec3(gx0.x, gy0.x, gz0.x);
+    glm::vec3 g100 = glm::vec3(gx0.y, gy0.y, gz0.y);
+    glm::vec3 g010 = glm::vec3(gx0.z, gy0.z, gz0.z);
+    glm::vec3 g110 = glm::vec3(gx0.w, gy0.w, gz0.w);
+    glm::vec3 g001 = glm::vec3(gx1.x, gy1.x, gz1.x);
+    glm::vec3 g101 = glm::vec3(gx1.y, gy1.y, gz1.y);
+    glm::vec3 g011 = glm::vec3(gx1.z, gy1.z, gz1.z);
+    glm::vec3 g111 = glm::vec3(gx1.w, gy1.w, gz1.w);
+
+    glm::vec4 norm0 = taylorInvSqrt(glm::vec4(glm::dot(g000, g000), glm::dot(g010, g010), glm::dot(g100, g100), glm::dot(g110, g110)));
+    g000 *= norm0.x;
+    g010 *= norm0.y;
+    g100 *= norm0.z;
+    g110 *= norm0.w;
+    glm::vec4 norm1 = taylorInvSqrt(glm::vec4(glm::dot(g001, g001), glm::dot(g011, g011), glm::dot(g101, g101), glm::dot(g111, g111)));
+    g001 *= norm1.x;
+    g011 *= norm1.y;
+    g101 *= norm1.z;
+    g111 *= norm1.w;
+
+    float n000 = glm::dot(g000, Pf0);
+    float n100 = glm::dot(g100, glm::vec3(Pf1.x, Pf0.y, Pf0.z));
+    float n010 = glm::dot(g010, glm::vec3(Pf0.x, Pf1.y, Pf0.z));
+    float n110 = glm::dot(g110, glm::vec3(Pf1.x, Pf1.y, Pf0.z));
+    float n001 = glm::dot(g001, glm::vec3(Pf0.x, Pf0.y, Pf1.z));
+    float n101 = glm::dot(g101, glm::vec3(Pf1.x, Pf0.y, Pf1.z));
+    float n011 = glm::dot(g011, glm::vec3(Pf0.x, Pf1.y, Pf1.z));
+    float n111 = glm::dot(g111, Pf1);
+
+    glm::vec3 fade_xyz = fade(Pf0);
+    glm::vec4 n_z = glm::mix(glm::vec4(n000, n100, n010, n110), glm::vec4(n001, n101, n011, n111), fade_xyz.z);
+    glm::vec2 n_yz = glm::mix(glm::vec2(n_z.x, n_z.y), glm::vec2(n_z.z, n_z.w), fade_xyz.y);
+    float n_xyz = glm::mix(n_yz.x, n_yz.y, fade_xyz.x);
+    return 2.2f * n_xyz;
+}
+
+float CPUShading::MultifractalNoise3D(const glm::vec3& xyz, int octaves, float scale, float lacunarity, float dimension)
+{
+    // Multifractal noise with multiplied fractals rather than added.
+    float val = 1.0f;
+    float amplitude = scale;
+    float gain = std::pow(lacunarity, -dimension);
+    float frequency = 1.0f;
+
+    for (int i = 0; i < octaves; i++)
+    {
+        val *= amplitude * CNoise3D(frequency * xyz) + 1.0f;
+        amplitude *= gain;
+        frequency *= lacunarity;
+    }
+    return val;
+}
+
+
+/////////////////////////////////////////////////////
+////////////////   SPHERE SHADING   /////////////////
+/////////////////////////////////////////////////////
+
+CPUShading::CPUShading(const BlackHoleParameters& params, const GeodesicIntegrator& integrator, const CPUCubeMap& skybox)
+    : m_params(params), m_integrator(integrator), m_skybox(skybox)
+{
+}
+
+CPUShading::~CPUShading()
+{
+}
+
+glm::vec3 CPUShading::GetSphereColour(const glm::vec3& p) const
+{
+    // BlackHole never loads a sphere texture (m_sphereTexturePath is empty), so only the checkerboard is ported.
+    float pi = 3.14159265359f;
+    // Number of divisions of the sphere for the checkboard pattern.
+    float sphere_latitudes = 7.0f;
+    float sphere_longitudes = 7.0f;
+
+    glm::vec3 normal = glm::normalize(p);
+    float u = (std::atan2(normal.x, normal.z) + pi) / (2.0f * pi);
+    float v = std::asin(normal.y) / pi + 0.5f;
+
+    // Makes the checkerboard pattern on the sphere.
+    glm::vec2 uvsignvec = glm::sign(glm::vec2(std::sin(2.0f * pi * sphere_latitudes * u), std::sin(2.0f * pi * sphere_longitudes * v)));
+    float uvsign = uvsignvec.x * uvsignvec.y;
+    float uvscaled = (uvsign + 1.0f) * 0.5f;
+    return uvscaled * m_params.sphereDebugColour1 + (1.0f - uvscaled) * m_params.sphereDebugColour2;
+}
+
+glm::vec3 CPUShading::GetSkyboxColour(const glm::vec3& dir) const
+{
+    // Same flip of the x direction as the texture(skybox, ...) lookup in the shader.
+    return m_skybox.Sample(glm::vec3(-dir.x, dir.y, dir.z));
+}
+
+
+/////////////////////////////////////////////////////
+/////////////////   DISK SHADING   //////////////////
+/////////////////////////////////////////////////////
+
+glm::vec3 CPUShading::DrawDebugDiskTexture(const glm::vec3& p) const
+{
+    float pi = 3.14159265359f;
+
+    float u = (std::atan2(p.x, p.z) + pi) / (2.0f * pi) - m_params.diskRotationAngle;
+    u = u - std::floor(u);
+
+    // Makes alternating pattern between the two different colours.
+    float usign = glm::sign(std::sin(m_params.diskDebugDivisions * 2.0f * pi * u));
+    float uscaled = (usign + 1.0f) * 0.5f;
+    if (p.y >= 0)
+    {
+        return uscaled * m_params.diskDebugColourTop1 + (1.0f - uscaled) * m_params.diskDebugColourTop2;
+    }
+    return uscaled * m_params.diskDebugColourBottom1 + (1.0f - uscaled) * m_params.diskDebugColourBottom2;
+}
+
+float CPUShading::SampleNoiseTexture(const glm::vec3& p) const
+{
+    // To spherical coordinates
+    float r = std::sqrt(p.x * p.x + p.z * p.z);
+    float phi = std::atan2(p.z, p.x);
+    float theta = std::atan2(r, p.y);
+
+    // Smear theta
+    float rotational_smear = -1.2f;
+    float power = std::pow(theta, rotational_smear);
+
+    // Spiral phi and rotate it
+    float rho = glm::length(p);
+    float rhohalf = std::sqrt(rho);
+    float spiral_factor = 3.0f;
+    float spiral = Map(rhohalf, 0.0f, 5.0f, 0.0f, spiral_factor);
+    phi += spiral + m_params.diskRotationAngle;
+
+    // Back to Cartesian with the adjusted angles
+    glm::vec3 xyz = glm::vec3(rho * std::sin(power) * std::cos(phi), rho * std::sin(power) * std::sin(phi), rho * std::cos(power));
+
+    // Noise
+    int octaves = 3;
+    float lacunarity = 2.0f;
+    float dimension = 0.12f;
+    float amplitude = 0.6f;
+    return MultifractalNoise3D(xyz, octaves, amplitude, lacunarity, dimension);
+}
+
+glm::vec3 CPUShading::TemperatureToRGB(float temperature)
+{
+    // From https://www.shadertoy.com/view/4sc3D7
+    // Converts a blackbody temperature to colour in RGB.
+    // Valid from 1000 to 40000 K.
+    temperature = std::clamp(temperature, 1000.0f, 40000.0f);
+    glm::vec3 m0, m1, m2;
+    if (temperature <= 6500.0f)
+    {
+        m0 = glm::vec3(0.0f, -2902.1955373783176f, -8257.7997278925690f);
+        m1 = glm::vec3(0.0f, 1669.5803561666639f, 2575.2827530017594f);
+        m2 = glm::vec3(1.0f, 1.3302673723350029f, 1.8993753891711275f);
+    }
+    else
+    {
+        m0 = glm::vec3(1745.0425298314172f, 1216.6168361476490f, -8257.7997278925690f);
+        m1 = glm::vec3(-2666.3474220535695f, -2173.1012343082230f, 2575.2827530017594f);
+        m2 = glm::vec3(0.55995389139931482f, 0.70381203140554553f, 1.8993753891711275f);
+    }
+    glm::vec3 colour = glm::clamp(m0 / (glm::vec3(temperature) + m1) + m2, glm::vec3(0.0f), glm::vec3(1.0f));
+    // The shader mixes toward white with smoothstep(1000.0, 0.0, temperature), which is always 0 after the clamp.
+    return colour;
+}
+
+float CPUShading::f(float r) const
+{
+    // Page and Thorne (1973) f(r).  See f() in KerrBlackHole.shader.
+    if (r < m_params.risco)
+    {
+        return 0.0f;
+    }
+    float pi = 3.14159265359f;
+    float mass = m_params.mass;
+
+    float astar = m_params.a / mass;
+    float x = std::sqrt(r / mass);
+    float x0 = std::sqrt(m_params.risco / mass);
+    // x1, x2, x3 are the roots of x^3 - 3*x + 2*astar = 0.
+    float x1 = 2.0f * std::cos((1.0f / 3.0f) * std::acos(astar) - pi / 3.0f);
+    float x2 = 2.0f * std::cos((1.0f / 3.0f) * std::acos(astar) + pi / 3.0f);
+    float x3 = -2.0f * std::cos((1.0f / 3.0f) * std::acos(astar));
+
+    float x1numer = 3.0f * (x1 - astar) * (x1 - astar);
+    float x1denom = x1 * (x1 - x2) * (x1 - x3);
+    float x2numer = 3.0f * (x2 - astar) * (x2 - astar);
+    float x2denom = x2 * (x2 - x1) * (x2 - x3);
+    float x3numer = 3.0f * (x3 - astar) * (x3 - astar);
+    float x3denom = x3 * (x3 - x1) * (x3 - x2);
+    float xdenom = x * x * (x * x * x - 3.0f * x + 2.0f * astar);
+
+    return (3.0f / (2.0f * mass)) * (1.0f / xdenom) * (x - x0 - (3.0f * astar / 2.0f) * std::log(x / x0)
+        - (x1numer / x1denom) * std::log((x - x1) / (x0 - x1)) - (x2numer / x2denom) * std::log((x - x2) / (x0 - x2))
+        - (x3numer / x3denom) * std::log((x - x3) / (x0 - x3)));
+}
+
+float CPUShading::ObservedTemperature(float r, float blueshift) const
+{
+    // From "Detecting Accretion Disks in Active Galactic Nuclei" by Fanton, et al (1997).
+    float r_max = (49.0f / 36.0f) * m_params.risco;
+    return blueshift * m_params.Tmax * std::pow(f(r) * r_max / (r * f(r_max)), 1.0f / 4.0f);
+}
+
+double CPUShading::DiskRedshift(const glm::dmat2x4& diskIntersectionPoint, double r) const
+{
+    // Velocity of a massive particle in circular orbit in the equatorial plane, with the time component flipped
+    // because we are tracing backwards.  See diskRedshift() in the shader.
+    double mass = m_params.mass;
+    double a = m_params.a;
+    double timeSign = m_params.insideHorizon ? 1.0 : -1.0;
+    glm::dvec4 diskVel = glm::dvec4(timeSign * (r + a * std::sqrt(mass / r)),
+        -diskIntersectionPoint[0].w * std::sqrt(mass / r), 0.0, diskIntersectionPoint[0].y * std::sqrt(mass / r))
+        / std::sqrt(r * r - 3.0 * r * mass + 2.0 * a * std::sqrt(mass * r));
+    // Ensure diskVel is normalized, otherwise the dot product produces incorrect results for g.
+    diskVel /= std::sqrt(-glm::dot(m_integrator.Metric(diskIntersectionPoint[0]) * diskVel, diskVel));
+
+    // g is the energy/frequency shift aka the Doppler effect.
+    return 1.0 / glm::dot(diskIntersectionPoint[1], diskVel);
+}
+
+glm::vec3 CPUShading::GetDiskColour(const glm::dmat2x4& diskIntersectionPoint, float previousy, float r, float& T) const
+{
+    glm::vec3 rayCol;
+    glm::vec3 diskSample;
+    glm::vec3 emission;
+
+    glm::vec3 planeIntersectionPoint = glm::vec3(diskIntersectionPoint[0].y, diskIntersectionPoint[0].z, diskIntersectionPoint[0].w);
+    if (m_params.useDebugDiskTexture)
+    {
+        diskSample = DrawDebugDiskTexture(glm::vec3(planeIntersectionPoint.x, previousy, planeIntersectionPoint.z));
+    }
+    else
+    {
+        diskSample = glm::vec3(1.0f) * SampleNoiseTexture(planeIntersectionPoint);
+    }
+
+    // This r-mapping is a hack to make the disc look nice when the disk's inner radius doesn't match the ISCO.
+    float mappedr = Map(r, m_params.innerRadius, m_params.outerRadius, m_params.risco, m_params.outerRadius);
+
+    if (!m_params.drawBasicDisk)
+    {
+        float g = (float)DiskRedshift(diskIntersectionPoint, r);
+
+        float blueshift = std::pow(g, m_params.blueshiftPower);
+        float temperature = ObservedTemperature(mappedr, blueshift);
+
+        float brightnessFromVel = std::clamp(std::pow(g, m_params.brightnessFromDiskVel), 0.0f, 10.0f);
+
+        float outerRadius = m_params.outerRadius;
+        float brightnessFromRadius = m_params.dMdt * (f(mappedr) / mappedr
+            - ((mappedr - m_params.risco) / (outerRadius - m_params.risco)) * (f(outerRadius) / outerRadius));
+
+        emission = brightnessFromRadius * brightnessFromVel * m_params.bloomDiskMultiplier * diskSample * TemperatureToRGB(temperature);
+        rayCol = T * emission;
+    }
+    else
+    {
+        emission = diskSample * m_params.bloomDiskMultiplier;
+        rayCol = T * emission;
+    }
+    if (m_params.transparentDisk && !m_params.useDebugDiskTexture && T > 0.05f)
+    {
+        // Beer's law (https://en.wikipedia.org/wiki/Beer%E2%80%93Lambert_law)
+        float absorptionDropOff = std::clamp(700.0f * (std::pow(mappedr, -2.5f) - std::pow(m_params.outerRadius, -2.5f)), 0.0f, 1.0f);
+        float absorptionNoise = SampleNoiseTexture(-planeIntersectionPoint);
+        float absorption = m_params.diskAbsorption * absorptionNoise * absorptionDropOff;
+        T *= std::exp(-absorption);
+    }
+    else if (m_params.useDebugDiskTexture)
+    {
+        // No transparency.
+        T = 0.0f;
+    }
+    return rayCol;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "GeodesicIntegrator.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+class CPUCubeMap
+{
+	// CPU copy of the skybox TextureCubeMap.  Sample() follows the OpenGL cube map face selection rules with
+	// GL_LINEAR filtering and GL_CLAMP_TO_EDGE wrapping, which is how BlackHole sets up the GL cube map.
+public:
+	CPUCubeMap();
+	CPUCubeMap(const std::vector<std::string>& paths);
+	~CPUCubeMap();
+
+	// Ordering of faces must be: xpos, xneg, ypos, yneg, zpos, zneg.
+	bool Load(const std::vector<std::string>& paths);
+	bool IsLoaded() const { return m_loaded; }
+
+	glm::vec3 Sample(const glm::vec3& dir) const;
+
+private:
+	struct Face
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<glm::vec3> texels;
+	};
+
+	glm::vec3 Bilinear(const Face& face, float s, float t) const;
+
+	std::array<Face, 6> m_faces;
+	bool m_loaded = false;
+};
+
+
+class CPUShading
+{
+	// Port of the "NOISE", "SPHERE SHADING" and "DISK SHADING" sections of KerrBlackHole.shader.  Colours are computed
+	// in single precision like the shader so that the output can be compared against the GL framebuffer.
+public:
+	CPUShading(const BlackHoleParameters& params, const GeodesicIntegrator& integrator, const CPUCubeMap& skybox);
+	~CPUShading();
+
+	glm::vec3 GetSphereColour(const glm::vec3& p) const;
+	// The redshift g of the disk at a crossing of its plane, which the geodesic records store.
+	double DiskRedshift(const glm::dmat2x4& diskIntersectionPoint, double r) const;
+	glm::vec3 GetDiskColour(const glm::dmat2x4& diskIntersectionPoint, float previousy, float r, float& T) const;
+	glm::vec3 GetSkyboxColour(const glm::vec3& dir) const;
+
+	static float CNoise3D(const glm::vec3& P);
+	static float MultifractalNoise3D(const glm::vec3& xyz, int octaves, float scale, float lacunarity, float dimension);
+	static glm::vec3 TemperatureToRGB(float temperature);
+
+private:
+	glm::vec3 DrawDebugDiskTexture(const glm::vec3& p) const;
+	float SampleNoiseTexture(const glm::vec3& p) const;
+	float f(float r) const;
+	float ObservedTemperature(float r, float blueshift) const;
+
+	const BlackHoleParameters& m_params;
+	const GeodesicIntegrator& m_integrator;
+	const CPUCubeMap& m_skybox;
+};
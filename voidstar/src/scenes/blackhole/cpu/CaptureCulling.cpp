@@ -0,0 +1,221 @@
+#include "CaptureCulling.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+static constexpr double PI = 3.14159265358979323846;
+
+
+CaptureCulling::CaptureCulling()
+{
+}
+
+CaptureCulling::~CaptureCulling()
+{
+}
+
+void CaptureCulling::Update(double mass, double a, double cameraRadius)
+{
+    if (mass == m_mass && a == m_a && cameraRadius == m_cameraRadius)
+    {
+        return;
+    }
+    m_mass = mass;
+    m_a = a;
+    m_cameraRadius = cameraRadius;
+    m_rplus = mass + std::sqrt(std::max(0.0, mass * mass - a * a));
+
+    // The equatorial photon orbits, whose lambda is the furthest from 0 on the critical curve, are within 7 M for any
+    // spin.  eta_c is below -a^2, which no ray reaches, well before the ends of the table.
+    m_lambdaRange = (float)(8.0 * mass);
+    double spacing = 2.0 * m_lambdaRange / (NumSamples - 1);
+    for (int i = 0; i < NumSamples; i++)
+    {
+        m_curve[i] = (float)CriticalEta(-m_lambdaRange + i * spacing);
+    }
+
+    // Linear interpolation overestimates eta_c where the curve is convex, which it is sharply in the cell where the
+    // minimum moves into the ergosphere.  Lower the samples at both ends of each cell by as much as it overestimates
+    // there, then measure what's left.
+    const int numChecks = 16;
+    auto cellError = [this, spacing](int i)
+    {
+        double error = 0.0;
+        for (int j = 1; j < numChecks; j++)
+        {
+            double lambda = -m_lambdaRange + (i + (double)j / numChecks) * spacing;
+            error = std::max(error, InterpolateCurve(lambda) - CriticalEta(lambda));
+        }
+        return error;
+    };
+    double errors[NumSamples - 1];
+    for (int i = 0; i + 1 < NumSamples; i++)
+    {
+        errors[i] = cellError(i);
+    }
+    for (int i = 0; i < NumSamples; i++)
+    {
+        double error = std::max((i > 0) ? errors[i - 1] : 0.0, (i + 1 < NumSamples) ? errors[i] : 0.0);
+        m_curve[i] -= (float)error;
+    }
+    double error = 0.0;
+    for (int i = 0; i + 1 < NumSamples; i++)
+    {
+        error = std::max(error, cellError(i));
+    }
+    // Floor for eta computed from the float momentum in the shader, relative to the shadow's size of 27 M^2.
+    m_margin = (float)std::max(2.0 * error, 0.03 * mass * mass);
+}
+
+double CaptureCulling::CriticalEta(double lambda) const
+{
+    double a = m_a;
+    double a2 = a * a;
+    auto eta = [this, a, a2, lambda](double r)
+    {
+        double Delta = r * r - 2.0 * m_mass * r + a2;
+        double A = r * r + a2 - a * lambda;
+        return A * A / Delta - (lambda - a) * (lambda - a);
+    };
+
+    // Infinite at the horizon, with a single minimum outside it at the spherical photon orbit with this lambda,
+    // unless the camera is inside that.  Bracket it on a grid that is denser towards the horizon, then refine it with
+    // a golden section search.
+    const int numSteps = 256;
+    double span = m_cameraRadius - m_rplus;
+    auto radius = [this, span](int k) { double t = (double)k / numSteps; return m_rplus + span * t * t; };
+    int best = numSteps;
+    double bestEta = eta(m_cameraRadius);
+    for (int k = 1; k < numSteps; k++)
+    {
+        double value = eta(radius(k));
+        if (value < bestEta)
+        {
+            best = k;
+            bestEta = value;
+        }
+    }
+
+    double lo = radius(best - 1);
+    double hi = radius(std::min(best + 1, numSteps));
+    const double ratio = 0.5 * (std::sqrt(5.0) - 1.0);
+    double r1 = hi - ratio * (hi - lo);
+    double r2 = lo + ratio * (hi - lo);
+    double eta1 = eta(r1);
+    double eta2 = eta(r2);
+    for (int i = 0; i < 40; i++)
+    {
+        if (eta1 < eta2)
+        {
+            hi = r2;
+            r2 = r1;
+            eta2 = eta1;
+            r1 = hi - ratio * (hi - lo);
+            eta1 = eta(r1);
+        }
+        else
+        {
+            lo = r1;
+            r1 = r2;
+            eta1 = eta2;
+            r2 = lo + ratio * (hi - lo);
+            eta2 = eta(r2);
+        }
+    }
+    return std::min(bestEta, std::min(eta1, eta2));
+}
+
+double CaptureCulling::InterpolateCurve(double lambda) const
+{
+    // As in the shader.  Outside the table nothing is captured.
+    double t = (lambda / m_lambdaRange * 0.5 + 0.5) * (NumSamples - 1);
+    if (!(t >= 0.0 && t < NumSamples - 1))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+    int i = (int)t;
+    return m_curve[i] + (t - i) * (m_curve[i + 1] - m_curve[i]);
+}
+
+bool CaptureCulling::IsCulled(const glm::dmat2x4& xp, const GeodesicIntegrator& integrator, double innerRadius) const
+{
+    glm::dvec4 x = xp[0];
+    glm::dvec4 p = xp[1];
+    double a = m_a;
+    double a2 = a * a;
+
+    KerrSchildState state = integrator.KerrState(x);
+    double r = state.r;
+    double cosTheta = x.z / r;
+    double sin2Theta = 1.0 - cosTheta * cosTheta;
+    double E = -p.x;
+    if (sin2Theta < 1e-6 || E <= 0.0)
+    {
+        return false;
+    }
+
+    // Only ingoing rays.  dr/dl from dx/dl = g^-1 p, by differentiating r^4 - (|x|^2 - a^2) r^2 - a^2 y^2 = 0.
+    glm::dvec4 v = integrator.KerrRaiseIndex(state, p);
+    if (r * r * (x.y * v.y + x.w * v.w) + (r * r + a2) * x.z * v.z >= 0.0)
+    {
+        return false;
+    }
+
+    // lambda and p_theta / E as in AnalyticKerrTracer::Trace().  p = g (1, rayDir) isn't null in Kerr-Schild
+    // coordinates, and the rays are integrated with g^{ab} p_a p_b = h E^2 > 0.  The Carter constant and Theta pick up
+    // a^2 h cos^2(theta) terms for that, and R a Delta h r^2 term (MTW 33.31).
+    double sinTheta = std::sqrt(sin2Theta);
+    double lambda = (x.w * p.y - x.y * p.w) / E;
+    double pTheta = (cosTheta / sinTheta * (x.y * p.y + x.w * p.w) - r * sinTheta * p.z) / E;
+    double h = glm::dot(v, p) / (E * E);
+    double a2h = a2 * (1.0 + h);
+    double eta = pTheta * pTheta + cosTheta * cosTheta * (lambda * lambda / sin2Theta - a2h);
+
+    // The Delta h r^2 term only raises eta_c, by at least h r+^2.
+    double etaCritical = InterpolateCurve(lambda) + std::max(h, 0.0) * m_rplus * m_rplus - m_margin;
+    if (!(eta < etaCritical))
+    {
+        return false;
+    }
+
+    // The ray is captured.  r decreases all the way to the horizon, so it can only miss the disk by crossing the
+    // equatorial plane inside the inner radius, or not at all.
+    double rInner = std::max(innerRadius, m_rplus);
+    if (r <= rInner || eta <= 0.0)
+    {
+        return true;
+    }
+
+    // The first crossing is at Mino time (F(j pi | m) - F(psi0 | m)) / sqrt(A) in the polar motion of
+    // AnalyticKerrTracer::Trace(), which is at least (j pi - psi0) / sqrt(A + a^2 u+) because m <= 0.
+    double B = eta + lambda * lambda - a2h;
+    double D = std::sqrt(B * B + 4.0 * a2h * eta);
+    double uplus = 2.0 * eta / (B + D);
+    double A = 0.5 * (B + D);
+    double psi0 = std::asin(std::clamp(cosTheta / std::sqrt(uplus), -1.0, 1.0));
+    if (pTheta > 0.0)
+    {
+        psi0 = PI - psi0;
+    }
+    double tauTheta = (PI * (std::floor(psi0 / PI) + 1.0) - psi0) / std::sqrt(A + a2h * uplus);
+
+    // Mino time to reach the inner radius, the integral of dr / sqrt(R) by Gauss-Legendre quadrature in s = 1 / r,
+    // where R / r^4 = (1 + (a^2 - a lambda) s^2)^2 - (1 - 2 M s + a^2 s^2) (C s^2 - h) is smooth.  The margin below
+    // eta_c keeps R away from 0, and the factor of 1.1 covers the quadrature's error.
+    static constexpr double nodes[4] = { 0.1834346424956498, 0.5255324099163290, 0.7966664774136267, 0.9602898564975363 };
+    static constexpr double weights[4] = { 0.3626837833783620, 0.3137066458778873, 0.2223810344533745, 0.1012285362903763 };
+    double C = eta + (lambda - a) * (lambda - a);
+    double sMid = 0.5 * (1.0 / rInner + 1.0 / r);
+    double sHalf = 0.5 * (1.0 / rInner - 1.0 / r);
+    double tauR = 0.0;
+    for (int k = 0; k < 8; k++)
+    {
+        double s = sMid + ((k < 4) ? -sHalf : sHalf) * nodes[k % 4];
+        double q = 1.0 + (a2 - a * lambda) * s * s;
+        double DeltaS2 = 1.0 - 2.0 * m_mass * s + a2 * s * s;
+        tauR += weights[k % 4] / std::sqrt(std::max(q * q - DeltaS2 * (C * s * s - h), 1e-12));
+    }
+    tauR *= sHalf;
+    return tauTheta > 1.1 * tauR;
+}
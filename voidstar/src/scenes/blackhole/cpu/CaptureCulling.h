@@ -0,0 +1,58 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "GeodesicIntegrator.h"
+
+#include "glm/glm.hpp"
+
+
+class CaptureCulling
+{
+	// Skips the rays that are bound to fall into the black hole without reaching the disk, from their constants of
+	// motion.  With lambda = L / E and eta = Q / E^2, an ingoing ray has no radial turning point between the horizon
+	// and the camera, so it falls in, when R(r) = (r^2 + a^2 - a lambda)^2 - Delta (eta + (lambda - a)^2) > 0 there,
+	// i.e. when eta is below the critical curve (J. M. Bardeen, "Timelike and null geodesics in the Kerr metric", 1973)
+	//     eta_c(lambda) = min over r+ < r <= rCamera of (r^2 + a^2 - a lambda)^2 / Delta - (lambda - a)^2.
+	// Update() tabulates eta_c for the camera's radius, and the shader interpolates the table from uniforms.  Such a
+	// ray can still cross the disk on its way in, so it is only culled if it can't reach the equatorial plane before
+	// the disk's inner radius, or never crosses it at all.
+	//
+	// Only the Kerr metric with the camera outside the horizon is supported.  The debug sphere texture needs where
+	// each ray crosses the horizon, so nothing is culled with it.
+public:
+	static constexpr int NumSamples = 65;
+
+	CaptureCulling();
+	~CaptureCulling();
+
+	static bool IsSupported(const BlackHoleParameters& params)
+	{
+		return params.metric == 0 && !params.insideHorizon && !params.useDebugSphereTexture;
+	}
+
+	// Tabulates eta_c for a camera at cameraRadius, if that or the black hole changed since the last call.
+	void Update(double mass, double a, double cameraRadius);
+
+	// CPU version of captureCulled() in KerrBlackHole.shader, with the same table.  xp is the initial position and
+	// momentum as set up in rayMarch().
+	bool IsCulled(const glm::dmat2x4& xp, const GeodesicIntegrator& integrator, double innerRadius) const;
+
+	// The u_captureCurve, u_captureLambdaRange and u_captureMargin uniforms.  The samples are evenly spaced in lambda
+	// from -GetLambdaRange() to GetLambdaRange().
+	const float* GetCurve() const { return m_curve; }
+	float GetLambdaRange() const { return m_lambdaRange; }
+	float GetMargin() const { return m_margin; }
+
+private:
+	double CriticalEta(double lambda) const;
+	double InterpolateCurve(double lambda) const;
+
+	double m_mass = 0.0;
+	double m_a = 0.0;
+	double m_cameraRadius = 0.0;
+	double m_rplus = 0.0;
+	float m_curve[NumSamples] = {};
+	float m_lambdaRange = 0.0f;
+	// Covers what's left of the interpolation error after the samples are lowered, and evaluating eta in single precision.
+	float m_margin = 0.0f;
+};
@@ -0,0 +1,205 @@
+#include "EllipticIntegrals.h"
+
+#include <cmath>
+#include <algorithm>
+
+static constexpr double PI = 3.14159265358979323846;
+
+
+double CarlsonRF(double x, double y, double z)
+{
+    // Duplication until the arguments agree to about 1e-3, then a fifth order Taylor expansion.  The truncation error
+    // is then below double precision.
+    const double errorTolerance = 0.0025;
+    double xt = x;
+    double yt = y;
+    double zt = z;
+    double average, deltax, deltay, deltaz;
+    while (true)
+    {
+        double sqrtx = std::sqrt(xt);
+        double sqrty = std::sqrt(yt);
+        double sqrtz = std::sqrt(zt);
+        double lambda = sqrtx * (sqrty + sqrtz) + sqrty * sqrtz;
+        xt = 0.25 * (xt + lambda);
+        yt = 0.25 * (yt + lambda);
+        zt = 0.25 * (zt + lambda);
+        average = (xt + yt + zt) / 3.0;
+        deltax = (average - xt) / average;
+        deltay = (average - yt) / average;
+        deltaz = (average - zt) / average;
+        if (std::max({ std::abs(deltax), std::abs(deltay), std::abs(deltaz) }) < errorTolerance)
+        {
+            break;
+        }
+    }
+    double e2 = deltax * deltay - deltaz * deltaz;
+    double e3 = deltax * deltay * deltaz;
+    return (1.0 + (e2 / 24.0 - 0.1 - 3.0 * e3 / 44.0) * e2 + e3 / 14.0) / std::sqrt(average);
+}
+
+double CarlsonRC(double x, double y)
+{
+    const double errorTolerance = 0.0012;
+    double xt, yt, weight;
+    if (y > 0.0)
+    {
+        xt = x;
+        yt = y;
+        weight = 1.0;
+    }
+    else
+    {
+        xt = x - y;
+        yt = -y;
+        weight = std::sqrt(x) / std::sqrt(xt);
+    }
+    double average, s;
+    while (true)
+    {
+        double lambda = 2.0 * std::sqrt(xt) * std::sqrt(yt) + yt;
+        xt = 0.25 * (xt + lambda);
+        yt = 0.25 * (yt + lambda);
+        average = (xt + yt + yt) / 3.0;
+        s = (yt - average) / average;
+        if (std::abs(s) < errorTolerance)
+        {
+            break;
+        }
+    }
+    return weight * (1.0 + s * s * (0.3 + s * (1.0 / 7.0 + s * (0.375 + s * 9.0 / 22.0)))) / std::sqrt(average);
+}
+
+double CarlsonRJ(double x, double y, double z, double p)
+{
+    const double errorTolerance = 0.0015;
+    const double C1 = 3.0 / 14.0;
+    const double C2 = 1.0 / 3.0;
+    const double C3 = 3.0 / 22.0;
+    const double C4 = 3.0 / 26.0;
+    const double C5 = 0.75 * C3;
+    const double C6 = 1.5 * C4;
+    const double C7 = 0.5 * C2;
+    const double C8 = C3 + C3;
+    double xt = x;
+    double yt = y;
+    double zt = z;
+    double pt = p;
+    double sum = 0.0;
+    double factor = 1.0;
+    double average, deltax, deltay, deltaz, deltap;
+    while (true)
+    {
+        double sqrtx = std::sqrt(xt);
+        double sqrty = std::sqrt(yt);
+        double sqrtz = std::sqrt(zt);
+        double lambda = sqrtx * (sqrty + sqrtz) + sqrty * sqrtz;
+        double alpha = pt * (sqrtx + sqrty + sqrtz) + sqrtx * sqrty * sqrtz;
+        alpha *= alpha;
+        double beta = pt * (pt + lambda) * (pt + lambda);
+        sum += factor * CarlsonRC(alpha, beta);
+        factor *= 0.25;
+        xt = 0.25 * (xt + lambda);
+        yt = 0.25 * (yt + lambda);
+        zt = 0.25 * (zt + lambda);
+        pt = 0.25 * (pt + lambda);
+        average = 0.2 * (xt + yt + zt + pt + pt);
+        deltax = (average - xt) / average;
+        deltay = (average - yt) / average;
+        deltaz = (average - zt) / average;
+        deltap = (average - pt) / average;
+        if (std::max({ std::abs(deltax), std::abs(deltay), std::abs(deltaz), std::abs(deltap) }) < errorTolerance)
+        {
+            break;
+        }
+    }
+    double ea = deltax * (deltay + deltaz) + deltay * deltaz;
+    double eb = deltax * deltay * deltaz;
+    double ec = deltap * deltap;
+    double ed = ea - 3.0 * ec;
+    double ee = eb + 2.0 * deltap * (ea - ec);
+    return 3.0 * sum + factor * (1.0 + ed * (-C1 + C5 * ed - C6 * ee) + eb * (C7 + deltap * (-C8 + deltap * C4))
+        + deltap * ea * (C2 - deltap * C3) - C2 * deltap * ec) / (average * std::sqrt(average));
+}
+
+
+double EllipticK(double m)
+{
+    return CarlsonRF(0.0, 1.0 - m, 1.0);
+}
+
+double EllipticF(double phi, double m)
+{
+    // F(phi + j pi) = F(phi) + 2 j K, so reduce phi to [-pi/2, pi/2] first.
+    double j = std::round(phi / PI);
+    double reduced = phi - j * PI;
+    double s = std::sin(reduced);
+    double c = std::cos(reduced);
+    double F = s * CarlsonRF(c * c, 1.0 - m * s * s, 1.0);
+    return (j != 0.0) ? F + 2.0 * j * EllipticK(m) : F;
+}
+
+double EllipticPi(double n, double m)
+{
+    return CarlsonRF(0.0, 1.0 - m, 1.0) + n / 3.0 * CarlsonRJ(0.0, 1.0 - m, 1.0, 1.0 - n);
+}
+
+double EllipticPi(double n, double phi, double m)
+{
+    double j = std::round(phi / PI);
+    double reduced = phi - j * PI;
+    double s = std::sin(reduced);
+    double c = std::cos(reduced);
+    double s2 = s * s;
+    double Pi = s * CarlsonRF(c * c, 1.0 - m * s2, 1.0) + n / 3.0 * s * s2 * CarlsonRJ(c * c, 1.0 - m * s2, 1.0, 1.0 - n * s2);
+    return (j != 0.0) ? Pi + 2.0 * j * EllipticPi(n, m) : Pi;
+}
+
+
+double JacobiAmplitude(double u, double m)
+{
+    // Newton's method on F(phi) = u.  dF/dphi = 1 / sqrt(1 - m sin^2(phi)) stays between 1 / sqrt(1 - m) and 1 for
+    // m < 0 and between 1 and 1 / sqrt(1 - m) for m >= 0, so the linear first guess is already close.
+    double phi = 0.5 * PI * u / EllipticK(m);
+    for (int i = 0; i < 20; i++)
+    {
+        double s = std::sin(phi);
+        double correction = (EllipticF(phi, m) - u) * std::sqrt(1.0 - m * s * s);
+        phi -= correction;
+        if (std::abs(correction) < 1e-14 * std::max(1.0, std::abs(phi)))
+        {
+            break;
+        }
+    }
+    return phi;
+}
+
+void JacobiElliptic(double u, double m, double& sn, double& cn, double& dn)
+{
+    // Arithmetic-geometric mean, DLMF 22.20(ii).
+    const int maxIterations = 16;
+    double a[maxIterations + 1];
+    double c[maxIterations + 1];
+    a[0] = 1.0;
+    double b = std::sqrt(1.0 - m);
+    c[0] = std::sqrt(m);
+    int n = 0;
+    while (n < maxIterations && std::abs(c[n]) > 1e-16)
+    {
+        double an = a[n];
+        a[n + 1] = 0.5 * (an + b);
+        c[n + 1] = 0.5 * (an - b);
+        b = std::sqrt(an * b);
+        n++;
+    }
+    double phi = std::ldexp(a[n] * u, n);
+    double previousPhi = phi;
+    for (; n > 0; n--)
+    {
+        previousPhi = phi;
+        phi = 0.5 * (phi + std::asin(c[n] / a[n] * std::sin(phi)));
+    }
+    sn = std::sin(phi);
+    cn = std::cos(phi);
+    dn = (previousPhi == phi) ? 1.0 : cn / std::cos(previousPhi - phi);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Elliptic integrals and Jacobi elliptic functions for AnalyticKerrTracer.  The integrals are computed with Carlson's
+// symmetric forms by the duplication method (B. C. Carlson, "Numerical computation of real or complex elliptic
+// integrals", 1995), which converge for any parameter m < 1, including the negative parameters of the polar motion.
+// m is the parameter, i.e. the square of the modulus k.
+
+
+double CarlsonRF(double x, double y, double z);
+// Degenerate case R_C(x, y) = R_F(x, y, y).  y < 0 gives the Cauchy principal value.
+double CarlsonRC(double x, double y);
+// Requires p > 0.
+double CarlsonRJ(double x, double y, double z, double p);
+
+double EllipticK(double m);
+// Incomplete integral of the first kind, for any real amplitude phi.
+double EllipticF(double phi, double m);
+double EllipticPi(double n, double m);
+// Incomplete integral of the third kind, for any real amplitude phi.  Requires n < 1.
+double EllipticPi(double n, double phi, double m);
+
+// Inverse of EllipticF in phi, for m < 1.
+double JacobiAmplitude(double u, double m);
+// sn, cn and dn for 0 <= m < 1 by the arithmetic-geometric mean.
+void JacobiElliptic(double u, double m, double& sn, double& cn, double& dn);
@@ -0,0 +1,1054 @@
+#include "GeodesicIntegrator.h"
+#include "TaylorSeries.h"
+
+#include <cmath>
+#include <algorithm>
+
+
+GeodesicIntegrator::GeodesicIntegrator(const BlackHoleParameters& params)
+    : m_metric(params.metric), m_insideHorizon(params.insideHorizon), m_ODESolver(params.ODESolver),
+    m_mass(params.mass), m_a(params.a), m_tolerance(params.tolerance), m_hybridRadius(params.hybridRadius),
+    m_PIController(params.PIController),
+    m_absoluteTolerance(params.absoluteTolerance), m_relativeTolerance(params.relativeTolerance),
+    m_diskIntersectionThreshold(params.diskIntersectionThreshold),
+    m_sphereIntersectionThreshold(params.sphereIntersectionThreshold)
+{
+    m_horizon = m_mass + std::sqrt(m_mass * m_mass - m_a * m_a); // G = c = 1
+}
+
+GeodesicIntegrator::~GeodesicIntegrator()
+{
+}
+
+
+/////////////////////////////////////////////////////
+//////////////   GENERAL RELATIVITY   ///////////////
+/////////////////////////////////////////////////////
+
+double GeodesicIntegrator::ImplicitR(const glm::dvec4& x) const
+{
+    // Calculate the implicitly defined r value in the Kerr-Schild coordinates from the position.
+    // This reduces to solving a polynomial of the form r**4 + b*r**2 + c = 0.
+    glm::dvec3 p = glm::dvec3(x.y, x.z, x.w);
+    double a2 = m_a * m_a;
+    double b = a2 - glm::dot(p, p);
+    double c = -a2 * p.y * p.y;
+    // Stable form of the root, as in the shader.  -b + sqrt(b^2 - 4c) cancels when b > 0.
+    double sq = std::sqrt(b * b - 4.0 * c);
+    double r2 = (b > 0.0) ? -2.0 * c / (b + sq) : 0.5 * (sq - b);
+    return std::sqrt(r2);
+}
+
+glm::dvec4 GeodesicIntegrator::KerrSchildL(const glm::dvec4& x, double r, double timeComponent) const
+{
+    // The null vector l of the Kerr-Schild decomposition g = \eta + f * outerProduct(l, l).  Only the sign of the time
+    // component differs between the metric, the inverse metric, and ingoing vs outgoing coordinates.
+    double r2plusa2 = r * r + m_a * m_a;
+    return glm::dvec4(timeComponent, (r * x.y - m_a * x.w) / r2plusa2, x.z / r, (r * x.w + m_a * x.y) / r2plusa2);
+}
+
+KerrSchildState GeodesicIntegrator::KerrState(const glm::dvec4& x) const
+{
+    // r, f and the inverse metric's l at x.  r is solved for as in ImplicitR(), keeping r^2.
+    KerrSchildState state;
+    double a2 = m_a * m_a;
+    double y2 = x.z * x.z;
+    double b = a2 - (x.y * x.y + y2 + x.w * x.w);
+    double sq = std::sqrt(b * b + 4.0 * a2 * y2);
+    double r2 = (b > 0.0) ? 2.0 * a2 * y2 / (b + sq) : 0.5 * (sq - b);
+    state.r = std::sqrt(r2);
+    state.r2plusa2 = r2 + a2;
+    state.Q = r2 * r2 + a2 * y2;
+    state.f = 2.0 * m_mass * r2 * state.r / state.Q;
+    // Outgoing Kerr-Schild coordinates inside the horizon, ingoing outside.
+    state.l = KerrSchildL(x, state.r, m_insideHorizon ? 1.0 : -1.0);
+    return state;
+}
+
+glm::dvec4 GeodesicIntegrator::KerrRaiseIndex(const KerrSchildState& state, const glm::dvec4& p) const
+{
+    // g^{ab} p_b = \eta p - f (l.p) l, without building g^-1.
+    return glm::dvec4(-p.x, p.y, p.z, p.w) - state.f * glm::dot(state.l, p) * state.l;
+}
+
+glm::dmat4 GeodesicIntegrator::Metric(const glm::dvec4& x) const
+{
+    glm::dmat4 eta = glm::dmat4(1.0);
+    if (m_metric == 1)
+    {
+        // Classical.
+        return eta;
+    }
+    eta[0][0] = -1.0;
+    if (m_metric == 2)
+    {
+        // Minkowski.
+        return eta;
+    }
+
+    // Calculate the Kerr metric in Kerr-Schild coordinates at the position x.  G = c = 1.  Signature (-+++).
+    // Cartesian y is the up direction, as in the shader.  The metric's l is the inverse metric's with the time
+    // component negated.
+    KerrSchildState state = KerrState(x);
+    glm::dvec4 l = glm::dvec4(-state.l.x, state.l.y, state.l.z, state.l.w);
+    return eta + state.f * glm::outerProduct(l, l);
+}
+
+glm::dmat4 GeodesicIntegrator::InvMetric(const glm::dvec4& x) const
+{
+    glm::dmat4 eta = glm::dmat4(1.0);
+    if (m_metric == 1)
+    {
+        return eta;
+    }
+    eta[0][0] = -1.0;
+    if (m_metric == 2)
+    {
+        return eta;
+    }
+
+    // Inverse Kerr metric in Kerr-Schild coordinates.  See the comments in KerrBlackHole.shader's invmetric().
+    KerrSchildState state = KerrState(x);
+    return eta - state.f * glm::outerProduct(state.l, state.l);
+}
+
+double GeodesicIntegrator::MetricDistance(const glm::dvec4& x) const
+{
+    if (m_metric == 0)
+    {
+        return ImplicitR(x);
+    }
+    return std::sqrt(x.y * x.y + x.z * x.z + x.w * x.w);
+}
+
+glm::dvec3 GeodesicIntegrator::PToDir(const glm::dmat2x4& xp) const
+{
+    // dx^i/dl = g^ij * p_j
+    glm::dvec4 dxdl = (m_metric == 0) ? KerrRaiseIndex(KerrState(xp[0]), xp[1]) : InvMetric(xp[0]) * xp[1];
+    // Discard the time "velocity", dx^0/dl.
+    return glm::normalize(glm::dvec3(dxdl.y, dxdl.z, dxdl.w));
+}
+
+double GeodesicIntegrator::H(const glm::dvec4& x, const glm::dvec4& p) const
+{
+    // Calculate the Super-Hamiltonian for position x and momentum p.
+    if (m_metric == 0)
+    {
+        return 0.5 * glm::dot(KerrRaiseIndex(KerrState(x), p), p);
+    }
+    return 0.5 * glm::dot(InvMetric(x) * p, p);
+}
+
+glm::dvec4 GeodesicIntegrator::dHdx(const glm::dvec4& x, const glm::dvec4& p) const
+{
+    // Naive dH/dx approximation.
+    glm::dvec4 Hdx;
+    double dx = 0.005; // Governs accuracy of dHdx
+    Hdx[0] = H(x + glm::dvec4(dx, 0.0, 0.0, 0.0), p);
+    Hdx[1] = H(x + glm::dvec4(0.0, dx, 0.0, 0.0), p);
+    Hdx[2] = H(x + glm::dvec4(0.0, 0.0, dx, 0.0), p);
+    Hdx[3] = H(x + glm::dvec4(0.0, 0.0, 0.0, dx), p);
+    return (Hdx - H(x, p)) / dx;
+}
+
+glm::dvec4 GeodesicIntegrator::KerrdHdxExact(const KerrSchildState& state, const glm::dvec4& x,
+    const glm::dvec4& p) const
+{
+    // Calculates dH/dx exactly for the Kerr metric in Kerr-Schild Cartesian coordinates, from the state at x.  The
+    // derivation is in the comments of KerrdHdxExact() in KerrBlackHole.shader.
+    glm::dvec3 pos = glm::dvec3(x.y, x.z, x.w);
+    double r = state.r;
+    double r2 = r * r;
+    double a2 = m_a * m_a;
+    double ldotp = glm::dot(state.l, p);
+
+    // dr/dx = r^3 x / Q, dr/dy = r (r^2 + a^2) y / Q, dr/dz = r^3 z / Q.
+    double rOverQ = r / state.Q;
+    glm::dvec3 drdxhat = rOverQ * glm::dvec3(r2 * pos.x, state.r2plusa2 * pos.y, r2 * pos.z);
+
+    // df/dx^i = df/dr * dr/dx^i, plus the explicit dependence on y.
+    double fOverQ = state.f / state.Q;
+    glm::dvec3 dfdxhat = (fOverQ * (3.0 * a2 * pos.y * pos.y - r2 * r2) / r) * drdxhat;
+    dfdxhat.y -= 2.0 * a2 * pos.y * fOverQ;
+
+    // (dl/dx^i).p = G * dr/dx^i + the explicit dependence of l on x^i at constant r.
+    double G = (p.y * (pos.x - 2.0 * r * state.l.y) + p.w * (pos.z - 2.0 * r * state.l.w)) / state.r2plusa2
+        - p.z * state.l.z / r;
+    glm::dvec3 explicitTerm = glm::dvec3((r * p.y + m_a * p.w) / state.r2plusa2, p.z / r,
+        (r * p.w - m_a * p.y) / state.r2plusa2);
+    glm::dvec3 dldxhatdotp = G * drdxhat + explicitTerm;
+
+    return glm::dvec4(0.0, -0.5 * ldotp * (ldotp * dfdxhat + 2.0 * state.f * dldxhatdotp));
+}
+
+glm::dmat2x4 GeodesicIntegrator::FasterXPUpdate(const glm::dmat2x4& xp, double dl) const
+{
+    glm::dmat2x4 dxp;
+    if (m_metric == 1)
+    {
+        // Update function for classical black holes.  See the comments on the CLASSICAL fasterxpupdate() in the shader
+        // for the origin of the factor of 2.0.
+        glm::dvec3 p = glm::dvec3(xp[0].y, xp[0].z, xp[0].w);
+        double dist2 = glm::dot(p, p);
+        double dist = std::sqrt(dist2);
+        glm::dvec3 bendingAcceleration = -2.0 * (m_mass / dist2) * (p / dist);
+        glm::dvec3 momentum = glm::dvec3(xp[1].y, xp[1].z, xp[1].w);
+        dxp[1] = glm::dvec4(1.0, glm::normalize(momentum + bendingAcceleration * dl)) - xp[1];
+        dxp[0] = xp[1] * dl;
+        return dxp;
+    }
+
+    glm::dvec4 x = xp[0];
+    glm::dvec4 p = xp[1];
+    if (m_metric == 0)
+    {
+        // Both of Hamilton's equations from one KerrSchildState.
+        KerrSchildState state = KerrState(x);
+        dxp[1] = -KerrdHdxExact(state, x, p) * dl;
+        dxp[0] = KerrRaiseIndex(state, p) * dl;
+        return dxp;
+    }
+    dxp[1] = -dHdx(x, p) * dl;
+    dxp[0] = InvMetric(x) * p * dl;
+    return dxp;
+}
+
+glm::dmat2x4 GeodesicIntegrator::FasterXPUpdateImplicitEuler(const glm::dmat2x4& xp, double dl) const
+{
+    // https://en.wikipedia.org/wiki/Semi-implicit_Euler_method
+    glm::dvec4 x = xp[0];
+    glm::dvec4 p = xp[1];
+
+    glm::dmat2x4 dxp;
+    if (m_metric == 0)
+    {
+        KerrSchildState state = KerrState(x);
+        dxp[1] = -KerrdHdxExact(state, x, p) * dl;
+        // Correction for Euler-Cromer method as opposed to vanilla Euler method
+        p += dxp[1];
+        dxp[0] = KerrRaiseIndex(state, p) * dl;
+        return dxp;
+    }
+    glm::dmat4 ginv = InvMetric(x);
+    dxp[1] = -dHdx(x, p) * dl;
+    p += dxp[1];
+    dxp[0] = ginv * p * dl;
+    return dxp;
+}
+
+
+/////////////////////////////////////////////////////
+/////////   DIFFERENTIAL EQUATION SOLVING   /////////
+/////////////////////////////////////////////////////
+
+glm::dmat2x4 GeodesicIntegrator::IntegrationStep(const glm::dmat2x4& xp, double dl) const
+{
+    // Forward-Euler-Cromer integration of Hamilton's equations.
+    glm::dmat2x4 dxp = (m_metric == 1) ? FasterXPUpdate(xp, dl) : FasterXPUpdateImplicitEuler(xp, dl);
+    return xp + dxp;
+}
+
+glm::dmat2x4 GeodesicIntegrator::RK4IntegrationStep(const glm::dmat2x4& xp, double dl) const
+{
+    // Classic Runge-Kutta 4.
+    glm::dmat2x4 k1 = FasterXPUpdate(xp, dl);
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.5 * k1, dl);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + 0.5 * k2, dl);
+    glm::dmat2x4 k4 = FasterXPUpdate(xp + k3, dl);
+    return xp + (k1 + 2.0 * k2 + 2.0 * k3 + k4) / 6.0;
+}
+
+glm::dmat2x4 GeodesicIntegrator::GaussLegendreIntegrationStep(const glm::dmat2x4& xp, double dl) const
+{
+    // Two stage Gauss-Legendre Method.  It is only symplectic at a fixed step size, and the renderer gives it RK4's
+    // steps, which grow with the distance, so H does drift, just less than with RK4.  The stages are solved by fixed
+    // point iteration from the Euler guess; FasterXPUpdate() uses the exact Kerr gradient KerrdHdxExact().
+    double s = std::sqrt(3.0) / 6.0;
+    glm::dmat2x4 k1 = FasterXPUpdate(xp, dl);
+    glm::dmat2x4 k2 = k1;
+    for (int i = 0; i < 20; i++)
+    {
+        glm::dmat2x4 previousk1 = k1;
+        k1 = FasterXPUpdate(xp + 0.25 * k1 + (0.25 - s) * k2, dl);
+        k2 = FasterXPUpdate(xp + (0.25 + s) * k1 + 0.25 * k2, dl);
+        glm::dmat2x4 change = k1 - previousk1;
+        if (glm::dot(change[0], change[0]) + glm::dot(change[1], change[1])
+            < 1.0e-24 * (glm::dot(k1[0], k1[0]) + glm::dot(k1[1], k1[1])))
+        {
+            break;
+        }
+    }
+    return xp + 0.5 * (k1 + k2);
+}
+
+void GeodesicIntegrator::RK23IntegrationStep(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize) const
+{
+    // Bogacki-Shampine Method.
+    glm::dmat2x4 FSAL = FasterXPUpdate(xp, stepsize) / stepsize;
+    RK23IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, FSAL);
+}
+
+void GeodesicIntegrator::RK23IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize, glm::dmat2x4& FSAL) const
+{
+    // Bogacki-Shampine Method with the first-same-as-last (FSAL) optimization.
+    glm::dmat2x4 k1 = FSAL * stepsize;
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.5 * k1, stepsize);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + 0.75 * k2, stepsize);
+    nextxp1 = xp + (2.0 / 9.0) * k1 + (1.0 / 3.0) * k2 + (4.0 / 9.0) * k3;
+    glm::dmat2x4 k4 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + (7.0 / 24.0) * k1 + (1.0 / 4.0) * k2 + (1.0 / 3.0) * k3 + (1.0 / 8.0) * k4;
+    FSAL = k4 / stepsize;
+}
+
+void GeodesicIntegrator::RK45IntegrationStep(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize) const
+{
+    // Dormand-Prince Method.
+    glm::dmat2x4 FSAL = FasterXPUpdate(xp, stepsize) / stepsize;
+    RK45IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, FSAL);
+}
+
+void GeodesicIntegrator::RK45IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize, glm::dmat2x4& FSAL) const
+{
+    // Dormand-Prince Method with the first-same-as-last (FSAL) optimization.
+    glm::dmat2x4 k1 = FSAL * stepsize;
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.2 * k1, stepsize);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + (3.0 / 40.0) * k1 + (9.0 / 40.0) * k2, stepsize);
+    glm::dmat2x4 k4 = FasterXPUpdate(xp + (44.0 / 45.0) * k1 + (-56.0 / 15.0) * k2 + (32.0 / 9.0) * k3, stepsize);
+    glm::dmat2x4 k5 = FasterXPUpdate(xp + (19372.0 / 6561.0) * k1 + (-25360.0 / 2187.0) * k2 + (64448.0 / 6561.0) * k3
+        + (-212.0 / 729.0) * k4, stepsize);
+    glm::dmat2x4 k6 = FasterXPUpdate(xp + (9017.0 / 3168.0) * k1 + (-355.0 / 33.0) * k2 + (46732.0 / 5247.0) * k3
+        + (49.0 / 176.0) * k4 + (-5103.0 / 18656.0) * k5, stepsize);
+    nextxp1 = xp + (35.0 / 384.0) * k1 + (500.0 / 1113.0) * k3 + (125.0 / 192.0) * k4 + (-2187.0 / 6784.0) * k5
+        + (11.0 / 84.0) * k6;
+    glm::dmat2x4 k7 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + (5179.0 / 57600.0) * k1 + (7571.0 / 16695.0) * k3 + (393.0 / 640.0) * k4 + (-92097.0 / 339200.0) * k5
+        + (187.0 / 2100.0) * k6 + (1.0 / 40.0) * k7;
+    FSAL = k7 / stepsize;
+}
+
+void GeodesicIntegrator::Tsit5IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize, glm::dmat2x4& FSAL) const
+{
+    // Tsitouras 5(4) Method with the first-same-as-last (FSAL) optimization.
+    glm::dmat2x4 k1 = FSAL * stepsize;
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.161 * k1, stepsize);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + -0.008480655492356989 * k1 + 0.335480655492357 * k2, stepsize);
+    glm::dmat2x4 k4 = FasterXPUpdate(xp + 2.897153057105493 * k1 + -6.359448489975075 * k2 + 4.3622954328695815 * k3,
+        stepsize);
+    glm::dmat2x4 k5 = FasterXPUpdate(xp + 5.325864828439257 * k1 + -11.748883564062828 * k2 + 7.4955393428898365 * k3
+        + -0.09249506636175525 * k4, stepsize);
+    glm::dmat2x4 k6 = FasterXPUpdate(xp + 5.86145544294642 * k1 + -12.92096931784711 * k2 + 8.159367898576159 * k3
+        + -0.071584973281401 * k4 + -0.028269050394068383 * k5, stepsize);
+    nextxp1 = xp + 0.09646076681806523 * k1 + 0.01 * k2 + 0.4798896504144996 * k3 + 1.379008574103742 * k4
+        + -3.290069515436081 * k5 + 2.324710524099774 * k6;
+    glm::dmat2x4 k7 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + 0.09824077787029101 * k1 + 0.010816434459656746 * k2 + 0.4720087724042376 * k3
+        + 1.5237195812770048 * k4 + -3.872426680888636 * k5 + 2.7827926300289607 * k6 + (-1.0 / 66.0) * k7;
+    FSAL = k7 / stepsize;
+}
+
+void GeodesicIntegrator::Vern6IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize, glm::dmat2x4& FSAL) const
+{
+    // Verner's 6(5) Method with the first-same-as-last (FSAL) optimization.  Same embedded weights as the shader.
+    glm::dmat2x4 k1 = FSAL * stepsize;
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.06 * k1, stepsize);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + 0.019239962962962962 * k1 + 0.07669337037037037 * k2, stepsize);
+    glm::dmat2x4 k4 = FasterXPUpdate(xp + 0.035975 * k1 + 0.107925 * k3, stepsize);
+    glm::dmat2x4 k5 = FasterXPUpdate(xp + 1.3186834152331484 * k1 + -5.042058063628562 * k3 + 4.220674648395414 * k4,
+        stepsize);
+    glm::dmat2x4 k6 = FasterXPUpdate(xp + -41.872591664327516 * k1 + 159.4325621631375 * k3 + -122.11921356501003 * k4
+        + 5.531743066200054 * k5, stepsize);
+    glm::dmat2x4 k7 = FasterXPUpdate(xp + -54.430156935316504 * k1 + 207.06725136501848 * k3 + -158.61081378459 * k4
+        + 6.991816585950242 * k5 + -0.018597231062309694 * k6, stepsize);
+    glm::dmat2x4 k8 = FasterXPUpdate(xp + -54.66374178728198 * k1 + 207.95280625538936 * k3 + -159.2889574744995 * k4
+        + 7.018743740796944 * k5 + -0.018338785905045722 * k6 + -0.0005119484997882099 * k7, stepsize);
+    nextxp1 = xp + 0.03438957868357036 * k1 + 0.2582624555633503 * k4 + 0.4209371189673537 * k5
+        + 4.40539646966931 * k6 + -176.48311902429865 * k7 + 172.36413340141507 * k8;
+    glm::dmat2x4 k9 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + 0.0430129829743893 * k1 + 0.23882842559078052 * k4 + 0.44938719158355656 * k5
+        + 2.2956854065344765 * k6 + -73.02457601267984 * k7 + 70.96432867266324 * k8 + (1.0 / 30.0) * k9;
+    FSAL = k9 / stepsize;
+}
+
+void GeodesicIntegrator::Vern8IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2,
+    double stepsize, glm::dmat2x4& FSAL, glm::dmat2x4* dense) const
+{
+    // Verner's "most efficient" 8(7) Method.  It isn't FSAL by itself, because the seventh order solution needs the
+    // thirteenth stage rather than the derivative at the end of the step.  Evaluating that derivative anyway costs
+    // nothing, since the next step starts from it, and it gives the dense output a derivative to match at the end.
+    glm::dmat2x4 k1 = FSAL * stepsize;
+    glm::dmat2x4 k2 = FasterXPUpdate(xp + 0.05 * k1, stepsize);
+    glm::dmat2x4 k3 = FasterXPUpdate(xp + -0.0069931640625 * k1 + 0.1135556640625 * k2, stepsize);
+    glm::dmat2x4 k4 = FasterXPUpdate(xp + 0.0399609375 * k1 + 0.1198828125 * k3, stepsize);
+    glm::dmat2x4 k5 = FasterXPUpdate(xp + 0.36139756280045754 * k1 + -1.3415240667004928 * k3
+        + 1.3701265039000352 * k4, stepsize);
+    glm::dmat2x4 k6 = FasterXPUpdate(xp + 0.049047202797202795 * k1 + 0.23509720422144048 * k4
+        + 0.18085559298135673 * k5, stepsize);
+    glm::dmat2x4 k7 = FasterXPUpdate(xp + 0.06169289044289044 * k1 + 0.11236568314640277 * k4
+        + -0.03885046071451367 * k5 + 0.01979188712522046 * k6, stepsize);
+    glm::dmat2x4 k8 = FasterXPUpdate(xp + -1.767630240222327 * k1 + -62.5 * k4 + -6.061889377376669 * k5
+        + 5.6508231982227635 * k6 + 65.62169641937624 * k7, stepsize);
+    glm::dmat2x4 k9 = FasterXPUpdate(xp + -1.1809450665549708 * k1 + -41.50473441114321 * k4
+        + -4.434438319103725 * k5 + 4.260408188586133 * k6 + 43.75364022446172 * k7
+        + 0.00787142548991231 * k8, stepsize);
+    glm::dmat2x4 k10 = FasterXPUpdate(xp + -1.2814059994414886 * k1 + -45.047139960139866 * k4
+        + -4.731362069449577 * k5 + 4.514967016593808 * k6 + 47.44909557172985 * k7
+        + 0.01059228297111661 * k8 + -0.0057468422638446166 * k9, stepsize);
+    glm::dmat2x4 k11 = FasterXPUpdate(xp + -1.7244701342624853 * k1 + -60.92349008483054 * k4
+        + -5.95151837622239 * k5 + 5.556523730698456 * k6 + 63.98301198033305 * k7
+        + 0.014642028250414961 * k8 + 0.06460408772358203 * k9 + -0.0793032316900888 * k10, stepsize);
+    glm::dmat2x4 k12 = FasterXPUpdate(xp + -3.3016226677404474 * k1 + -118.01127235951945 * k4
+        + -10.141422388436428 * k5 + 9.139311332215422 * k6 + 123.37594282816136 * k7
+        + 4.623244378874414 * k8 + -3.383277738074183 * k9 + 4.527592100330938 * k10
+        + -5.828495485811614 * k11, stepsize);
+    glm::dmat2x4 k13 = FasterXPUpdate(xp + -3.039515033762664 * k1 + -109.26086808928908 * k4
+        + -9.29064249738975 * k5 + 8.430504981755927 * k6 + 114.20100103769929 * k7
+        + -0.9637271342144407 * k8 + -5.034884088804453 * k9 + 5.958130824005171 * k10, stepsize);
+    nextxp1 = xp + 0.04427989419007951 * k1 + 0.3541049391724448 * k6 + 0.2479692154956438 * k7
+        + -15.694202038837085 * k8 + 25.084064965572146 * k9 + -31.738367786273237 * k10
+        + 22.93828327398714 * k11 + -0.2361324633071309 * k12;
+    nextxp2 = xp + 0.044312615229089795 * k1 + 0.35460956423432266 * k6 + 0.2478480431366653 * k7
+        + 4.448134732475161 * k8 + 19.84688636612851 * k9 + -23.58162337747476 * k10
+        + -0.3601679437289908 * k13;
+    glm::dmat2x4 k14 = FasterXPUpdate(nextxp1, stepsize);
+    FSAL = k14 / stepsize;
+
+    if (dense == nullptr)
+    {
+        return;
+    }
+
+    // Verner's own interpolants need extra stages.  This quintic in the fraction theta of the step uses the stages
+    // above, satisfies the fifth order conditions for every theta and matches the derivative at both ends.
+    // dense[k] is the coefficient of theta^k, so EvaluateTaylorSeries() evaluates it.
+    dense[0] = xp;
+    dense[1] = 1.0079133911587814 * k1 + 0.006491678522376501 * k6 + -0.01719988671439345 * k7
+        + -28.005948340223966 * k8 + 47.08117710844366 * k9 + -63.476735572546474 * k10
+        + 45.87656654797428 * k11 + -0.4722649266142618 * k12 - k14;
+    dense[2] = -5.410341992480587 * k1 + -2.271583948414191 * k6 + 7.05386251598136 * k7
+        + 10.26525200132551 * k8 + -19.673405552005324 * k9 + 31.738367786273237 * k10
+        + -22.93828327398714 * k11 + 0.2361324633071309 * k12 + k14;
+    dense[3] = 11.237103688800438 * k1 + 12.585232076507115 * k6 + -20.137268565646803 * k7
+        + 14.378014388224868 * k8 + -18.063081587885616 * k9;
+    dense[4] = -10.053435493843843 * k1 + -16.61115432599894 * k6 + 20.42159520768532 * k7
+        + -25.999001613715834 * k8 + 32.241996225873294 * k9;
+    dense[5] = 3.2630403005552893 * k1 + 6.645119458556082 * k6 + -7.073020055809839 * k7
+        + 13.667481525552335 * k8 + -16.50262122885387 * k9;
+}
+
+glm::dmat2x4 GeodesicIntegrator::AdaptiveRKDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize,
+    glm::dmat2x4& FSAL, double& previousError) const
+{
+    // oldStepSize is the size of the step that is actually used in the integration step.  stepsize is then updated
+    // for the next step based on the error.  Same safety factor, clamps, controller gains and attempt limit as the
+    // shader.
+    glm::dmat2x4 nextxp1;
+    glm::dmat2x4 nextxp2;
+    double safety = 0.9;
+    double minstep = 0.2;
+    double maxstep = 2.0;
+    // The automatic solver picks its pair before the attempts, as in the shader.
+    int solver = m_ODESolver;
+    if (solver == 8)
+    {
+        solver = UseHighOrderPair(xp, previousError) ? 3 : 2;
+    }
+    double power = (solver == 2) ? 1.0 / 3.0 : (solver == 5) ? 1.0 / 6.0 : (solver == 10) ? 1.0 / 8.0 : 1.0 / 5.0;
+    double alpha = 0.7 * power;
+    double beta = 0.4 * power;
+    bool rejected = false;
+
+    glm::dmat2x4 localFSAL = FSAL;
+    int max_attempts = 10;
+    for (int i = 0; i < max_attempts; i++)
+    {
+        localFSAL = FSAL;
+        stepsize = LimitStepSize(xp[0], stepsize);
+
+        switch (solver)
+        {
+        case 2:
+            RK23IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+            break;
+        case 4:
+            Tsit5IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+            break;
+        case 5:
+            Vern6IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+            break;
+        case 10:
+            Vern8IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL, nullptr);
+            break;
+        default:
+            RK45IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+            break;
+        }
+        // The shader leaves oldStepSize undefined if every attempt is rejected; the step actually returned is the
+        // last attempted one, so record that.
+        oldStepSize = stepsize;
+
+        glm::dmat2x4 errormat = nextxp1 - nextxp2;
+        if (m_PIController)
+        {
+            double error = std::max(ErrorRatio(xp, nextxp1, errormat), 1.0e-10);
+            if (error <= 1.0)
+            {
+                double stepSizeRatio = std::clamp(safety * std::pow(error, -alpha) * std::pow(previousError, beta),
+                    minstep, maxstep);
+                stepsize *= rejected ? std::min(stepSizeRatio, 1.0) : stepSizeRatio;
+                previousError = std::max(error, 1.0e-4);
+                break;
+            }
+            stepsize *= std::clamp(safety * std::pow(error, -power), minstep, 1.0);
+            rejected = true;
+            continue;
+        }
+
+        // L2-norm error
+        double error = std::sqrt(glm::dot(errormat[0], errormat[0]) + glm::dot(errormat[1], errormat[1]));
+
+        double ratio = m_tolerance / error;
+        double stepSizeRatio = std::clamp(safety * std::pow(ratio, power), minstep, maxstep);
+
+        if (error <= m_tolerance)
+        {
+            // Successful step.
+            if (stepSizeRatio > 0.5)
+            {
+                stepsize *= stepSizeRatio;
+                previousError = rejected ? 1.0 : error / m_tolerance;
+                break;
+            }
+        }
+
+        stepsize *= stepSizeRatio;
+        rejected = true;
+    }
+
+    FSAL = localFSAL;
+    return nextxp1;
+}
+
+bool GeodesicIntegrator::UseHighOrderPair(const glm::dmat2x4& xp, double previousError) const
+{
+    // Dormand-Prince in the weak field and after steps well under the tolerance, Bogacki-Shampine otherwise.  See
+    // useHighOrderPair() in the shader.
+    return MetricDistance(xp[0]) > m_hybridRadius * m_mass || previousError < 0.5;
+}
+
+double GeodesicIntegrator::LimitStepSize(const glm::dvec4& x, double stepsize) const
+{
+    // HACK.  The adaptive driver steps too far for flat or close to flat spacetimes.  This causes it to miss
+    // crossing the disk or the sphere.  The PI controller caps the step relative to the distance instead.
+    if (m_PIController)
+    {
+        return std::min(0.01 + MetricDistance(x) / 5.0, stepsize);
+    }
+    else if (m_metric == 1)
+    {
+        return std::min(0.01 + (MetricDistance(x) - 2.0 * m_mass) * 1.0 / 5.0, stepsize);
+    }
+    return stepsize;
+}
+
+double GeodesicIntegrator::ErrorRatio(const glm::dmat2x4& xp, const glm::dmat2x4& nextxp,
+    const glm::dmat2x4& errormat) const
+{
+    // RMS of the error relative to atol + rtol * |component|.  Without the PI controller, the L2-norm of the error
+    // relative to the tolerance, as in AdaptiveRKDriver().
+    if (!m_PIController)
+    {
+        return std::sqrt(glm::dot(errormat[0], errormat[0]) + glm::dot(errormat[1], errormat[1])) / m_tolerance;
+    }
+    double error2 = 0.0;
+    for (int i = 0; i < 2; i++)
+    {
+        for (int mu = 0; mu < 4; mu++)
+        {
+            double scale = m_absoluteTolerance + m_relativeTolerance * std::max(std::abs(xp[i][mu]),
+                std::abs(nextxp[i][mu]));
+            error2 += (errormat[i][mu] / scale) * (errormat[i][mu] / scale);
+        }
+    }
+    return std::sqrt(error2 / 8.0);
+}
+
+glm::dmat2x4 GeodesicIntegrator::ModifiedMidpointStep(const glm::dmat2x4& xp, double stepsize, int numSubsteps) const
+{
+    // Gragg's modified midpoint rule over numSubsteps (even) substeps, with his smoothing step at the end.  Its error
+    // expands in even powers of the substep size, so every Richardson extrapolation gains two orders.  Costs
+    // numSubsteps + 1 evaluations.
+    double h = stepsize / numSubsteps;
+    glm::dmat2x4 z0 = xp;
+    glm::dmat2x4 z1 = xp + FasterXPUpdate(xp, h);
+    for (int m = 1; m < numSubsteps; m++)
+    {
+        glm::dmat2x4 z2 = z0 + 2.0 * FasterXPUpdate(z1, h);
+        z0 = z1;
+        z1 = z2;
+    }
+    return 0.5 * (z0 + z1 + FasterXPUpdate(z1, h));
+}
+
+glm::dmat2x4 GeodesicIntegrator::ExtrapolatedMidpointStep(const glm::dmat2x4& xp, double stepsize, int numColumns) const
+{
+    // Fixed order Bulirsch-Stoer step, exact to order 2 * numColumns, for the bisection in the intersection points.
+    constexpr int maxColumns = 8;
+    numColumns = std::clamp(numColumns, 1, maxColumns);
+    glm::dmat2x4 T[maxColumns];
+    for (int k = 0; k < numColumns; k++)
+    {
+        // Aitken-Neville on the substep counts 2, 4, 6, ...  T holds the previous row until row k overwrites it.
+        glm::dmat2x4 row = ModifiedMidpointStep(xp, stepsize, 2 * (k + 1));
+        for (int j = 1; j <= k; j++)
+        {
+            double ratio = (double)(k + 1) / (double)(k + 1 - j);
+            glm::dmat2x4 next = row + (row - T[j - 1]) / (ratio * ratio - 1.0);
+            T[j - 1] = row;
+            row = next;
+        }
+        T[k] = row;
+    }
+    return T[numColumns - 1];
+}
+
+glm::dmat2x4 GeodesicIntegrator::BulirschStoerDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize,
+    int& targetColumn) const
+{
+    // Gragg-Bulirsch-Stoer extrapolation with the order and step size control of ODEX in Hairer, Norsett and Wanner,
+    // "Solving Ordinary Differential Equations I", section II.9.  Row k of the tableau is the modified midpoint rule
+    // with 2(k + 1) substeps and column j is exact to order 2(j + 1).  The step is accepted in a column next to
+    // targetColumn, and the next targetColumn is whichever does the least work per unit step.  targetColumn is
+    // carried between steps like the step size; 0 lets the first step choose it from the tolerance.
+    constexpr int maxColumns = 8;
+    double safety = 0.94;
+    double errorSafety = 0.65;
+    double minstep = 0.02;
+    double maxstep = 4.0;
+
+    glm::dmat2x4 T[maxColumns][maxColumns];
+    double work[maxColumns];
+    double newStepSize[maxColumns];
+    double workPerStep[maxColumns];
+
+    if (targetColumn <= 0)
+    {
+        double tolerance = m_PIController ? m_relativeTolerance : m_tolerance;
+        targetColumn = std::clamp((int)(-std::log10(tolerance + 1.0e-40) * 0.6 + 0.5), 1, maxColumns - 2);
+    }
+
+    bool rejected = false;
+    glm::dmat2x4 nextxp = xp;
+    int max_attempts = 10;
+    for (int attempt = 0; attempt < max_attempts; attempt++)
+    {
+        stepsize = LimitStepSize(xp[0], stepsize);
+        oldStepSize = stepsize;
+
+        int lastColumn = std::min(targetColumn + 1, maxColumns - 1);
+        int acceptedColumn = -1;
+        for (int k = 0; k <= lastColumn; k++)
+        {
+            int numSubsteps = 2 * (k + 1);
+            T[k][0] = ModifiedMidpointStep(xp, stepsize, numSubsteps);
+            work[k] = (k == 0 ? 0.0 : work[k - 1]) + numSubsteps + 1;
+            for (int j = 1; j <= k; j++)
+            {
+                double ratio = (double)(k + 1) / (double)(k + 1 - j);
+                T[k][j] = T[k][j - 1] + (T[k][j - 1] - T[k - 1][j - 1]) / (ratio * ratio - 1.0);
+            }
+            nextxp = T[k][k];
+            if (k == 0)
+            {
+                continue;
+            }
+
+            // T[k][k - 1] is exact to order 2k, so its error grows like stepsize^(2k + 1).
+            double error = std::max(ErrorRatio(xp, T[k][k], T[k][k] - T[k][k - 1]), 1.0e-10);
+            double factor = std::clamp(std::pow(error / errorSafety, 1.0 / (2.0 * k + 1.0)) / safety, 1.0 / maxstep,
+                1.0 / minstep);
+            newStepSize[k] = stepsize / factor;
+            workPerStep[k] = work[k] / newStepSize[k];
+            if (k >= targetColumn - 1 && error <= 1.0)
+            {
+                acceptedColumn = k;
+                break;
+            }
+        }
+
+        if (acceptedColumn < 0)
+        {
+            // Retry with the step size the last column asks for, and don't aim any higher than it.
+            stepsize = newStepSize[lastColumn];
+            targetColumn = std::min(targetColumn, lastColumn);
+            rejected = true;
+            continue;
+        }
+
+        // Order control.  Drop a column if that is clearly cheaper, or add one if the accepted column was cheaper
+        // than the one before it.  Column 0 has no error estimate, so neither test looks at it.  After a rejection,
+        // neither the order nor the step size grows.
+        int k = acceptedColumn;
+        int nextColumn = k;
+        if (k >= 2 && workPerStep[k - 1] < 0.8 * workPerStep[k])
+        {
+            nextColumn = k - 1;
+        }
+        else if (!rejected && k >= 2 && k >= targetColumn && k + 1 < maxColumns
+            && workPerStep[k] < 0.9 * workPerStep[k - 1])
+        {
+            nextColumn = k + 1;
+        }
+        nextColumn = std::clamp(nextColumn, 1, maxColumns - 2);
+
+        if (nextColumn <= k)
+        {
+            stepsize = newStepSize[nextColumn];
+        }
+        else
+        {
+            // Column k + 1 wasn't computed, so scale by the extra work it costs.
+            stepsize = newStepSize[k] * (work[k] + 2 * (k + 2) + 1) / work[k];
+        }
+        if (rejected)
+        {
+            stepsize = std::min(stepsize, oldStepSize);
+        }
+        targetColumn = nextColumn;
+        break;
+    }
+
+    return nextxp;
+}
+
+int GeodesicIntegrator::TaylorOrder() const
+{
+    // Jorba and Zou's optimal order for a tolerance eps, -ln(eps) / 2 + 1, balances the cost per step against the
+    // number of steps.
+    double tolerance = m_PIController ? m_relativeTolerance : m_tolerance;
+    return std::clamp((int)std::ceil(-0.5 * std::log(tolerance + 1.0e-40)) + 1, 6, MaxTaylorOrder);
+}
+
+void GeodesicIntegrator::TaylorCoefficients(const glm::dmat2x4& xp, int order, glm::dmat2x4* coefficients) const
+{
+    // The Taylor coefficients of the geodesic through xp, coefficients[k] = (d/dl)^k xp / k!, by automatic
+    // differentiation of Hamilton's equations in the form FasterXPUpdate() integrates.  With g^-1 = eta - f * l l:
+    //     dx/dl = eta * p - f (l.p) l
+    //     dp/dl = (l.p)^2 / 2 * grad(f) + f (l.p) * grad(l).p
+    // r, f and l are built up as in ImplicitR(), Metric() and KerrSchildL(), and their gradients as in KerrdHdxExact(),
+    // simplified with r^4 - (|x|^2 - a^2) r^2 - a^2 y^2 = 0.  Order k of every intermediate series only needs orders 0
+    // to k of the position and momentum, and gives order k of the derivative and so order k + 1 of the state.
+    // Minkowski is the same with zero mass.
+    double m = (m_metric == 0) ? m_mass : 0.0;
+    double a = m_a;
+    double a2 = a * a;
+    double s = m_insideHorizon ? 1.0 : -1.0;
+
+    TaylorSeries y[8];
+    for (int i = 0; i < 8; i++)
+    {
+        y[i][0] = xp[i / 4][i % 4];
+    }
+    TaylorSeries& X = y[1];
+    TaylorSeries& Y = y[2];
+    TaylorSeries& Z = y[3];
+    TaylorSeries& p0 = y[4];
+    TaylorSeries& px = y[5];
+    TaylorSeries& py = y[6];
+    TaylorSeries& pz = y[7];
+
+    TaylorSeries y2, d, disc, sq, r2, r, r3, r4, Q, f, r2plusa2, lx, ly, lz, ldotp, flp;
+    TaylorSeries w, r2w, r2plusa2w, drdx, drdy, drdz, fOverQ, dfdrNumer, dfdr, dfdy;
+    TaylorSeries xterm, zterm, GOverr2plusa2, lyOverr, G, halfldotp2, common, ex, ey, ez;
+    for (int k = 0; k < order; k++)
+    {
+        auto P = [k](const TaylorSeries& u, const TaylorSeries& v) { return TaylorSeries::Product(u, v, k); };
+        double constant = (k == 0) ? 1.0 : 0.0;
+
+        // r from r^4 + b * r^2 + c = 0, with b = -d = a^2 - |x|^2 and c = -a^2 * y^2.
+        y2[k] = P(Y, Y);
+        d[k] = P(X, X) + y2[k] + P(Z, Z) - a2 * constant;
+        disc[k] = P(d, d) + 4.0 * a2 * y2[k];
+        sq[k] = sq.SquareRoot(disc[k], k);
+        r2[k] = 0.5 * (sq[k] + d[k]);
+        r[k] = r.SquareRoot(r2[k], k);
+        r3[k] = P(r2, r);
+        r4[k] = P(r2, r2);
+        Q[k] = r4[k] + a2 * y2[k];
+        f[k] = f.Quotient(2.0 * m * r3[k], Q, k);
+
+        r2plusa2[k] = r2[k] + a2 * constant;
+        lx[k] = lx.Quotient(P(r, X) - a * Z[k], r2plusa2, k);
+        ly[k] = ly.Quotient(Y[k], r, k);
+        lz[k] = lz.Quotient(P(r, Z) + a * X[k], r2plusa2, k);
+        ldotp[k] = s * p0[k] + P(lx, px) + P(ly, py) + P(lz, pz);
+        flp[k] = P(f, ldotp);
+
+        // dr/dx = r^3 x / Q, dr/dy = r (r^2 + a^2) y / Q, dr/dz = r^3 z / Q.
+        w[k] = w.Quotient(r[k], Q, k);
+        r2w[k] = P(r2, w);
+        r2plusa2w[k] = P(r2plusa2, w);
+        drdx[k] = P(r2w, X);
+        drdy[k] = P(r2plusa2w, Y);
+        drdz[k] = P(r2w, Z);
+
+        // df/dr = f (3 a^2 y^2 - r^4) / (r Q) at constant y, and df/dy = -2 a^2 y f / Q at constant r.
+        fOverQ[k] = fOverQ.Quotient(f[k], Q, k);
+        dfdrNumer[k] = 3.0 * a2 * y2[k] - r4[k];
+        dfdr[k] = dfdr.Quotient(P(fOverQ, dfdrNumer), r, k);
+        dfdy[k] = -2.0 * a2 * P(fOverQ, Y);
+
+        // grad(l).p = G * grad(r) + (e_x, e_y, e_z), where G collects the terms through r and e the explicit ones.
+        xterm[k] = X[k] - 2.0 * P(r, lx);
+        zterm[k] = Z[k] - 2.0 * P(r, lz);
+        GOverr2plusa2[k] = GOverr2plusa2.Quotient(P(px, xterm) + P(pz, zterm), r2plusa2, k);
+        lyOverr[k] = lyOverr.Quotient(ly[k], r, k);
+        G[k] = GOverr2plusa2[k] - P(py, lyOverr);
+        ex[k] = ex.Quotient(P(px, r) + a * pz[k], r2plusa2, k);
+        ey[k] = ey.Quotient(py[k], r, k);
+        ez[k] = ez.Quotient(P(pz, r) - a * px[k], r2plusa2, k);
+
+        halfldotp2[k] = 0.5 * P(ldotp, ldotp);
+        common[k] = P(halfldotp2, dfdr) + P(flp, G);
+
+        double dydl[8];
+        dydl[0] = -p0[k] - s * flp[k];
+        dydl[1] = px[k] - P(flp, lx);
+        dydl[2] = py[k] - P(flp, ly);
+        dydl[3] = pz[k] - P(flp, lz);
+        dydl[4] = 0.0;
+        dydl[5] = P(common, drdx) + P(flp, ex);
+        dydl[6] = P(common, drdy) + P(flp, ey) + P(halfldotp2, dfdy);
+        dydl[7] = P(common, drdz) + P(flp, ez);
+        for (int i = 0; i < 8; i++)
+        {
+            y[i][k + 1] = dydl[i] / (k + 1);
+        }
+    }
+
+    for (int k = 0; k <= order; k++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            coefficients[k][i / 4][i % 4] = y[i][k];
+        }
+    }
+}
+
+glm::dmat2x4 GeodesicIntegrator::EvaluateTaylorSeries(const glm::dmat2x4* coefficients, int order, double stepsize)
+{
+    // Horner's rule.  Any stepsize up to the one the series was built for is as accurate as the step itself, so this
+    // is also the dense output.
+    glm::dmat2x4 xp = coefficients[order];
+    for (int k = order - 1; k >= 0; k--)
+    {
+        xp = coefficients[k] + stepsize * xp;
+    }
+    return xp;
+}
+
+glm::dmat2x4 GeodesicIntegrator::TaylorDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize) const
+{
+    // Taylor series step.  The step size comes from the series itself, as in Jorba and Zou: the last two terms, which
+    // bound the truncation error while the series converges geometrically, must each stay below the tolerance.  So
+    // steps are never rejected, and each costs one series.  The incoming stepsize isn't used.
+    double safety = 0.9;
+    int order = TaylorOrder();
+    glm::dmat2x4 coefficients[MaxTaylorOrder + 1];
+    TaylorCoefficients(xp, order, coefficients);
+
+    double tolerance = m_PIController
+        ? m_absoluteTolerance + m_relativeTolerance * std::sqrt(glm::dot(xp[0], xp[0]) + glm::dot(xp[1], xp[1]))
+        : m_tolerance;
+    double h = 1.0e10;
+    for (int k = order - 1; k <= order; k++)
+    {
+        double norm = std::sqrt(glm::dot(coefficients[k][0], coefficients[k][0])
+            + glm::dot(coefficients[k][1], coefficients[k][1]));
+        if (norm > 0.0)
+        {
+            h = std::min(h, std::pow(tolerance / norm, 1.0 / k));
+        }
+    }
+    stepsize = LimitStepSize(xp[0], safety * h);
+    oldStepSize = stepsize;
+    return EvaluateTaylorSeries(coefficients, order, stepsize);
+}
+
+
+/////////////////////////////////////////////////////
+//////////////   INTERSECTION POINTS   //////////////
+/////////////////////////////////////////////////////
+
+void GeodesicIntegrator::BSDiskIntersectionPoint(const glm::dmat2x4& previousxp, const glm::dmat2x4& xp,
+    glm::dmat2x4& diskIntersectionPoint, double stepsize) const
+{
+    // Binary search on stepsize to get within some threshold of the xz-plane.
+    int BS_attempts = 20;
+    double leftEndpoint = 0.0;
+    double rightEndpoint = stepsize;
+    double midpoint;
+    glm::dmat2x4 xptest = previousxp;
+    glm::dmat2x4 xptest2;
+    glm::dmat2x4 FSAL;
+    if (IsAdaptive())
+    {
+        FSAL = FasterXPUpdate(previousxp, stepsize) / stepsize;
+    }
+    // The series is the Taylor solver's dense output, so every bisection point costs one evaluation of it.
+    int order = TaylorOrder();
+    glm::dmat2x4 coefficients[MaxTaylorOrder + 1];
+    if (IsTaylor())
+    {
+        TaylorCoefficients(previousxp, order, coefficients);
+    }
+    // Verner 8(7)'s dense output, the same way: one step, and then one polynomial per bisection point.
+    glm::dmat2x4 dense[6];
+    if (m_ODESolver == 10)
+    {
+        glm::dmat2x4 nextxp1;
+        glm::dmat2x4 nextxp2;
+        glm::dmat2x4 denseFSAL = FSAL;
+        Vern8IntegrationStepFSAL(previousxp, nextxp1, nextxp2, stepsize, denseFSAL, dense);
+    }
+
+    if (std::abs(previousxp[0][2]) < m_diskIntersectionThreshold)
+    {
+        diskIntersectionPoint = previousxp;
+        return;
+    }
+    else if (std::abs(xp[0][2]) < m_diskIntersectionThreshold)
+    {
+        diskIntersectionPoint = xp;
+        return;
+    }
+
+    for (int j = 0; j < BS_attempts; j++)
+    {
+        glm::dmat2x4 localFSAL = FSAL;
+        midpoint = (leftEndpoint + rightEndpoint) / 2.0;
+        switch (m_ODESolver)
+        {
+        case 0:
+            xptest = IntegrationStep(previousxp, midpoint);
+            break;
+        case 2:
+            RK23IntegrationStepFSAL(previousxp, xptest, xptest2, midpoint, localFSAL);
+            break;
+        case 6:
+            // Bulirsch-Stoer steps are long, so bisect with an order 8 step rather than RK4.
+            xptest = ExtrapolatedMidpointStep(previousxp, midpoint, 4);
+            break;
+        case 7:
+            xptest = GaussLegendreIntegrationStep(previousxp, midpoint);
+            break;
+        case 9:
+            xptest = EvaluateTaylorSeries(coefficients, order, midpoint);
+            break;
+        case 10:
+            xptest = EvaluateTaylorSeries(dense, 5, midpoint / stepsize);
+            break;
+        default:
+            // The shader also bisects with RK4 for Dormand-Prince.
+            xptest = RK4IntegrationStep(previousxp, midpoint);
+            break;
+        }
+        if (std::abs(xptest[0][2]) < m_diskIntersectionThreshold)
+        {
+            break;
+        }
+        if (xptest[0][2] * previousxp[0][2] > 0.0)
+        {
+            leftEndpoint = midpoint;
+        }
+        else
+        {
+            rightEndpoint = midpoint;
+        }
+    }
+    diskIntersectionPoint = xptest;
+}
+
+void GeodesicIntegrator::BSSphereIntersectionPoint(const glm::dmat2x4& xp, glm::dmat2x4& sphereIntersectionPoint,
+    double horizon, double stepsize) const
+{
+    // Binary search on stepsize to get within some threshold of the sphere horizon.
+    int BS_attempts = 20;
+    double leftEndpoint = 0.0;
+    double rightEndpoint = stepsize;
+    double midpoint;
+    double dist;
+    glm::dmat2x4 xptest = xp;
+    glm::dmat2x4 xptest2;
+    glm::dmat2x4 FSAL;
+    if (IsAdaptive())
+    {
+        FSAL = FasterXPUpdate(xp, stepsize) / stepsize;
+    }
+    int order = TaylorOrder();
+    glm::dmat2x4 coefficients[MaxTaylorOrder + 1];
+    if (IsTaylor())
+    {
+        TaylorCoefficients(xp, order, coefficients);
+    }
+    glm::dmat2x4 dense[6];
+    if (m_ODESolver == 10)
+    {
+        glm::dmat2x4 nextxp1;
+        glm::dmat2x4 nextxp2;
+        glm::dmat2x4 denseFSAL = FSAL;
+        Vern8IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, denseFSAL, dense);
+    }
+
+    for (int j = 0; j < BS_attempts; j++)
+    {
+        glm::dmat2x4 localFSAL = FSAL;
+        midpoint = (leftEndpoint + rightEndpoint) / 2.0;
+        switch (m_ODESolver)
+        {
+        case 0:
+            xptest = IntegrationStep(xp, midpoint);
+            break;
+        case 1:
+            xptest = RK4IntegrationStep(xp, midpoint);
+            break;
+        case 2:
+            RK23IntegrationStepFSAL(xp, xptest, xptest2, midpoint, localFSAL);
+            break;
+        case 6:
+            xptest = ExtrapolatedMidpointStep(xp, midpoint, 4);
+            break;
+        case 7:
+            xptest = GaussLegendreIntegrationStep(xp, midpoint);
+            break;
+        case 9:
+            xptest = EvaluateTaylorSeries(coefficients, order, midpoint);
+            break;
+        case 10:
+            xptest = EvaluateTaylorSeries(dense, 5, midpoint / stepsize);
+            break;
+        default:
+            RK45IntegrationStep(xp, xptest, xptest2, midpoint);
+            break;
+        }
+        dist = MetricDistance(xptest[0]);
+        if (std::abs(dist - horizon) < m_sphereIntersectionThreshold)
+        {
+            break;
+        }
+        if (dist > horizon)
+        {
+            leftEndpoint = midpoint;
+        }
+        else
+        {
+            rightEndpoint = midpoint;
+        }
+    }
+    sphereIntersectionPoint = xptest;
+}
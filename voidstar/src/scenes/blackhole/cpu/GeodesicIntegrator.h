@@ -0,0 +1,114 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+
+#include "glm/glm.hpp"
+
+
+struct KerrSchildState
+{
+	// Everything about the Kerr metric at one position that Hamilton's equations need: r, and f and the null vector l
+	// of the inverse metric g^{ab} = \eta^{ab} - f * l^a l^b, with the intermediates the gradient reuses.  Computed once
+	// per evaluation and shared, as KerrSchildState in the shader.
+	double r;
+	double r2plusa2;
+	// r^4 + a^2 y^2, the denominator of f.
+	double Q;
+	double f;
+	glm::dvec4 l;
+};
+
+
+class GeodesicIntegrator
+{
+	// Double precision port of the "GENERAL RELATIVITY", "DIFFERENTIAL EQUATION SOLVING" and "INTERSECTION POINTS"
+	// sections of KerrBlackHole.shader.  The shader selects the metric and ODE solver with #defines; here they are
+	// runtime settings taken from BlackHoleParameters so that one binary can reproduce any shader variant.
+	// xp[0] is the position x^\mu and xp[1] is the momentum p_\mu, exactly as the mat2x4 in the shader.
+public:
+	GeodesicIntegrator(const BlackHoleParameters& params);
+	~GeodesicIntegrator();
+
+	double ImplicitR(const glm::dvec4& x) const;
+	glm::dmat4 Metric(const glm::dvec4& x) const;
+	glm::dmat4 InvMetric(const glm::dvec4& x) const;
+	double MetricDistance(const glm::dvec4& x) const;
+	glm::dvec3 PToDir(const glm::dmat2x4& xp) const;
+	double H(const glm::dvec4& x, const glm::dvec4& p) const;
+	glm::dvec4 dHdx(const glm::dvec4& x, const glm::dvec4& p) const;
+	KerrSchildState KerrState(const glm::dvec4& x) const;
+	glm::dvec4 KerrRaiseIndex(const KerrSchildState& state, const glm::dvec4& p) const;
+	glm::dvec4 KerrdHdxExact(const KerrSchildState& state, const glm::dvec4& x, const glm::dvec4& p) const;
+
+	glm::dmat2x4 FasterXPUpdate(const glm::dmat2x4& xp, double dl) const;
+	glm::dmat2x4 FasterXPUpdateImplicitEuler(const glm::dmat2x4& xp, double dl) const;
+
+	glm::dmat2x4 IntegrationStep(const glm::dmat2x4& xp, double dl) const;
+	glm::dmat2x4 RK4IntegrationStep(const glm::dmat2x4& xp, double dl) const;
+	glm::dmat2x4 GaussLegendreIntegrationStep(const glm::dmat2x4& xp, double dl) const;
+	void RK23IntegrationStep(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize) const;
+	void RK23IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize,
+		glm::dmat2x4& FSAL) const;
+	void RK45IntegrationStep(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize) const;
+	void RK45IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize,
+		glm::dmat2x4& FSAL) const;
+	void Tsit5IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize,
+		glm::dmat2x4& FSAL) const;
+	void Vern6IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize,
+		glm::dmat2x4& FSAL) const;
+	// Verner 8(7), ODESolver 10.  There is no shader version.  dense, if not null, receives the six coefficients of the
+	// step's continuous extension.
+	void Vern8IntegrationStepFSAL(const glm::dmat2x4& xp, glm::dmat2x4& nextxp1, glm::dmat2x4& nextxp2, double stepsize,
+		glm::dmat2x4& FSAL, glm::dmat2x4* dense) const;
+	glm::dmat2x4 AdaptiveRKDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize, glm::dmat2x4& FSAL,
+		double& previousError) const;
+
+	// Gragg-Bulirsch-Stoer extrapolation, ODESolver 6.  There is no shader version.
+	glm::dmat2x4 ModifiedMidpointStep(const glm::dmat2x4& xp, double stepsize, int numSubsteps) const;
+	glm::dmat2x4 ExtrapolatedMidpointStep(const glm::dmat2x4& xp, double stepsize, int numColumns) const;
+	glm::dmat2x4 BulirschStoerDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize,
+		int& targetColumn) const;
+
+	// Taylor series integration with automatic differentiation, ODESolver 9, for the Kerr and Minkowski metrics.
+	// There is no shader version.  coefficients holds order + 1 terms.
+	int TaylorOrder() const;
+	void TaylorCoefficients(const glm::dmat2x4& xp, int order, glm::dmat2x4* coefficients) const;
+	static glm::dmat2x4 EvaluateTaylorSeries(const glm::dmat2x4* coefficients, int order, double stepsize);
+	glm::dmat2x4 TaylorDriver(const glm::dmat2x4& xp, double& stepsize, double& oldStepSize) const;
+
+	void BSDiskIntersectionPoint(const glm::dmat2x4& previousxp, const glm::dmat2x4& xp, glm::dmat2x4& diskIntersectionPoint,
+		double stepsize) const;
+	void BSSphereIntersectionPoint(const glm::dmat2x4& xp, glm::dmat2x4& sphereIntersectionPoint, double horizon,
+		double stepsize) const;
+
+	double GetHorizon() const { return m_horizon; }
+	// The embedded Runge-Kutta pairs, which carry FSAL between steps.  8 switches between 2 and 3.
+	bool IsAdaptive() const
+	{
+		return (m_ODESolver >= 2 && m_ODESolver <= 5) || m_ODESolver == 8 || m_ODESolver == 10;
+	}
+	bool UseHighOrderPair(const glm::dmat2x4& xp, double previousError) const;
+	bool IsBulirschStoer() const { return m_ODESolver == 6; }
+	bool IsTaylor() const { return m_ODESolver == 9; }
+
+private:
+	glm::dvec4 KerrSchildL(const glm::dvec4& x, double r, double timeComponent) const;
+	// Shared by the adaptive drivers.  LimitStepSize() is the cap on steps in nearly flat spacetime, and ErrorRatio()
+	// is the error of a step relative to the tolerance, accepted when at most 1.
+	double LimitStepSize(const glm::dvec4& x, double stepsize) const;
+	double ErrorRatio(const glm::dmat2x4& xp, const glm::dmat2x4& nextxp, const glm::dmat2x4& errormat) const;
+
+	int m_metric;
+	bool m_insideHorizon;
+	int m_ODESolver;
+	double m_mass;
+	double m_a;
+	double m_horizon;
+	double m_tolerance;
+	double m_hybridRadius;
+	bool m_PIController;
+	double m_absoluteTolerance;
+	double m_relativeTolerance;
+	double m_diskIntersectionThreshold;
+	double m_sphereIntersectionThreshold;
+};
@@ -0,0 +1,324 @@
+#include "PacketIntegrator.h"
+
+using simd::Floats;
+using simd::Mask;
+
+
+glm::dmat2x4 PacketXP::GetLane(int lane) const
+{
+    glm::dmat2x4 xp;
+    for (int mu = 0; mu < 4; mu++)
+    {
+        xp[0][mu] = simd::GetLane(x[mu], lane);
+        xp[1][mu] = simd::GetLane(p[mu], lane);
+    }
+    return xp;
+}
+
+void PacketXP::SetLane(int lane, const glm::dmat2x4& xp)
+{
+    for (int mu = 0; mu < 4; mu++)
+    {
+        simd::SetLane(x[mu], lane, (float)xp[0][mu]);
+        simd::SetLane(p[mu], lane, (float)xp[1][mu]);
+    }
+}
+
+PacketXP operator+(const PacketXP& a, const PacketXP& b)
+{
+    PacketXP result;
+    for (int mu = 0; mu < 4; mu++)
+    {
+        result.x[mu] = a.x[mu] + b.x[mu];
+        result.p[mu] = a.p[mu] + b.p[mu];
+    }
+    return result;
+}
+
+PacketXP operator-(const PacketXP& a, const PacketXP& b)
+{
+    PacketXP result;
+    for (int mu = 0; mu < 4; mu++)
+    {
+        result.x[mu] = a.x[mu] - b.x[mu];
+        result.p[mu] = a.p[mu] - b.p[mu];
+    }
+    return result;
+}
+
+PacketXP operator*(Floats s, const PacketXP& a)
+{
+    PacketXP result;
+    for (int mu = 0; mu < 4; mu++)
+    {
+        result.x[mu] = s * a.x[mu];
+        result.p[mu] = s * a.p[mu];
+    }
+    return result;
+}
+
+PacketXP operator/(const PacketXP& a, Floats s)
+{
+    return (1.0f / s) * a;
+}
+
+PacketXP Select(Mask mask, const PacketXP& a, const PacketXP& b)
+{
+    PacketXP result;
+    for (int mu = 0; mu < 4; mu++)
+    {
+        result.x[mu] = simd::Select(mask, a.x[mu], b.x[mu]);
+        result.p[mu] = simd::Select(mask, a.p[mu], b.p[mu]);
+    }
+    return result;
+}
+
+
+PacketIntegrator::PacketIntegrator(const BlackHoleParameters& params)
+    : m_ODESolver(params.ODESolver), m_mass(params.mass), m_a(params.a),
+    m_lTime(params.insideHorizon ? 1.0f : -1.0f), m_tolerance(params.tolerance),
+    m_fp64Refinement(params.fp64Refinement && params.metric == 0)
+{
+    // The band is twice as wide for near-extremal spins, as in needsFP64() in the shader.
+    float horizon = m_mass + std::sqrt(std::max(0.0f, m_mass * m_mass - m_a * m_a));
+    float band = params.fp64Band * m_mass * ((std::abs(m_a) > 0.95f * m_mass) ? 2.0f : 1.0f);
+    m_fp64Radius = horizon + band;
+}
+
+PacketIntegrator::~PacketIntegrator()
+{
+}
+
+
+/////////////////////////////////////////////////////
+//////////////   GENERAL RELATIVITY   ///////////////
+/////////////////////////////////////////////////////
+
+Floats PacketIntegrator::ImplicitR(const Floats x[4]) const
+{
+    Floats a2 = Floats(m_a * m_a);
+    Floats b = a2 - (x[1] * x[1] + x[2] * x[2] + x[3] * x[3]);
+    Floats c = -a2 * x[2] * x[2];
+    // Stable form of the root, as in the shader.  -b + sqrt(b^2 - 4c) cancels when b > 0.
+    Floats sq = simd::Sqrt(b * b - 4.0f * c);
+    Floats r2 = simd::Select(b > Floats(0.0f), -2.0f * c / (b + sq), 0.5f * (sq - b));
+    return simd::Sqrt(r2);
+}
+
+Floats PacketIntegrator::MetricDistance(const Floats x[4]) const
+{
+    return ImplicitR(x);
+}
+
+Mask PacketIntegrator::NeedsDoublePrecision(const PacketXP& xp, Floats dist) const
+{
+    // Close to the horizon, where r and f lose precision, or on rays circling the photon orbits, where |p| is much
+    // larger than the energy.
+    if (!m_fp64Refinement)
+    {
+        return simd::FromBits(0);
+    }
+    Floats p2 = xp.p[1] * xp.p[1] + xp.p[2] * xp.p[2] + xp.p[3] * xp.p[3];
+    return (dist < Floats(m_fp64Radius)) | (p2 > 400.0f * xp.p[0] * xp.p[0]);
+}
+
+bool PacketIntegrator::NeedsDoublePrecision(const glm::dmat2x4& xp, double dist) const
+{
+    if (!m_fp64Refinement)
+    {
+        return false;
+    }
+    glm::dvec3 p = glm::dvec3(xp[1][1], xp[1][2], xp[1][3]);
+    return dist < m_fp64Radius || glm::dot(p, p) > 400.0 * xp[1][0] * xp[1][0];
+}
+
+PacketXP PacketIntegrator::Update(const PacketXP& xp, Floats dl, bool semiImplicit) const
+{
+    PacketXP dxp;
+    // Kerr.  Same formulas as GeodesicIntegrator::KerrState(), KerrRaiseIndex() and KerrdHdxExact(), with the common
+    // subexpressions computed once.  pos.x, pos.y, pos.z of the scalar code are X, Y, Z here.
+    const Floats& X = xp.x[1];
+    const Floats& Y = xp.x[2];
+    const Floats& Z = xp.x[3];
+    Floats a = Floats(m_a);
+    Floats a2 = Floats(m_a * m_a);
+    Floats y2 = Y * Y;
+    Floats b = a2 - (X * X + y2 + Z * Z);
+    Floats sq = simd::Sqrt(b * b + 4.0f * a2 * y2);
+    Floats r2 = simd::Select(b > Floats(0.0f), 2.0f * a2 * y2 / (b + sq), 0.5f * (sq - b));
+    Floats r = simd::Sqrt(r2);
+    Floats invr = 1.0f / r;
+    Floats r2plusa2 = r2 + a2;
+    Floats invr2plusa2 = 1.0f / r2plusa2;
+    Floats Q = r2 * r2 + a2 * y2;
+    Floats invQ = 1.0f / Q;
+    Floats f = 2.0f * m_mass * r2 * r * invQ;
+    Floats l[4] = { Floats(m_lTime), (r * X - a * Z) * invr2plusa2, Y * invr, (r * Z + a * X) * invr2plusa2 };
+    Floats ldotp = l[0] * xp.p[0] + l[1] * xp.p[1] + l[2] * xp.p[2] + l[3] * xp.p[3];
+
+    // dr/dx = r^3 x / Q, dr/dy = r (r^2 + a^2) y / Q, dr/dz = r^3 z / Q.
+    Floats rOverQ = r * invQ;
+    Floats r3OverQ = r2 * rOverQ;
+    Floats drdx = r3OverQ * X;
+    Floats drdy = r2plusa2 * rOverQ * Y;
+    Floats drdz = r3OverQ * Z;
+
+    // df/dx, df/dy, df/dz.  df/dt = 0.
+    Floats fOverQ = f * invQ;
+    Floats dfdr = fOverQ * (3.0f * a2 * y2 - r2 * r2) * invr;
+    Floats dfdx = dfdr * drdx;
+    Floats dfdy = dfdr * drdy - 2.0f * a2 * Y * fOverQ;
+    Floats dfdz = dfdr * drdz;
+
+    // (dl/dx).p, (dl/dy).p, (dl/dz).p.  dl/dt = 0 and the time component of every dl is 0.
+    Floats twor = 2.0f * r;
+    Floats G = (xp.p[1] * (X - twor * l[1]) + xp.p[3] * (Z - twor * l[3])) * invr2plusa2 - xp.p[2] * l[2] * invr;
+    Floats dldxdotp = G * drdx + (r * xp.p[1] + a * xp.p[3]) * invr2plusa2;
+    Floats dldydotp = G * drdy + xp.p[2] * invr;
+    Floats dldzdotp = G * drdz + (r * xp.p[3] - a * xp.p[1]) * invr2plusa2;
+
+    // dp = -dH/dx * dl = 0.5 * (df/dx (l.p)^2 + 2 f (l.p) (dl/dx).p) * dl
+    Floats halfldotpdl = 0.5f * ldotp * dl;
+    Floats twof = 2.0f * f;
+    dxp.p[0] = Floats(0.0f);
+    dxp.p[1] = halfldotpdl * (dfdx * ldotp + twof * dldxdotp);
+    dxp.p[2] = halfldotpdl * (dfdy * ldotp + twof * dldydotp);
+    dxp.p[3] = halfldotpdl * (dfdz * ldotp + twof * dldzdotp);
+
+    // dx = g^-1 p dl = (eta p - f (l.p) l) dl
+    Floats p[4] = { xp.p[0], xp.p[1], xp.p[2], xp.p[3] };
+    if (semiImplicit)
+    {
+        // Correction for Euler-Cromer method as opposed to vanilla Euler method
+        for (int mu = 0; mu < 4; mu++)
+        {
+            p[mu] += dxp.p[mu];
+        }
+        ldotp = l[0] * p[0] + l[1] * p[1] + l[2] * p[2] + l[3] * p[3];
+    }
+    Floats fldotp = f * ldotp;
+    dxp.x[0] = (-p[0] - fldotp * l[0]) * dl;
+    for (int i = 1; i < 4; i++)
+    {
+        dxp.x[i] = (p[i] - fldotp * l[i]) * dl;
+    }
+    return dxp;
+}
+
+PacketXP PacketIntegrator::FasterXPUpdate(const PacketXP& xp, Floats dl) const
+{
+    return Update(xp, dl, false);
+}
+
+PacketXP PacketIntegrator::FasterXPUpdateImplicitEuler(const PacketXP& xp, Floats dl) const
+{
+    return Update(xp, dl, true);
+}
+
+
+/////////////////////////////////////////////////////
+/////////   DIFFERENTIAL EQUATION SOLVING   /////////
+/////////////////////////////////////////////////////
+
+PacketXP PacketIntegrator::IntegrationStep(const PacketXP& xp, Floats dl) const
+{
+    // Forward-Euler-Cromer integration of Hamilton's equations.
+    return xp + FasterXPUpdateImplicitEuler(xp, dl);
+}
+
+PacketXP PacketIntegrator::RK4IntegrationStep(const PacketXP& xp, Floats dl) const
+{
+    // Classic Runge-Kutta 4.
+    PacketXP k1 = FasterXPUpdate(xp, dl);
+    PacketXP k2 = FasterXPUpdate(xp + Floats(0.5f) * k1, dl);
+    PacketXP k3 = FasterXPUpdate(xp + Floats(0.5f) * k2, dl);
+    PacketXP k4 = FasterXPUpdate(xp + k3, dl);
+    return xp + Floats(1.0f / 6.0f) * (k1 + Floats(2.0f) * (k2 + k3) + k4);
+}
+
+void PacketIntegrator::RK23IntegrationStepFSAL(const PacketXP& xp, PacketXP& nextxp1, PacketXP& nextxp2, Floats stepsize,
+    PacketXP& FSAL) const
+{
+    // Bogacki-Shampine Method with the first-same-as-last (FSAL) optimization.
+    PacketXP k1 = stepsize * FSAL;
+    PacketXP k2 = FasterXPUpdate(xp + Floats(0.5f) * k1, stepsize);
+    PacketXP k3 = FasterXPUpdate(xp + Floats(0.75f) * k2, stepsize);
+    nextxp1 = xp + Floats(2.0f / 9.0f) * k1 + Floats(1.0f / 3.0f) * k2 + Floats(4.0f / 9.0f) * k3;
+    PacketXP k4 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + Floats(7.0f / 24.0f) * k1 + Floats(1.0f / 4.0f) * k2 + Floats(1.0f / 3.0f) * k3
+        + Floats(1.0f / 8.0f) * k4;
+    FSAL = k4 / stepsize;
+}
+
+void PacketIntegrator::RK45IntegrationStepFSAL(const PacketXP& xp, PacketXP& nextxp1, PacketXP& nextxp2, Floats stepsize,
+    PacketXP& FSAL) const
+{
+    // Dormand-Prince Method with the first-same-as-last (FSAL) optimization.
+    PacketXP k1 = stepsize * FSAL;
+    PacketXP k2 = FasterXPUpdate(xp + Floats(0.2f) * k1, stepsize);
+    PacketXP k3 = FasterXPUpdate(xp + Floats(3.0f / 40.0f) * k1 + Floats(9.0f / 40.0f) * k2, stepsize);
+    PacketXP k4 = FasterXPUpdate(xp + Floats(44.0f / 45.0f) * k1 + Floats(-56.0f / 15.0f) * k2
+        + Floats(32.0f / 9.0f) * k3, stepsize);
+    PacketXP k5 = FasterXPUpdate(xp + Floats(19372.0f / 6561.0f) * k1 + Floats(-25360.0f / 2187.0f) * k2
+        + Floats(64448.0f / 6561.0f) * k3 + Floats(-212.0f / 729.0f) * k4, stepsize);
+    PacketXP k6 = FasterXPUpdate(xp + Floats(9017.0f / 3168.0f) * k1 + Floats(-355.0f / 33.0f) * k2
+        + Floats(46732.0f / 5247.0f) * k3 + Floats(49.0f / 176.0f) * k4 + Floats(-5103.0f / 18656.0f) * k5, stepsize);
+    nextxp1 = xp + Floats(35.0f / 384.0f) * k1 + Floats(500.0f / 1113.0f) * k3 + Floats(125.0f / 192.0f) * k4
+        + Floats(-2187.0f / 6784.0f) * k5 + Floats(11.0f / 84.0f) * k6;
+    PacketXP k7 = FasterXPUpdate(nextxp1, stepsize);
+    nextxp2 = xp + Floats(5179.0f / 57600.0f) * k1 + Floats(7571.0f / 16695.0f) * k3 + Floats(393.0f / 640.0f) * k4
+        + Floats(-92097.0f / 339200.0f) * k5 + Floats(187.0f / 2100.0f) * k6 + Floats(1.0f / 40.0f) * k7;
+    FSAL = k7 / stepsize;
+}
+
+PacketXP PacketIntegrator::AdaptiveRKDriver(const PacketXP& xp, Floats& stepsize, Floats& oldStepSize, PacketXP& FSAL,
+    Mask active) const
+{
+    // Lane by lane this is GeodesicIntegrator::AdaptiveRKDriver().  Lanes that have accepted their step drop out of
+    // trying, but keep being computed until every lane is done.
+    const float safety = 0.9f;
+    const float minstep = 0.2f;
+    const float maxstep = 2.0f;
+    const float power = (m_ODESolver == 2) ? 1.0f / 3.0f : 1.0f / 5.0f;
+
+    PacketXP result = xp;
+    PacketXP resultFSAL = FSAL;
+    Mask trying = active;
+    int max_attempts = 10;
+    for (int i = 0; i < max_attempts && simd::Any(trying); i++)
+    {
+        PacketXP localFSAL = FSAL;
+        PacketXP nextxp1;
+        PacketXP nextxp2;
+        if (m_ODESolver == 2)
+        {
+            RK23IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+        }
+        else
+        {
+            RK45IntegrationStepFSAL(xp, nextxp1, nextxp2, stepsize, localFSAL);
+        }
+        result = Select(trying, nextxp1, result);
+        resultFSAL = Select(trying, localFSAL, resultFSAL);
+        oldStepSize = simd::Select(trying, stepsize, oldStepSize);
+
+        // L2-norm error
+        PacketXP errormat = nextxp1 - nextxp2;
+        Floats error2 = Floats(0.0f);
+        for (int mu = 0; mu < 4; mu++)
+        {
+            error2 += errormat.x[mu] * errormat.x[mu] + errormat.p[mu] * errormat.p[mu];
+        }
+        Floats error = simd::Sqrt(error2);
+
+        Floats ratio = m_tolerance / error;
+        Floats stepSizeRatio = simd::Clamp(safety * simd::Pow(ratio, power), minstep, maxstep);
+
+        Mask accepted = (error <= Floats(m_tolerance)) & (stepSizeRatio > Floats(0.5f));
+        stepsize = simd::Select(trying, stepsize * stepSizeRatio, stepsize);
+        trying = trying & !accepted;
+    }
+
+    FSAL = resultFSAL;
+    return result;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "SIMD.h"
+
+#include "glm/glm.hpp"
+
+
+struct PacketXP
+{
+	// simd::Width geodesics in structure of arrays layout.  x[mu] and p[mu] hold component mu of xp[0] and xp[1] of
+	// every lane.
+	simd::Floats x[4];
+	simd::Floats p[4];
+
+	glm::dmat2x4 GetLane(int lane) const;
+	void SetLane(int lane, const glm::dmat2x4& xp);
+};
+
+PacketXP operator+(const PacketXP& a, const PacketXP& b);
+PacketXP operator-(const PacketXP& a, const PacketXP& b);
+PacketXP operator*(simd::Floats s, const PacketXP& a);
+PacketXP operator/(const PacketXP& a, simd::Floats s);
+PacketXP Select(simd::Mask mask, const PacketXP& a, const PacketXP& b);
+
+
+class PacketIntegrator
+{
+	// Single precision GeodesicIntegrator for simd::Width rays at once, used by CPURenderer for the inner integration
+	// loop.  Only the Kerr metric and the solvers up to Dormand-Prince are supported, on a CPU with simd's instruction
+	// set; IsSupported() is false for anything else and the renderer falls back to GeodesicIntegrator.  Minkowski rays
+	// are straight lines and aren't integrated at all.  Every lane has its own step size, so the adaptive driver keeps
+	// retrying until the last lane accepts its step.
+public:
+	PacketIntegrator(const BlackHoleParameters& params);
+	~PacketIntegrator();
+
+	static bool IsSupported(const BlackHoleParameters& params)
+	{
+		return params.metric == 0 && params.ODESolver <= 3 && !params.PIController && simd::CPUSupported();
+	}
+
+	simd::Floats ImplicitR(const simd::Floats x[4]) const;
+	simd::Floats MetricDistance(const simd::Floats x[4]) const;
+	// BlackHoleParameters::fp64Refinement.  Lanes, or scalar states, where single precision isn't accurate enough.
+	// Always false without it.
+	simd::Mask NeedsDoublePrecision(const PacketXP& xp, simd::Floats dist) const;
+	bool NeedsDoublePrecision(const glm::dmat2x4& xp, double dist) const;
+
+	PacketXP FasterXPUpdate(const PacketXP& xp, simd::Floats dl) const;
+	PacketXP FasterXPUpdateImplicitEuler(const PacketXP& xp, simd::Floats dl) const;
+
+	PacketXP IntegrationStep(const PacketXP& xp, simd::Floats dl) const;
+	PacketXP RK4IntegrationStep(const PacketXP& xp, simd::Floats dl) const;
+	void RK23IntegrationStepFSAL(const PacketXP& xp, PacketXP& nextxp1, PacketXP& nextxp2, simd::Floats stepsize,
+		PacketXP& FSAL) const;
+	void RK45IntegrationStepFSAL(const PacketXP& xp, PacketXP& nextxp1, PacketXP& nextxp2, simd::Floats stepsize,
+		PacketXP& FSAL) const;
+	// Lanes outside of active are left untouched.
+	PacketXP AdaptiveRKDriver(const PacketXP& xp, simd::Floats& stepsize, simd::Floats& oldStepSize, PacketXP& FSAL,
+		simd::Mask active) const;
+
+private:
+	// dx = g^-1 p dl and dp = -dH/dx dl, sharing r, f and l between the two.  semiImplicit uses the updated momentum
+	// for dx, as in FasterXPUpdateImplicitEuler().
+	PacketXP Update(const PacketXP& xp, simd::Floats dl, bool semiImplicit) const;
+
+	int m_ODESolver;
+	float m_mass;
+	float m_a;
+	// Time component of l in the inverse metric, -1 for ingoing coordinates and 1 for outgoing.
+	float m_lTime;
+	float m_tolerance;
+	bool m_fp64Refinement;
+	// Distance from the black hole within which NeedsDoublePrecision() is true.
+	float m_fp64Radius;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+// Thin wrapper over a packet of floats so the packet integrator can be written once and compiled for the widest
+// instruction set available.  MSVC on x64 uses the AVX2 intrinsics for 8 lanes without /arch, so only the packet code
+// needs AVX2 and the rest of the program still runs on any x64 CPU.  PacketIntegrator::IsSupported() checks the CPU
+// with CPUSupported() before anything runs it.  Setting "Enable Enhanced Instruction Set" (/arch) to AVX-512 gives 16
+// lanes, but then the whole program needs AVX-512.  Other compilers use AVX2 or AVX-512 when the build targets them,
+// and otherwise a portable 4 lane fallback.
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX512F__)
+#define VOIDSTAR_SIMD_AVX512
+#include <immintrin.h>
+#elif defined(__AVX2__) || (defined(_MSC_VER) && defined(_M_X64))
+#define VOIDSTAR_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace simd {
+
+#if defined(VOIDSTAR_SIMD_AVX512)
+
+constexpr int Width = 16;
+constexpr const char* InstructionSet = "AVX-512";
+
+struct Mask
+{
+	__mmask16 m;
+};
+
+struct Floats
+{
+	__m512 v;
+	Floats() : v(_mm512_setzero_ps()) {}
+	Floats(float s) : v(_mm512_set1_ps(s)) {}
+	Floats(__m512 x) : v(x) {}
+	static Floats Load(const float* p) { return _mm512_loadu_ps(p); }
+	void Store(float* p) const { _mm512_storeu_ps(p, v); }
+};
+
+inline Floats operator+(Floats a, Floats b) { return _mm512_add_ps(a.v, b.v); }
+inline Floats operator-(Floats a, Floats b) { return _mm512_sub_ps(a.v, b.v); }
+inline Floats operator*(Floats a, Floats b) { return _mm512_mul_ps(a.v, b.v); }
+inline Floats operator/(Floats a, Floats b) { return _mm512_div_ps(a.v, b.v); }
+inline Floats operator-(Floats a) { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+inline Mask operator<(Floats a, Floats b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+inline Mask operator<=(Floats a, Floats b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+inline Mask operator>(Floats a, Floats b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+inline Mask operator>=(Floats a, Floats b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+inline Mask operator&(Mask a, Mask b) { return { (__mmask16)(a.m & b.m) }; }
+inline Mask operator|(Mask a, Mask b) { return { (__mmask16)(a.m | b.m) }; }
+inline Mask operator!(Mask a) { return { (__mmask16)~a.m }; }
+inline unsigned int Bits(Mask a) { return a.m; }
+inline Mask FromBits(unsigned int bits) { return { (__mmask16)bits }; }
+// Lanes where mask is set take a, the others take b.
+inline Floats Select(Mask mask, Floats a, Floats b) { return _mm512_mask_blend_ps(mask.m, b.v, a.v); }
+inline Floats Sqrt(Floats a) { return _mm512_sqrt_ps(a.v); }
+inline Floats Abs(Floats a) { return _mm512_abs_ps(a.v); }
+inline Floats Min(Floats a, Floats b) { return _mm512_min_ps(a.v, b.v); }
+inline Floats Max(Floats a, Floats b) { return _mm512_max_ps(a.v, b.v); }
+inline Floats Floor(Floats a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+inline Floats FusedMultiplyAdd(Floats a, Floats b, Floats c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+// For positive normal x: floor(log2(x)) and the mantissa in [1, 2).
+inline Floats Exponent(Floats a) { return _mm512_getexp_ps(a.v); }
+inline Floats Mantissa(Floats a) { return _mm512_getmant_ps(a.v, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero); }
+// a * 2^n for integer valued n.
+inline Floats Scale2(Floats a, Floats n) { return _mm512_scalef_ps(a.v, n.v); }
+
+#elif defined(VOIDSTAR_SIMD_AVX2)
+
+constexpr int Width = 8;
+constexpr const char* InstructionSet = "AVX2";
+
+struct Mask
+{
+	__m256 m;
+};
+
+struct Floats
+{
+	__m256 v;
+	Floats() : v(_mm256_setzero_ps()) {}
+	Floats(float s) : v(_mm256_set1_ps(s)) {}
+	Floats(__m256 x) : v(x) {}
+	static Floats Load(const float* p) { return _mm256_loadu_ps(p); }
+	void Store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline Floats operator+(Floats a, Floats b) { return _mm256_add_ps(a.v, b.v); }
+inline Floats operator-(Floats a, Floats b) { return _mm256_sub_ps(a.v, b.v); }
+inline Floats operator*(Floats a, Floats b) { return _mm256_mul_ps(a.v, b.v); }
+inline Floats operator/(Floats a, Floats b) { return _mm256_div_ps(a.v, b.v); }
+inline Floats operator-(Floats a) { return _mm256_sub_ps(_mm256_setzero_ps(), a.v); }
+inline Mask operator<(Floats a, Floats b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline Mask operator<=(Floats a, Floats b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline Mask operator>(Floats a, Floats b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline Mask operator>=(Floats a, Floats b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline Mask operator&(Mask a, Mask b) { return { _mm256_and_ps(a.m, b.m) }; }
+inline Mask operator|(Mask a, Mask b) { return { _mm256_or_ps(a.m, b.m) }; }
+inline Mask operator!(Mask a) { return { _mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+inline unsigned int Bits(Mask a) { return (unsigned int)_mm256_movemask_ps(a.m); }
+inline Mask FromBits(unsigned int bits)
+{
+	__m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i set = _mm256_and_si256(_mm256_set1_epi32((int)bits), lanes);
+	return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lanes)) };
+}
+inline Floats Select(Mask mask, Floats a, Floats b) { return _mm256_blendv_ps(b.v, a.v, mask.m); }
+inline Floats Sqrt(Floats a) { return _mm256_sqrt_ps(a.v); }
+inline Floats Abs(Floats a) { return _mm256_and_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))); }
+inline Floats Min(Floats a, Floats b) { return _mm256_min_ps(a.v, b.v); }
+inline Floats Max(Floats a, Floats b) { return _mm256_max_ps(a.v, b.v); }
+inline Floats Floor(Floats a) { return _mm256_floor_ps(a.v); }
+inline Floats FusedMultiplyAdd(Floats a, Floats b, Floats c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+inline Floats Exponent(Floats a)
+{
+	__m256i bits = _mm256_castps_si256(a.v);
+	__m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+	return _mm256_cvtepi32_ps(exponent);
+}
+inline Floats Mantissa(Floats a)
+{
+	__m256i bits = _mm256_and_si256(_mm256_castps_si256(a.v), _mm256_set1_epi32(0x007fffff));
+	return _mm256_castsi256_ps(_mm256_or_si256(bits, _mm256_set1_epi32(0x3f800000)));
+}
+inline Floats Scale2(Floats a, Floats n)
+{
+	__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(a.v, _mm256_castsi256_ps(exponent));
+}
+
+#else
+
+constexpr int Width = 4;
+constexpr const char* InstructionSet = "Scalar";
+
+struct Mask
+{
+	unsigned int m;
+};
+
+struct Floats
+{
+	float v[Width];
+	Floats() : v{ 0.0f, 0.0f, 0.0f, 0.0f } {}
+	Floats(float s) : v{ s, s, s, s } {}
+	static Floats Load(const float* p) { Floats r; for (int i = 0; i < Width; i++) r.v[i] = p[i]; return r; }
+	void Store(float* p) const { for (int i = 0; i < Width; i++) p[i] = v[i]; }
+};
+
+template <typename F>
+inline Floats Map(Floats a, F f) { Floats r; for (int i = 0; i < Width; i++) r.v[i] = f(a.v[i]); return r; }
+template <typename F>
+inline Floats Map(Floats a, Floats b, F f) { Floats r; for (int i = 0; i < Width; i++) r.v[i] = f(a.v[i], b.v[i]); return r; }
+template <typename F>
+inline Mask Compare(Floats a, Floats b, F f) { unsigned int m = 0; for (int i = 0; i < Width; i++) m |= f(a.v[i], b.v[i]) ? (1u << i) : 0u; return { m }; }
+
+inline Floats operator+(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x + y; }); }
+inline Floats operator-(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x - y; }); }
+inline Floats operator*(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x * y; }); }
+inline Floats operator/(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x / y; }); }
+inline Floats operator-(Floats a) { return Map(a, [](float x) { return -x; }); }
+inline Mask operator<(Floats a, Floats b) { return Compare(a, b, [](float x, float y) { return x < y; }); }
+inline Mask operator<=(Floats a, Floats b) { return Compare(a, b, [](float x, float y) { return x <= y; }); }
+inline Mask operator>(Floats a, Floats b) { return Compare(a, b, [](float x, float y) { return x > y; }); }
+inline Mask operator>=(Floats a, Floats b) { return Compare(a, b, [](float x, float y) { return x >= y; }); }
+inline Mask operator&(Mask a, Mask b) { return { a.m & b.m }; }
+inline Mask operator|(Mask a, Mask b) { return { a.m | b.m }; }
+inline Mask operator!(Mask a) { return { ~a.m & ((1u << Width) - 1) }; }
+inline unsigned int Bits(Mask a) { return a.m; }
+inline Mask FromBits(unsigned int bits) { return { bits & ((1u << Width) - 1) }; }
+inline Floats Select(Mask mask, Floats a, Floats b)
+{
+	Floats r;
+	for (int i = 0; i < Width; i++) r.v[i] = (mask.m >> i) & 1u ? a.v[i] : b.v[i];
+	return r;
+}
+inline Floats Sqrt(Floats a) { return Map(a, [](float x) { return std::sqrt(x); }); }
+inline Floats Abs(Floats a) { return Map(a, [](float x) { return std::abs(x); }); }
+// Same operand order as minps/maxps: if either is NaN, the second operand is returned.
+inline Floats Min(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x < y ? x : y; }); }
+inline Floats Max(Floats a, Floats b) { return Map(a, b, [](float x, float y) { return x > y ? x : y; }); }
+inline Floats Floor(Floats a) { return Map(a, [](float x) { return std::floor(x); }); }
+inline Floats FusedMultiplyAdd(Floats a, Floats b, Floats c) { return a * b + c; }
+inline Floats Exponent(Floats a) { return Map(a, [](float x) { int e; std::frexp(x, &e); return (float)(e - 1); }); }
+inline Floats Mantissa(Floats a) { return Map(a, [](float x) { int e; return 2.0f * std::frexp(x, &e); }); }
+inline Floats Scale2(Floats a, Floats n) { return Map(a, n, [](float x, float y) { return std::ldexp(x, (int)y); }); }
+
+#endif
+
+// Operations that are the same for every instruction set.
+
+inline Floats operator+(Floats a, float b) { return a + Floats(b); }
+inline Floats operator+(float a, Floats b) { return Floats(a) + b; }
+inline Floats operator-(Floats a, float b) { return a - Floats(b); }
+inline Floats operator-(float a, Floats b) { return Floats(a) - b; }
+inline Floats operator*(Floats a, float b) { return a * Floats(b); }
+inline Floats operator*(float a, Floats b) { return Floats(a) * b; }
+inline Floats operator/(Floats a, float b) { return a / Floats(b); }
+inline Floats operator/(float a, Floats b) { return Floats(a) / b; }
+inline Floats& operator+=(Floats& a, Floats b) { a = a + b; return a; }
+inline Floats& operator-=(Floats& a, Floats b) { a = a - b; return a; }
+inline Floats& operator*=(Floats& a, Floats b) { a = a * b; return a; }
+
+inline bool Any(Mask a) { return Bits(a) != 0; }
+inline bool None(Mask a) { return Bits(a) == 0; }
+inline Mask AllLanes() { return FromBits((1u << Width) - 1); }
+inline Floats Clamp(Floats a, float lo, float hi) { return Min(Max(a, Floats(lo)), Floats(hi)); }
+
+inline float GetLane(Floats a, int lane)
+{
+	alignas(64) float lanes[Width];
+	a.Store(lanes);
+	return lanes[lane];
+}
+
+inline void SetLane(Floats& a, int lane, float value)
+{
+	alignas(64) float lanes[Width];
+	a.Store(lanes);
+	lanes[lane] = value;
+	a = Floats::Load(lanes);
+}
+
+inline Floats Log2(Floats x)
+{
+	// For positive x.  Split x = 2^e * m and bring m into [sqrt(1/2), sqrt(2)), then use the series
+	// log(m) = 2 * atanh(t) with t = (m - 1) / (m + 1), |t| < 0.172.  Relative error is below 1e-7.
+	Floats e = Exponent(x);
+	Floats m = Mantissa(x);
+	Mask large = m > Floats(1.41421356f);
+	m = Select(large, m * 0.5f, m);
+	e = Select(large, e + 1.0f, e);
+	Floats t = (m - 1.0f) / (m + 1.0f);
+	Floats t2 = t * t;
+	Floats series = FusedMultiplyAdd(t2, Floats(1.0f / 9.0f), Floats(1.0f / 7.0f));
+	series = FusedMultiplyAdd(t2, series, Floats(1.0f / 5.0f));
+	series = FusedMultiplyAdd(t2, series, Floats(1.0f / 3.0f));
+	series = FusedMultiplyAdd(t2, series, Floats(1.0f));
+	return e + (2.0f / 0.69314718f) * t * series;
+}
+
+inline Floats Exp2(Floats x)
+{
+	// Split x = n + f with |f| <= 1/2 and use the Taylor series of exp(f * ln(2)).  Relative error is below 2e-7.
+	x = Clamp(x, -126.0f, 126.0f);
+	Floats n = Floor(x + 0.5f);
+	Floats f = (x - n) * 0.69314718f;
+	Floats p = FusedMultiplyAdd(f, Floats(1.0f / 5040.0f), Floats(1.0f / 720.0f));
+	p = FusedMultiplyAdd(f, p, Floats(1.0f / 120.0f));
+	p = FusedMultiplyAdd(f, p, Floats(1.0f / 24.0f));
+	p = FusedMultiplyAdd(f, p, Floats(1.0f / 6.0f));
+	p = FusedMultiplyAdd(f, p, Floats(0.5f));
+	p = FusedMultiplyAdd(f, p, Floats(1.0f));
+	p = FusedMultiplyAdd(f, p, Floats(1.0f));
+	return Scale2(p, n);
+}
+
+inline Floats Pow(Floats x, float y)
+{
+	// x^y for x > 0.  Accurate enough for step size control, not for colours.
+	return Exp2(y * Log2(x));
+}
+
+inline bool CPUSupported()
+{
+	// Whether the CPU, and the OS's saving of the vector registers, can run the instruction set above.  The AVX2 path
+	// also uses FMA.
+#if defined(VOIDSTAR_SIMD_AVX512) || defined(VOIDSTAR_SIMD_AVX2)
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!fma || !osxsave || !avx)
+	{
+		return false;
+	}
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+#ifdef VOIDSTAR_SIMD_AVX512
+	return (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0;
+#else
+	return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+#endif
+#else
+	__builtin_cpu_init();
+#ifdef VOIDSTAR_SIMD_AVX512
+	return __builtin_cpu_supports("avx512f");
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#endif
+#else
+	return true;
+#endif
+}
+
+}
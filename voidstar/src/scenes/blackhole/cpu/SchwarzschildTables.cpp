@@ -0,0 +1,301 @@
+#include "SchwarzschildTables.h"
+
+#include <cmath>
+#include <algorithm>
+
+static constexpr double PI = 3.14159265358979323846;
+// Critical impact parameter 3 sqrt(3), of the photon sphere at u = 1/3.
+static constexpr double CriticalB = 5.19615242270663188;
+// The last row is this far from b_c, relative to it.
+static constexpr double LastRowDistance = 1.0e-3;
+
+
+// Roots of G(u) = 2 u^3 - u^2 + 1 / b^2 for b > b_c, from the trigonometric solution of the cubic:
+// u = 1/6 + cos(theta / 3 - 2 pi k / 3) / 3 with cos(theta) = 1 - 54 / b^2.  uTurn is the smallest positive one.
+static void ScatteringRoots(double b, double& uNegative, double& uTurn, double& uInner)
+{
+    double theta = std::acos(std::clamp(1.0 - 54.0 / (b * b), -1.0, 1.0));
+    uInner = 1.0 / 6.0 + std::cos(theta / 3.0) / 3.0;
+    uTurn = 1.0 / 6.0 + std::cos(theta / 3.0 - 2.0 * PI / 3.0) / 3.0;
+    uNegative = 1.0 / 6.0 + std::cos(theta / 3.0 + 2.0 * PI / 3.0) / 3.0;
+}
+
+
+SchwarzschildTables::SchwarzschildTables()
+{
+}
+
+SchwarzschildTables::~SchwarzschildTables()
+{
+}
+
+void SchwarzschildTables::Build()
+{
+    if (IsBuilt())
+    {
+        return;
+    }
+    m_data.resize(2 * NumRows + 4 * NumRows * NumColumns);
+    float* ends = m_data.data();
+    float* entries = m_data.data() + 2 * NumRows;
+
+    // psi is integrated in w = sqrt(1 - u / uEnd), which takes the square root singularity at the turning point out
+    // of the integrand, with 4 point Gauss-Legendre on a grid much finer than the table's columns.
+    const int subdivisions = 32;
+    const int numCells = (NumColumns - 1) * subdivisions;
+    static constexpr double nodes[2] = { 0.3399810435848563, 0.8611363115940526 };
+    static constexpr double weights[2] = { 0.6521451548625461, 0.3478548451374538 };
+    std::vector<double> psi(numCells + 1);
+
+    for (int i = 0; i < NumRows; i++)
+    {
+        double c = (double)i / (NumRows - 1);
+        double distance = std::pow(LastRowDistance, c);
+        for (int captured = 0; captured < 2; captured++)
+        {
+            float* row = entries + 4 * i * NumColumns + 2 * captured;
+            if (i == 0)
+            {
+                // The limits b -> infinity, a straight line with psi = pi/2 - 2 asin(w / sqrt(2)) and u = u_t sin(psi),
+                // and b -> 0, a radial line with psi = b u.
+                for (int j = 0; j < NumColumns; j++)
+                {
+                    double w = (double)j / (NumColumns - 1);
+                    double t = (double)j / (NumColumns - 1);
+                    row[4 * j] = captured ? 0.0f : (float)(0.5 * PI - 2.0 * std::asin(w / std::sqrt(2.0)));
+                    row[4 * j + 1] = captured ? (float)t : (float)std::sin(0.5 * PI * t);
+                }
+                ends[2 * i + captured] = captured ? 0.0f : (float)(0.5 * PI);
+                continue;
+            }
+
+            // dpsi/dw, with u = uEnd (1 - w^2).
+            double b = captured ? CriticalB * (1.0 - distance) : CriticalB / (1.0 - distance);
+            double uNegative, uTurn, uInner;
+            ScatteringRoots(b, uNegative, uTurn, uInner);
+            double uEnd = captured ? 0.5 : uTurn;
+            auto integrand = [=](double w)
+            {
+                double u = uEnd * (1.0 - w * w);
+                if (captured)
+                {
+                    return 2.0 * uEnd * w / std::sqrt(1.0 / (b * b) - u * u + 2.0 * u * u * u);
+                }
+                return 2.0 * uEnd / std::sqrt(2.0 * uEnd * (uInner - u) * (u - uNegative));
+            };
+
+            // Cumulative from w = 1, i.e. u = 0, inwards.
+            psi[numCells] = 0.0;
+            double h = 1.0 / numCells;
+            for (int k = numCells - 1; k >= 0; k--)
+            {
+                double middle = (k + 0.5) * h;
+                double sum = 0.0;
+                for (int n = 0; n < 2; n++)
+                {
+                    sum += weights[n] * (integrand(middle - 0.5 * h * nodes[n]) + integrand(middle + 0.5 * h * nodes[n]));
+                }
+                psi[k] = psi[k + 1] + 0.5 * h * sum;
+            }
+            double psiEnd = psi[0];
+            ends[2 * i + captured] = (float)psiEnd;
+
+            int k = numCells;
+            for (int j = 0; j < NumColumns; j++)
+            {
+                row[4 * j] = (float)psi[j * subdivisions];
+
+                // Invert psi(w) = t psiEnd on the fine grid.  psi decreases with w.
+                double target = psiEnd * j / (NumColumns - 1);
+                while (k > 0 && psi[k - 1] <= target)
+                {
+                    k--;
+                }
+                double w = 0.0;
+                if (k > 0)
+                {
+                    double fraction = (psi[k - 1] - target) / (psi[k - 1] - psi[k]);
+                    w = (k - 1 + fraction) * h;
+                }
+                row[4 * j + 1] = (float)(1.0 - w * w);
+            }
+        }
+    }
+}
+
+double SchwarzschildTables::RowCoordinate(double b, bool captured)
+{
+    double distance = captured ? 1.0 - b / CriticalB : 1.0 - CriticalB / b;
+    if (distance < LastRowDistance)
+    {
+        return -1.0;
+    }
+    return std::log(distance) / std::log(LastRowDistance);
+}
+
+glm::dvec4 SchwarzschildTables::Lookup(double row, double column) const
+{
+    // As in the shader.
+    const float* entries = m_data.data() + 2 * NumRows;
+    double y = row * (NumRows - 1);
+    double x = std::clamp(column, 0.0, 1.0) * (NumColumns - 1);
+    int i = std::min((int)y, NumRows - 2);
+    int j = std::min((int)x, NumColumns - 2);
+    double fy = y - i;
+    double fx = x - j;
+    auto entry = [entries](int i, int j)
+    {
+        const float* e = entries + 4 * (i * NumColumns + j);
+        return glm::dvec4(e[0], e[1], e[2], e[3]);
+    };
+    glm::dvec4 bottom = glm::mix(entry(i, j), entry(i, j + 1), fx);
+    glm::dvec4 top = glm::mix(entry(i + 1, j), entry(i + 1, j + 1), fx);
+    return glm::mix(bottom, top, fy);
+}
+
+glm::dvec2 SchwarzschildTables::LookupEnd(double row) const
+{
+    double y = row * (NumRows - 1);
+    int i = std::min((int)y, NumRows - 2);
+    double fy = y - i;
+    glm::dvec2 bottom = glm::dvec2(m_data[2 * i], m_data[2 * i + 1]);
+    glm::dvec2 top = glm::dvec2(m_data[2 * i + 2], m_data[2 * i + 3]);
+    return glm::mix(bottom, top, fy);
+}
+
+bool SchwarzschildTables::Trace(const glm::dmat2x4& xp, const GeodesicIntegrator& integrator, double mass,
+    double drawDistance, AnalyticRay& ray) const
+{
+    glm::dvec4 p = xp[1];
+    glm::dvec3 x = glm::dvec3(xp[0].y, xp[0].z, xp[0].w);
+    double r0 = glm::length(x);
+    if (!IsBuilt() || r0 <= 2.0 * mass || r0 >= drawDistance)
+    {
+        return false;
+    }
+
+    // Make p null by solving for p_t, as in AnalyticKerrTracer::Trace().
+    glm::dmat4 invMetric = integrator.InvMetric(xp[0]);
+    double quadraticA = invMetric[0][0];
+    double quadraticB = 0.0;
+    double quadraticC = 0.0;
+    for (int i = 1; i < 4; i++)
+    {
+        quadraticB += 2.0 * invMetric[0][i] * p[i];
+        for (int j = 1; j < 4; j++)
+        {
+            quadraticC += invMetric[i][j] * p[i] * p[j];
+        }
+    }
+    double discriminant = quadraticB * quadraticB - 4.0 * quadraticA * quadraticC;
+    if (discriminant < 0.0)
+    {
+        return false;
+    }
+    double root1 = (-quadraticB + std::sqrt(discriminant)) / (2.0 * quadraticA);
+    double root2 = (-quadraticB - std::sqrt(discriminant)) / (2.0 * quadraticA);
+    p.x = (std::abs(root1 - p.x) < std::abs(root2 - p.x)) ? root1 : root2;
+
+    // The orbital plane has the unit vectors e1 towards the camera and e2 in the direction the ray goes round.
+    double E = -p.x;
+    glm::dvec3 angularMomentum = glm::cross(x, glm::dvec3(p.y, p.z, p.w));
+    double L = glm::length(angularMomentum);
+    if (E <= 0.0 || L < 1e-9 * r0 * E)
+    {
+        // Radial rays.
+        return false;
+    }
+    glm::dvec3 e1 = x / r0;
+    glm::dvec3 e2 = glm::normalize(glm::cross(angularMomentum, e1));
+    // y / r = R cos(phi - alpha) along the ray, so the equatorial plane is crossed every pi from alpha + pi/2.  Rays
+    // in or parallel to the plane are integrated.
+    if (std::sqrt(e1.y * e1.y + e2.y * e2.y) < 1e-6)
+    {
+        return false;
+    }
+    glm::dvec4 v = invMetric * p;
+    bool outgoing = glm::dot(x, glm::dvec3(v.y, v.z, v.w)) > 0.0;
+
+    double b = L / (E * mass);
+    double u0 = mass / r0;
+    double uDraw = mass / drawDistance;
+    bool captured = b < CriticalB;
+    double row = RowCoordinate(b, captured);
+    if (row < 0.0 || (!captured && u0 > 1.0 / 3.0))
+    {
+        return false;
+    }
+    double uNegative, uTurn, uInner;
+    ScatteringRoots(b, uNegative, uTurn, uInner);
+    double uEnd = captured ? 0.5 : uTurn;
+    glm::dvec2 ends = LookupEnd(row);
+    double psiEnd = captured ? ends.y : ends.x;
+    auto psiAt = [&](double u)
+    {
+        glm::dvec4 entry = Lookup(row, std::sqrt(std::max(0.0, 1.0 - u / uEnd)));
+        return captured ? entry.z : entry.x;
+    };
+    auto uAt = [&](double psi)
+    {
+        // Past the turning point, the orbit is the mirror image of the way in.
+        psi = (psi > psiEnd) ? 2.0 * psiEnd - psi : psi;
+        glm::dvec4 entry = Lookup(row, (psiEnd > 0.0) ? psi / psiEnd : 0.0);
+        return uEnd * (captured ? entry.w : entry.y);
+    };
+
+    // psi at the camera and where the ray ends, and which way the ray moves through psi.
+    double psi0 = psiAt(u0);
+    double direction = 1.0;
+    double psiFinal;
+    ray.escapes = !captured || outgoing;
+    if (!captured)
+    {
+        psi0 = outgoing ? 2.0 * psiEnd - psi0 : psi0;
+        psiFinal = 2.0 * psiEnd - psiAt(uDraw);
+    }
+    else if (outgoing)
+    {
+        direction = -1.0;
+        psiFinal = psiAt(uDraw);
+    }
+    else
+    {
+        psiFinal = psiEnd;
+    }
+    double phiFinal = std::max(0.0, direction * (psiFinal - psi0));
+
+    double phi = std::fmod(std::atan2(e2.y, e1.y) + 0.5 * PI + 2.0 * PI, PI);
+    if (phi < 1e-9)
+    {
+        phi += PI;
+    }
+    float previousy = (x.y < 0.0) ? -1.0f : 1.0f;
+    ray.numCrossings = 0;
+    for (; phi < phiFinal && ray.numCrossings < AnalyticRay::MaxCrossings; phi += PI)
+    {
+        double r = mass / uAt(psi0 + direction * phi);
+        glm::dvec3 crossing = r * (std::cos(phi) * e1 + std::sin(phi) * e2);
+        double Xc = crossing.x;
+        double Zc = crossing.z;
+        // Only p_t and p_phi matter to GetDiskColour(), as in AnalyticKerrTracer::Trace().
+        double rho2 = Xc * Xc + Zc * Zc;
+        int n = ray.numCrossings++;
+        ray.crossing[n][0] = glm::dvec4(0.0, Xc, 0.0, Zc);
+        ray.crossing[n][1] = glm::dvec4(-E, angularMomentum.y * Zc / rho2, 0.0, -angularMomentum.y * Xc / rho2);
+        ray.crossingRadius[n] = r;
+        ray.previousy[n] = previousy;
+        previousy = -previousy;
+    }
+
+    // The escape direction is dx/dl at the draw distance, where the integrated rays stop, which is along
+    // sqrt(G) r^ + u phi^ in the orbital plane.  Captured rays cross the horizon at phiFinal.
+    glm::dvec3 radial = std::cos(phiFinal) * e1 + std::sin(phiFinal) * e2;
+    glm::dvec3 tangent = -std::sin(phiFinal) * e1 + std::cos(phiFinal) * e2;
+    double G = 1.0 / (b * b) - uDraw * uDraw + 2.0 * uDraw * uDraw * uDraw;
+    ray.escapeDirection = glm::normalize(std::sqrt(std::max(0.0, G)) * radial + uDraw * tangent);
+    ray.horizonPoint = 2.0 * mass * radial;
+    ray.E = E;
+    ray.L = angularMomentum.y;
+    ray.Q = L * L - angularMomentum.y * angularMomentum.y;
+    return true;
+}
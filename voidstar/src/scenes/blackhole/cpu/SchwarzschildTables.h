@@ -0,0 +1,61 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "GeodesicIntegrator.h"
+#include "AnalyticKerrTracer.h"
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+
+class SchwarzschildTables
+{
+	// Lookup tables for the a = 0 case, where every null geodesic stays in the plane through the black hole that
+	// contains its starting point and direction, and its orbit u(phi) = M / r follows the Binet equation
+	// u'' + u = 3 u^2, i.e. (du/dphi)^2 = G(u) = 1 / b^2 - u^2 + 2 u^3 in units of the mass, with impact parameter
+	// b = L / E.  Measured from infinity on the way in, a ray has swept
+	//     psi(u) = integral from 0 to u of du' / sqrt(G(u'))
+	// by the time it reaches u.  Rays with b above b_c = 3 sqrt(3) turn at the root u_t of G and sweep the same again
+	// on the way out, and rays below it reach the horizon at u = 1/2.  The tables hold psi(u) and its inverse for both,
+	// indexed by b and u, so that the camera's radius gives where the ray starts on its orbit and the azimuths of the
+	// equatorial plane crossings in the orbital plane give their radii.  Everything is in units of the mass, so the
+	// tables never change once built.
+	//
+	// Rows are spaced logarithmically in the distance from b_c, where psi diverges.  Rays closer to b_c than the last
+	// row, with the camera inside the photon sphere's turning point, or in the equatorial plane are not covered and
+	// must be integrated.
+public:
+	static constexpr int NumRows = 256;
+	static constexpr int NumColumns = 256;
+
+	SchwarzschildTables();
+	~SchwarzschildTables();
+
+	static bool IsSupported(const BlackHoleParameters& params)
+	{
+		return params.metric == 0 && !params.insideHorizon && params.a == 0.0f;
+	}
+
+	// Integrates the tables, the first time it's called.
+	void Build();
+	bool IsBuilt() const { return !m_data.empty(); }
+
+	// CPU version of schwarzschildRay() in KerrBlackHole.shader, reading the same tables.  xp is the initial position
+	// and momentum as set up in rayMarch().  Returns false for the rays that must be integrated instead.
+	bool Trace(const glm::dmat2x4& xp, const GeodesicIntegrator& integrator, double mass, double drawDistance,
+		AnalyticRay& ray) const;
+
+	// The u_schwarzschildTables storage buffer: NumRows vec2 (psi at the turning point for b > b_c, psi at the horizon
+	// for b < b_c), then NumRows * NumColumns vec4 (psi and u / u_t for b > b_c, psi and u / u_h for b < b_c).
+	const std::vector<float>& GetData() const { return m_data; }
+
+private:
+	// Row coordinate in [0, 1] of an impact parameter, or -1 if it's too close to b_c.
+	static double RowCoordinate(double b, bool captured);
+	// Bilinear interpolation of entry (row, column) in table coordinates, and of the row's end.
+	glm::dvec4 Lookup(double row, double column) const;
+	glm::dvec2 LookupEnd(double row) const;
+
+	std::vector<float> m_data;
+};
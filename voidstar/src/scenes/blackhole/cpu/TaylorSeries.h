@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cmath>
+
+
+constexpr int MaxTaylorOrder = 24;
+
+
+class TaylorSeries
+{
+	// The Taylor coefficients c[k] = f^(k)(0) / k! of a function of the affine parameter, for the Taylor series
+	// integrator in GeodesicIntegrator.  Every operation returns a single coefficient k, from coefficients 0 to k of its
+	// arguments, so a right-hand side written with them yields coefficient k of the derivative as soon as coefficient k
+	// of the state is known.  Building a series of order n then costs O(n^2) per operation.  See Jorba and Zou, "A
+	// software package for the numerical integration of ODEs by means of high-order Taylor methods", 2005.
+public:
+	double& operator[](int k) { return m_c[k]; }
+	double operator[](int k) const { return m_c[k]; }
+
+	// Coefficient k of a * b.
+	static double Product(const TaylorSeries& a, const TaylorSeries& b, int k)
+	{
+		double sum = 0.0;
+		for (int j = 0; j <= k; j++)
+		{
+			sum += a.m_c[j] * b.m_c[k - j];
+		}
+		return sum;
+	}
+
+	// Coefficient k of this = n / b, given coefficient k of n.  Coefficients 0 to k - 1 of this must already be set.
+	double Quotient(double n, const TaylorSeries& b, int k) const
+	{
+		for (int j = 1; j <= k; j++)
+		{
+			n -= b.m_c[j] * m_c[k - j];
+		}
+		return n / b.m_c[0];
+	}
+
+	// Coefficient k of this = sqrt(a), given coefficient k of a.  Coefficients 0 to k - 1 of this must already be set.
+	double SquareRoot(double a, int k) const
+	{
+		if (k == 0)
+		{
+			return std::sqrt(a);
+		}
+		for (int j = 1; j < k; j++)
+		{
+			a -= m_c[j] * m_c[k - j];
+		}
+		return a / (2.0 * m_c[0]);
+	}
+
+private:
+	double m_c[MaxTaylorOrder + 1];
+};
@@ -0,0 +1,225 @@
+#include "TransferAtlas.h"
+#include "CPURenderer.h"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static constexpr char Magic[8] = { 'V', 'O', 'I', 'D', 'A', 'T', 'L', 'S' };
+static constexpr uint32_t Version = 1;
+
+
+static glm::vec3 OctahedralDecode(glm::vec2 e)
+{
+    // octahedralDecode() in the shader.
+    glm::vec3 dir = glm::vec3(e, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if (dir.z < 0.0f)
+    {
+        glm::vec2 folded = (1.0f - glm::abs(glm::vec2(dir.y, dir.x)))
+            * glm::vec2(dir.x >= 0.0f ? 1.0f : -1.0f, dir.y >= 0.0f ? 1.0f : -1.0f);
+        dir.x = folded.x;
+        dir.y = folded.y;
+    }
+    return glm::normalize(dir);
+}
+
+
+TransferAtlas::TransferAtlas()
+{
+}
+
+TransferAtlas::~TransferAtlas()
+{
+    Unload();
+}
+
+glm::vec3 TransferAtlas::ObserverPosition(float a, float radius, float inclination)
+{
+    // In Kerr-Schild coordinates, the sphere of radius r is the spheroid x^2 + z^2 = (r^2 + a^2) sin^2(theta),
+    // y = r cos(theta).
+    return glm::vec3(0.0f, radius * std::cos(inclination), -std::sqrt(radius * radius + a * a) * std::sin(inclination));
+}
+
+float TransferAtlas::Bake(BlackHoleParameters params, float radius, float inclination, unsigned int size,
+    ThreadPool& pool, const std::string& fileName)
+{
+    auto start = std::chrono::steady_clock::now();
+    params.cameraPos = ObserverPosition(params.a, radius, inclination);
+    params.captureCulling = false;
+    params.farFieldEscape = false;
+    CPUCubeMap skybox;
+    CPURenderer renderer(params, skybox);
+
+    // Texel (i, j) is the ray through the centre of its cell of the map, as the environment cache's trace pass has it.
+    size_t planeSize = (size_t)size * size;
+    std::vector<glm::vec4> planes((GeodesicRecord::MaxDiskHits + 1) * planeSize);
+    pool.ResetStats();
+    for (unsigned int j = 0; j < size; j++)
+    {
+        pool.Submit([&renderer, &planes, &params, size, planeSize, j]()
+        {
+            for (unsigned int i = 0; i < size; i++)
+            {
+                glm::vec2 uv = (glm::vec2((float)i, (float)j) + 0.5f) / (float)size;
+                GeodesicRecord record;
+                renderer.TraceRay(params.cameraPos, OctahedralDecode(uv * 2.0f - 1.0f), record);
+                size_t texel = (size_t)j * size + i;
+                for (int k = 0; k < GeodesicRecord::MaxDiskHits; k++)
+                {
+                    planes[k * planeSize + texel] = record.diskHits[k];
+                }
+                planes[GeodesicRecord::MaxDiskHits * planeSize + texel] = record.escape;
+            }
+        });
+    }
+    pool.Wait();
+
+    Header header = {};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.size = size;
+    header.numDiskHits = GeodesicRecord::MaxDiskHits;
+    header.debugSphere = params.useDebugSphereTexture ? 1 : 0;
+    header.mass = params.mass;
+    header.a = params.a;
+    header.radius = radius;
+    header.inclination = inclination;
+    header.drawDistance = params.drawDistance;
+    std::ofstream file(fileName, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(planes.data()), planes.size() * sizeof(glm::vec4));
+    if (!file)
+    {
+        return -1.0f;
+    }
+
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+bool TransferAtlas::Load(const std::string& fileName)
+{
+    Unload();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    HANDLE mapping = GetFileSizeEx(file, &fileSize) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+        : nullptr;
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    m_file = file;
+    m_mapping = mapping;
+    m_fileSize = (size_t)fileSize.QuadPart;
+#else
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    void* view = (fstat(file, &status) == 0 && status.st_size > 0)
+        ? mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+    // The mapping keeps the file open.
+    close(file);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    m_fileSize = (size_t)status.st_size;
+#endif
+    m_data = static_cast<const unsigned char*>(view);
+
+    // Check the header and that the planes it describes are all there before handing any of it out.
+    const Header* header = reinterpret_cast<const Header*>(m_data);
+    bool valid = m_fileSize >= sizeof(Header) && std::memcmp(header->magic, Magic, sizeof(Magic)) == 0
+        && header->version == Version && header->size > 0 && header->numDiskHits > 0
+        && m_fileSize >= sizeof(Header) + (header->numDiskHits + 1) * (size_t)header->size * header->size * sizeof(glm::vec4);
+    m_header = header;
+    if (!valid)
+    {
+        Unload();
+    }
+    return valid;
+}
+
+void TransferAtlas::Unload()
+{
+    if (m_data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+        CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = nullptr;
+#else
+        munmap(const_cast<unsigned char*>(m_data), m_fileSize);
+#endif
+    }
+    m_header = nullptr;
+    m_data = nullptr;
+    m_fileSize = 0;
+}
+
+const glm::vec4* TransferAtlas::GetPlane(unsigned int k) const
+{
+    size_t planeSize = (size_t)m_header->size * m_header->size;
+    return reinterpret_cast<const glm::vec4*>(m_data + sizeof(Header)) + k * planeSize;
+}
+
+bool TransferAtlas::Covers(float mass, float a, bool debugSphere, float drawDistance, const glm::vec3& cameraPos,
+    float tolerance, float& azimuth) const
+{
+    if (!IsLoaded() || m_header->mass != mass || m_header->a != a || (m_header->debugSphere != 0) != debugSphere)
+    {
+        return false;
+    }
+    // The draw distance follows the camera's radius, so it gets the same tolerance.
+    if (std::abs(drawDistance - m_header->drawDistance) > tolerance * m_header->drawDistance)
+    {
+        return false;
+    }
+
+    // The camera's Kerr-Schild r and inclination, with r solved for as in BlackHole::CalculateKerrDistance().
+    double b = (double)a * a - glm::dot(glm::dvec3(cameraPos), glm::dvec3(cameraPos));
+    double c = -(double)a * a * cameraPos.y * cameraPos.y;
+    double sq = std::sqrt(b * b - 4.0 * c);
+    double r = std::sqrt((b > 0.0) ? -2.0 * c / (b + sq) : 0.5 * (sq - b));
+    double inclination = std::acos(std::clamp(cameraPos.y / r, -1.0, 1.0));
+    double radius = m_header->radius;
+    double offset = std::hypot(r - radius, radius * (inclination - m_header->inclination));
+    if (offset > tolerance * radius)
+    {
+        return false;
+    }
+
+    // Turning the atlas's observer on the -z axis by azimuth about y takes it to the camera.
+    azimuth = (cameraPos.x == 0.0f && cameraPos.z == 0.0f) ? 0.0f : std::atan2(-cameraPos.x, -cameraPos.z);
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "BlackHoleParameters.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+
+// How a geodesic record ended, as ESCAPE_* in KerrBlackHole.shader.
+enum class EscapeRecord
+{
+	None = 0, Infinity = 1, Unfinished = 2, Sphere = 3, Culled = 4
+};
+
+
+struct GeodesicRecord
+{
+	// One ray as the trace pass of the shader's geodesic G-buffer records it: its first MaxDiskHits crossings of the
+	// disk's plane as (r, phi, g, sign of previous y), with 0 in the last component for no crossing, and how it ended
+	// as (direction or point, EscapeRecord).
+	static constexpr int MaxDiskHits = 3;
+	glm::vec4 diskHits[MaxDiskHits] = {};
+	glm::vec4 escape = glm::vec4(0.0f);
+};
+
+
+class TransferAtlas
+{
+	// The geodesic records for every direction around an observer at Kerr-Schild radius r and inclination i from the
+	// spin axis, on the environment cache's octahedral map, for a fixed mass and spin.  The metric is symmetric about
+	// the spin axis, so an observer anywhere on the circle of that r and i sees the same records turned about the axis
+	// by its azimuth, and a camera moving along that circle can be shaded from the atlas without tracing anything.
+	// The observer the atlas is traced from is at azimuth 0, on the -z side of the spin axis.
+	//
+	// The file is the Header followed by one Size^2 plane of RGBA32F texels per disk hit and one for the escape
+	// records, rows from the bottom up, which is how BlackHole's G-buffer textures are laid out.  Load() maps it into
+	// memory instead of reading it, so that the planes go to the GPU straight from the file.
+public:
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t size;
+		uint32_t numDiskHits;
+		// Whether ESCAPE_SPHERE records hold the horizon point, as with BlackHoleParameters::useDebugSphereTexture.
+		uint32_t debugSphere;
+		float mass;
+		float a;
+		float radius;
+		float inclination;
+		float drawDistance;
+		uint32_t reserved;
+	};
+
+	TransferAtlas();
+	~TransferAtlas();
+
+	TransferAtlas(const TransferAtlas&) = delete;
+	TransferAtlas& operator=(const TransferAtlas&) = delete;
+
+	// Where the observer at Kerr-Schild radius r and inclination i in radians is, at azimuth 0.
+	static glm::vec3 ObserverPosition(float a, float radius, float inclination);
+
+	// Traces the records for the observer at radius and inclination, with everything else from params, on a size^2 map
+	// and writes them to fileName.  params must be the Kerr metric outside the horizon.  Capture culling and the
+	// far-field escape are turned off, since their records depend on the disk's radii.  Returns the wall clock time
+	// taken in seconds, or a negative number if the file couldn't be written.
+	static float Bake(BlackHoleParameters params, float radius, float inclination, unsigned int size, ThreadPool& pool,
+		const std::string& fileName);
+
+	bool Load(const std::string& fileName);
+	void Unload();
+	bool IsLoaded() const { return m_header != nullptr; }
+
+	const Header& GetHeader() const { return *m_header; }
+	// Plane k of the file: disk hit k for k < numDiskHits, then the escape records.
+	const glm::vec4* GetPlane(unsigned int k) const;
+
+	// Whether a camera at cameraPos is on the atlas's circle, to within tolerance times its radius, around a black hole
+	// of this mass and spin, with a draw distance within the same tolerance.  azimuth is then how far round the spin
+	// axis the camera is from the atlas's observer.
+	bool Covers(float mass, float a, bool debugSphere, float drawDistance, const glm::vec3& cameraPos, float tolerance,
+		float& azimuth) const;
+
+private:
+	const Header* m_header = nullptr;
+	const unsigned char* m_data = nullptr;
+	size_t m_fileSize = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};